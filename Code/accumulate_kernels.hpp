@@ -0,0 +1,54 @@
+/**
+ * @file accumulate_kernels.hpp
+ * @date 2023-03-08
+ * @author Diego Hernández Delgado
+ * @author Jesús Isaías García Moreno
+ * @brief Kernels que acumulan las coordenadas y la cantidad de puntos de cada cluster para actualizar los centroides, especializados en tiempo de compilación para las dimensiones comunes
+ * */
+
+#ifndef ACCUMULATE_KERNELS_HPP
+#define ACCUMULATE_KERNELS_HPP
+
+#include <cstdint>
+#include "dataset.hpp"
+
+/**
+ * @name AccumulateKernel
+ * @brief Firma común de los kernels: suma las coordenadas de los puntos [begin, end) en el bloque de su cluster
+ * @param points Conjunto de puntos por columnas
+ * @param begin Índice del primer punto
+ * @param end Índice siguiente al último punto
+ * @param labels Cluster de cada punto del conjunto
+ * @param sums Bloque de fields doubles por cluster: [suma de cada coordenada, cantidad de puntos]
+ * @param fields Cantidad de doubles por cluster en el bloque (al menos dimensión + 1)
+ * */
+typedef void (*AccumulateKernel)(const Dataset& points, long long int begin, long long int end, const int32_t* labels, double* sums, int fields);
+
+/**
+ * @name accumulate_points
+ * @brief Kernel de acumulación
+ * @tparam DIM Dimensión fija de los puntos, o 0 para usar la dimensión del conjunto en tiempo de ejecución
+ * */
+template <int DIM>
+inline void accumulate_points(const Dataset& points, long long int begin, long long int end, const int32_t* labels, double* sums, int fields) {
+    const int dimension = DIM > 0 ? DIM : points.dimension();
+    for (long long int i = begin; i < end; i++) {
+        double* slot = sums + (long long int) labels[i] * fields; // Cluster/Centroide al que pertenece el punto
+        for (int d = 0; d < dimension; d++) {
+            slot[d] += points.at(i, d);
+        }
+        slot[dimension] += 1.0;
+    }
+}
+
+/**
+ * @name select_accumulate_kernel
+ * @brief Función para obtener el kernel de acumulación especializado para la dimensión de los puntos
+ * @param dimension Número de coordenadas de cada punto
+ * @return Apuntador al kernel
+ * */
+inline AccumulateKernel select_accumulate_kernel(int dimension) {
+    return KMEANS_SPECIALIZE_DIMENSION(accumulate_points, dimension);
+}
+
+#endif
@@ -0,0 +1,333 @@
+/**
+ * @file benchmark.hpp
+ * @date 2023-03-08
+ * @author Diego Hernández Delgado
+ * @author Jesús Isaías García Moreno
+ * @brief Medición por fases de k-means (parallel_kmeans bench): tiempos de lectura, preparación, elección de centroides, asignación, actualización y escritura de cada repetición, con su estadística (mínimo, mediana, percentil 95, promedio y desviación estándar), los datos de la máquina y la configuración, en JSON o CSV, y la comparación contra un CSV anterior para detectar regresiones entre compilaciones
+ * */
+
+#ifndef BENCHMARK_HPP
+#define BENCHMARK_HPP
+
+#include <omp.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "distance_kernels.hpp"
+
+// Texto de ayuda de las opciones propias de la medición (el resto son las de run_options.hpp)
+const char BENCHMARK_USAGE[] = "[warmup=n] [repetitions=n] [format=json|csv] [file=path] [baseline=file.csv] [tolerance=percent]";
+
+/**
+ * @name BenchmarkPhase
+ * @brief Fases que se miden por separado en cada repetición
+ * */
+enum BenchmarkPhase { PHASE_LOAD, PHASE_SETUP, PHASE_INIT, PHASE_ASSIGN, PHASE_UPDATE, PHASE_SAVE, PHASE_TOTAL, N_PHASES };
+
+// Las fases cuya mediana anterior es menor que esto (segundos) se comparan pero no cuentan como regresión: su ruido relativo es demasiado grande
+const double BENCHMARK_MIN_REGRESSION_SECONDS = 1e-3;
+
+// Nombre de cada fase en los reportes
+const char* const PHASE_NAMES[N_PHASES] = {"load", "setup", "init", "assign", "update", "save", "total"};
+
+/**
+ * @name PhaseTimes
+ * @brief Segundos de cada fase de una repetición; kmeans suma aquí el tiempo de todas sus pasadas de asignación y de actualización
+ * */
+struct PhaseTimes {
+    double seconds[N_PHASES] = {0.0};
+};
+
+/**
+ * @name BenchmarkOptions
+ * @brief Opciones de la medición con sus valores por defecto
+ * */
+struct BenchmarkOptions {
+    int warmup = 2;            // Repeticiones que se descartan antes de medir
+    int repetitions = 10;      // Repeticiones medidas
+    bool json = true;          // Formato del reporte (JSON o CSV)
+    std::string file;          // Archivo del reporte, o vacío para el nombre por defecto
+    std::string baseline;      // CSV de una medición anterior con el que se comparan las medianas, o vacío
+    double tolerance = 10.0;   // Porcentaje que puede crecer la mediana de una fase sin considerarse regresión
+};
+
+/**
+ * @name parse_benchmark_options
+ * @brief Función para separar las opciones de la medición de las de run_options.hpp
+ * @param argc Cantidad de argumentos de entrada
+ * @param argv Argumentos de entrada
+ * @param first Índice del primer argumento opcional
+ * @param rest Salida con los argumentos que no son de la medición, para parse_run_options
+ * @return Opciones de la medición
+ * */
+inline BenchmarkOptions parse_benchmark_options(int argc, char** argv, int first, std::vector<char*>& rest) {
+    BenchmarkOptions options;
+    for (int i = first; i < argc; i++) {
+        std::string argument = argv[i];
+        size_t separator = argument.find('=');
+        std::string name = separator == std::string::npos ? argument : argument.substr(0, separator);
+        std::string value = separator == std::string::npos ? "" : argument.substr(separator + 1);
+        if (name == "warmup" || name == "repetitions") {
+            size_t parsed = 0;
+            int number = -1;
+            try {
+                number = std::stoi(value, &parsed);
+            } catch (const std::exception&) {
+                parsed = 0;
+            }
+            if (parsed == 0 || parsed != value.size() || number < (name == "warmup" ? 0 : 1))
+                throw std::invalid_argument("Invalid " + name + ": " + value);
+            (name == "warmup" ? options.warmup : options.repetitions) = number;
+        } else if (name == "format") {
+            if (value != "json" && value != "csv")
+                throw std::invalid_argument("Invalid format (json or csv): " + value);
+            options.json = value == "json";
+        } else if (name == "file") {
+            options.file = value;
+        } else if (name == "baseline") {
+            options.baseline = value;
+        } else if (name == "tolerance") {
+            size_t parsed = 0;
+            options.tolerance = std::stod(value, &parsed);
+            if (parsed != value.size() || options.tolerance < 0.0)
+                throw std::invalid_argument("Invalid tolerance: " + value);
+        } else {
+            rest.push_back(argv[i]);
+        }
+    }
+    return options;
+}
+
+/**
+ * @name PhaseStats
+ * @brief Estadística de los tiempos de una fase en las repeticiones medidas
+ * */
+struct PhaseStats {
+    double min;
+    double median;
+    double p95;      // Percentil 95 por rango más cercano
+    double mean;
+    double stddev;   // Desviación estándar muestral (0 con una sola repetición)
+};
+
+/**
+ * @name phase_stats
+ * @brief Función para calcular la estadística de una lista de tiempos
+ * @param samples Segundos de cada repetición (al menos uno)
+ * @return Estadística de los tiempos
+ * */
+inline PhaseStats phase_stats(std::vector<double> samples) {
+    std::sort(samples.begin(), samples.end());
+    const size_t n = samples.size();
+    PhaseStats stats;
+    stats.min = samples[0];
+    stats.median = n % 2 == 1 ? samples[n / 2] : 0.5 * (samples[n / 2 - 1] + samples[n / 2]);
+    stats.p95 = samples[(size_t) std::ceil(0.95 * n) - 1];
+    double sum = 0.0;
+    for (double sample : samples) sum += sample;
+    stats.mean = sum / n;
+    double squares = 0.0;
+    for (double sample : samples) squares += (sample - stats.mean) * (sample - stats.mean);
+    stats.stddev = n > 1 ? std::sqrt(squares / (n - 1)) : 0.0;
+    return stats;
+}
+
+/**
+ * @name MachineInfo
+ * @brief Datos de la máquina y de la compilación que acompañan a cada reporte
+ * */
+struct MachineInfo {
+    std::string hostname;
+    std::string cpu;        // Modelo del procesador (/proc/cpuinfo)
+    int logical_cores;      // Procesadores que ve OpenMP
+    std::string simd;       // Conjunto de instrucciones del kernel de distancias
+    std::string compiler;
+    int openmp;             // Versión de OpenMP (_OPENMP)
+};
+
+/**
+ * @name machine_info
+ * @brief Función para obtener los datos de la máquina y de la compilación
+ * @return Datos de la máquina
+ * */
+inline MachineInfo machine_info() {
+    MachineInfo info;
+    char hostname[256] = {0};
+    gethostname(hostname, sizeof(hostname) - 1);
+    info.hostname = hostname;
+    info.cpu = "unknown";
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line)) {
+        if (line.compare(0, 10, "model name") == 0) {
+            size_t colon = line.find(':');
+            if (colon != std::string::npos) info.cpu = line.substr(line.find_first_not_of(' ', colon + 1));
+            break;
+        }
+    }
+    info.logical_cores = omp_get_num_procs();
+    info.simd = kernel_isa_name(detect_kernel_isa());
+#ifdef __VERSION__
+    info.compiler = __VERSION__;
+#endif
+    info.openmp = _OPENMP;
+    return info;
+}
+
+/**
+ * @name BenchmarkConfig
+ * @brief Configuración de la medición que acompaña a cada reporte
+ * */
+struct BenchmarkConfig {
+    long long int num_points;
+    int dimension;
+    int n_clusters;
+    long long int max_iterations;
+    int threads;
+    std::string algorithm;
+    std::string init;
+    uint64_t seed;
+    std::string output;
+    std::string input_file;
+    bool numa;               // numa=on (puntos, centroides y acumulador colocados por nodo)
+    std::string affinity;    // Política de afinidad de los hilos
+    int numa_nodes;          // Nodos con alguna CPU permitida
+    double local_percent;    // Porcentaje de los bytes de los puntos y clusters en el nodo del hilo que los asigna (-1 si move_pages no pudo consultarlos)
+};
+
+/**
+ * @name json_string
+ * @brief Función para escribir un texto como cadena de JSON (con comillas y caracteres escapados)
+ * @param text Texto
+ * @return Cadena de JSON
+ * */
+inline std::string json_string(const std::string& text) {
+    std::string quoted = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') quoted += '\\';
+        if ((unsigned char) c < 0x20) continue;
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+/**
+ * @name write_benchmark_report
+ * @brief Función para escribir el reporte de la medición en JSON (con los tiempos de cada repetición) o en CSV (un renglón por fase con la configuración repetida, para compararlo con baseline=)
+ * @param file_name Nombre del archivo del reporte
+ * @param json Si se escribe en JSON (si no, en CSV)
+ * @param machine Datos de la máquina
+ * @param config Configuración de la medición
+ * @param options Opciones de la medición
+ * @param samples Segundos de cada fase en cada repetición medida
+ * @param iterations Iteraciones de cada repetición medida
+ * */
+inline void write_benchmark_report(const std::string& file_name, bool json, const MachineInfo& machine, const BenchmarkConfig& config, const BenchmarkOptions& options,
+                                   const std::vector<PhaseTimes>& samples, const std::vector<long long int>& iterations) {
+    std::ofstream out(file_name);
+    if (!out) throw std::runtime_error("Could not open " + file_name);
+    out.precision(9);
+    if (json) {
+        out << "{\n";
+        out << "  \"machine\": {\"hostname\": " << json_string(machine.hostname) << ", \"cpu\": " << json_string(machine.cpu)
+            << ", \"logical_cores\": " << machine.logical_cores << ", \"simd\": " << json_string(machine.simd)
+            << ", \"compiler\": " << json_string(machine.compiler) << ", \"openmp\": " << machine.openmp << "},\n";
+        out << "  \"config\": {\"input\": " << json_string(config.input_file) << ", \"points\": " << config.num_points << ", \"dimension\": " << config.dimension
+            << ", \"clusters\": " << config.n_clusters << ", \"max_iterations\": " << config.max_iterations << ", \"threads\": " << config.threads
+            << ", \"algorithm\": " << json_string(config.algorithm) << ", \"init\": " << json_string(config.init) << ", \"seed\": " << config.seed
+            << ", \"output\": " << json_string(config.output) << ", \"warmup\": " << options.warmup << ", \"repetitions\": " << options.repetitions << "},\n";
+        out << "  \"numa\": {\"enabled\": " << (config.numa ? "true" : "false") << ", \"affinity\": " << json_string(config.affinity) << ", \"nodes\": " << config.numa_nodes
+            << ", \"local_percent\": ";
+        if (config.local_percent < 0) out << "null"; else out << config.local_percent;
+        out << "},\n";
+        out << "  \"iterations\": [";
+        for (size_t r = 0; r < iterations.size(); r++) out << (r > 0 ? ", " : "") << iterations[r];
+        out << "],\n  \"phases\": {\n";
+        for (int p = 0; p < N_PHASES; p++) {
+            std::vector<double> values;
+            for (const PhaseTimes& sample : samples) values.push_back(sample.seconds[p]);
+            PhaseStats stats = phase_stats(values);
+            out << "    \"" << PHASE_NAMES[p] << "\": {\"min\": " << stats.min << ", \"median\": " << stats.median << ", \"p95\": " << stats.p95
+                << ", \"mean\": " << stats.mean << ", \"stddev\": " << stats.stddev << ", \"samples\": [";
+            for (size_t r = 0; r < values.size(); r++) out << (r > 0 ? ", " : "") << values[r];
+            out << "]}" << (p + 1 < N_PHASES ? "," : "") << "\n";
+        }
+        out << "  }\n}\n";
+        return;
+    }
+    out << "phase,min,median,p95,mean,stddev,points,dimension,clusters,max_iterations,threads,algorithm,init,seed,warmup,repetitions,logical_cores,simd,numa,affinity,numa_nodes,local_percent,cpu\n";
+    for (int p = 0; p < N_PHASES; p++) {
+        std::vector<double> values;
+        for (const PhaseTimes& sample : samples) values.push_back(sample.seconds[p]);
+        PhaseStats stats = phase_stats(values);
+        out << PHASE_NAMES[p] << "," << stats.min << "," << stats.median << "," << stats.p95 << "," << stats.mean << "," << stats.stddev << ","
+            << config.num_points << "," << config.dimension << "," << config.n_clusters << "," << config.max_iterations << "," << config.threads << ","
+            << config.algorithm << "," << config.init << "," << config.seed << "," << options.warmup << "," << options.repetitions << ","
+            << machine.logical_cores << "," << machine.simd << "," << (config.numa ? "on" : "off") << "," << config.affinity << "," << config.numa_nodes << ","
+            << config.local_percent << "," << json_string(machine.cpu) << "\n";
+    }
+}
+
+/**
+ * @name print_benchmark_summary
+ * @brief Función para imprimir la estadística de cada fase en milisegundos
+ * @param samples Segundos de cada fase en cada repetición medida
+ * */
+inline void print_benchmark_summary(const std::vector<PhaseTimes>& samples) {
+    std::cout << "phase      min ms   median ms   p95 ms   stddev ms" << "\n";
+    for (int p = 0; p < N_PHASES; p++) {
+        std::vector<double> values;
+        for (const PhaseTimes& sample : samples) values.push_back(sample.seconds[p]);
+        PhaseStats stats = phase_stats(values);
+        std::cout << PHASE_NAMES[p] << std::string(10 - std::string(PHASE_NAMES[p]).size(), ' ')
+                  << stats.min * 1e3 << "   " << stats.median * 1e3 << "   " << stats.p95 * 1e3 << "   " << stats.stddev * 1e3 << "\n";
+    }
+}
+
+/**
+ * @name compare_with_baseline
+ * @brief Función para comparar la mediana de cada fase con la de un reporte CSV anterior e imprimir el cambio. Una fase es una regresión si su mediana crece más de tolerance por ciento y la anterior era de al menos BENCHMARK_MIN_REGRESSION_SECONDS
+ * @param baseline_file CSV de la medición anterior (format=csv)
+ * @param samples Segundos de cada fase en cada repetición medida
+ * @param tolerance Porcentaje permitido
+ * @return Cantidad de fases con regresión
+ * */
+inline int compare_with_baseline(const std::string& baseline_file, const std::vector<PhaseTimes>& samples, double tolerance) {
+    std::ifstream in(baseline_file);
+    if (!in) throw std::runtime_error("Could not open " + baseline_file);
+    std::map<std::string, double> baseline;
+    std::string line;
+    std::getline(in, line); // Encabezado
+    while (std::getline(in, line)) {
+        std::stringstream fields(line);
+        std::string phase, min_value, median_value;
+        if (std::getline(fields, phase, ',') && std::getline(fields, min_value, ',') && std::getline(fields, median_value, ',')) {
+            baseline[phase] = std::stod(median_value);
+        }
+    }
+    int regressions = 0;
+    std::cout << "Comparison with " << baseline_file << " (median, tolerance " << tolerance << "%)" << "\n";
+    for (int p = 0; p < N_PHASES; p++) {
+        auto found = baseline.find(PHASE_NAMES[p]);
+        if (found == baseline.end() || found->second <= 0.0) continue;
+        std::vector<double> values;
+        for (const PhaseTimes& sample : samples) values.push_back(sample.seconds[p]);
+        double median = phase_stats(values).median;
+        double change = 100.0 * (median - found->second) / found->second;
+        bool regression = change > tolerance && found->second >= BENCHMARK_MIN_REGRESSION_SECONDS;
+        regressions += regression;
+        std::cout << "  " << PHASE_NAMES[p] << ": " << found->second * 1e3 << " ms -> " << median * 1e3 << " ms (" << (change >= 0 ? "+" : "") << change << "%)"
+                  << (regression ? " REGRESSION" : "") << "\n";
+    }
+    return regressions;
+}
+
+#endif
@@ -0,0 +1,31 @@
+# Parallel K-Means Benchmark
+# Author: Diego Hernández Delgado
+# Author: Jesús Isaías García Moreno
+# Date: 2023-03-08
+
+# Parameters
+num_points="300000"
+num_threads=("1" "6" "12")
+num_threads_size=${#num_threads[@]}
+n_clusters="13"
+max_iterations="20"
+algorithms=("lloyd" "kdtree")
+algorithms_size=${#algorithms[@]}
+baseline_dir=""  # Directory with the CSV reports of a previous build to compare against (empty to skip)
+
+# Time every phase of each configuration (2 warmup rounds, 10 measured rounds) and write a CSV report to ./../Analysis/Benchmark/
+# With baseline_dir, every median is compared with the previous report and the script exits with 2 when a phase is slower
+status=0
+for((i=0; i<num_threads_size; i++))
+do
+    for((j=0; j<algorithms_size; j++))
+    do
+        echo "Benchmark:  ${num_points} points, ${num_threads[i]} threads, ${algorithms[j]}"
+        baseline=""
+        if [ -n "$baseline_dir" ]; then
+            baseline="baseline=${baseline_dir}/${num_points}_Points_${num_threads[i]}_threads_${algorithms[j]}.csv"
+        fi
+        ./parallel_kmeans bench $n_clusters $num_points $max_iterations ${num_threads[i]} algorithm=${algorithms[j]} format=csv $baseline || status=$?
+    done
+done
+exit $status
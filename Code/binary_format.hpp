@@ -0,0 +1,201 @@
+/**
+ * @file binary_format.hpp
+ * @date 2023-03-08
+ * @author Diego Hernández Delgado
+ * @author Jesús Isaías García Moreno
+ * @brief Formato binario por columnas para los conjuntos de puntos. Un encabezado de 64 bytes (magic, versión, N, D, tipo de dato) va seguido de una columna alineada a 64 bytes por coordenada, de modo que el archivo se puede proyectar en memoria y usar directamente como conjunto de puntos sin copiarlo. También detecta el formato de un archivo de entrada a partir de su encabezado
+ * */
+
+#ifndef BINARY_FORMAT_HPP
+#define BINARY_FORMAT_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <sys/stat.h>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "csv_io.hpp"
+#include "dataset.hpp"
+#include "distance_kernels.hpp"
+#include "mapped_file.hpp"
+
+// Identificador al inicio de todo archivo binario de puntos
+const char BINARY_DATASET_MAGIC[8] = {'K', 'M', 'E', 'A', 'N', 'S', 'D', 'S'};
+const uint32_t BINARY_DATASET_VERSION = 1;
+// Tipos de dato de las coordenadas
+const uint32_t BINARY_DTYPE_FLOAT32 = 1;
+
+/**
+ * @name BinaryDatasetHeader
+ * @brief Encabezado del formato binario (64 bytes, little endian). La columna d empieza en data_offset + d * column_stride
+ * */
+struct BinaryDatasetHeader {
+    char magic[8];          // BINARY_DATASET_MAGIC
+    uint32_t version;       // BINARY_DATASET_VERSION
+    uint32_t dtype;         // BINARY_DTYPE_FLOAT32
+    uint64_t num_rows;      // N, número de puntos
+    uint64_t dimension;     // D, número de coordenadas
+    uint64_t data_offset;   // Byte donde empieza la primera columna (múltiplo de 64)
+    uint64_t column_stride; // Bytes entre el inicio de dos columnas (múltiplo de 64)
+    uint64_t reserved[2];
+};
+static_assert(sizeof(BinaryDatasetHeader) == 64, "BinaryDatasetHeader must be 64 bytes");
+
+/**
+ * @name is_binary_dataset
+ * @brief Función para saber si un bloque de memoria empieza con el encabezado del formato binario
+ * @param data Inicio del archivo
+ * @param size Tamaño del archivo en bytes
+ * @return true si el archivo es un conjunto de puntos binario
+ * */
+inline bool is_binary_dataset(const char* data, long long int size) {
+    return size >= (long long int) sizeof(BinaryDatasetHeader) && memcmp(data, BINARY_DATASET_MAGIC, sizeof(BINARY_DATASET_MAGIC)) == 0;
+}
+
+/**
+ * @name save_binary
+ * @brief Función para guardar un conjunto de puntos en el formato binario por columnas
+ * @param file_name Nombre del archivo binario
+ * @param points Conjunto de puntos por columnas
+ * */
+inline void save_binary(const std::string& file_name, const Dataset& points) {
+    BinaryDatasetHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BINARY_DATASET_MAGIC, sizeof(BINARY_DATASET_MAGIC));
+    header.version = BINARY_DATASET_VERSION;
+    header.dtype = BINARY_DTYPE_FLOAT32;
+    header.num_rows = points.size();
+    header.dimension = points.dimension();
+    header.data_offset = sizeof(BinaryDatasetHeader);
+    header.column_stride = (points.size() * sizeof(float) + DATASET_ALIGNMENT - 1) / DATASET_ALIGNMENT * DATASET_ALIGNMENT;
+
+    std::ofstream fout(file_name, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!fout.is_open()) throw std::runtime_error("Could not open " + file_name + " for writing");
+    fout.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    std::vector<char> padding(header.column_stride - points.size() * sizeof(float), 0);
+    for (int d = 0; d < points.dimension(); d++) {
+        fout.write(reinterpret_cast<const char*>(points.column(d)), points.size() * sizeof(float));
+        fout.write(padding.data(), padding.size());
+    }
+    if (!fout.good()) throw std::runtime_error("Could not write " + file_name);
+}
+
+/**
+ * @name read_binary_header
+ * @brief Función para leer y validar el encabezado de un archivo binario ya proyectado en memoria
+ * @param file Archivo proyectado en memoria
+ * @param file_name Nombre del archivo (para los mensajes de error)
+ * @return Encabezado del archivo
+ * */
+inline BinaryDatasetHeader read_binary_header(const MappedFile& file, const std::string& file_name) {
+    BinaryDatasetHeader header;
+    memcpy(&header, file.data(), sizeof(header));
+    if (header.version != BINARY_DATASET_VERSION)
+        throw std::runtime_error("Unsupported binary dataset version " + std::to_string(header.version) + " in " + file_name);
+    if (header.dtype != BINARY_DTYPE_FLOAT32)
+        throw std::runtime_error("Unsupported binary dataset dtype " + std::to_string(header.dtype) + " in " + file_name);
+    // Los límites se comprueban con divisiones para que un encabezado corrupto no desborde los productos y deje las columnas fuera del archivo
+    const uint64_t file_size = file.size();
+    if (header.dimension < 1 || header.dimension > (uint64_t) std::numeric_limits<int>::max() ||
+        header.num_rows > (uint64_t) std::numeric_limits<long long int>::max() ||
+        header.data_offset % DATASET_ALIGNMENT != 0 || header.column_stride % DATASET_ALIGNMENT != 0 ||
+        header.data_offset < sizeof(BinaryDatasetHeader) || header.data_offset > file_size ||
+        header.num_rows > header.column_stride / sizeof(float) ||
+        (header.column_stride > 0 && header.dimension > (file_size - header.data_offset) / header.column_stride))
+        throw std::runtime_error("Corrupt binary dataset header in " + file_name);
+    return header;
+}
+
+/**
+ * @name map_binary
+ * @brief Función para usar un archivo binario ya proyectado en memoria como conjunto de puntos, sin copiar sus columnas
+ * @param file Archivo proyectado en memoria; el conjunto lo mantiene vivo
+ * @param file_name Nombre del archivo (para los mensajes de error)
+ * @return Conjunto de puntos cuyas columnas son una vista sobre el archivo
+ * */
+inline Dataset map_binary(std::shared_ptr<const MappedFile> file, const std::string& file_name) {
+    BinaryDatasetHeader header = read_binary_header(*file, file_name);
+    std::vector<const float*> columns(header.dimension);
+    for (uint64_t d = 0; d < header.dimension; d++) {
+        columns[d] = reinterpret_cast<const float*>(file->data() + header.data_offset + d * header.column_stride);
+    }
+    return Dataset::view(header.num_rows, header.dimension, columns.data(), file);
+}
+
+/**
+ * @name load_points
+ * @brief Función para leer un conjunto de puntos detectando el formato a partir del encabezado del archivo: los archivos binarios se proyectan en memoria sin copia y cualquier otro archivo se lee como CSV
+ * @param file_name Nombre del archivo de entrada
+ * @param num_threads Número de hilos a utilizar para leer un CSV
+ * @return Conjunto de puntos por columnas sin cluster asignado
+ * */
+inline Dataset load_points(const std::string& file_name, int num_threads) {
+    std::shared_ptr<const MappedFile> file = std::make_shared<const MappedFile>(file_name);
+    if (is_binary_dataset(file->data(), file->size())) {
+        return map_binary(file, file_name);
+    }
+    return load_CSV(*file, file_name, num_threads);
+}
+
+/**
+ * @name load_points_shard
+ * @brief Función para leer sólo la parte shard de n_shards de un conjunto de puntos, para que cada proceso de una ejecución distribuida tenga únicamente sus puntos. En un archivo binario las partes son rangos consecutivos de renglones alineados a KERNEL_BLOCK_SIZE y se proyectan sin copia; en un CSV son rangos de bytes de tamaño parecido alineados a fin de renglón, y sólo se convierten los renglones del rango. Las partes se toman en orden, así que el índice global del primer punto de cada parte es la suma de los tamaños de las anteriores
+ * @param file_name Nombre del archivo de entrada
+ * @param shard Índice de la parte (de 0 a n_shards - 1)
+ * @param n_shards Número de partes
+ * @param num_threads Número de hilos a utilizar para leer un CSV
+ * @return Conjunto con los puntos de la parte, sin cluster asignado
+ * */
+inline Dataset load_points_shard(const std::string& file_name, int shard, int n_shards, int num_threads) {
+    std::shared_ptr<const MappedFile> file = std::make_shared<const MappedFile>(file_name);
+    if (is_binary_dataset(file->data(), file->size())) {
+        BinaryDatasetHeader header = read_binary_header(*file, file_name);
+        const long long int num_rows = header.num_rows;
+        const long long int n_blocks = (num_rows + KERNEL_BLOCK_SIZE - 1) / KERNEL_BLOCK_SIZE;
+        const long long int shard_rows = (n_blocks + n_shards - 1) / n_shards * KERNEL_BLOCK_SIZE;
+        const long long int first_row = std::min(shard * shard_rows, num_rows);
+        const long long int end_row = std::min(first_row + shard_rows, num_rows);
+        // Cada parte empieza en un múltiplo de KERNEL_BLOCK_SIZE renglones, así que sus columnas siguen alineadas a 64 bytes
+        std::vector<const float*> columns(header.dimension);
+        for (uint64_t d = 0; d < header.dimension; d++) {
+            columns[d] = reinterpret_cast<const float*>(file->data() + header.data_offset + d * header.column_stride) + first_row;
+        }
+        return Dataset::view(end_row - first_row, header.dimension, columns.data(), file);
+    }
+    if (file->size() == 0) throw std::runtime_error("CSV file " + file_name + " is empty");
+    const char* text = file->data();
+    const char* text_end = text + file->size();
+    const int dimension = detect_dimension(text, text_end);
+    std::vector<const char*> bounds = csv_chunk_bounds(text, text_end, n_shards);
+    return load_CSV_range(bounds[shard], bounds[shard + 1], dimension, file_name, num_threads);
+}
+
+/**
+ * @name resolve_input_file
+ * @brief Función para obtener el archivo de entrada a partir del argumento del programa: si el argumento es un archivo existente se usa tal cual (CSV o binario); si es un número de puntos se usa el archivo ./../Data/<num_points>_data.csv de los experimentos
+ * @param argument Ruta del archivo de entrada o número de puntos
+ * @return Ruta del archivo de entrada
+ * */
+inline std::string resolve_input_file(const std::string& argument) {
+    struct stat sb;
+    if (stat(argument.c_str(), &sb) == 0 && S_ISREG(sb.st_mode)) {
+        return argument;
+    }
+    size_t parsed = 0;
+    long long int num_points = 0;
+    try {
+        num_points = std::stoll(argument, &parsed);
+    } catch (const std::exception&) {
+        parsed = 0;
+    }
+    if (parsed != argument.size())
+        throw std::invalid_argument("Input file not found: " + argument);
+    if (num_points < 1) throw std::invalid_argument("Invalid number of points");
+    return "./../Data/" + std::to_string(num_points) + "_data.csv";
+}
+
+#endif
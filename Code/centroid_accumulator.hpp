@@ -0,0 +1,135 @@
+/**
+ * @file centroid_accumulator.hpp
+ * @date 2023-03-08
+ * @author Diego Hernández Delgado
+ * @author Jesús Isaías García Moreno
+ * @brief Buffers de acumulación por hilo con los que las versiones paralelas suman las coordenadas y la cantidad de puntos de cada cluster sin candados
+ * */
+
+#ifndef CENTROID_ACCUMULATOR_HPP
+#define CENTROID_ACCUMULATOR_HPP
+
+#include <omp.h>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <new>
+#include "accumulate_kernels.hpp"
+#include "dataset.hpp"
+#include "distance_kernels.hpp"
+#include "iteration_trace.hpp"
+
+/**
+ * @name CentroidAccumulator
+ * @brief Buffers de acumulación por hilo para actualizar los centroides sin candados. Cada hilo tiene su propio bloque de [suma de cada coordenada, cantidad] por cluster, alineado y rellenado a múltiplos de la línea de caché para evitar compartición falsa. Se reservan una sola vez y se reutilizan en todas las iteraciones y repeticiones
+ * */
+struct CentroidAccumulator {
+    int n_threads;   // Número de bloques, uno por hilo
+    int n_clusters;  // Número de clusters o centroides
+    int fields;      // Campos por cluster: una suma por coordenada más la cantidad de puntos
+    long long int stride; // Cantidad de doubles por bloque (múltiplo de la alineación)
+    double* buffer;  // Memoria contigua con los bloques de todos los hilos
+};
+
+const int CACHE_LINE_SIZE = 64;
+
+/**
+ * @name create_accumulator
+ * @brief Función para reservar los buffers de acumulación por hilo
+ * @param n_threads Número máximo de hilos que usarán el acumulador
+ * @param n_clusters Número de clusters o centroides
+ * @param dimension Número de coordenadas de cada punto
+ * @param alignment Alineación de cada bloque en bytes: una línea de caché para que los hilos no compartan líneas, o una página para que cada bloque quede en el nodo NUMA de su hilo (numa_placement.hpp)
+ * @return Apuntador al acumulador reservado
+ * */
+inline CentroidAccumulator* create_accumulator(int n_threads, int n_clusters, int dimension, long long int alignment = CACHE_LINE_SIZE) {
+    CentroidAccumulator* accumulator = new CentroidAccumulator;
+    long long int doubles_per_line = alignment / sizeof(double);
+    accumulator->n_threads = n_threads;
+    accumulator->n_clusters = n_clusters;
+    accumulator->fields = dimension + 1;
+    long long int block = (long long int) n_clusters * accumulator->fields;
+    accumulator->stride = (block + doubles_per_line - 1) / doubles_per_line * doubles_per_line;
+    accumulator->buffer = static_cast<double*>(aligned_alloc(alignment, accumulator->stride * n_threads * sizeof(double)));
+    if (accumulator->buffer == nullptr) {
+        delete accumulator;
+        throw std::bad_alloc();
+    }
+    return accumulator;
+}
+
+/**
+ * @name free_accumulator
+ * @brief Función para liberar los buffers de acumulación por hilo
+ * @param accumulator Acumulador a liberar
+ * */
+inline void free_accumulator(CentroidAccumulator* accumulator) {
+    free(accumulator->buffer);
+    delete accumulator;
+}
+
+/**
+ * @name merge_thread_blocks
+ * @brief Función para combinar los bloques de los hilos en árbol: en cada ronda el hilo t suma el bloque del hilo t + step. La llaman todos los hilos de la región paralela donde cada uno llenó su bloque; al terminar, el bloque del hilo 0 tiene las sumas totales
+ * @param accumulator Buffers de acumulación por hilo
+ * @param thread_id Número del hilo que llama
+ * @param n_threads Número de hilos de la región paralela
+ * */
+inline void merge_thread_blocks(CentroidAccumulator* accumulator, int thread_id, int n_threads) {
+    const long long int stride = accumulator->stride;
+    const long long int block = (long long int) accumulator->n_clusters * accumulator->fields;
+    double* local = accumulator->buffer + thread_id * stride;
+    // Todos los hilos deben haber terminado su bloque antes de la primera ronda
+    #pragma omp barrier
+    for (int step = 1; step < n_threads; step *= 2) {
+        if (thread_id % (2 * step) == 0 && thread_id + step < n_threads) {
+            double* other = accumulator->buffer + (thread_id + step) * stride;
+            for (long long int f = 0; f < block; f++) {
+                local[f] += other[f];
+            }
+        }
+        #pragma omp barrier
+    }
+}
+
+/**
+ * @name accumulate_clusters
+ * @brief Función para sumar las coordenadas y la cantidad de puntos de cada cluster. Cada hilo acumula sus puntos en su propio bloque y los bloques se combinan en árbol (log2 de hilos rondas) sin secciones críticas; al terminar, el bloque del hilo 0 (el inicio de buffer) tiene las sumas totales
+ * @param points Conjunto de puntos por columnas
+ * @param count Cantidad de puntos a acumular (los primeros del conjunto)
+ * @param labels Cluster de cada punto
+ * @param accumulator Buffers de acumulación por hilo reservados previamente
+ * */
+inline void accumulate_clusters(const Dataset& points, long long int count, const int32_t* labels, CentroidAccumulator* accumulator) {
+    const int fields = accumulator->fields;
+    const long long int stride = accumulator->stride;
+    const long long int block = (long long int) accumulator->n_clusters * fields;
+    const AccumulateKernel accumulate = select_accumulate_kernel(points.dimension());
+
+    #pragma omp parallel shared(points, accumulator, labels) num_threads(accumulator->n_threads)
+    {
+        int thread_id = omp_get_thread_num();
+        int n_threads = omp_get_num_threads();
+        double* local = accumulator->buffer + thread_id * stride;
+        KMEANS_TRACE_ONLY(double busy_start = omp_get_wtime();
+                          double busy_end = busy_start;)
+
+        // Se inicializa en 0 el bloque del hilo
+        for (long long int f = 0; f < block; f++) {
+            local[f] = 0.0;
+        }
+
+        // Se iteran los puntos del hilo y se suman las coordenadas y la cantidad de puntos de cada cluster en su bloque
+        #pragma omp for schedule(static)
+        for (long long int begin = 0; begin < count; begin += KERNEL_BLOCK_SIZE) {
+            accumulate(points, begin, std::min(begin + KERNEL_BLOCK_SIZE, count), labels, local, fields);
+            KMEANS_TRACE_ONLY(busy_end = omp_get_wtime();)
+        }
+        KMEANS_TRACE_ONLY(iteration_trace().thread_busy(TRACE_UPDATE, thread_id, busy_start, busy_end);)
+
+        // Se combinan los bloques en árbol
+        merge_thread_blocks(accumulator, thread_id, n_threads);
+    }
+}
+
+#endif
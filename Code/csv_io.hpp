@@ -0,0 +1,234 @@
+/**
+ * @file csv_io.hpp
+ * @date 2023-03-08
+ * @author Diego Hernández Delgado
+ * @author Jesús Isaías García Moreno
+ * @brief Lector paralelo de los archivos CSV de puntos. El archivo se proyecta en memoria (mmap), se divide en un trozo alineado a fin de renglón por hilo y cada hilo convierte sus números con from_chars directamente a las columnas del conjunto de puntos, sin reservar memoria intermedia. También guarda los centroides de minibatch_kmeans y outofcore_kmeans en CSV
+ * */
+
+#ifndef CSV_IO_HPP
+#define CSV_IO_HPP
+
+#include <omp.h>
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+#include "dataset.hpp"
+#include "mapped_file.hpp"
+
+/**
+ * @name csv_row_starts
+ * @brief Función para saber si en la posición dada empieza un renglón con datos (los renglones vacíos se ignoran)
+ * @param c Apuntador al primer carácter del renglón
+ * @return true si el renglón tiene datos
+ * */
+inline bool csv_row_starts(const char* c) {
+    return *c != '\n' && *c != '\r';
+}
+
+/**
+ * @name csv_next_row
+ * @brief Función para avanzar hasta el inicio del siguiente renglón
+ * @param c Posición actual
+ * @param end Fin del texto
+ * @return Inicio del siguiente renglón o end
+ * */
+inline const char* csv_next_row(const char* c, const char* end) {
+    const char* newline = static_cast<const char*>(memchr(c, '\n', end - c));
+    return newline == nullptr ? end : newline + 1;
+}
+
+/**
+ * @name detect_dimension
+ * @brief Función para detectar la dimensión de los puntos contando las columnas del primer renglón con datos
+ * @param begin Inicio del texto del archivo CSV
+ * @param end Fin del texto del archivo CSV
+ * @return Número de coordenadas de cada punto
+ * */
+inline int detect_dimension(const char* begin, const char* end) {
+    while (begin < end && !csv_row_starts(begin)) begin++;
+    if (begin == end) throw std::runtime_error("CSV file has no rows");
+    int dimension = 1;
+    for (const char* c = begin; c < end && *c != '\n'; c++) {
+        dimension += *c == ',';
+    }
+    return dimension;
+}
+
+/**
+ * @name parse_csv_row
+ * @brief Función para convertir un renglón con datos y guardarlo en el punto dado
+ * @param c Inicio del renglón (debe tener datos)
+ * @param end Fin del texto
+ * @param points Conjunto de puntos donde se guardarán las coordenadas
+ * @param row Índice del punto donde se guarda el renglón
+ * @return Inicio del siguiente renglón, o nullptr si el renglón es inválido
+ * */
+inline const char* parse_csv_row(const char* c, const char* end, Dataset& points, long long int row) {
+    const int dimension = points.dimension();
+    for (int d = 0; d < dimension; d++) {
+        while (c < end && (*c == ' ' || *c == '\t' || *c == '+')) c++;
+        float value;
+        std::from_chars_result result = std::from_chars(c, end, value);
+        if (result.ec != std::errc()) return nullptr;
+        points.at(row, d) = value;
+        c = result.ptr;
+        while (c < end && (*c == ' ' || *c == '\t')) c++;
+        if (d + 1 < dimension) {
+            if (c == end || *c != ',') return nullptr;
+            c++;
+        }
+    }
+    return csv_next_row(c, end);
+}
+
+/**
+ * @name parse_csv_chunk
+ * @brief Función para convertir los renglones de un trozo del archivo y guardarlos a partir del punto dado
+ * @param begin Inicio del trozo (inicio de renglón)
+ * @param end Fin del trozo (inicio de renglón o fin del archivo)
+ * @param points Conjunto de puntos donde se guardarán las coordenadas
+ * @param first_row Índice del punto donde se guarda el primer renglón del trozo
+ * @return Índice del renglón inválido o -1 si todos los renglones son válidos
+ * */
+inline long long int parse_csv_chunk(const char* begin, const char* end, Dataset& points, long long int first_row) {
+    long long int row = first_row;
+    const char* c = begin;
+    while (c < end) {
+        if (!csv_row_starts(c)) {
+            c++;
+            continue;
+        }
+        c = parse_csv_row(c, end, points, row);
+        if (c == nullptr) return row;
+        row++;
+    }
+    return -1;
+}
+
+/**
+ * @name csv_chunk_bounds
+ * @brief Función para dividir un rango del texto en trozos de tamaño parecido; cada frontera se recorre al inicio del siguiente renglón
+ * @param begin Inicio del rango (inicio de renglón)
+ * @param end Fin del rango
+ * @param n_chunks Número de trozos
+ * @return Inicio de cada trozo seguido del fin del rango (n_chunks + 1 posiciones)
+ * */
+inline std::vector<const char*> csv_chunk_bounds(const char* begin, const char* end, int n_chunks) {
+    std::vector<const char*> bounds(n_chunks + 1);
+    bounds[0] = begin;
+    bounds[n_chunks] = end;
+    for (int t = 1; t < n_chunks; t++) {
+        const char* guess = begin + (end - begin) * t / n_chunks;
+        guess = guess < bounds[t - 1] ? bounds[t - 1] : guess;
+        bounds[t] = guess == begin ? begin : csv_next_row(guess - 1, end);
+    }
+    return bounds;
+}
+
+/**
+ * @name load_CSV_range
+ * @brief Función para leer de forma paralela los renglones de un rango del texto de un archivo CSV ya proyectado en memoria
+ * @param text Inicio del rango (inicio de renglón)
+ * @param text_end Fin del rango (inicio de renglón o fin del archivo)
+ * @param dimension Número de coordenadas de cada punto
+ * @param file_name Nombre del archivo CSV (para los mensajes de error)
+ * @param num_threads Número de hilos (y de trozos del rango) a utilizar
+ * @return Conjunto de puntos por columnas sin cluster asignado
+ * */
+inline Dataset load_CSV_range(const char* text, const char* text_end, int dimension, const std::string& file_name, int num_threads) {
+    // Se divide el rango en un trozo por hilo
+    std::vector<const char*> bounds = csv_chunk_bounds(text, text_end, num_threads);
+
+    // Primera pasada: cada hilo cuenta los renglones con datos de su trozo
+    std::vector<long long int> first_rows(num_threads + 1, 0);
+    #pragma omp parallel for num_threads(num_threads) schedule(static, 1)
+    for (int t = 0; t < num_threads; t++) {
+        long long int rows = 0;
+        for (const char* c = bounds[t]; c < bounds[t + 1]; c = csv_next_row(c, bounds[t + 1])) {
+            rows += csv_row_starts(c);
+        }
+        first_rows[t + 1] = rows;
+    }
+    for (int t = 0; t < num_threads; t++) {
+        first_rows[t + 1] += first_rows[t];
+    }
+
+    // Segunda pasada: cada hilo convierte su trozo directamente en las columnas a partir de su primer renglón
+    Dataset points(first_rows[num_threads], dimension);
+    long long int invalid_row = -1;
+    #pragma omp parallel for num_threads(num_threads) schedule(static, 1)
+    for (int t = 0; t < num_threads; t++) {
+        long long int invalid = parse_csv_chunk(bounds[t], bounds[t + 1], points, first_rows[t]);
+        if (invalid >= 0) {
+            #pragma omp critical
+            {
+                if (invalid_row < 0 || invalid < invalid_row) invalid_row = invalid;
+            }
+        }
+    }
+    if (invalid_row >= 0)
+        throw std::invalid_argument("Invalid row " + std::to_string(invalid_row + 1) + " in " + file_name);
+    return points;
+}
+
+/**
+ * @name load_CSV
+ * @brief Función para leer un archivo CSV de puntos ya proyectado en memoria de forma paralela. La cantidad de puntos se cuenta del archivo y la dimensión se detecta del primer renglón
+ * @param file Archivo CSV proyectado en memoria
+ * @param file_name Nombre del archivo CSV (para los mensajes de error)
+ * @param num_threads Número de hilos (y de trozos del archivo) a utilizar
+ * @return Conjunto de puntos por columnas sin cluster asignado
+ * */
+inline Dataset load_CSV(const MappedFile& file, const std::string& file_name, int num_threads) {
+    if (file.size() == 0) throw std::runtime_error("CSV file " + file_name + " is empty");
+    const int dimension = detect_dimension(file.data(), file.data() + file.size());
+    return load_CSV_range(file.data(), file.data() + file.size(), dimension, file_name, num_threads);
+}
+
+/**
+ * @name load_CSV
+ * @brief Función para leer un archivo CSV de puntos de forma paralela
+ * @param file_name Nombre del archivo CSV
+ * @param num_threads Número de hilos (y de trozos del archivo) a utilizar
+ * @return Conjunto de puntos por columnas sin cluster asignado
+ * */
+inline Dataset load_CSV(const std::string& file_name, int num_threads) {
+    MappedFile file(file_name);
+    return load_CSV(file, file_name, num_threads);
+}
+
+/**
+ * @name save_centroids
+ * @brief Función para guardar los centroides en un archivo CSV, un renglón por centroide
+ * @param file_name Nombre del archivo CSV
+ * @param centroids Conjunto de centroides por columnas
+ * */
+inline void save_centroids(const std::string& file_name, const Dataset& centroids) {
+    std::fstream fout;
+    fout.open(file_name, std::ios::out);
+    for (long long int k = 0; k < centroids.size(); k++) {
+        for (int d = 0; d < centroids.dimension(); d++) {
+            fout << centroids.at(k, d) << (d + 1 < centroids.dimension() ? "," : "\n");
+        }
+    }
+}
+
+/**
+ * @name file_stem
+ * @brief Función para obtener el nombre de un archivo sin directorio ni extensión
+ * @param file_name Ruta del archivo
+ * @return Nombre del archivo sin directorio ni extensión
+ * */
+inline std::string file_stem(const std::string& file_name) {
+    size_t slash = file_name.find_last_of('/');
+    std::string name = slash == std::string::npos ? file_name : file_name.substr(slash + 1);
+    size_t dot = name.find_last_of('.');
+    return dot == std::string::npos || dot == 0 ? name : name.substr(0, dot);
+}
+
+#endif
@@ -0,0 +1,60 @@
+/**
+ * @file csv_to_binary.cpp
+ * @date 2023-03-08
+ * @author Diego Hernández Delgado
+ * @author Jesús Isaías García Moreno
+ * @brief Convertidor de archivos CSV de puntos al formato binario por columnas de binary_format.hpp, que los programas de k-means proyectan en memoria sin copiarlo
+ * @param input_file_path Ruta del archivo CSV de entrada
+ * @param output_file_path Ruta del archivo binario de salida
+ * @param num_threads Número de hilos a utilizar para leer el CSV
+ * */
+
+#include <omp.h>
+#include <iostream>
+#include <string>
+#include "binary_format.hpp"
+#include "csv_io.hpp"
+#include "dataset.hpp"
+
+using namespace std;
+
+
+/**
+ * @name main
+ * @brief Función main del convertidor
+ * @param argc Cantidad de argumentos de entrada (STDIN)
+ * @param argv Argumentos de entrada (STDIN) [nombre del programa, archivo CSV, archivo binario, número de hilos (opcional)]
+ * @return 0 si la conversión termina correctamente
+ * */
+int main(int argc, char** argv) {
+    string input_file_name;
+    string output_file_name;
+    int num_threads = omp_get_max_threads();
+    try{
+        if (argc != 3 && argc != 4)
+            throw std::invalid_argument("Invalid number of arguments");
+        input_file_name = argv[1];
+        output_file_name = argv[2];
+        if (argc == 4) num_threads = stoi(argv[3]);
+        if (num_threads < 1)
+            throw std::invalid_argument("Invalid number of threads");
+    } catch (const std::exception& e) {
+        cout << e.what() << "\n";
+        cout << "Usage: ./csv_to_binary <input.csv> <output.bin> [num_threads]" << "\n";
+        return 1;
+    }
+
+    try{
+        double start = omp_get_wtime();
+        Dataset points = load_CSV(input_file_name, num_threads);
+        double loaded = omp_get_wtime();
+        save_binary(output_file_name, points);
+        cout << output_file_name << ": " << points.size() << " points, " << points.dimension() << " dimensions"
+             << " (load " << loaded - start << " s, write " << omp_get_wtime() - loaded << " s)" << "\n";
+    } catch (const std::exception& e) {
+        cout << "Error: csv_to_binary" << "\n";
+        cout << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
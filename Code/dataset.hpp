@@ -0,0 +1,217 @@
+/**
+ * @file dataset.hpp
+ * @date 2023-03-08
+ * @author Diego Hernández Delgado
+ * @author Jesús Isaías García Moreno
+ * @brief Contenedor de puntos en formato de estructura de arreglos (SoA) compartido por la implementación serial y la paralela del algoritmo k-means. Cada coordenada se guarda en una columna contigua y alineada, y el cluster de cada punto en un arreglo separado de enteros de 32 bits
+ * */
+
+#ifndef DATASET_HPP
+#define DATASET_HPP
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <utility>
+
+// Alineación de cada columna en bytes (una línea de caché, suficiente para AVX-512)
+const long long int DATASET_ALIGNMENT = 64;
+
+// Elige la instancia de una plantilla de kernel con la dimensión fija (2, 3, 4, 8, 16 o 32) para que sus ciclos se desenrollen por completo, o la instancia 0 que recorre la dimensión en tiempo de ejecución
+#define KMEANS_SPECIALIZE_DIMENSION(kernel, dimension) \
+    ((dimension) == 2 ? kernel<2> : \
+     (dimension) == 3 ? kernel<3> : \
+     (dimension) == 4 ? kernel<4> : \
+     (dimension) == 8 ? kernel<8> : \
+     (dimension) == 16 ? kernel<16> : \
+     (dimension) == 32 ? kernel<32> : kernel<0>)
+
+/**
+ * @name Dataset
+ * @brief Conjunto de puntos (o de centroides) almacenado por columnas. Cada columna es una sola reserva alineada cuyo tamaño se redondea a múltiplos de la alineación y cuyo relleno se deja en 0. Las columnas también pueden ser una vista sin copia sobre memoria externa (por ejemplo un archivo proyectado en memoria), que se mantiene viva mientras exista el conjunto
+ * */
+class Dataset {
+public:
+    /**
+     * @name Dataset
+     * @brief Constructor de un conjunto vacío, sin puntos ni columnas
+     * */
+    Dataset() : num_rows_(0), dimension_(0), columns_(nullptr), labels_(nullptr), owns_columns_(true) {}
+
+    /**
+     * @name Dataset
+     * @brief Constructor que reserva las columnas en 0 y, si se pide, el arreglo de clusters en -1 (sin cluster)
+     * @param num_rows Número de puntos (filas)
+     * @param dimension Número de coordenadas de cada punto (columnas)
+     * @param with_labels Si se reserva el arreglo de clusters de cada punto
+     * */
+    Dataset(long long int num_rows, int dimension, bool with_labels = true)
+        : num_rows_(num_rows), dimension_(dimension), columns_(nullptr), labels_(nullptr), owns_columns_(true) {
+        columns_ = new float*[dimension_]();
+        try {
+            for (int d = 0; d < dimension_; d++) {
+                columns_[d] = static_cast<float*>(aligned_block(num_rows_ * sizeof(float)));
+            }
+            if (with_labels) {
+                labels_ = static_cast<int32_t*>(aligned_block(num_rows_ * sizeof(int32_t)));
+                for (long long int i = 0; i < num_rows_; i++) {
+                    labels_[i] = -1;
+                }
+            }
+        } catch (...) {
+            release();
+            throw;
+        }
+    }
+
+    ~Dataset() {
+        release();
+    }
+
+    Dataset(const Dataset&) = delete;
+    Dataset& operator=(const Dataset&) = delete;
+
+    /**
+     * @name view
+     * @brief Función para crear un conjunto cuyas columnas apuntan a memoria externa, sin copiarlas. El arreglo de clusters sí se reserva y se inicializa en -1
+     * @param num_rows Número de puntos (filas)
+     * @param dimension Número de coordenadas de cada punto (columnas)
+     * @param columns Apuntador al inicio de cada una de las columnas externas
+     * @param backing Dueño de la memoria externa; se conserva mientras exista el conjunto
+     * @return Conjunto que ve las columnas externas
+     * */
+    static Dataset view(long long int num_rows, int dimension, const float* const* columns, std::shared_ptr<const void> backing) {
+        Dataset dataset;
+        dataset.num_rows_ = num_rows;
+        dataset.dimension_ = dimension;
+        dataset.owns_columns_ = false;
+        dataset.backing_ = std::move(backing);
+        dataset.columns_ = new float*[dimension]();
+        for (int d = 0; d < dimension; d++) {
+            dataset.columns_[d] = const_cast<float*>(columns[d]);
+        }
+        dataset.labels_ = static_cast<int32_t*>(aligned_block(num_rows * sizeof(int32_t)));
+        for (long long int i = 0; i < num_rows; i++) {
+            dataset.labels_[i] = -1;
+        }
+        return dataset;
+    }
+
+    /**
+     * @name untouched
+     * @brief Función para reservar las columnas y el arreglo de clusters sin escribirlos, alineados y redondeados a alignment bytes. Linux asigna cada página al nodo NUMA del hilo que la escribe primero, así que quien llama debe escribir todas las posiciones (incluido el relleno hasta la alineación) desde los hilos que después las van a recorrer
+     * @param num_rows Número de puntos (filas)
+     * @param dimension Número de coordenadas de cada punto (columnas)
+     * @param alignment Alineación de cada columna en bytes (múltiplo de DATASET_ALIGNMENT, por ejemplo una página)
+     * @return Conjunto con las columnas y los clusters sin inicializar
+     * */
+    static Dataset untouched(long long int num_rows, int dimension, long long int alignment) {
+        Dataset dataset;
+        dataset.num_rows_ = num_rows;
+        dataset.dimension_ = dimension;
+        dataset.columns_ = new float*[dimension]();
+        try {
+            for (int d = 0; d < dimension; d++) {
+                dataset.columns_[d] = static_cast<float*>(aligned_block(num_rows * sizeof(float), alignment, false));
+            }
+            dataset.labels_ = static_cast<int32_t*>(aligned_block(num_rows * sizeof(int32_t), alignment, false));
+        } catch (...) {
+            dataset.release();
+            throw;
+        }
+        return dataset;
+    }
+
+    /**
+     * @name Dataset
+     * @brief Constructor de movimiento: toma las columnas de otro conjunto, que queda vacío
+     * @param other Conjunto del que se toman las columnas
+     * */
+    Dataset(Dataset&& other) noexcept : Dataset() {
+        swap(other);
+    }
+
+    /**
+     * @name operator=
+     * @brief Asignación por movimiento: libera las columnas propias y toma las de otro conjunto, que queda vacío
+     * @param other Conjunto del que se toman las columnas
+     * @return Este conjunto
+     * */
+    Dataset& operator=(Dataset&& other) noexcept {
+        if (this != &other) {
+            release();
+            swap(other);
+        }
+        return *this;
+    }
+
+    // Si las columnas pertenecen al conjunto (false si son una vista sobre memoria externa de sólo lectura)
+    bool owns_columns() const { return owns_columns_; }
+    // Número de puntos
+    long long int size() const { return num_rows_; }
+    // Número de coordenadas de cada punto
+    int dimension() const { return dimension_; }
+    // Columna contigua de la coordenada d
+    float* column(int d) { return columns_[d]; }
+    const float* column(int d) const { return columns_[d]; }
+    // Arreglo de clusters de cada punto (-1 si no tiene cluster)
+    int32_t* labels() { return labels_; }
+    const int32_t* labels() const { return labels_; }
+    // Coordenada d del punto i
+    float& at(long long int i, int d) { return columns_[d][i]; }
+    float at(long long int i, int d) const { return columns_[d][i]; }
+
+private:
+    /**
+     * @name aligned_block
+     * @brief Reserva un bloque alineado cuyo tamaño se redondea a múltiplos de la alineación y, si se pide, lo llena de 0
+     * @param bytes Cantidad de bytes útiles
+     * @param alignment Alineación en bytes
+     * @param zero Si se llena de 0 (false deja las páginas sin tocar)
+     * @return Apuntador al bloque reservado
+     * */
+    static void* aligned_block(long long int bytes, long long int alignment = DATASET_ALIGNMENT, bool zero = true) {
+        long long int padded = (bytes + alignment - 1) / alignment * alignment;
+        if (padded == 0) padded = alignment;
+        void* block = aligned_alloc(alignment, padded);
+        if (block == nullptr) throw std::bad_alloc();
+        if (zero) memset(block, 0, padded);
+        return block;
+    }
+
+    void release() {
+        if (columns_ != nullptr) {
+            for (int d = 0; d < dimension_ && owns_columns_; d++) {
+                free(columns_[d]);
+            }
+            delete[] columns_;
+            columns_ = nullptr;
+        }
+        free(labels_);
+        labels_ = nullptr;
+        backing_.reset();
+        num_rows_ = 0;
+        dimension_ = 0;
+        owns_columns_ = true;
+    }
+
+    void swap(Dataset& other) noexcept {
+        std::swap(num_rows_, other.num_rows_);
+        std::swap(dimension_, other.dimension_);
+        std::swap(columns_, other.columns_);
+        std::swap(labels_, other.labels_);
+        std::swap(owns_columns_, other.owns_columns_);
+        std::swap(backing_, other.backing_);
+    }
+
+    long long int num_rows_;
+    int dimension_;
+    float** columns_;
+    int32_t* labels_;
+    bool owns_columns_;
+    std::shared_ptr<const void> backing_;
+};
+
+#endif
@@ -0,0 +1,167 @@
+/**
+ * @file distance_benchmark.cpp
+ * @date 2023-03-08
+ * @author Diego Hernández Delgado
+ * @author Jesús Isaías García Moreno
+ * @brief Microbenchmark que compara la búsqueda del centroide más cercano con euclidean_distance (pow y sqrt por cada par punto-centroide) contra los kernels vectorizados de distancias al cuadrado de distance_kernels.hpp. Verifica que todos los kernels produzcan las mismas etiquetas que el kernel escalar
+ * @param num_points Número de puntos aleatorios
+ * @param n_clusters Número de clusters o centroides
+ * @param repetitions Número de repeticiones de cada medición
+ * @param dimension Número de coordenadas de cada punto (opcional, 2 por defecto)
+ * */
+
+#include <omp.h>
+#include <iostream>
+#include <string>
+#include <cmath>
+#include <random>
+#include <bits/stdc++.h>
+#include "dataset.hpp"
+#include "distance_kernels.hpp"
+
+using namespace std;
+
+
+/**
+ * @name euclidean_distance
+ * @brief Función original para calcular la distancia euclidiana entre un punto y un centroide (con pow y sqrt)
+ * @param points Conjunto de puntos por columnas
+ * @param point_index Índice del punto
+ * @param centroids Conjunto de centroides por columnas
+ * @param centroid_index Índice del centroide
+ * @return Distancia euclidiana entre el punto y el centroide dados
+ * */
+float euclidean_distance(const Dataset& points, long long int point_index, const Dataset& centroids, int centroid_index) {
+    float distance = 0;
+    for (int d = 0; d < points.dimension(); d++) {
+        distance += pow((points.at(point_index, d) - centroids.at(centroid_index, d)), 2);
+    }
+    return sqrt(distance);
+}
+
+/**
+ * @name find_nearest_centroid
+ * @brief Función original para encontrar el índice del centroide más cercano para un punto dado
+ * @param centroids Conjunto de centroides por columnas
+ * @param points Conjunto de puntos por columnas
+ * @param point_index Índice del punto
+ * @return Índice del centroide más cercano al punto dado
+ * */
+int find_nearest_centroid(const Dataset& centroids, const Dataset& points, long long int point_index) {
+    float min_distance = euclidean_distance(points, point_index, centroids, 0);
+    int nearest_centroid_index = 0;
+    for (int i = 1; i < centroids.size(); i++) {
+        float distance = euclidean_distance(points, point_index, centroids, i);
+        if (distance < min_distance) {
+            min_distance = distance;
+            nearest_centroid_index = i;
+        }
+    }
+    return nearest_centroid_index;
+}
+
+/**
+ * @name time_kernel
+ * @brief Función para medir el mejor tiempo de un kernel sobre todos los puntos en bloques de KERNEL_BLOCK_SIZE
+ * @param kernel Kernel a medir
+ * @param points Conjunto de puntos por columnas
+ * @param centroids Conjunto de centroides por columnas
+ * @param labels Arreglo de salida con una etiqueta por punto
+ * @param repetitions Número de repeticiones
+ * @return Mejor tiempo en segundos
+ * */
+double time_kernel(NearestCentroidsKernel kernel, const Dataset& points, const Dataset& centroids, int32_t* labels, int repetitions) {
+    double best = 1e30;
+    for (int r = 0; r < repetitions; r++) {
+        double start = omp_get_wtime();
+        for (long long int begin = 0; begin < points.size(); begin += KERNEL_BLOCK_SIZE) {
+            kernel(points, begin, min(begin + KERNEL_BLOCK_SIZE, points.size()), centroids, labels + begin, nullptr);
+        }
+        best = min(best, omp_get_wtime() - start);
+    }
+    return best;
+}
+
+/**
+ * @name main
+ * @brief Función main del microbenchmark
+ * @param argc Cantidad de argumentos de entrada (STDIN)
+ * @param argv Argumentos de entrada (STDIN) [nombre del programa, número de puntos, número de clusters, número de repeticiones, dimensión (opcional)]
+ * @return 0 si todos los kernels coinciden con el kernel escalar
+ * */
+int main(int argc, char** argv) {
+    long long int num_points = 1000000;
+    int n_clusters = 13;
+    int repetitions = 5;
+    int dimension = 2;
+    try{
+        if (argc == 4 || argc == 5) {
+            num_points = stoll(argv[1]);
+            n_clusters = stoi(argv[2]);
+            repetitions = stoi(argv[3]);
+            if (argc == 5) dimension = stoi(argv[4]);
+        } else if (argc != 1) {
+            throw std::invalid_argument("Invalid number of arguments");
+        }
+        if (num_points < 1 || n_clusters < 1 || repetitions < 1 || dimension < 1)
+            throw std::invalid_argument("Invalid arguments");
+    } catch (const std::exception& e) {
+        cout << e.what() << "\n";
+        cout << "Usage: ./distance_benchmark <num_points> <n_clusters> <repetitions> [dimension]" << "\n";
+        return 1;
+    }
+
+    // Puntos y centroides aleatorios en el mismo rango que generate_data.py
+    mt19937 generator(7);
+    uniform_real_distribution<float> coordinate(0.0f, 1.2f);
+    Dataset points(num_points, dimension);
+    Dataset centroids(n_clusters, dimension, false);
+    for (int d = 0; d < dimension; d++) {
+        for (long long int i = 0; i < num_points; i++) points.at(i, d) = roundf(coordinate(generator) * 1000.0f) / 1000.0f;
+        for (int k = 0; k < n_clusters; k++) centroids.at(k, d) = coordinate(generator);
+    }
+
+    // Referencia: búsqueda original con pow y sqrt
+    int32_t* reference = new int32_t[num_points];
+    double best_reference = 1e30;
+    for (int r = 0; r < repetitions; r++) {
+        double start = omp_get_wtime();
+        for (long long int i = 0; i < num_points; i++) {
+            reference[i] = find_nearest_centroid(centroids, points, i);
+        }
+        best_reference = min(best_reference, omp_get_wtime() - start);
+    }
+
+    // Kernels disponibles en este procesador, especializados para la dimensión
+    vector<pair<string, NearestCentroidsKernel>> kernels;
+    for (KernelIsa isa : {ISA_SCALAR, ISA_SSE2, ISA_AVX2, ISA_AVX512}) {
+        if (isa <= detect_kernel_isa()) kernels.push_back({kernel_isa_name(isa), nearest_centroids_kernel(isa, dimension)});
+    }
+    const char* selected_name;
+    select_nearest_centroids_kernel(dimension, &selected_name);
+
+    cout << "points=" << num_points << " clusters=" << n_clusters << " dimension=" << dimension << " repetitions=" << repetitions << " selected=" << selected_name << "\n";
+    cout << "kernel,seconds,speedup,mismatches_vs_scalar,mismatches_vs_euclidean_distance" << "\n";
+    cout << "euclidean_distance," << best_reference << ",1,-,0" << "\n";
+
+    int32_t* scalar_labels = new int32_t[num_points];
+    int32_t* labels = new int32_t[num_points];
+    bool identical = true;
+    for (size_t v = 0; v < kernels.size(); v++) {
+        double seconds = time_kernel(kernels[v].second, points, centroids, v == 0 ? scalar_labels : labels, repetitions);
+        int32_t* result = v == 0 ? scalar_labels : labels;
+        long long int mismatches_scalar = 0;
+        long long int mismatches_reference = 0;
+        for (long long int i = 0; i < num_points; i++) {
+            mismatches_scalar += result[i] != scalar_labels[i];
+            mismatches_reference += result[i] != reference[i];
+        }
+        identical = identical && mismatches_scalar == 0;
+        cout << kernels[v].first << "," << seconds << "," << best_reference / seconds << "," << mismatches_scalar << "," << mismatches_reference << "\n";
+    }
+
+    delete[] labels;
+    delete[] scalar_labels;
+    delete[] reference;
+    return identical ? 0 : 1;
+}
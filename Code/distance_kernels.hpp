@@ -0,0 +1,380 @@
+/**
+ * @file distance_kernels.hpp
+ * @date 2023-03-08
+ * @author Diego Hernández Delgado
+ * @author Jesús Isaías García Moreno
+ * @brief Kernels vectorizados que calculan la distancia euclidiana al cuadrado de un bloque de puntos a todos los centroides y regresan el índice del centroide más cercano (argmin). Se elige en tiempo de ejecución entre AVX-512, AVX2, SSE2 o la versión escalar según lo que soporte el procesador (CPUID)
+ * */
+
+#ifndef DISTANCE_KERNELS_HPP
+#define DISTANCE_KERNELS_HPP
+
+#include <cstdint>
+#include "dataset.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KMEANS_X86 1
+#endif
+
+// Cantidad de puntos que se procesan por llamada al kernel; el bloque de etiquetas resultante cabe en L1
+const long long int KERNEL_BLOCK_SIZE = 1024;
+
+// Todas las variantes calculan diff * diff y luego la suma, en el mismo orden de coordenadas y sin fusionar en FMA, para que la versión escalar y las vectoriales produzcan exactamente las mismas etiquetas
+#define KMEANS_KERNEL_ATTRIBUTES __attribute__((optimize("fp-contract=off")))
+
+/**
+ * @name NearestCentroidsKernel
+ * @brief Firma común de los kernels: asigna a cada punto del rango [begin, end) el índice de su centroide más cercano
+ * @param points Conjunto de puntos por columnas
+ * @param begin Índice del primer punto del bloque
+ * @param end Índice siguiente al último punto del bloque
+ * @param centroids Conjunto de centroides por columnas
+ * @param labels Arreglo de salida con end - begin etiquetas
+ * @param min_distances Arreglo opcional de salida con la distancia al cuadrado al centroide más cercano (puede ser nullptr)
+ * */
+typedef void (*NearestCentroidsKernel)(const Dataset& points, long long int begin, long long int end, const Dataset& centroids, int32_t* labels, float* min_distances);
+
+/**
+ * @name squared_distance
+ * @brief Función para calcular la distancia euclidiana al cuadrado entre un punto y un centroide (sin raíz, ya que sólo se comparan distancias)
+ * @tparam DIM Dimensión fija de los puntos, o 0 para usar la dimensión del conjunto en tiempo de ejecución
+ * @param points Conjunto de puntos por columnas
+ * @param point_index Índice del punto
+ * @param centroids Conjunto de centroides por columnas
+ * @param centroid_index Índice del centroide
+ * @return Distancia euclidiana al cuadrado
+ * */
+template <int DIM = 0>
+KMEANS_KERNEL_ATTRIBUTES
+inline float squared_distance(const Dataset& points, long long int point_index, const Dataset& centroids, int centroid_index) {
+    const int dimension = DIM > 0 ? DIM : points.dimension();
+    float distance = 0.0f;
+    for (int d = 0; d < dimension; d++) {
+        float diff = points.at(point_index, d) - centroids.at(centroid_index, d);
+        distance += diff * diff;
+    }
+    return distance;
+}
+
+/**
+ * @name nearest_centroids_scalar
+ * @brief Kernel escalar de referencia; también se usa para los puntos sobrantes de los kernels vectoriales
+ * @tparam DIM Dimensión fija de los puntos, o 0 para usar la dimensión del conjunto en tiempo de ejecución
+ * */
+template <int DIM>
+KMEANS_KERNEL_ATTRIBUTES
+inline void nearest_centroids_scalar(const Dataset& points, long long int begin, long long int end, const Dataset& centroids, int32_t* labels, float* min_distances) {
+    const int n_clusters = centroids.size();
+    for (long long int i = begin; i < end; i++) {
+        float best = squared_distance<DIM>(points, i, centroids, 0);
+        int32_t best_index = 0;
+        for (int k = 1; k < n_clusters; k++) {
+            float distance = squared_distance<DIM>(points, i, centroids, k);
+            bool closer = distance < best;
+            best = closer ? distance : best;
+            best_index = closer ? k : best_index;
+        }
+        labels[i - begin] = best_index;
+        if (min_distances != nullptr) min_distances[i - begin] = best;
+    }
+}
+
+/**
+ * @name PointDistancesKernel
+ * @brief Firma común de los kernels que calculan la distancia al cuadrado de un solo punto a los centroides [first, last), vectorizando sobre los centroides. Se usan cuando sólo algunos puntos necesitan sus distancias (asignación con cotas)
+ * @param points Conjunto de puntos por columnas
+ * @param point_index Índice del punto
+ * @param centroids Conjunto de centroides por columnas; sus columnas deben poder leerse hasta first + point_distances_size(last - first) (el relleno de Dataset lo cumple cuando first = 0)
+ * @param first Índice del primer centroide
+ * @param last Índice siguiente al último centroide
+ * @param distances Arreglo de salida con al menos point_distances_size(last - first) distancias (la distancia al centroide k va en k - first); las posiciones después del último centroide no tienen significado
+ * */
+typedef void (*PointDistancesKernel)(const Dataset& points, long long int point_index, const Dataset& centroids, int first, int last, float* distances);
+
+// Los kernels de un punto procesan los centroides de 16 en 16 (el relleno de las columnas de Dataset cubre el último grupo)
+const int POINT_DISTANCES_LANES = 16;
+
+/**
+ * @name point_distances_size
+ * @brief Función para obtener el tamaño del arreglo de salida de los kernels de un punto
+ * @param n_clusters Número de clusters o centroides
+ * @return Cantidad de distancias que escribe el kernel
+ * */
+inline int point_distances_size(int n_clusters) {
+    return (n_clusters + POINT_DISTANCES_LANES - 1) / POINT_DISTANCES_LANES * POINT_DISTANCES_LANES;
+}
+
+/**
+ * @name point_distances_scalar
+ * @brief Kernel escalar de un punto; cada distancia es exactamente la de squared_distance
+ * @tparam DIM Dimensión fija de los puntos, o 0 para usar la dimensión del conjunto en tiempo de ejecución
+ * */
+template <int DIM>
+KMEANS_KERNEL_ATTRIBUTES
+inline void point_distances_scalar(const Dataset& points, long long int point_index, const Dataset& centroids, int first, int last, float* distances) {
+    for (int k = first; k < last; k++) {
+        distances[k - first] = squared_distance<DIM>(points, point_index, centroids, k);
+    }
+}
+
+#ifdef KMEANS_X86
+
+// Con dimensión fija las coordenadas del bloque de puntos se cargan una sola vez en registros; con dimensión en tiempo de ejecución se leen de la columna en cada centroide
+#define KMEANS_POINT_REGISTERS (DIM > 0 ? DIM : 1)
+
+/**
+ * @name nearest_centroids_sse2
+ * @brief Kernel SSE2: procesa 4 puntos a la vez, cada carril calcula las distancias de un punto a todos los centroides
+ * @tparam DIM Dimensión fija de los puntos, o 0 para usar la dimensión del conjunto en tiempo de ejecución
+ * */
+template <int DIM>
+__attribute__((target("sse2"))) KMEANS_KERNEL_ATTRIBUTES
+inline void nearest_centroids_sse2(const Dataset& points, long long int begin, long long int end, const Dataset& centroids, int32_t* labels, float* min_distances) {
+    const int n_clusters = centroids.size();
+    const int dimension = DIM > 0 ? DIM : points.dimension();
+    long long int i = begin;
+    for (; i + 4 <= end; i += 4) {
+        __m128 coordinates[KMEANS_POINT_REGISTERS];
+        if (DIM > 0) {
+            for (int d = 0; d < DIM; d++) coordinates[d] = _mm_loadu_ps(points.column(d) + i);
+        }
+        __m128 best = _mm_set1_ps(__builtin_inff());
+        __m128i best_index = _mm_setzero_si128();
+        for (int k = 0; k < n_clusters; k++) {
+            __m128 distance = _mm_setzero_ps();
+            for (int d = 0; d < dimension; d++) {
+                __m128 coordinate = DIM > 0 ? coordinates[d] : _mm_loadu_ps(points.column(d) + i);
+                __m128 diff = _mm_sub_ps(coordinate, _mm_set1_ps(centroids.at(k, d)));
+                distance = _mm_add_ps(distance, _mm_mul_ps(diff, diff));
+            }
+            __m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, best));
+            best = _mm_min_ps(distance, best);
+            best_index = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(k)), _mm_andnot_si128(closer, best_index));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(labels + (i - begin)), best_index);
+        if (min_distances != nullptr) _mm_storeu_ps(min_distances + (i - begin), best);
+    }
+    nearest_centroids_scalar<DIM>(points, i, end, centroids, labels + (i - begin), min_distances == nullptr ? nullptr : min_distances + (i - begin));
+}
+
+/**
+ * @name nearest_centroids_avx2
+ * @brief Kernel AVX2: procesa 8 puntos a la vez
+ * @tparam DIM Dimensión fija de los puntos, o 0 para usar la dimensión del conjunto en tiempo de ejecución
+ * */
+template <int DIM>
+__attribute__((target("avx2"))) KMEANS_KERNEL_ATTRIBUTES
+inline void nearest_centroids_avx2(const Dataset& points, long long int begin, long long int end, const Dataset& centroids, int32_t* labels, float* min_distances) {
+    const int n_clusters = centroids.size();
+    const int dimension = DIM > 0 ? DIM : points.dimension();
+    long long int i = begin;
+    for (; i + 8 <= end; i += 8) {
+        __m256 coordinates[KMEANS_POINT_REGISTERS];
+        if (DIM > 0) {
+            for (int d = 0; d < DIM; d++) coordinates[d] = _mm256_loadu_ps(points.column(d) + i);
+        }
+        __m256 best = _mm256_set1_ps(__builtin_inff());
+        __m256i best_index = _mm256_setzero_si256();
+        for (int k = 0; k < n_clusters; k++) {
+            __m256 distance = _mm256_setzero_ps();
+            for (int d = 0; d < dimension; d++) {
+                __m256 coordinate = DIM > 0 ? coordinates[d] : _mm256_loadu_ps(points.column(d) + i);
+                __m256 diff = _mm256_sub_ps(coordinate, _mm256_set1_ps(centroids.at(k, d)));
+                distance = _mm256_add_ps(distance, _mm256_mul_ps(diff, diff));
+            }
+            __m256 closer = _mm256_cmp_ps(distance, best, _CMP_LT_OQ);
+            best = _mm256_blendv_ps(best, distance, closer);
+            best_index = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(best_index), _mm256_castsi256_ps(_mm256_set1_epi32(k)), closer));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(labels + (i - begin)), best_index);
+        if (min_distances != nullptr) _mm256_storeu_ps(min_distances + (i - begin), best);
+    }
+    nearest_centroids_sse2<DIM>(points, i, end, centroids, labels + (i - begin), min_distances == nullptr ? nullptr : min_distances + (i - begin));
+}
+
+/**
+ * @name nearest_centroids_avx512
+ * @brief Kernel AVX-512: procesa 16 puntos a la vez usando registros de máscara para la selección
+ * @tparam DIM Dimensión fija de los puntos, o 0 para usar la dimensión del conjunto en tiempo de ejecución
+ * */
+template <int DIM>
+__attribute__((target("avx512f"))) KMEANS_KERNEL_ATTRIBUTES
+inline void nearest_centroids_avx512(const Dataset& points, long long int begin, long long int end, const Dataset& centroids, int32_t* labels, float* min_distances) {
+    const int n_clusters = centroids.size();
+    const int dimension = DIM > 0 ? DIM : points.dimension();
+    long long int i = begin;
+    for (; i + 16 <= end; i += 16) {
+        __m512 coordinates[KMEANS_POINT_REGISTERS];
+        if (DIM > 0) {
+            for (int d = 0; d < DIM; d++) coordinates[d] = _mm512_loadu_ps(points.column(d) + i);
+        }
+        __m512 best = _mm512_set1_ps(__builtin_inff());
+        __m512i best_index = _mm512_setzero_si512();
+        for (int k = 0; k < n_clusters; k++) {
+            __m512 distance = _mm512_setzero_ps();
+            for (int d = 0; d < dimension; d++) {
+                __m512 coordinate = DIM > 0 ? coordinates[d] : _mm512_loadu_ps(points.column(d) + i);
+                __m512 diff = _mm512_sub_ps(coordinate, _mm512_set1_ps(centroids.at(k, d)));
+                distance = _mm512_add_ps(distance, _mm512_mul_ps(diff, diff));
+            }
+            __mmask16 closer = _mm512_cmp_ps_mask(distance, best, _CMP_LT_OQ);
+            best = _mm512_mask_mov_ps(best, closer, distance);
+            best_index = _mm512_mask_mov_epi32(best_index, closer, _mm512_set1_epi32(k));
+        }
+        _mm512_storeu_si512(labels + (i - begin), best_index);
+        if (min_distances != nullptr) _mm512_storeu_ps(min_distances + (i - begin), best);
+    }
+    nearest_centroids_avx2<DIM>(points, i, end, centroids, labels + (i - begin), min_distances == nullptr ? nullptr : min_distances + (i - begin));
+}
+
+
+/**
+ * @name point_distances_sse2
+ * @brief Kernel SSE2 de un punto: 4 centroides a la vez
+ * @tparam DIM Dimensión fija de los puntos, o 0 para usar la dimensión del conjunto en tiempo de ejecución
+ * */
+template <int DIM>
+__attribute__((target("sse2"))) KMEANS_KERNEL_ATTRIBUTES
+inline void point_distances_sse2(const Dataset& points, long long int point_index, const Dataset& centroids, int first, int last, float* distances) {
+    const int padded_clusters = point_distances_size(last - first);
+    const int dimension = DIM > 0 ? DIM : points.dimension();
+    for (int k = 0; k < padded_clusters; k += 4) {
+        __m128 distance = _mm_setzero_ps();
+        for (int d = 0; d < dimension; d++) {
+            __m128 diff = _mm_sub_ps(_mm_set1_ps(points.at(point_index, d)), _mm_loadu_ps(centroids.column(d) + first + k));
+            distance = _mm_add_ps(distance, _mm_mul_ps(diff, diff));
+        }
+        _mm_storeu_ps(distances + k, distance);
+    }
+}
+
+/**
+ * @name point_distances_avx2
+ * @brief Kernel AVX2 de un punto: 8 centroides a la vez
+ * @tparam DIM Dimensión fija de los puntos, o 0 para usar la dimensión del conjunto en tiempo de ejecución
+ * */
+template <int DIM>
+__attribute__((target("avx2"))) KMEANS_KERNEL_ATTRIBUTES
+inline void point_distances_avx2(const Dataset& points, long long int point_index, const Dataset& centroids, int first, int last, float* distances) {
+    const int padded_clusters = point_distances_size(last - first);
+    const int dimension = DIM > 0 ? DIM : points.dimension();
+    for (int k = 0; k < padded_clusters; k += 8) {
+        __m256 distance = _mm256_setzero_ps();
+        for (int d = 0; d < dimension; d++) {
+            __m256 diff = _mm256_sub_ps(_mm256_set1_ps(points.at(point_index, d)), _mm256_loadu_ps(centroids.column(d) + first + k));
+            distance = _mm256_add_ps(distance, _mm256_mul_ps(diff, diff));
+        }
+        _mm256_storeu_ps(distances + k, distance);
+    }
+}
+
+/**
+ * @name point_distances_avx512
+ * @brief Kernel AVX-512 de un punto: 16 centroides a la vez
+ * @tparam DIM Dimensión fija de los puntos, o 0 para usar la dimensión del conjunto en tiempo de ejecución
+ * */
+template <int DIM>
+__attribute__((target("avx512f"))) KMEANS_KERNEL_ATTRIBUTES
+inline void point_distances_avx512(const Dataset& points, long long int point_index, const Dataset& centroids, int first, int last, float* distances) {
+    const int padded_clusters = point_distances_size(last - first);
+    const int dimension = DIM > 0 ? DIM : points.dimension();
+    for (int k = 0; k < padded_clusters; k += 16) {
+        __m512 distance = _mm512_setzero_ps();
+        for (int d = 0; d < dimension; d++) {
+            __m512 diff = _mm512_sub_ps(_mm512_set1_ps(points.at(point_index, d)), _mm512_loadu_ps(centroids.column(d) + first + k));
+            distance = _mm512_add_ps(distance, _mm512_mul_ps(diff, diff));
+        }
+        _mm512_storeu_ps(distances + k, distance);
+    }
+}
+
+#undef KMEANS_POINT_REGISTERS
+
+#endif
+
+/**
+ * @name KernelIsa
+ * @brief Conjunto de instrucciones vectoriales del kernel elegido
+ * */
+enum KernelIsa { ISA_SCALAR, ISA_SSE2, ISA_AVX2, ISA_AVX512 };
+
+/**
+ * @name detect_kernel_isa
+ * @brief Función para consultar CPUID y elegir el conjunto de instrucciones más ancho que soporta el procesador. La consulta se hace una sola vez y es segura entre hilos
+ * @return Conjunto de instrucciones elegido
+ * */
+inline KernelIsa detect_kernel_isa() {
+    static const KernelIsa isa = []() {
+#ifdef KMEANS_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) return ISA_AVX512;
+        if (__builtin_cpu_supports("avx2")) return ISA_AVX2;
+        if (__builtin_cpu_supports("sse2")) return ISA_SSE2;
+#endif
+        return ISA_SCALAR;
+    }();
+    return isa;
+}
+
+/**
+ * @name kernel_isa_name
+ * @brief Función para obtener el nombre de un conjunto de instrucciones (para reportes)
+ * @param isa Conjunto de instrucciones
+ * @return Nombre del conjunto de instrucciones
+ * */
+inline const char* kernel_isa_name(KernelIsa isa) {
+    switch (isa) {
+        case ISA_AVX512: return "avx512";
+        case ISA_AVX2: return "avx2";
+        case ISA_SSE2: return "sse2";
+        default: return "scalar";
+    }
+}
+
+/**
+ * @name nearest_centroids_kernel
+ * @brief Función para obtener el kernel de un conjunto de instrucciones especializado para una dimensión
+ * @param isa Conjunto de instrucciones
+ * @param dimension Número de coordenadas de cada punto
+ * @return Apuntador al kernel
+ * */
+inline NearestCentroidsKernel nearest_centroids_kernel(KernelIsa isa, int dimension) {
+#ifdef KMEANS_X86
+    if (isa == ISA_AVX512) return KMEANS_SPECIALIZE_DIMENSION(nearest_centroids_avx512, dimension);
+    if (isa == ISA_AVX2) return KMEANS_SPECIALIZE_DIMENSION(nearest_centroids_avx2, dimension);
+    if (isa == ISA_SSE2) return KMEANS_SPECIALIZE_DIMENSION(nearest_centroids_sse2, dimension);
+#endif
+    return KMEANS_SPECIALIZE_DIMENSION(nearest_centroids_scalar, dimension);
+}
+
+/**
+ * @name select_nearest_centroids_kernel
+ * @brief Función para obtener el kernel más ancho que soporta el procesador especializado para la dimensión de los puntos
+ * @param dimension Número de coordenadas de cada punto
+ * @param kernel_name Salida opcional con el nombre del conjunto de instrucciones elegido
+ * @return Apuntador al kernel elegido
+ * */
+inline NearestCentroidsKernel select_nearest_centroids_kernel(int dimension, const char** kernel_name = nullptr) {
+    KernelIsa isa = detect_kernel_isa();
+    if (kernel_name != nullptr) *kernel_name = kernel_isa_name(isa);
+    return nearest_centroids_kernel(isa, dimension);
+}
+
+/**
+ * @name select_point_distances_kernel
+ * @brief Función para obtener el kernel de un punto más ancho que soporta el procesador especializado para la dimensión de los puntos
+ * @param dimension Número de coordenadas de cada punto
+ * @return Apuntador al kernel elegido
+ * */
+inline PointDistancesKernel select_point_distances_kernel(int dimension) {
+#ifdef KMEANS_X86
+    KernelIsa isa = detect_kernel_isa();
+    if (isa == ISA_AVX512) return KMEANS_SPECIALIZE_DIMENSION(point_distances_avx512, dimension);
+    if (isa == ISA_AVX2) return KMEANS_SPECIALIZE_DIMENSION(point_distances_avx2, dimension);
+    if (isa == ISA_SSE2) return KMEANS_SPECIALIZE_DIMENSION(point_distances_sse2, dimension);
+#endif
+    return KMEANS_SPECIALIZE_DIMENSION(point_distances_scalar, dimension);
+}
+
+#endif
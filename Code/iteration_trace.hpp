@@ -0,0 +1,417 @@
+/**
+ * @file iteration_trace.hpp
+ * @date 2023-03-08
+ * @author Diego Hernández Delgado
+ * @author Jesús Isaías García Moreno
+ * @brief Instrumentación opcional de cada iteración de k-means: puntos que cambiaron de cluster, distancias calculadas, desplazamiento máximo de los centroides, inercia, tiempo ocupado y ocioso de cada hilo, tiempo de la iteración y, con counters=on, ciclos, instrucciones, fallos de caché y fallos del último nivel de caché (perf_event_open). Sólo existe al compilar con -DKMEANS_TRACE; sin esa bandera KMEANS_TRACE_ONLY descarta todo el código de medición y no cuesta nada. La traza se escribe en el formato de eventos de Chrome (chrome://tracing o https://ui.perfetto.dev) y en un CSV con un renglón por iteración
+ * */
+
+#ifndef ITERATION_TRACE_HPP
+#define ITERATION_TRACE_HPP
+
+#ifdef KMEANS_TRACE
+
+#include <omp.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Código que sólo se compila con -DKMEANS_TRACE
+#define KMEANS_TRACE_ONLY(...) __VA_ARGS__
+
+/**
+ * @name TracePhase
+ * @brief Regiones paralelas cuyo tiempo ocupado y ocioso por hilo se registra
+ * */
+enum TracePhase { TRACE_ASSIGN, TRACE_UPDATE, N_TRACE_PHASES };
+
+// Nombre de cada región en la traza
+const char* const TRACE_PHASE_NAMES[N_TRACE_PHASES] = {"assign", "update"};
+
+// Contadores de hardware que se leen con counters=on
+enum HardwareCounter { COUNTER_CYCLES, COUNTER_INSTRUCTIONS, COUNTER_CACHE_MISSES, COUNTER_LLC_MISSES, N_COUNTERS };
+
+// Nombre de cada contador en la traza
+const char* const COUNTER_NAMES[N_COUNTERS] = {"cycles", "instructions", "cache_misses", "llc_misses"};
+
+/**
+ * @name ThreadCounters
+ * @brief Contadores de hardware de cada hilo de OpenMP. Cada hilo abre los suyos (perf_event_open sobre el hilo que llama, sólo en modo usuario) y el hilo principal los lee y los suma
+ * */
+class ThreadCounters {
+public:
+    ThreadCounters() : available_(false) {}
+
+    ~ThreadCounters() {
+        close_all();
+    }
+
+    ThreadCounters(const ThreadCounters&) = delete;
+    ThreadCounters& operator=(const ThreadCounters&) = delete;
+
+    /**
+     * @name open
+     * @brief Función para abrir los contadores en cada hilo de una región paralela de n_threads hilos
+     * @param n_threads Número de hilos de OpenMP que se miden
+     * @return true si todos los contadores se pudieron abrir
+     * */
+    bool open(int n_threads) {
+        close_all();
+        fds_.assign((size_t) n_threads * N_COUNTERS, -1);
+        bool ok = true;
+        #pragma omp parallel num_threads(n_threads) reduction(&&:ok)
+        {
+            int thread_id = omp_get_thread_num();
+            for (int c = 0; c < N_COUNTERS; c++) {
+                int fd = open_counter((HardwareCounter) c);
+                fds_[(size_t) thread_id * N_COUNTERS + c] = fd;
+                ok = ok && fd >= 0;
+            }
+        }
+        available_ = ok;
+        if (!ok) close_all();
+        return ok;
+    }
+
+    // Si los contadores están abiertos
+    bool available() const { return available_; }
+
+    /**
+     * @name read
+     * @brief Función para leer la suma de cada contador en todos los hilos
+     * @param values Arreglo de salida con N_COUNTERS valores
+     * */
+    void read(uint64_t* values) const {
+        for (int c = 0; c < N_COUNTERS; c++) values[c] = 0;
+        if (!available_) return;
+        for (size_t i = 0; i < fds_.size(); i++) {
+            uint64_t value = 0;
+            if (::read(fds_[i], &value, sizeof(value)) == (ssize_t) sizeof(value)) values[i % N_COUNTERS] += value;
+        }
+    }
+
+private:
+    /**
+     * @name open_counter
+     * @brief Función para abrir un contador del hilo que llama
+     * @param counter Contador
+     * @return Descriptor del contador, o -1 si el procesador o el sistema no lo permiten
+     * */
+    static int open_counter(HardwareCounter counter) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        switch (counter) {
+            case COUNTER_CYCLES: attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+            case COUNTER_INSTRUCTIONS: attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+            case COUNTER_CACHE_MISSES: attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_CACHE_MISSES; break;
+            default:
+                attr.type = PERF_TYPE_HW_CACHE;
+                attr.config = PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+                break;
+        }
+        return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    void close_all() {
+        for (int fd : fds_) {
+            if (fd >= 0) close(fd);
+        }
+        fds_.clear();
+        available_ = false;
+    }
+
+    std::vector<int> fds_;  // Descriptor de cada contador de cada hilo (hilos x N_COUNTERS)
+    bool available_;
+};
+
+/**
+ * @name IterationRecord
+ * @brief Datos de una iteración (la primera asignación es la iteración 0)
+ * */
+struct IterationRecord {
+    int repetition;
+    long long int iteration;
+    double start;                // Segundos desde el inicio de la traza
+    double end;
+    long long int changed;       // Puntos que cambiaron de cluster
+    long long int distances;     // Distancias punto-centroide calculadas
+    double max_shift;            // Desplazamiento máximo de un centroide en la actualización
+    double inertia;              // Suma de las distancias al cuadrado de cada punto a su centroide después de la asignación
+    double region_start[N_TRACE_PHASES];   // Inicio y fin de cada región paralela
+    double region_end[N_TRACE_PHASES];
+    std::vector<double> busy_start[N_TRACE_PHASES]; // Inicio y fin del trabajo de cada hilo en cada región
+    std::vector<double> busy_end[N_TRACE_PHASES];
+    uint64_t counters[N_COUNTERS];  // Contadores de hardware de la iteración (0 sin counters=on)
+};
+
+/**
+ * @name IterationTrace
+ * @brief Registro de las iteraciones de todas las repeticiones. kmeans llama a begin_run al empezar cada repetición, a begin_iteration y end_iteration alrededor de cada pasada, y las regiones paralelas llaman a region y a thread_busy con sus tiempos. Mientras no se habilite con configure (trace=), o entre iteraciones, las llamadas no registran nada
+ * */
+class IterationTrace {
+public:
+    IterationTrace() : origin_(omp_get_wtime()), enabled_(false), counters_requested_(false), repetition_(0), n_threads_(1), current_(-1) {}
+
+    /**
+     * @name configure
+     * @brief Función para habilitar el registro y elegir si se leen los contadores de hardware
+     * @param enabled Si se registran las iteraciones
+     * @param hardware_counters Si se leen los contadores con perf_event_open
+     * */
+    void configure(bool enabled, bool hardware_counters) {
+        enabled_ = enabled;
+        counters_requested_ = enabled && hardware_counters;
+    }
+
+    // Si se registran las iteraciones
+    bool enabled() const { return enabled_; }
+
+    // Si los contadores de hardware se están leyendo
+    bool counters_available() const { return counters_.available(); }
+
+    /**
+     * @name begin_run
+     * @brief Función para empezar una repetición de k-means (abre los contadores si se pidieron y aún no están abiertos para este número de hilos)
+     * @param repetition Número de la repetición
+     * @param n_threads Número de hilos de OpenMP
+     * */
+    void begin_run(int repetition, int n_threads) {
+        if (!enabled_) return;
+        repetition_ = repetition;
+        if (counters_requested_ && (n_threads != n_threads_ || !counters_.available())) {
+            counters_.open(n_threads);
+        }
+        n_threads_ = n_threads;
+    }
+
+    /**
+     * @name begin_iteration
+     * @brief Función para empezar el registro de una iteración
+     * @param iteration Número de la iteración
+     * */
+    void begin_iteration(long long int iteration) {
+        if (!enabled_) return;
+        IterationRecord record;
+        record.repetition = repetition_;
+        record.iteration = iteration;
+        record.start = now();
+        record.end = record.start;
+        record.changed = 0;
+        record.distances = 0;
+        record.max_shift = 0.0;
+        record.inertia = 0.0;
+        for (int p = 0; p < N_TRACE_PHASES; p++) {
+            record.region_start[p] = record.region_end[p] = 0.0;
+            record.busy_start[p].assign(n_threads_, 0.0);
+            record.busy_end[p].assign(n_threads_, 0.0);
+        }
+        counters_.read(record.counters);
+        records_.push_back(record);
+        current_ = (long long int) records_.size() - 1;
+    }
+
+    /**
+     * @name region
+     * @brief Función para registrar el inicio y el fin de una región paralela de la iteración actual
+     * @param phase Región
+     * @param start Tiempo de inicio (omp_get_wtime)
+     * @param end Tiempo de fin (omp_get_wtime)
+     * */
+    void region(TracePhase phase, double start, double end) {
+        if (current_ < 0) return;
+        records_[current_].region_start[phase] = start - origin_;
+        records_[current_].region_end[phase] = end - origin_;
+    }
+
+    /**
+     * @name thread_busy
+     * @brief Función que llama cada hilo de una región paralela con el inicio y el fin de su trabajo; cada hilo escribe sólo su lugar
+     * @param phase Región
+     * @param thread_id Número del hilo
+     * @param start Tiempo de inicio (omp_get_wtime)
+     * @param end Tiempo de fin (omp_get_wtime)
+     * */
+    void thread_busy(TracePhase phase, int thread_id, double start, double end) {
+        if (current_ < 0 || thread_id >= n_threads_) return;
+        records_[current_].busy_start[phase][thread_id] = start - origin_;
+        records_[current_].busy_end[phase][thread_id] = end - origin_;
+    }
+
+    /**
+     * @name add_changed
+     * @brief Función para sumar puntos que cambiaron de cluster en la iteración actual (se llama desde una sección crítica o fuera de las regiones paralelas)
+     * @param changed Puntos que cambiaron de cluster
+     * */
+    void add_changed(long long int changed) {
+        if (current_ >= 0) records_[current_].changed += changed;
+    }
+
+    /**
+     * @name add_distances
+     * @brief Función para sumar distancias punto-centroide calculadas en la iteración actual
+     * @param distances Distancias calculadas
+     * */
+    void add_distances(long long int distances) {
+        if (current_ >= 0) records_[current_].distances += distances;
+    }
+
+    /**
+     * @name end_pass
+     * @brief Función para marcar el fin de la asignación y la actualización de la iteración actual: se toman el tiempo y los contadores antes de calcular el desplazamiento y la inercia para que no cuenten
+     * */
+    void end_pass() {
+        if (current_ < 0) return;
+        IterationRecord& record = records_[current_];
+        record.end = now();
+        uint64_t counters[N_COUNTERS];
+        counters_.read(counters);
+        for (int c = 0; c < N_COUNTERS; c++) record.counters[c] = counters[c] - record.counters[c];
+    }
+
+    /**
+     * @name end_iteration
+     * @brief Función para terminar el registro de la iteración actual
+     * @param max_shift Desplazamiento máximo de un centroide
+     * @param inertia Suma de las distancias al cuadrado de cada punto a su centroide
+     * */
+    void end_iteration(double max_shift, double inertia) {
+        if (current_ < 0) return;
+        records_[current_].max_shift = max_shift;
+        records_[current_].inertia = inertia;
+        current_ = -1;
+    }
+
+    /**
+     * @name write
+     * @brief Función para escribir la traza en el formato de eventos de Chrome (prefix.json) y un renglón por iteración (prefix.csv)
+     * @param prefix Ruta de los archivos sin la extensión
+     * */
+    void write(const std::string& prefix) const {
+        write_chrome_trace(prefix + ".json");
+        write_csv(prefix + ".csv");
+    }
+
+private:
+    double now() const { return omp_get_wtime() - origin_; }
+
+    /**
+     * @name busy_summary
+     * @brief Función para obtener el tiempo ocupado promedio, el ocupado máximo y el ocioso promedio (el resto de la región) de los hilos en una región
+     * */
+    void busy_summary(const IterationRecord& record, int phase, double& busy_avg, double& busy_max, double& idle_avg) const {
+        busy_avg = busy_max = idle_avg = 0.0;
+        const size_t n = record.busy_start[phase].size();
+        double region = record.region_end[phase] - record.region_start[phase];
+        if (n == 0 || region <= 0.0) return;
+        for (size_t t = 0; t < n; t++) {
+            double busy = record.busy_end[phase][t] - record.busy_start[phase][t];
+            busy_avg += busy / n;
+            busy_max = std::max(busy_max, busy);
+            idle_avg += std::max(0.0, region - busy) / n;
+        }
+    }
+
+    void write_csv(const std::string& file_name) const {
+        std::ofstream out(file_name);
+        if (!out) throw std::runtime_error("Could not open " + file_name);
+        out.precision(9);
+        out << "repetition,iteration,wall_ms,changed,distances,max_shift,inertia";
+        for (int p = 0; p < N_TRACE_PHASES; p++) {
+            out << "," << TRACE_PHASE_NAMES[p] << "_busy_avg_ms," << TRACE_PHASE_NAMES[p] << "_busy_max_ms," << TRACE_PHASE_NAMES[p] << "_idle_avg_ms";
+        }
+        for (int c = 0; c < N_COUNTERS; c++) out << "," << COUNTER_NAMES[c];
+        out << "\n";
+        for (const IterationRecord& record : records_) {
+            out << record.repetition << "," << record.iteration << "," << (record.end - record.start) * 1e3 << "," << record.changed << ","
+                << record.distances << "," << record.max_shift << "," << record.inertia;
+            for (int p = 0; p < N_TRACE_PHASES; p++) {
+                double busy_avg, busy_max, idle_avg;
+                busy_summary(record, p, busy_avg, busy_max, idle_avg);
+                out << "," << busy_avg * 1e3 << "," << busy_max * 1e3 << "," << idle_avg * 1e3;
+            }
+            for (int c = 0; c < N_COUNTERS; c++) {
+                out << ",";
+                if (counters_.available()) out << record.counters[c];
+            }
+            out << "\n";
+        }
+    }
+
+    void write_chrome_trace(const std::string& file_name) const {
+        std::ofstream out(file_name);
+        if (!out) throw std::runtime_error("Could not open " + file_name);
+        out.precision(12);
+        out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+        out << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": {\"name\": \"iterations\"}}";
+        for (int t = 0; t < n_threads_; t++) {
+            out << ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << t + 1 << ", \"args\": {\"name\": \"OpenMP thread " << t << "\"}}";
+        }
+        for (const IterationRecord& record : records_) {
+            // La iteración completa con sus datos
+            out << ",\n{\"name\": \"repetition " << record.repetition << " iteration " << record.iteration << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": 0, \"ts\": "
+                << record.start * 1e6 << ", \"dur\": " << (record.end - record.start) * 1e6 << ", \"args\": {\"changed\": " << record.changed
+                << ", \"distances\": " << record.distances << ", \"max_shift\": " << record.max_shift << ", \"inertia\": " << record.inertia;
+            if (counters_.available()) {
+                for (int c = 0; c < N_COUNTERS; c++) out << ", \"" << COUNTER_NAMES[c] << "\": " << record.counters[c];
+            }
+            out << "}}";
+            // El trabajo de cada hilo en cada región
+            for (int p = 0; p < N_TRACE_PHASES; p++) {
+                for (size_t t = 0; t < record.busy_start[p].size(); t++) {
+                    if (record.busy_end[p][t] <= record.busy_start[p][t]) continue;
+                    out << ",\n{\"name\": \"" << TRACE_PHASE_NAMES[p] << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << t + 1 << ", \"ts\": " << record.busy_start[p][t] * 1e6
+                        << ", \"dur\": " << (record.busy_end[p][t] - record.busy_start[p][t]) * 1e6 << "}";
+                }
+            }
+            // Series de tiempo
+            out << ",\n{\"name\": \"changed\", \"ph\": \"C\", \"pid\": 1, \"ts\": " << record.end * 1e6 << ", \"args\": {\"changed\": " << record.changed << "}}";
+            out << ",\n{\"name\": \"inertia\", \"ph\": \"C\", \"pid\": 1, \"ts\": " << record.end * 1e6 << ", \"args\": {\"inertia\": " << record.inertia << "}}";
+            out << ",\n{\"name\": \"max_shift\", \"ph\": \"C\", \"pid\": 1, \"ts\": " << record.end * 1e6 << ", \"args\": {\"max_shift\": " << record.max_shift << "}}";
+            if (counters_.available()) {
+                double ipc = record.counters[COUNTER_CYCLES] > 0 ? (double) record.counters[COUNTER_INSTRUCTIONS] / record.counters[COUNTER_CYCLES] : 0.0;
+                out << ",\n{\"name\": \"ipc\", \"ph\": \"C\", \"pid\": 1, \"ts\": " << record.end * 1e6 << ", \"args\": {\"ipc\": " << ipc << "}}";
+                out << ",\n{\"name\": \"cache misses\", \"ph\": \"C\", \"pid\": 1, \"ts\": " << record.end * 1e6 << ", \"args\": {\"cache_misses\": "
+                    << record.counters[COUNTER_CACHE_MISSES] << ", \"llc_misses\": " << record.counters[COUNTER_LLC_MISSES] << "}}";
+            }
+        }
+        out << "\n]}\n";
+    }
+
+    double origin_;                        // omp_get_wtime al crear la traza
+    bool enabled_;
+    bool counters_requested_;
+    ThreadCounters counters_;
+    int repetition_;
+    int n_threads_;
+    long long int current_;                // Registro de la iteración actual, o -1 entre iteraciones
+    std::vector<IterationRecord> records_;
+};
+
+/**
+ * @name iteration_trace
+ * @brief Función para obtener la traza del programa (una sola por proceso)
+ * @return Traza
+ * */
+inline IterationTrace& iteration_trace() {
+    static IterationTrace trace;
+    return trace;
+}
+
+#else
+
+// Sin -DKMEANS_TRACE la instrumentación no se compila
+#define KMEANS_TRACE_ONLY(...)
+
+#endif
+
+#endif
@@ -0,0 +1,412 @@
+/**
+ * @file k_selection.hpp
+ * @date 2023-03-08
+ * @author Diego Hernández Delgado
+ * @author Jesús Isaías García Moreno
+ * @brief Selección del número de clusters en un solo proceso (parallel_kmeans ksweep): cada K empieza de la solución de K - 1 dividiendo en dos el cluster de mayor suma de distancias al cuadrado (SSE). Una pasada final asigna los puntos a los centroides finales y calcula la inercia, la SSE de cada cluster y su punto más lejano mientras los hilos que terminan calculan la silueta de una muestra fija, cuyas distancias entre pares se calculan una sola vez para todos los K. Al terminar se escribe la tabla del codo
+ * */
+
+#ifndef K_SELECTION_HPP
+#define K_SELECTION_HPP
+
+#include <omp.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "dataset.hpp"
+#include "distance_kernels.hpp"
+#include "seeding.hpp"
+#include "triangle_bounds.hpp"
+
+// Texto de ayuda de la selección de K
+const char KSWEEP_USAGE[] = "Usage: ./parallel_kmeans ksweep <num_points | input_file> <max_iterations> <num_threads> [k=min-max] [sample=points] [algorithm=lloyd|hamerly|elkan|yinyang|kdtree] [memory=MiB] [init=random|kmeans++|kmeans||] [seed=n] [compare=on|off]";
+
+// Flujo aleatorio de la muestra de la silueta (los de la elección de los centroides iniciales son SEED_STREAM_*)
+const uint64_t SEED_STREAM_SILHOUETTE = 5;
+// Máximo de puntos de la muestra de la silueta (su matriz de distancias ocupa sample x sample floats)
+const long long int MAX_SILHOUETTE_SAMPLE = 8192;
+// Iteraciones de 2-means sobre los puntos del cluster que se divide
+const int SPLIT_ITERATIONS = 10;
+
+/**
+ * @name KSweepOptions
+ * @brief Opciones de la selección de K con sus valores por defecto
+ * */
+struct KSweepOptions {
+    int k_min = 2;                                       // Primer número de clusters
+    int k_max = 13;                                      // Último número de clusters
+    long long int sample_size = 2000;                    // Puntos de la muestra de la silueta
+    AssignmentAlgorithm algorithm = ASSIGN_LLOYD;        // Algoritmo de asignación
+    long long int bounds_memory = DEFAULT_BOUNDS_MEMORY; // Bytes disponibles para las cotas inferiores de Yinyang
+    InitMethod init = INIT_KMEANS_PLUS_PLUS;             // Forma de elegir los centroides iniciales del primer K (y de cada K con compare=on)
+    uint64_t seed = 42;                                  // Semilla de los centroides iniciales y de la muestra
+    bool compare = false;                                // Si también se ejecuta cada K por separado desde centroides elegidos para medir el ahorro
+};
+
+/**
+ * @name parse_ksweep_options
+ * @brief Función para leer las opciones nombre=valor de la selección de K
+ * @param argc Cantidad de argumentos de entrada
+ * @param argv Argumentos de entrada
+ * @param first Índice del primer argumento opcional
+ * @return Opciones de la selección de K
+ * */
+inline KSweepOptions parse_ksweep_options(int argc, char** argv, int first) {
+    KSweepOptions options;
+    for (int i = first; i < argc; i++) {
+        std::string argument = argv[i];
+        size_t separator = argument.find('=');
+        if (separator == std::string::npos)
+            throw std::invalid_argument("Invalid option (expected name=value): " + argument);
+        std::string name = argument.substr(0, separator);
+        std::string value = argument.substr(separator + 1);
+        size_t parsed = 0;
+        if (name == "k") {
+            size_t dash = value.find('-');
+            try {
+                options.k_min = std::stoi(value.substr(0, dash), &parsed);
+                if (parsed != (dash == std::string::npos ? value.size() : dash)) throw std::invalid_argument(value);
+                options.k_max = dash == std::string::npos ? options.k_min : std::stoi(value.substr(dash + 1), &parsed);
+                if (dash != std::string::npos && parsed != value.size() - dash - 1) throw std::invalid_argument(value);
+            } catch (const std::exception&) {
+                throw std::invalid_argument("Invalid k range (expected min-max): " + value);
+            }
+            if (options.k_min < 1 || options.k_max < options.k_min)
+                throw std::invalid_argument("Invalid k range (expected min-max): " + value);
+        } else if (name == "sample") {
+            options.sample_size = std::stoll(value, &parsed);
+            if (parsed != value.size() || options.sample_size < 2 || options.sample_size > MAX_SILHOUETTE_SAMPLE)
+                throw std::invalid_argument("Invalid silhouette sample (2 to " + std::to_string(MAX_SILHOUETTE_SAMPLE) + " points): " + value);
+        } else if (name == "algorithm") {
+            options.algorithm = parse_assignment_algorithm(value);
+        } else if (name == "memory") {
+            long long int megabytes = std::stoll(value, &parsed);
+            if (parsed != value.size() || megabytes < 1)
+                throw std::invalid_argument("Invalid memory budget in MiB: " + value);
+            options.bounds_memory = megabytes << 20;
+        } else if (name == "init") {
+            options.init = parse_init_method(value);
+        } else if (name == "seed") {
+            options.seed = std::stoull(value, &parsed);
+            if (parsed != value.size())
+                throw std::invalid_argument("Invalid seed: " + value);
+        } else if (name == "compare") {
+            if (value != "on" && value != "off")
+                throw std::invalid_argument("Invalid compare (expected on or off): " + value);
+            options.compare = value == "on";
+        } else {
+            throw std::invalid_argument("Unknown option: " + name);
+        }
+    }
+    return options;
+}
+
+/**
+ * @name SilhouetteSample
+ * @brief Muestra fija de puntos para la silueta con la distancia entre cada par, que no depende de K
+ * */
+struct SilhouetteSample {
+    Dataset points;                 // Puntos de la muestra por columnas (con su cluster en cada K)
+    std::vector<float> distances;   // Distancia euclidiana entre cada par, renglón i con las distancias del punto i
+};
+
+/**
+ * @name make_silhouette_sample
+ * @brief Función para elegir sin repetición los puntos de la muestra (algoritmo de Floyd con un flujo aleatorio propio) y calcular en paralelo sus distancias entre pares
+ * @param points Conjunto de puntos por columnas
+ * @param sample_size Puntos de la muestra (todos si el conjunto tiene menos)
+ * @param seed Semilla de la muestra
+ * @param num_threads Número de hilos de OpenMP
+ * @return Muestra con su matriz de distancias
+ * */
+inline SilhouetteSample make_silhouette_sample(const Dataset& points, long long int sample_size, uint64_t seed, int num_threads) {
+    const long long int num_points = points.size();
+    const int dimension = points.dimension();
+    sample_size = std::min(sample_size, num_points);
+    std::vector<long long int> rows;
+    if (sample_size == num_points) {
+        for (long long int i = 0; i < num_points; i++) rows.push_back(i);
+    } else {
+        RandomStream random(seed, SEED_STREAM_SILHOUETTE);
+        std::unordered_set<long long int> chosen;
+        for (long long int j = num_points - sample_size; j < num_points; j++) {
+            long long int t = random.below(j + 1);
+            chosen.insert(chosen.count(t) ? j : t);
+        }
+        rows.assign(chosen.begin(), chosen.end());
+        std::sort(rows.begin(), rows.end());
+    }
+
+    SilhouetteSample sample;
+    sample.points = Dataset(sample_size, dimension);
+    for (long long int i = 0; i < sample_size; i++) {
+        for (int d = 0; d < dimension; d++) sample.points.at(i, d) = points.at(rows[i], d);
+    }
+    sample.distances.resize(sample_size * sample_size);
+    const Dataset& sample_points = sample.points;
+    float* distances = sample.distances.data();
+    #pragma omp parallel for num_threads(num_threads) schedule(dynamic, 16)
+    for (long long int i = 0; i < sample_size; i++) {
+        for (long long int j = 0; j < sample_size; j++) {
+            float squared = 0.0f;
+            for (int d = 0; d < dimension; d++) {
+                float diff = sample_points.at(i, d) - sample_points.at(j, d);
+                squared += diff * diff;
+            }
+            distances[i * sample_size + j] = std::sqrt(squared);
+        }
+    }
+    return sample;
+}
+
+/**
+ * @name ClusterEvaluation
+ * @brief Resultado de la pasada final de un K
+ * */
+struct ClusterEvaluation {
+    double inertia = 0.0;                   // Suma de distancias al cuadrado de cada punto a su centroide más cercano
+    double silhouette = 0.0;                // Silueta promedio de la muestra
+    std::vector<double> sse;                // Suma de distancias al cuadrado de cada cluster
+    std::vector<long long int> sizes;       // Puntos de cada cluster
+    std::vector<float> farthest_distance;   // Distancia al cuadrado del punto más lejano de cada cluster
+    std::vector<long long int> farthest_point; // Índice del punto más lejano de cada cluster (-1 si está vacío)
+};
+
+/**
+ * @name evaluate_clusters
+ * @brief Función para la pasada final de un K: asigna cada punto a su centroide más cercano con el kernel vectorizado y acumula por hilo la SSE, los puntos y el punto más lejano de cada cluster. La pasada se reparte sin barrera al final (nowait), así que los hilos que terminan su parte empiezan la silueta de la muestra: para cada punto, a es su distancia promedio a los demás puntos de su cluster en la muestra, b la menor distancia promedio a otro cluster y su silueta (b - a) / max(a, b) (0 si es el único punto de su cluster)
+ * @param points Conjunto de puntos por columnas; al terminar contiene el cluster de cada punto con los centroides finales
+ * @param centroids Conjunto de centroides finales
+ * @param sample Muestra de la silueta con sus distancias
+ * @param num_threads Número de hilos de OpenMP
+ * @return Inercia, silueta y SSE de cada cluster
+ * */
+inline ClusterEvaluation evaluate_clusters(Dataset& points, const Dataset& centroids, SilhouetteSample& sample, int num_threads) {
+    const int n_clusters = centroids.size();
+    const long long int num_points = points.size();
+    const long long int sample_size = sample.points.size();
+    const NearestCentroidsKernel nearest_centroids = select_nearest_centroids_kernel(points.dimension());
+    ClusterEvaluation evaluation;
+    evaluation.sse.assign(n_clusters, 0.0);
+    evaluation.sizes.assign(n_clusters, 0);
+    evaluation.farthest_distance.assign(n_clusters, -1.0f);
+    evaluation.farthest_point.assign(n_clusters, -1);
+
+    // Clusters de la muestra con los mismos centroides (son los que les da la pasada completa)
+    int32_t* sample_labels = sample.points.labels();
+    for (long long int begin = 0; begin < sample_size; begin += KERNEL_BLOCK_SIZE) {
+        nearest_centroids(sample.points, begin, std::min(begin + KERNEL_BLOCK_SIZE, sample_size), centroids, sample_labels + begin, nullptr);
+    }
+    std::vector<long long int> sample_sizes(n_clusters, 0);
+    for (long long int i = 0; i < sample_size; i++) sample_sizes[sample_labels[i]]++;
+
+    int32_t* labels = points.labels();
+    const float* distances = sample.distances.data();
+    double silhouette_sum = 0.0;
+    #pragma omp parallel num_threads(num_threads)
+    {
+        std::vector<double> sse(n_clusters, 0.0);
+        std::vector<long long int> sizes(n_clusters, 0);
+        std::vector<float> farthest_distance(n_clusters, -1.0f);
+        std::vector<long long int> farthest_point(n_clusters, -1);
+        float min_distances[KERNEL_BLOCK_SIZE];
+        #pragma omp for schedule(static) nowait
+        for (long long int begin = 0; begin < num_points; begin += KERNEL_BLOCK_SIZE) {
+            const long long int end = std::min(begin + KERNEL_BLOCK_SIZE, num_points);
+            nearest_centroids(points, begin, end, centroids, labels + begin, min_distances);
+            for (long long int i = begin; i < end; i++) {
+                const int32_t k = labels[i];
+                const float distance = min_distances[i - begin];
+                sse[k] += distance;
+                sizes[k]++;
+                if (distance > farthest_distance[k]) {
+                    farthest_distance[k] = distance;
+                    farthest_point[k] = i;
+                }
+            }
+        }
+
+        std::vector<double> cluster_sums(n_clusters);
+        #pragma omp for schedule(dynamic, 16) reduction(+:silhouette_sum)
+        for (long long int i = 0; i < sample_size; i++) {
+            std::fill(cluster_sums.begin(), cluster_sums.end(), 0.0);
+            const float* row = distances + i * sample_size;
+            for (long long int j = 0; j < sample_size; j++) cluster_sums[sample_labels[j]] += row[j];
+            const int32_t own = sample_labels[i];
+            if (sample_sizes[own] <= 1) continue;
+            const double a = cluster_sums[own] / (sample_sizes[own] - 1);
+            double b = std::numeric_limits<double>::infinity();
+            for (int k = 0; k < n_clusters; k++) {
+                if (k != own && sample_sizes[k] > 0) b = std::min(b, cluster_sums[k] / sample_sizes[k]);
+            }
+            if (std::isinf(b) || std::max(a, b) <= 0.0) continue;
+            silhouette_sum += (b - a) / std::max(a, b);
+        }
+
+        #pragma omp critical(evaluate_clusters)
+        {
+            for (int k = 0; k < n_clusters; k++) {
+                evaluation.sse[k] += sse[k];
+                evaluation.sizes[k] += sizes[k];
+                if (farthest_distance[k] > evaluation.farthest_distance[k] ||
+                    (farthest_distance[k] == evaluation.farthest_distance[k] && farthest_point[k] >= 0 && farthest_point[k] < evaluation.farthest_point[k])) {
+                    evaluation.farthest_distance[k] = farthest_distance[k];
+                    evaluation.farthest_point[k] = farthest_point[k];
+                }
+            }
+        }
+    }
+    for (int k = 0; k < n_clusters; k++) evaluation.inertia += evaluation.sse[k];
+    evaluation.silhouette = silhouette_sum / sample_size;
+    return evaluation;
+}
+
+/**
+ * @name split_highest_sse
+ * @brief Función para obtener los K + 1 centroides iniciales del siguiente K dividiendo en dos el cluster de mayor SSE. Los dos centroides empiezan en c - (p - c) / 2 y c + (p - c) / 2, donde c es el centroide del cluster y p su punto más lejano, y se ajustan con unas cuantas iteraciones de 2-means sólo sobre los puntos del cluster (con los clusters de la pasada final); los demás centroides no cambian
+ * @param points Conjunto de puntos por columnas con el cluster de cada punto de la pasada final
+ * @param centroids Conjunto de K centroides finales
+ * @param evaluation Pasada final de los K centroides
+ * @param split Conjunto de K + 1 centroides donde se escriben los nuevos centroides
+ * @param num_threads Número de hilos de OpenMP
+ * @return Cluster que se dividió
+ * */
+inline int split_highest_sse(const Dataset& points, const Dataset& centroids, const ClusterEvaluation& evaluation, Dataset& split, int num_threads) {
+    const int n_clusters = centroids.size();
+    const int dimension = centroids.dimension();
+    const long long int num_points = points.size();
+    const int worst = (int) (std::max_element(evaluation.sse.begin(), evaluation.sse.end()) - evaluation.sse.begin());
+    const long long int farthest = evaluation.farthest_point[worst];
+    std::vector<double> halves(2 * dimension);   // Centroides de las dos mitades, d por d
+    for (int d = 0; d < dimension; d++) {
+        for (int k = 0; k < n_clusters; k++) split.at(k, d) = centroids.at(k, d);
+        const double center = centroids.at(worst, d);
+        const double half = farthest >= 0 ? (points.at(farthest, d) - center) / 2.0 : 0.0;
+        halves[d] = center - half;
+        halves[dimension + d] = center + half;
+    }
+
+    // Puntos del cluster que se divide (con los clusters de la pasada final)
+    const int32_t* labels = points.labels();
+    std::vector<long long int> members;
+    members.reserve(farthest >= 0 ? evaluation.sizes[worst] : 0);
+    for (long long int i = 0; i < num_points && farthest >= 0; i++) {
+        if (labels[i] == worst) members.push_back(i);
+    }
+    const long long int num_members = members.size();
+    const long long int* members_data = members.data();
+    std::vector<double> sums(2 * (dimension + 1));
+    double* sums_data = sums.data();
+    const double* halves_data = halves.data();
+    long long int previous_first = -1;   // Puntos de la primera mitad en la iteración anterior
+    for (int iteration = 0; iteration < SPLIT_ITERATIONS && num_members > 1; iteration++) {
+        std::fill(sums.begin(), sums.end(), 0.0);
+        #pragma omp parallel for num_threads(num_threads) schedule(static) reduction(+:sums_data[:2 * (dimension + 1)])
+        for (long long int m = 0; m < num_members; m++) {
+            const long long int i = members_data[m];
+            double first = 0.0, second = 0.0;
+            for (int d = 0; d < dimension; d++) {
+                const double x = points.at(i, d);
+                first += (x - halves_data[d]) * (x - halves_data[d]);
+                second += (x - halves_data[dimension + d]) * (x - halves_data[dimension + d]);
+            }
+            double* slot = sums_data + (second < first ? dimension + 1 : 0);
+            for (int d = 0; d < dimension; d++) slot[d] += points.at(i, d);
+            slot[dimension] += 1.0;
+        }
+        if (sums[dimension] == 0.0 || sums[2 * dimension + 1] == 0.0) break;
+        for (int half = 0; half < 2; half++) {
+            for (int d = 0; d < dimension; d++) halves[half * dimension + d] = sums[half * (dimension + 1) + d] / sums[half * (dimension + 1) + dimension];
+        }
+        // Si ningún punto cambió de mitad, las dos mitades ya no se mueven
+        if ((long long int) sums[dimension] == previous_first) break;
+        previous_first = (long long int) sums[dimension];
+    }
+    for (int d = 0; d < dimension; d++) {
+        split.at(worst, d) = halves[d];
+        split.at(n_clusters, d) = halves[dimension + d];
+    }
+    return worst;
+}
+
+/**
+ * @name KSweepResult
+ * @brief Resultado de un K
+ * */
+struct KSweepResult {
+    int k;                              // Número de clusters
+    int split;                          // Cluster de K - 1 que se dividió (-1 en el primer K)
+    long long int iterations;           // Iteraciones después de la primera asignación
+    double seconds;                     // Segundos de kmeans y de la pasada final
+    double inertia;                     // Inercia con los centroides finales
+    double silhouette;                  // Silueta promedio de la muestra
+    long long int independent_iterations; // Iteraciones ejecutando el K por separado (compare=on; -1 sin comparación)
+    double independent_seconds;         // Segundos ejecutando el K por separado, con su pasada final
+    double independent_inertia;         // Inercia ejecutando el K por separado
+};
+
+/**
+ * @name elbow_index
+ * @brief Función para elegir el codo de la curva de inercia: con K e inercia normalizados entre 0 y 1, el K más alejado por debajo de la recta entre el primer y el último K
+ * @param results Resultado de cada K en orden creciente
+ * @return Índice del K del codo
+ * */
+inline size_t elbow_index(const std::vector<KSweepResult>& results) {
+    if (results.size() < 3) return 0;
+    const double k_first = results.front().k, k_last = results.back().k;
+    const double first = results.front().inertia, last = results.back().inertia;
+    size_t elbow = 0;
+    double best = -std::numeric_limits<double>::infinity();
+    for (size_t i = 0; i < results.size(); i++) {
+        const double x = (results[i].k - k_first) / (k_last - k_first);
+        const double y = first != last ? (results[i].inertia - last) / (first - last) : 0.0;
+        const double below = (1.0 - x) - y;
+        if (below > best) {
+            best = below;
+            elbow = i;
+        }
+    }
+    return elbow;
+}
+
+/**
+ * @name write_ksweep_table
+ * @brief Función para guardar la tabla del codo en CSV e imprimirla, marcando el K del codo y el de mayor silueta
+ * @param file_name Nombre del archivo CSV
+ * @param results Resultado de cada K en orden creciente
+ * @param compare Si se incluyen las columnas de cada K por separado
+ * */
+inline void write_ksweep_table(const std::string& file_name, const std::vector<KSweepResult>& results, bool compare) {
+    const size_t elbow = elbow_index(results);
+    size_t best_silhouette = 0;
+    for (size_t i = 1; i < results.size(); i++) {
+        if (results[i].silhouette > results[best_silhouette].silhouette) best_silhouette = i;
+    }
+    std::ofstream out(file_name);
+    if (!out) throw std::runtime_error("Could not open " + file_name);
+    out.precision(12);
+    out << "k,split,iterations,seconds,inertia,inertia_drop,silhouette,elbow,best_silhouette" << (compare ? ",independent_iterations,independent_seconds,independent_inertia" : "") << "\n";
+    std::cout << "K   iterations   seconds   inertia   drop   silhouette" << (compare ? "   separately: iterations   seconds   inertia" : "") << "\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const KSweepResult& result = results[i];
+        const double drop = i > 0 ? 100.0 * (results[i - 1].inertia - result.inertia) / results[i - 1].inertia : 0.0;
+        out << result.k << "," << result.split << "," << result.iterations << "," << result.seconds << "," << result.inertia << "," << drop << ","
+            << result.silhouette << "," << (i == elbow ? 1 : 0) << "," << (i == best_silhouette ? 1 : 0);
+        std::cout << result.k << "   " << result.iterations << "   " << result.seconds << "   " << result.inertia << "   " << drop << "%   " << result.silhouette;
+        if (compare) {
+            out << "," << result.independent_iterations << "," << result.independent_seconds << "," << result.independent_inertia;
+            std::cout << "   " << result.independent_iterations << "   " << result.independent_seconds << "   " << result.independent_inertia;
+        }
+        out << "\n";
+        std::cout << (i == elbow ? "   elbow" : "") << (i == best_silhouette ? "   best silhouette" : "") << "\n";
+    }
+}
+
+#endif
@@ -0,0 +1,498 @@
+/**
+ * @file kd_tree.hpp
+ * @date 2023-03-08
+ * @author Diego Hernández Delgado
+ * @author Jesús Isaías García Moreno
+ * @brief Asignación de los puntos con el algoritmo de filtrado de Kanungo et al. sobre un árbol kd. El árbol se construye una sola vez en paralelo y guarda en cada nodo la caja que encierra sus puntos y la suma de sus coordenadas; en cada pasada se recorre con un conjunto de centroides candidatos, se descartan los que no pueden ser los más cercanos a ningún punto de la caja y, cuando queda uno solo, todo el subárbol se asigna a él y se suma con la suma precalculada del nodo en lugar de visitar cada punto. Las etiquetas son las de la asignación completa (Lloyd) con los mismos centroides
+ * */
+
+#ifndef KD_TREE_HPP
+#define KD_TREE_HPP
+
+#include <omp.h>
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <vector>
+#include "centroid_accumulator.hpp"
+#include "dataset.hpp"
+#include "distance_kernels.hpp"
+#include "iteration_trace.hpp"
+
+// Máximo de puntos de una hoja del árbol
+const int KD_TREE_LEAF_SIZE = 32;
+// Los subárboles con más puntos que éste se construyen como tareas de OpenMP separadas
+const long long int KD_TREE_TASK_SIZE = 1LL << 15;
+// Subárboles (con su lista de candidatos) que se reparten a cada hilo en cada pasada
+const int KD_TREE_ITEMS_PER_THREAD = 16;
+
+/**
+ * @name KdNode
+ * @brief Nodo del árbol kd: el rango de puntos [begin, end) en el orden del árbol, sus hijos y el cluster de todos sus puntos en la última pasada
+ * */
+struct KdNode {
+    long long int begin;  // Posición del primer punto del nodo en el orden del árbol
+    long long int end;    // Posición siguiente al último punto del nodo
+    int left;             // Hijo izquierdo, o -1 si es una hoja
+    int right;            // Hijo derecho, o -1 si es una hoja
+    int32_t owner;        // Cluster de todos los puntos del nodo, o -1 si están en varios o no se sabe
+};
+
+/**
+ * @name KdTree
+ * @brief Árbol kd sobre un conjunto de puntos para la asignación por filtrado. Se construye una sola vez y se reutiliza en todas las repeticiones; al empezar cada repetición se llama a reset y en cada pasada a assign, que deja en el acumulador las sumas y cantidades de cada cluster (no hace falta recorrer los puntos otra vez para actualizar los centroides).
+ *
+ * Los puntos se copian en el orden del árbol para que cada hoja sea contigua. Un candidato z sólo se descarta frente al candidato z* más cercano al centro de la caja cuando el vértice de la caja más favorable a z sigue más cerca de z*, con el margen del error de redondeo de las distancias en float, por lo que el centroide descartado nunca puede ganar (ni empatar) en la asignación completa. En las hojas con varios candidatos las distancias se calculan con squared_distance en orden de índice, igual que el kernel escalar
+ * */
+class KdTree {
+public:
+    /**
+     * @name KdTree
+     * @brief Constructor que construye el árbol en paralelo (los subárboles grandes son tareas de OpenMP) y calcula la caja y la suma de las coordenadas de cada nodo
+     * @param points Conjunto de puntos por columnas
+     * @param num_threads Número de hilos para construir el árbol
+     * */
+    KdTree(const Dataset& points, int num_threads)
+        : num_points_(points.size()), dimension_(points.dimension()),
+          // Error relativo máximo de una distancia al cuadrado en float, con holgura (el mismo de TriangleBounds)
+          rounding_((points.dimension() + 4) * (double) FLT_EPSILON),
+          order_(points.size()), depth_(0), computed_(0), total_(0) {
+        std::iota(order_.begin(), order_.end(), 0LL);
+        // Con hojas de entre KD_TREE_LEAF_SIZE / 2 y KD_TREE_LEAF_SIZE puntos hay a lo más 2 N / KD_TREE_LEAF_SIZE + 1 hojas
+        long long int max_nodes = 2 * (2 * num_points_ / KD_TREE_LEAF_SIZE + 1);
+        nodes_.resize(max_nodes);
+        box_min_.resize(max_nodes * dimension_);
+        box_max_.resize(max_nodes * dimension_);
+        sums_.resize(max_nodes * dimension_);
+        std::atomic<int> next_node(1);
+
+        #pragma omp parallel num_threads(num_threads)
+        #pragma omp single
+        build(points, 0, 0, num_points_, next_node);
+
+        nodes_.resize(next_node.load());
+        nodes_.shrink_to_fit();
+        depth_ = subtree_depth(0);
+
+        // Copia de los puntos en el orden del árbol
+        sorted_ = Dataset(num_points_, dimension_, false);
+        #pragma omp parallel for num_threads(num_threads) schedule(static)
+        for (long long int i = 0; i < num_points_; i++) {
+            for (int d = 0; d < dimension_; d++) {
+                sorted_.at(i, d) = points.at(order_[i], d);
+            }
+        }
+        tree_labels_.assign(num_points_, -1);
+    }
+
+    KdTree(const KdTree&) = delete;
+    KdTree& operator=(const KdTree&) = delete;
+
+    // Número de nodos del árbol
+    long long int nodes() const { return nodes_.size(); }
+    // Profundidad máxima del árbol
+    int depth() const { return depth_; }
+    // Distancias punto-centroide que se calcularon en las hojas en todas las pasadas
+    long long int computed_distances() const { return computed_; }
+    // Distancias punto-centroide que habría calculado la asignación completa en todas las pasadas
+    long long int total_distances() const { return total_; }
+
+    /**
+     * @name reset
+     * @brief Función para empezar una nueva ejecución de k-means: toma el cluster actual de cada punto y olvida el dueño de cada nodo
+     * @param points Conjunto de puntos por columnas con el cluster de cada punto (el mismo con el que se construyó el árbol)
+     * */
+    void reset(const Dataset& points) {
+        const int32_t* labels = points.labels();
+        for (long long int i = 0; i < num_points_; i++) {
+            tree_labels_[i] = labels[order_[i]];
+        }
+        for (KdNode& node : nodes_) {
+            node.owner = -1;
+        }
+    }
+
+    /**
+     * @name assign
+     * @brief Función para asignar cada punto a su centroide más cercano recorriendo el árbol con los hilos del acumulador. Los primeros niveles se filtran en un solo hilo hasta tener KD_TREE_ITEMS_PER_THREAD subárboles por hilo, que se reparten en orden fijo para que las sumas no dependan de la ejecución
+     * @param centroids Conjunto de centroides por columnas
+     * @param points Conjunto de puntos por columnas (el mismo con el que se construyó el árbol); se actualiza el cluster de cada punto que cambia
+     * @param accumulator Buffers de acumulación por hilo; al terminar, el bloque del hilo 0 tiene la suma de las coordenadas y la cantidad de puntos de cada cluster
+     * @return Cantidad de puntos que cambiaron de cluster
+     * */
+    long long int assign(const Dataset& centroids, Dataset& points, CentroidAccumulator* accumulator) {
+        const int n_clusters = centroids.size();
+        const int fields = accumulator->fields;
+        const long long int stride = accumulator->stride;
+        const long long int block = (long long int) n_clusters * fields;
+        int32_t* labels = points.labels();
+
+        // Filtrado serial de los primeros niveles
+        items_.clear();
+        item_candidates_.clear();
+        serial_nodes_.clear();
+        std::vector<int> all(n_clusters);
+        std::iota(all.begin(), all.end(), 0);
+        long long int item_size = std::max<long long int>(KD_TREE_LEAF_SIZE, num_points_ / ((long long int) KD_TREE_ITEMS_PER_THREAD * accumulator->n_threads));
+        std::vector<int> scratch((long long int) (depth_ + 1) * n_clusters);
+        collect(0, all.data(), n_clusters, item_size, centroids, scratch.data());
+
+        long long int changed = 0;
+        long long int computed = 0;
+        const int n_items = items_.size();
+        KMEANS_TRACE_ONLY(double region_start = omp_get_wtime();)
+        #pragma omp parallel num_threads(accumulator->n_threads) reduction(+:changed, computed)
+        {
+            int thread_id = omp_get_thread_num();
+            int n_threads = omp_get_num_threads();
+            double* local = accumulator->buffer + thread_id * stride;
+            KMEANS_TRACE_ONLY(double busy_start = omp_get_wtime();
+                              double busy_end = busy_start;)
+            for (long long int f = 0; f < block; f++) {
+                local[f] = 0.0;
+            }
+            // Candidatos de cada nivel de la recursión del hilo
+            std::vector<int> candidates((long long int) (depth_ + 1) * n_clusters);
+            Pass pass = {centroids, labels, local, fields, candidates.data(), 0, 0};
+
+            #pragma omp for schedule(static, 1)
+            for (int item = 0; item < n_items; item++) {
+                const WorkItem& work = items_[item];
+                filter(work.node, item_candidates_.data() + work.first_candidate, work.count, 0, pass);
+                KMEANS_TRACE_ONLY(busy_end = omp_get_wtime();)
+            }
+            changed += pass.changed;
+            computed += pass.computed;
+            KMEANS_TRACE_ONLY(iteration_trace().thread_busy(TRACE_ASSIGN, thread_id, busy_start, busy_end);)
+
+            merge_thread_blocks(accumulator, thread_id, n_threads);
+        }
+        KMEANS_TRACE_ONLY(iteration_trace().region(TRACE_ASSIGN, region_start, omp_get_wtime());)
+
+        // Los dueños de los nodos filtrados en serie se obtienen de sus hijos, de abajo hacia arriba
+        for (int n = (int) serial_nodes_.size() - 1; n >= 0; n--) {
+            KdNode& node = nodes_[serial_nodes_[n]];
+            node.owner = nodes_[node.left].owner == nodes_[node.right].owner ? nodes_[node.left].owner : -1;
+        }
+        computed_ += computed;
+        total_ += num_points_ * n_clusters;
+        return changed;
+    }
+
+private:
+    /**
+     * @name WorkItem
+     * @brief Subárbol que se filtra en paralelo con su lista de candidatos (guardada en item_candidates_)
+     * */
+    struct WorkItem {
+        int node;
+        long long int first_candidate;
+        int count;
+    };
+
+    /**
+     * @name Pass
+     * @brief Estado de un hilo durante una pasada de assign
+     * */
+    struct Pass {
+        const Dataset& centroids;
+        int32_t* labels;       // Cluster de cada punto en el orden original
+        double* local;         // Bloque del acumulador del hilo
+        int fields;            // Campos por cluster del acumulador
+        int* candidates;       // (depth_ + 1) listas de candidatos, una por nivel
+        long long int changed; // Puntos que cambiaron de cluster
+        long long int computed;// Distancias punto-centroide calculadas
+    };
+
+    /**
+     * @name build
+     * @brief Función recursiva que calcula la caja de un nodo y, si tiene más de KD_TREE_LEAF_SIZE puntos, lo divide por la mediana de la coordenada más extendida. La suma de las coordenadas se calcula de abajo hacia arriba
+     * @param points Conjunto de puntos por columnas
+     * @param index Índice del nodo
+     * @param begin Posición del primer punto del nodo en order_
+     * @param end Posición siguiente al último punto del nodo
+     * @param next_node Siguiente índice de nodo libre
+     * */
+    void build(const Dataset& points, int index, long long int begin, long long int end, std::atomic<int>& next_node) {
+        KdNode& node = nodes_[index];
+        node.begin = begin;
+        node.end = end;
+        node.left = -1;
+        node.right = -1;
+        node.owner = -1;
+        float* low = box_min_.data() + (long long int) index * dimension_;
+        float* high = box_max_.data() + (long long int) index * dimension_;
+        double* sum = sums_.data() + (long long int) index * dimension_;
+        for (int d = 0; d < dimension_; d++) {
+            low[d] = std::numeric_limits<float>::infinity();
+            high[d] = -std::numeric_limits<float>::infinity();
+        }
+        for (long long int i = begin; i < end; i++) {
+            for (int d = 0; d < dimension_; d++) {
+                float value = points.at(order_[i], d);
+                low[d] = std::min(low[d], value);
+                high[d] = std::max(high[d], value);
+            }
+        }
+
+        int split = 0;
+        for (int d = 1; d < dimension_; d++) {
+            if (high[d] - low[d] > high[split] - low[split]) split = d;
+        }
+        // Las hojas (y los nodos cuyos puntos son todos iguales) suman sus puntos directamente
+        if (end - begin <= KD_TREE_LEAF_SIZE || high[split] == low[split]) {
+            for (int d = 0; d < dimension_; d++) {
+                sum[d] = 0.0;
+            }
+            for (long long int i = begin; i < end; i++) {
+                for (int d = 0; d < dimension_; d++) {
+                    sum[d] += points.at(order_[i], d);
+                }
+            }
+            return;
+        }
+
+        long long int middle = begin + (end - begin) / 2;
+        const float* column = points.column(split);
+        std::nth_element(order_.begin() + begin, order_.begin() + middle, order_.begin() + end,
+                         [column](long long int a, long long int b) { return column[a] < column[b]; });
+        int left = next_node.fetch_add(2);
+        node.left = left;
+        node.right = left + 1;
+        if (end - begin > KD_TREE_TASK_SIZE) {
+            #pragma omp task shared(points, next_node)
+            build(points, left, begin, middle, next_node);
+            build(points, left + 1, middle, end, next_node);
+            #pragma omp taskwait
+        } else {
+            build(points, left, begin, middle, next_node);
+            build(points, left + 1, middle, end, next_node);
+        }
+        for (int d = 0; d < dimension_; d++) {
+            sum[d] = sums_[(long long int) left * dimension_ + d] + sums_[(long long int) (left + 1) * dimension_ + d];
+        }
+    }
+
+    /**
+     * @name subtree_depth
+     * @brief Función recursiva para obtener la profundidad de un subárbol
+     * @param index Índice de la raíz del subárbol
+     * @return Cantidad de niveles debajo del nodo
+     * */
+    int subtree_depth(int index) const {
+        const KdNode& node = nodes_[index];
+        if (node.left < 0) return 0;
+        return 1 + std::max(subtree_depth(node.left), subtree_depth(node.right));
+    }
+
+    /**
+     * @name prune
+     * @brief Función para descartar los candidatos que no pueden ser los más cercanos a ningún punto de la caja de un nodo
+     * @param index Índice del nodo
+     * @param candidates Candidatos en orden creciente
+     * @param count Cantidad de candidatos
+     * @param centroids Conjunto de centroides por columnas
+     * @param kept Arreglo de salida con los candidatos que quedan, en orden creciente
+     * @return Cantidad de candidatos que quedan
+     * */
+    int prune(int index, const int* candidates, int count, const Dataset& centroids, int* kept) const {
+        const float* low = box_min_.data() + (long long int) index * dimension_;
+        const float* high = box_max_.data() + (long long int) index * dimension_;
+        // z* es el candidato más cercano al centro de la caja
+        int best = candidates[0];
+        double best_distance = std::numeric_limits<double>::infinity();
+        for (int c = 0; c < count; c++) {
+            double distance = 0.0;
+            for (int d = 0; d < dimension_; d++) {
+                double diff = 0.5 * ((double) low[d] + high[d]) - centroids.at(candidates[c], d);
+                distance += diff * diff;
+            }
+            if (distance < best_distance) {
+                best_distance = distance;
+                best = candidates[c];
+            }
+        }
+        double best_farthest = farthest_distance(low, high, centroids, best);
+        int n_kept = 0;
+        for (int c = 0; c < count; c++) {
+            int z = candidates[c];
+            if (z != best) {
+                // Vértice de la caja más favorable a z frente a z*: d2(v, z) - d2(v, z*) es la menor diferencia en la caja
+                double gap = 0.0;
+                for (int d = 0; d < dimension_; d++) {
+                    double z_d = centroids.at(z, d);
+                    double best_d = centroids.at(best, d);
+                    double vertex = z_d > best_d ? high[d] : low[d];
+                    gap += (best_d - z_d) * (2.0 * vertex - z_d - best_d);
+                }
+                if (gap > rounding_ * (farthest_distance(low, high, centroids, z) + best_farthest)) continue;
+            }
+            kept[n_kept++] = z;
+        }
+        return n_kept;
+    }
+
+    /**
+     * @name farthest_distance
+     * @brief Función para obtener la distancia al cuadrado del punto de una caja más lejano a un centroide
+     * @return Distancia al cuadrado al vértice más lejano
+     * */
+    double farthest_distance(const float* low, const float* high, const Dataset& centroids, int k) const {
+        double distance = 0.0;
+        for (int d = 0; d < dimension_; d++) {
+            double c = centroids.at(k, d);
+            double diff = std::max(c - low[d], (double) high[d] - c);
+            distance += diff * diff;
+        }
+        return distance;
+    }
+
+    /**
+     * @name push_owner
+     * @brief Función para pasar el dueño de un nodo a sus hijos antes de bajar por ellos (un nodo asignado completo no actualiza a sus descendientes)
+     * @param node Nodo interno
+     * */
+    void push_owner(const KdNode& node) {
+        if (node.owner >= 0) {
+            nodes_[node.left].owner = node.owner;
+            nodes_[node.right].owner = node.owner;
+        }
+    }
+
+    /**
+     * @name collect
+     * @brief Función recursiva que filtra en un solo hilo los nodos con más de item_size puntos y guarda como trabajo para los hilos los subárboles más pequeños (o con un solo candidato)
+     * */
+    void collect(int index, const int* candidates, int count, long long int item_size, const Dataset& centroids, int* scratch) {
+        KdNode& node = nodes_[index];
+        if (node.left < 0 || node.end - node.begin <= item_size || count == 1) {
+            items_.push_back({index, (long long int) item_candidates_.size(), count});
+            item_candidates_.insert(item_candidates_.end(), candidates, candidates + count);
+            return;
+        }
+        int n_kept = prune(index, candidates, count, centroids, scratch);
+        if (n_kept == 1) {
+            items_.push_back({index, (long long int) item_candidates_.size(), 1});
+            item_candidates_.push_back(scratch[0]);
+            return;
+        }
+        serial_nodes_.push_back(index);
+        push_owner(node);
+        int* next = scratch + centroids.size();
+        collect(node.left, scratch, n_kept, item_size, centroids, next);
+        collect(node.right, scratch, n_kept, item_size, centroids, next);
+    }
+
+    /**
+     * @name assign_whole
+     * @brief Función para asignar todos los puntos de un nodo a un centroide: suma la suma precalculada del nodo y sólo reescribe los clusters si el nodo no era ya de ese centroide
+     * */
+    void assign_whole(KdNode& node, const double* sum, int32_t k, Pass& pass) {
+        double* slot = pass.local + (long long int) k * pass.fields;
+        for (int d = 0; d < dimension_; d++) {
+            slot[d] += sum[d];
+        }
+        slot[dimension_] += node.end - node.begin;
+        if (node.owner != k) {
+            for (long long int i = node.begin; i < node.end; i++) {
+                if (tree_labels_[i] != k) {
+                    tree_labels_[i] = k;
+                    pass.labels[order_[i]] = k;
+                    pass.changed++;
+                }
+            }
+            node.owner = k;
+        }
+    }
+
+    /**
+     * @name filter
+     * @brief Función recursiva del algoritmo de filtrado: descarta candidatos con la caja del nodo y asigna el subárbol completo si queda uno solo, recorre los puntos si es una hoja o baja por los hijos
+     * @param index Índice del nodo
+     * @param candidates Candidatos en orden creciente
+     * @param count Cantidad de candidatos
+     * @param level Nivel de la recursión (elige la lista de candidatos del hilo)
+     * @param pass Estado del hilo
+     * */
+    void filter(int index, const int* candidates, int count, int level, Pass& pass) {
+        KdNode& node = nodes_[index];
+        const Dataset& centroids = pass.centroids;
+        int* kept = pass.candidates + (long long int) level * centroids.size();
+        int n_kept = count == 1 ? 1 : prune(index, candidates, count, centroids, kept);
+        if (count == 1) kept[0] = candidates[0];
+        if (n_kept == 1) {
+            assign_whole(node, sums_.data() + (long long int) index * dimension_, kept[0], pass);
+            return;
+        }
+        if (node.left < 0) {
+            // Hoja con varios candidatos: se calculan sus distancias en orden de índice
+            int32_t owner = -2;
+            for (long long int i = node.begin; i < node.end; i++) {
+                int32_t nearest = kept[0];
+                float best = squared_distance(sorted_, i, centroids, kept[0]);
+                for (int c = 1; c < n_kept; c++) {
+                    float distance = squared_distance(sorted_, i, centroids, kept[c]);
+                    if (distance < best) {
+                        best = distance;
+                        nearest = kept[c];
+                    }
+                }
+                double* slot = pass.local + (long long int) nearest * pass.fields;
+                for (int d = 0; d < dimension_; d++) {
+                    slot[d] += sorted_.at(i, d);
+                }
+                slot[dimension_] += 1.0;
+                if (tree_labels_[i] != nearest) {
+                    tree_labels_[i] = nearest;
+                    pass.labels[order_[i]] = nearest;
+                    pass.changed++;
+                }
+                owner = owner == -2 || owner == nearest ? nearest : -1;
+            }
+            pass.computed += (node.end - node.begin) * n_kept;
+            node.owner = owner;
+            return;
+        }
+        push_owner(node);
+        filter(node.left, kept, n_kept, level + 1, pass);
+        filter(node.right, kept, n_kept, level + 1, pass);
+        node.owner = nodes_[node.left].owner == nodes_[node.right].owner ? nodes_[node.left].owner : -1;
+    }
+
+    long long int num_points_;
+    int dimension_;
+    double rounding_;                     // Margen relativo del error de redondeo de una distancia en float
+    std::vector<long long int> order_;    // Índice original del punto en cada posición del árbol
+    std::vector<KdNode> nodes_;           // Nodos; el 0 es la raíz y los hijos de un nodo son consecutivos
+    std::vector<float> box_min_;          // Esquina inferior de la caja de cada nodo (nodos x dimensión)
+    std::vector<float> box_max_;          // Esquina superior de la caja de cada nodo (nodos x dimensión)
+    std::vector<double> sums_;            // Suma de las coordenadas de los puntos de cada nodo (nodos x dimensión)
+    Dataset sorted_;                      // Puntos en el orden del árbol
+    std::vector<int32_t> tree_labels_;    // Cluster de cada punto en el orden del árbol
+    int depth_;
+    std::vector<WorkItem> items_;         // Subárboles de la pasada actual que se reparten entre los hilos
+    std::vector<int> item_candidates_;    // Candidatos de cada subárbol de items_
+    std::vector<int> serial_nodes_;       // Nodos filtrados en serie en la pasada actual, en preorden
+    long long int computed_;
+    long long int total_;
+};
+
+/**
+ * @name report_kd_tree
+ * @brief Función para imprimir el tamaño del árbol y cuántas distancias punto-centroide evitó calcular respecto a la asignación completa
+ * @param tree Árbol kd
+ * @param build_time Segundos que tomó construir el árbol
+ * */
+inline void report_kd_tree(const KdTree& tree, double build_time) {
+    long long int total = tree.total_distances();
+    long long int skipped = total - tree.computed_distances();
+    std::cout << "kdtree (" << tree.nodes() << " nodes, depth " << tree.depth() << ", built in " << build_time << " s)"
+              << ": skipped " << skipped << " of " << total
+              << " distance evaluations (" << (total > 0 ? 100.0 * skipped / total : 0.0) << "%)" << "\n";
+}
+
+#endif
@@ -0,0 +1,211 @@
+/**
+ * @file kmeans_load.cpp
+ * @date 2023-03-08
+ * @author Diego Hernández Delgado
+ * @author Jesús Isaías García Moreno
+ * @brief Generador de carga para kmeans_serve. Cada cliente es un hilo con su propia conexión que envía solicitudes de puntos tomados al azar del archivo de entrada y espera cada respuesta antes de enviar la siguiente (ciclo cerrado). Al terminar imprime las solicitudes y puntos por segundo y la latencia p50, p99 y máxima de ida y vuelta; con centroids=archivo además compara cada cluster recibido con el que calcula localmente el mismo kernel
+ * @param socket_path Ruta del socket Unix del servidor
+ * @param input_file_path Ruta del archivo de entrada (CSV o binario) o número de puntos de ./../Data
+ * */
+
+#include <omp.h>
+#include <unistd.h>
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <bits/stdc++.h>
+#include "dataset.hpp"
+#include "binary_format.hpp"
+#include "distance_kernels.hpp"
+#include "kmeans_model.hpp"
+#include "seeding.hpp"
+#include "serve_protocol.hpp"
+
+using namespace std;
+
+// Texto de ayuda con las opciones aceptadas
+const char LOAD_OPTIONS_USAGE[] = "[clients=n] [requests=n] [points=n] [seed=n] [centroids=file]";
+
+/**
+ * @name LoadOptions
+ * @brief Opciones del generador de carga con sus valores por defecto
+ * */
+struct LoadOptions {
+    int clients = 4;                   // Conexiones concurrentes (un hilo por conexión)
+    long long int requests = 1000;     // Solicitudes de cada cliente
+    long long int points = 64;         // Puntos por solicitud
+    uint64_t seed = 42;                // Semilla de la elección de los puntos
+    string centroids_file;             // Centroides para verificar los clusters recibidos (vacío para no verificar)
+};
+
+/**
+ * @name parse_load_options
+ * @brief Función para leer las opciones nombre=valor de los argumentos de entrada
+ * @param argc Cantidad de argumentos de entrada
+ * @param argv Argumentos de entrada
+ * @param first Índice del primer argumento opcional
+ * @return Opciones del generador de carga
+ * */
+LoadOptions parse_load_options(int argc, char** argv, int first) {
+    LoadOptions options;
+    for (int i = first; i < argc; i++) {
+        string argument = argv[i];
+        size_t separator = argument.find('=');
+        if (separator == string::npos)
+            throw std::invalid_argument("Invalid option (expected name=value): " + argument);
+        string name = argument.substr(0, separator);
+        string value = argument.substr(separator + 1);
+        size_t parsed = 0;
+        if (name == "clients") {
+            options.clients = stoi(value, &parsed);
+            if (parsed != value.size() || options.clients < 1)
+                throw std::invalid_argument("Invalid number of clients: " + value);
+        } else if (name == "requests") {
+            options.requests = stoll(value, &parsed);
+            if (parsed != value.size() || options.requests < 1)
+                throw std::invalid_argument("Invalid number of requests: " + value);
+        } else if (name == "points") {
+            options.points = stoll(value, &parsed);
+            if (parsed != value.size() || options.points < 1 || options.points > SERVE_MAX_POINTS)
+                throw std::invalid_argument("Invalid points per request: " + value);
+        } else if (name == "seed") {
+            options.seed = stoull(value, &parsed);
+            if (parsed != value.size())
+                throw std::invalid_argument("Invalid seed: " + value);
+        } else if (name == "centroids") {
+            options.centroids_file = value;
+        } else {
+            throw std::invalid_argument("Unknown option: " + name);
+        }
+    }
+    return options;
+}
+
+/**
+ * @name ClientResult
+ * @brief Resultado de un cliente
+ * */
+struct ClientResult {
+    vector<double> latencies;        // Segundos de ida y vuelta de cada solicitud
+    long long int mismatches = 0;    // Clusters distintos a los calculados localmente
+    string error;                    // Error de la conexión (vacío si terminó bien)
+};
+
+/**
+ * @name run_client
+ * @brief Función de un cliente: se conecta, envía las solicitudes una tras otra y mide cada respuesta
+ * @param socket_path Ruta del socket del servidor
+ * @param points Conjunto de puntos por columnas de donde se toman las solicitudes
+ * @param expected Cluster esperado de cada punto (nullptr para no verificar)
+ * @param options Opciones del generador de carga
+ * @param client Número del cliente (flujo de números aleatorios)
+ * @param result Resultado del cliente
+ * */
+void run_client(const string& socket_path, const Dataset& points, const int32_t* expected, const LoadOptions& options, int client, ClientResult& result) {
+    const int dimension = points.dimension();
+    RandomStream random(options.seed, client);
+    vector<char> request(sizeof(ServeRequestHeader) + options.points * dimension * sizeof(float));
+    vector<int32_t> labels(options.points);
+    vector<long long int> rows(options.points);
+    ServeRequestHeader header = {SERVE_MAGIC, (uint32_t) options.points, (uint32_t) dimension, 0};
+    memcpy(request.data(), &header, sizeof(header));
+    float* coordinates = reinterpret_cast<float*>(request.data() + sizeof(header));
+    result.latencies.reserve(options.requests);
+    try{
+        int fd = connect_unix(socket_path);
+        for (long long int r = 0; r < options.requests; r++) {
+            for (long long int i = 0; i < options.points; i++) {
+                rows[i] = random.below(points.size());
+                for (int d = 0; d < dimension; d++) coordinates[i * dimension + d] = points.at(rows[i], d);
+            }
+            double start = omp_get_wtime();
+            ServeResponseHeader response;
+            if (!send_all(fd, request.data(), request.size()) || !receive_all(fd, &response, sizeof(response)))
+                throw std::runtime_error("Connection closed by the server");
+            if (response.magic != SERVE_MAGIC || response.status != SERVE_OK || response.num_points != options.points)
+                throw std::runtime_error("Server answered with status " + to_string(response.status));
+            if (!receive_all(fd, labels.data(), labels.size() * sizeof(int32_t)))
+                throw std::runtime_error("Connection closed by the server");
+            result.latencies.push_back(omp_get_wtime() - start);
+            if (expected != nullptr) {
+                for (long long int i = 0; i < options.points; i++) result.mismatches += labels[i] != expected[rows[i]];
+            }
+        }
+        close(fd);
+    } catch (const std::exception& e) {
+        result.error = e.what();
+    }
+}
+
+/**
+ * @name main
+ * @brief Función main del programa
+ * @param argc Cantidad de argumentos de entrada (STDIN)
+ * @param argv Argumentos de entrada (STDIN) [nombre del programa, ruta del socket, archivo de entrada o número de puntos, opciones nombre=valor (clients=n, requests=n, points=n, seed=n, centroids=archivo)]
+ * @return 0 si el programa termina correctamente
+ * */
+int main(int argc, char** argv) {
+    string socket_path;
+    string input_file;
+    LoadOptions options;
+    try{
+        if (argc < 3)
+            throw std::invalid_argument("Invalid number of arguments");
+        socket_path = argv[1];
+        input_file = resolve_input_file(argv[2]);
+        options = parse_load_options(argc, argv, 3);
+    } catch (const std::exception& e) {
+        cout << e.what() << "\n";
+        cout << "Usage: ./kmeans_load <socket_path> <num_points|input_file> " << LOAD_OPTIONS_USAGE << "\n";
+        return 1;
+    }
+
+    try{
+        Dataset points = load_points(input_file, 1);
+        // Clusters esperados: el mismo kernel del servidor sobre todos los puntos
+        const int32_t* expected = nullptr;
+        Dataset centroids;
+        if (!options.centroids_file.empty()) {
+            centroids = std::move(load_model(options.centroids_file).centroids);
+            if (centroids.dimension() != points.dimension())
+                throw std::invalid_argument("Centroids and points have different dimensions");
+            const NearestCentroidsKernel nearest_centroids = select_nearest_centroids_kernel(points.dimension());
+            for (long long int begin = 0; begin < points.size(); begin += KERNEL_BLOCK_SIZE) {
+                nearest_centroids(points, begin, min(begin + KERNEL_BLOCK_SIZE, points.size()), centroids, points.labels() + begin, nullptr);
+            }
+            expected = points.labels();
+        }
+
+        vector<ClientResult> results(options.clients);
+        vector<thread> clients;
+        double start = omp_get_wtime();
+        for (int c = 0; c < options.clients; c++) {
+            clients.emplace_back(run_client, cref(socket_path), cref(points), expected, cref(options), c, ref(results[c]));
+        }
+        for (thread& client : clients) client.join();
+        double elapsed = omp_get_wtime() - start;
+
+        vector<double> latencies;
+        long long int mismatches = 0;
+        for (int c = 0; c < options.clients; c++) {
+            if (!results[c].error.empty()) cout << "Client " << c << ": " << results[c].error << "\n";
+            latencies.insert(latencies.end(), results[c].latencies.begin(), results[c].latencies.end());
+            mismatches += results[c].mismatches;
+        }
+        sort(latencies.begin(), latencies.end());
+        const long long int requests = latencies.size();
+        cout << options.clients << " clients, " << requests << " requests of " << options.points << " points in " << elapsed << " s: "
+             << requests / elapsed << " requests/s, " << requests * options.points / elapsed << " points/s" << "\n";
+        cout << "Latency p50 " << latency_percentile(latencies, 50) * 1e6 << " us, p99 " << latency_percentile(latencies, 99) * 1e6 << " us, max "
+             << (latencies.empty() ? 0.0 : latencies.back() * 1e6) << " us" << "\n";
+        if (expected != nullptr) cout << "Labels checked against " << options.centroids_file << ": " << mismatches << " mismatches" << "\n";
+        if (requests < options.clients * options.requests || mismatches > 0) return 1;
+    } catch (const std::exception& e) {
+        cout << "Error: kmeans_load" << "\n";
+        cout << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,224 @@
+/**
+ * @file kmeans_model.hpp
+ * @date 2023-03-08
+ * @author Diego Hernández Delgado
+ * @author Jesús Isaías García Moreno
+ * @brief Archivo de modelo de k-means: un encabezado de 64 bytes (magic, versión, K, D, iteraciones, puntos, semilla, inercia) seguido de los centroides por columnas en float. Se escribe al terminar una ejecución (model=), cada cierto número de iteraciones como punto de control para reanudar una ejecución larga (checkpoint=n), y se lee para empezar desde centroides anteriores en lugar de elegirlos (warm=). Los archivos se escriben en un archivo temporal que después se renombra, así que un punto de control interrumpido nunca deja un modelo incompleto
+ * */
+
+#ifndef KMEANS_MODEL_HPP
+#define KMEANS_MODEL_HPP
+
+#include <sys/stat.h>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "binary_format.hpp"
+#include "dataset.hpp"
+#include "mapped_file.hpp"
+
+// Identificador al inicio de todo archivo de modelo
+const char KMEANS_MODEL_MAGIC[8] = {'K', 'M', 'E', 'A', 'N', 'S', 'M', 'D'};
+const uint32_t KMEANS_MODEL_VERSION = 1;
+// Banderas del modelo
+const uint32_t MODEL_CHECKPOINT = 1; // Punto de control de una ejecución que no ha terminado
+
+/**
+ * @name KmeansModelHeader
+ * @brief Encabezado del archivo de modelo (64 bytes, little endian). Le siguen D columnas de K floats
+ * */
+struct KmeansModelHeader {
+    char magic[8];          // KMEANS_MODEL_MAGIC
+    uint32_t version;       // KMEANS_MODEL_VERSION
+    uint32_t flags;         // MODEL_CHECKPOINT o 0
+    uint32_t n_clusters;    // K, número de centroides
+    uint32_t dimension;     // D, número de coordenadas
+    uint64_t iterations;    // Iteraciones después de la primera asignación
+    uint64_t num_points;    // Puntos con los que se entrenó
+    uint64_t seed;          // Semilla de la elección de los centroides iniciales
+    double inertia;         // Suma de distancias al cuadrado de cada punto a su centroide (NaN en un punto de control)
+    uint64_t reserved;
+};
+static_assert(sizeof(KmeansModelHeader) == 64, "KmeansModelHeader must be 64 bytes");
+
+/**
+ * @name KmeansModel
+ * @brief Centroides de un modelo con los datos de la ejecución que los produjo
+ * */
+struct KmeansModel {
+    Dataset centroids;                // Centroides por columnas (sin clusters)
+    long long int iterations = 0;     // Iteraciones después de la primera asignación
+    long long int num_points = 0;     // Puntos con los que se entrenó (0 si se desconoce)
+    uint64_t seed = 0;                // Semilla de la elección de los centroides iniciales
+    double inertia = std::numeric_limits<double>::quiet_NaN(); // Inercia al terminar (NaN si se desconoce)
+    bool checkpoint = false;          // Si es un punto de control de una ejecución que no ha terminado
+};
+
+/**
+ * @name is_model_file
+ * @brief Función para saber si un bloque de memoria empieza con el encabezado del archivo de modelo
+ * @param data Inicio del archivo
+ * @param size Tamaño del archivo en bytes
+ * @return true si el archivo es un modelo
+ * */
+inline bool is_model_file(const char* data, long long int size) {
+    return size >= (long long int) sizeof(KmeansModelHeader) && memcmp(data, KMEANS_MODEL_MAGIC, sizeof(KMEANS_MODEL_MAGIC)) == 0;
+}
+
+/**
+ * @name save_model
+ * @brief Función para guardar un modelo. Se escribe en <file_name>.tmp y después se renombra, de modo que el archivo anterior sigue completo si la escritura se interrumpe
+ * @param file_name Nombre del archivo de modelo
+ * @param centroids Conjunto de centroides por columnas
+ * @param iterations Iteraciones después de la primera asignación
+ * @param num_points Puntos con los que se entrenó
+ * @param seed Semilla de la elección de los centroides iniciales
+ * @param inertia Inercia al terminar (NaN si se desconoce)
+ * @param checkpoint Si es un punto de control de una ejecución que no ha terminado
+ * */
+inline void save_model(const std::string& file_name, const Dataset& centroids, long long int iterations, long long int num_points, uint64_t seed, double inertia, bool checkpoint) {
+    KmeansModelHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, KMEANS_MODEL_MAGIC, sizeof(KMEANS_MODEL_MAGIC));
+    header.version = KMEANS_MODEL_VERSION;
+    header.flags = checkpoint ? MODEL_CHECKPOINT : 0;
+    header.n_clusters = centroids.size();
+    header.dimension = centroids.dimension();
+    header.iterations = iterations;
+    header.num_points = num_points;
+    header.seed = seed;
+    header.inertia = inertia;
+
+    const std::string temporary = file_name + ".tmp";
+    {
+        std::ofstream fout(temporary, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!fout.is_open()) throw std::runtime_error("Could not open " + temporary + " for writing");
+        fout.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        for (int d = 0; d < centroids.dimension(); d++) {
+            fout.write(reinterpret_cast<const char*>(centroids.column(d)), centroids.size() * sizeof(float));
+        }
+        if (!fout.good()) throw std::runtime_error("Could not write " + temporary);
+    }
+    if (std::rename(temporary.c_str(), file_name.c_str()) != 0)
+        throw std::runtime_error("Could not rename " + temporary + " to " + file_name);
+}
+
+/**
+ * @name load_model
+ * @brief Función para leer un modelo. Un archivo que no es un modelo se lee con load_points como conjunto de centroides, un renglón por centroide (por ejemplo los CSV de minibatch_kmeans y outofcore_kmeans), sin datos de la ejecución
+ * @param file_name Nombre del archivo de modelo o de centroides
+ * @return Modelo con los centroides por columnas
+ * */
+inline KmeansModel load_model(const std::string& file_name) {
+    KmeansModel model;
+    struct stat sb;
+    if (stat(file_name.c_str(), &sb) != 0)
+        throw std::runtime_error("Model file not found: " + file_name);
+    std::shared_ptr<const MappedFile> file = std::make_shared<MappedFile>(file_name);
+    if (!is_model_file(file->data(), file->size())) {
+        model.centroids = load_points(file_name, 1);
+        return model;
+    }
+    KmeansModelHeader header;
+    memcpy(&header, file->data(), sizeof(header));
+    if (header.version != KMEANS_MODEL_VERSION)
+        throw std::runtime_error("Unsupported model version " + std::to_string(header.version) + " in " + file_name);
+    if (header.n_clusters < 1 || header.dimension < 1 ||
+        (unsigned long long) file->size() < sizeof(header) + (unsigned long long) header.n_clusters * header.dimension * sizeof(float))
+        throw std::runtime_error("Corrupt model header in " + file_name);
+    model.centroids = Dataset(header.n_clusters, header.dimension, false);
+    const float* data = reinterpret_cast<const float*>(file->data() + sizeof(header));
+    for (uint32_t d = 0; d < header.dimension; d++) {
+        memcpy(model.centroids.column(d), data + (size_t) d * header.n_clusters, header.n_clusters * sizeof(float));
+    }
+    model.iterations = header.iterations;
+    model.num_points = header.num_points;
+    model.seed = header.seed;
+    model.inertia = header.inertia;
+    model.checkpoint = (header.flags & MODEL_CHECKPOINT) != 0;
+    return model;
+}
+
+/**
+ * @name ModelRecorder
+ * @brief Registro de los centroides de una ejecución de kmeans: escribe un punto de control cada cierto número de iteraciones y conserva una copia de los centroides finales, que kmeans libera al salir
+ * */
+class ModelRecorder {
+public:
+    /**
+     * @name ModelRecorder
+     * @brief Constructor del registro
+     * @param checkpoint_file Archivo del punto de control (vacío sin puntos de control)
+     * @param checkpoint_interval Iteraciones entre dos puntos de control (0 sin puntos de control)
+     * @param num_points Puntos de la ejecución
+     * @param seed Semilla de la elección de los centroides iniciales
+     * */
+    ModelRecorder(const std::string& checkpoint_file, long long int checkpoint_interval, long long int num_points, uint64_t seed)
+        : checkpoint_file_(checkpoint_file), checkpoint_interval_(checkpoint_interval), num_points_(num_points), seed_(seed), iterations_(0), checkpoints_(0) {}
+
+    /**
+     * @name record_iteration
+     * @brief Función para registrar los centroides después de una actualización; escribe el punto de control si la iteración es múltiplo del intervalo
+     * @param centroids Conjunto de centroides actualizados
+     * @param iteration Iteraciones terminadas después de la primera asignación
+     * */
+    void record_iteration(const Dataset& centroids, long long int iteration) {
+        if (checkpoint_interval_ > 0 && iteration > 0 && iteration % checkpoint_interval_ == 0) {
+            save_model(checkpoint_file_, centroids, iteration, num_points_, seed_, std::numeric_limits<double>::quiet_NaN(), true);
+            checkpoints_++;
+        }
+    }
+
+    /**
+     * @name finish
+     * @brief Función para copiar los centroides finales al terminar la ejecución
+     * @param centroids Conjunto de centroides finales
+     * @param iterations Iteraciones después de la primera asignación
+     * */
+    void finish(const Dataset& centroids, long long int iterations) {
+        if (centroids_.size() != centroids.size() || centroids_.dimension() != centroids.dimension()) {
+            centroids_ = Dataset(centroids.size(), centroids.dimension(), false);
+        }
+        for (int d = 0; d < centroids.dimension(); d++) {
+            memcpy(centroids_.column(d), centroids.column(d), centroids.size() * sizeof(float));
+        }
+        iterations_ = iterations;
+    }
+
+    /**
+     * @name save
+     * @brief Función para guardar los centroides finales como modelo
+     * @param file_name Nombre del archivo de modelo
+     * @param inertia Inercia de los centroides finales
+     * */
+    void save(const std::string& file_name, double inertia) const {
+        save_model(file_name, centroids_, iterations_, num_points_, seed_, inertia, false);
+    }
+
+    // Centroides finales de la última ejecución
+    const Dataset& centroids() const { return centroids_; }
+    // Iteraciones de la última ejecución
+    long long int iterations() const { return iterations_; }
+    // Puntos de control escritos
+    long long int checkpoints() const { return checkpoints_; }
+    // Cambia la semilla que se guarda con los siguientes puntos de control y modelos
+    void set_seed(uint64_t seed) { seed_ = seed; }
+
+private:
+    std::string checkpoint_file_;
+    long long int checkpoint_interval_;
+    long long int num_points_;
+    uint64_t seed_;
+    Dataset centroids_;
+    long long int iterations_;
+    long long int checkpoints_;
+};
+
+#endif
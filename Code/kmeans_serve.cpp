@@ -0,0 +1,448 @@
+/**
+ * @file kmeans_serve.cpp
+ * @date 2023-03-08
+ * @author Diego Hernández Delgado
+ * @author Jesús Isaías García Moreno
+ * @brief Servidor de asignación de puntos a centroides ya entrenados. Lee los centroides una sola vez y escucha en un socket Unix (protocolo de serve_protocol.hpp). Las solicitudes de todos los clientes que llegan dentro de una ventana de tiempo se juntan en un lote por columnas, el kernel vectorizado de distancias asigna el lote completo con los hilos de OpenMP y cada cliente recibe los clusters de sus puntos. Se imprimen periódicamente y al terminar (SIGINT o SIGTERM) la latencia p50 y p99 de las solicitudes, desde que se reciben completas hasta que se envía la respuesta, y las solicitudes y puntos por segundo
+ * @param centroids_file Archivo de modelo de parallel_kmeans (model=) o de centroides (CSV con un centroide por renglón, como los de minibatch_kmeans y outofcore_kmeans, o binario)
+ * @param socket_path Ruta del socket Unix
+ * @param num_threads Número de hilos a utilizar
+ * */
+
+#include <omp.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <bits/stdc++.h>
+#include "dataset.hpp"
+#include "binary_format.hpp"
+#include "distance_kernels.hpp"
+#include "kmeans_model.hpp"
+#include "serve_protocol.hpp"
+
+using namespace std;
+
+// Texto de ayuda con las opciones aceptadas
+const char SERVE_OPTIONS_USAGE[] = "[window=microseconds] [batch=points] [report=seconds]";
+
+/**
+ * @name ServeOptions
+ * @brief Opciones del servidor con sus valores por defecto
+ * */
+struct ServeOptions {
+    long long int window_us = 200;   // Tiempo máximo que espera la primera solicitud de un lote a que lleguen otras
+    long long int batch_size = 16384; // Puntos a partir de los cuales el lote se asigna sin esperar al final de la ventana
+    double report_seconds = 5.0;     // Segundos entre dos reportes periódicos (0 sólo reporta al terminar)
+};
+
+/**
+ * @name parse_serve_options
+ * @brief Función para leer las opciones nombre=valor de los argumentos de entrada
+ * @param argc Cantidad de argumentos de entrada
+ * @param argv Argumentos de entrada
+ * @param first Índice del primer argumento opcional
+ * @return Opciones del servidor
+ * */
+ServeOptions parse_serve_options(int argc, char** argv, int first) {
+    ServeOptions options;
+    for (int i = first; i < argc; i++) {
+        string argument = argv[i];
+        size_t separator = argument.find('=');
+        if (separator == string::npos)
+            throw std::invalid_argument("Invalid option (expected name=value): " + argument);
+        string name = argument.substr(0, separator);
+        string value = argument.substr(separator + 1);
+        size_t parsed = 0;
+        if (name == "window") {
+            options.window_us = stoll(value, &parsed);
+            if (parsed != value.size() || options.window_us < 0)
+                throw std::invalid_argument("Invalid window in microseconds: " + value);
+        } else if (name == "batch") {
+            options.batch_size = stoll(value, &parsed);
+            if (parsed != value.size() || options.batch_size < 1)
+                throw std::invalid_argument("Invalid batch size: " + value);
+        } else if (name == "report") {
+            options.report_seconds = stod(value, &parsed);
+            if (parsed != value.size() || options.report_seconds < 0)
+                throw std::invalid_argument("Invalid report interval in seconds: " + value);
+        } else {
+            throw std::invalid_argument("Unknown option: " + name);
+        }
+    }
+    return options;
+}
+
+// Se pone en 1 con SIGINT o SIGTERM para terminar el ciclo del servidor
+volatile sig_atomic_t stop_requested = 0;
+
+void request_stop(int) {
+    stop_requested = 1;
+}
+
+/**
+ * @name ServeReply
+ * @brief Respuesta en el buffer de salida de un cliente, para medir su latencia cuando termina de enviarse
+ * */
+struct ServeReply {
+    size_t end;              // Byte del buffer de salida donde termina la respuesta
+    long long int count;     // Puntos de la solicitud
+    double received;         // Momento en que se recibió completa la solicitud
+};
+
+/**
+ * @name ServeClient
+ * @brief Conexión de un cliente con los bytes recibidos que todavía no forman una solicitud completa y las respuestas que todavía no se envían. Mientras tiene respuestas sin enviar no se leen sus solicitudes, así que un cliente que no lee sus respuestas sólo se detiene a sí mismo
+ * */
+struct ServeClient {
+    int fd;
+    vector<char> buffer;          // Bytes recibidos
+    vector<char> output;          // Respuestas por enviar
+    size_t sent = 0;              // Bytes de output ya enviados
+    deque<ServeReply> replies;    // Respuestas de output en orden
+    bool closing = false;         // Se cierra al terminar de enviar output (después de una solicitud inválida)
+};
+
+/**
+ * @name PendingRequest
+ * @brief Solicitud completa que espera en el lote actual
+ * */
+struct PendingRequest {
+    int fd;                  // Socket del cliente (-1 si se desconectó antes de la respuesta)
+    long long int first;     // Primer punto de la solicitud en el lote
+    long long int count;     // Puntos de la solicitud
+    double received;         // Momento en que se recibió completa
+};
+
+/**
+ * @name ServeStats
+ * @brief Latencias y conteos desde el último reporte y desde el inicio
+ * */
+struct ServeStats {
+    LatencyHistogram latencies;      // Segundos de cada solicitud
+    long long int requests = 0;
+    long long int points = 0;
+    long long int batches = 0;
+    double start = 0.0;              // Inicio del periodo
+};
+
+/**
+ * @name print_serve_stats
+ * @brief Función para imprimir la latencia p50, p99 y máxima, las solicitudes y puntos por segundo y el tamaño promedio de los lotes de un periodo
+ * @param label Nombre del periodo
+ * @param stats Latencias y conteos del periodo
+ * @param elapsed Segundos del periodo
+ * */
+void print_serve_stats(const string& label, const ServeStats& stats, double elapsed) {
+    cout << label << ": " << stats.requests << " requests, " << stats.points << " points in " << elapsed << " s (" << stats.requests / elapsed << " requests/s, "
+         << stats.points / elapsed << " points/s), " << (stats.batches > 0 ? (double) stats.points / stats.batches : 0.0) << " points per batch; latency p50 "
+         << stats.latencies.percentile(50) * 1e6 << " us, p99 " << stats.latencies.percentile(99) * 1e6 << " us, max "
+         << stats.latencies.max * 1e6 << " us" << endl;
+}
+
+/**
+ * @name Server
+ * @brief Ciclo de eventos del servidor: un solo hilo acepta conexiones, lee solicitudes, arma los lotes y envía las respuestas; los hilos de OpenMP sólo calculan las asignaciones de cada lote. Ninguna operación del ciclo bloquea: las respuestas se copian al buffer de salida de cada cliente y se envían cuando ppoll indica que su socket acepta más bytes
+ * */
+class Server {
+public:
+    /**
+     * @name Server
+     * @brief Constructor que crea el socket Unix (reemplazando uno anterior en la misma ruta) y reserva el lote
+     * @param centroids Conjunto de centroides por columnas
+     * @param socket_path Ruta del socket
+     * @param options Opciones del servidor
+     * @param num_threads Número de hilos de OpenMP
+     * */
+    Server(const Dataset& centroids, const string& socket_path, const ServeOptions& options, int num_threads)
+        : centroids_(centroids), socket_path_(socket_path), options_(options), num_threads_(num_threads),
+          nearest_centroids_(select_nearest_centroids_kernel(centroids.dimension())), batch_(options.batch_size, centroids.dimension()), batch_points_(0) {
+        sockaddr_un address = unix_address(socket_path);
+        listen_fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen_fd_ < 0) throw std::runtime_error("socket() failed: " + string(strerror(errno)));
+        unlink(socket_path.c_str());
+        if (bind(listen_fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listen_fd_, 128) != 0) {
+            int error = errno;
+            close(listen_fd_);
+            throw std::runtime_error("Could not listen on " + socket_path + ": " + strerror(error));
+        }
+        fcntl(listen_fd_, F_SETFL, O_NONBLOCK);
+    }
+
+    ~Server() {
+        for (ServeClient& client : clients_) close(client.fd);
+        close(listen_fd_);
+        unlink(socket_path_.c_str());
+    }
+
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+
+    /**
+     * @name run
+     * @brief Función para atender clientes hasta recibir SIGINT o SIGTERM e imprimir el reporte final
+     * */
+    void run() {
+        interval_.start = total_.start = omp_get_wtime();
+        double next_report = interval_.start + options_.report_seconds;
+        vector<pollfd> fds;
+        while (!stop_requested) {
+            // Se espera hasta el final de la ventana del lote actual, o hasta el siguiente reporte
+            double now = omp_get_wtime();
+            double wake = options_.report_seconds > 0 ? next_report : now + 1.0;
+            if (!pending_.empty()) wake = min(wake, pending_.front().received + options_.window_us * 1e-6);
+            double wait = max(wake - now, 0.0);
+            timespec timeout = {(time_t) wait, (long) ((wait - (time_t) wait) * 1e9)};
+            // Un cliente con respuestas por enviar sólo espera a poder escribir; no se leen sus solicitudes hasta que las envíe todas
+            fds.assign(1, {listen_fd_, POLLIN, 0});
+            for (const ServeClient& client : clients_) fds.push_back({client.fd, (short) (client.output.empty() ? POLLIN : POLLOUT), 0});
+            if (ppoll(fds.data(), fds.size(), &timeout, nullptr) < 0 && errno != EINTR)
+                throw std::runtime_error("ppoll() failed: " + string(strerror(errno)));
+
+            if (fds[0].revents & POLLIN) accept_clients();
+            // Se recorre de atrás hacia adelante porque un cliente desconectado se quita de la lista
+            for (size_t c = fds.size() - 1; c >= 1; c--) {
+                if (fds[c].revents & (POLLHUP | POLLERR) && !(fds[c].revents & POLLIN)) {
+                    close_client(c - 1);
+                } else if (fds[c].revents & POLLOUT) {
+                    // Al enviar todas sus respuestas se atienden las solicitudes que ya estaban en su buffer
+                    if (write_client(c - 1) && clients_[c - 1].output.empty()) parse_requests(c - 1);
+                } else if (fds[c].revents & POLLIN) {
+                    read_client(c - 1);
+                }
+            }
+            // Se asigna el lote al vencer la ventana, al llenarse o cuando ya hay tantas solicitudes como clientes que pueden enviar (nadie más puede sumarse si cada cliente espera su respuesta)
+            now = omp_get_wtime();
+            if (!pending_.empty() && (batch_points_ >= options_.batch_size || pending_.size() >= sending_clients()
+                                      || now >= pending_.front().received + options_.window_us * 1e-6)) {
+                flush_batch();
+            }
+            if (options_.report_seconds > 0 && omp_get_wtime() >= next_report) {
+                now = omp_get_wtime();
+                if (interval_.requests > 0) print_serve_stats("interval", interval_, now - interval_.start);
+                interval_ = ServeStats();
+                interval_.start = now;
+                next_report = now + options_.report_seconds;
+            }
+        }
+        // Al terminar se asigna el último lote y se envía lo que quepa en cada socket, sin esperar a los clientes
+        if (!pending_.empty()) flush_batch();
+        for (size_t c = clients_.size(); c-- > 0;) write_client(c);
+        print_serve_stats("total", total_, omp_get_wtime() - total_.start);
+    }
+
+private:
+    // Acepta todas las conexiones pendientes; las lecturas de los clientes no bloquean
+    void accept_clients() {
+        int fd;
+        while ((fd = accept(listen_fd_, nullptr, nullptr)) >= 0) {
+            fcntl(fd, F_SETFL, O_NONBLOCK);
+            clients_.emplace_back();
+            clients_.back().fd = fd;
+        }
+    }
+
+    // Lee lo disponible de un cliente y atiende sus solicitudes completas; cierra la conexión si el cliente se desconectó
+    void read_client(size_t index) {
+        ServeClient& client = clients_[index];
+        char chunk[65536];
+        while (true) {
+            ssize_t received = recv(client.fd, chunk, sizeof(chunk), 0);
+            if (received > 0) {
+                client.buffer.insert(client.buffer.end(), chunk, chunk + received);
+                continue;
+            }
+            if (received < 0 && errno == EINTR) continue;
+            if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                close_client(index);
+                return;
+            }
+            break;
+        }
+        parse_requests(index);
+    }
+
+    // Pasa al lote cada solicitud completa del buffer de un cliente mientras no tenga respuestas por enviar; una solicitud inválida recibe su error y la conexión se cierra después de enviarlo
+    void parse_requests(size_t index) {
+        ServeClient& client = clients_[index];
+        size_t offset = 0;
+        while (client.output.empty() && client.buffer.size() - offset >= sizeof(ServeRequestHeader)) {
+            ServeRequestHeader header;
+            memcpy(&header, client.buffer.data() + offset, sizeof(header));
+            int32_t status = header.num_points > SERVE_MAX_POINTS ? SERVE_TOO_LARGE
+                           : header.dimension != (uint32_t) centroids_.dimension() ? SERVE_BAD_DIMENSION : SERVE_OK;
+            if (header.magic != SERVE_MAGIC || status != SERVE_OK) {
+                for (PendingRequest& request : pending_) {
+                    if (request.fd == client.fd) request.fd = -1;
+                }
+                ServeResponseHeader response = {SERVE_MAGIC, header.num_points, header.magic != SERVE_MAGIC ? SERVE_BAD_DIMENSION : status, 0};
+                append_output(client, &response, sizeof(response));
+                client.closing = true;
+                client.buffer.clear();
+                return;
+            }
+            size_t payload = (size_t) header.num_points * header.dimension * sizeof(float);
+            if (client.buffer.size() - offset - sizeof(header) < payload) break;
+            add_request(client.fd, reinterpret_cast<const float*>(client.buffer.data() + offset + sizeof(header)), header.num_points);
+            offset += sizeof(header) + payload;
+        }
+        client.buffer.erase(client.buffer.begin(), client.buffer.begin() + offset);
+    }
+
+    // Envía lo que acepte el socket del buffer de salida de un cliente sin bloquear y registra la latencia de cada respuesta que termina; regresa false si el cliente se cerró
+    bool write_client(size_t index) {
+        ServeClient& client = clients_[index];
+        while (client.sent < client.output.size()) {
+            ssize_t sent = send(client.fd, client.output.data() + client.sent, client.output.size() - client.sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (sent < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                close_client(index);
+                return false;
+            }
+            client.sent += sent;
+        }
+        const double now = omp_get_wtime();
+        while (!client.replies.empty() && client.replies.front().end <= client.sent) {
+            for (ServeStats* stats : {&interval_, &total_}) {
+                stats->latencies.record(now - client.replies.front().received);
+                stats->requests++;
+                stats->points += client.replies.front().count;
+            }
+            client.replies.pop_front();
+        }
+        if (client.sent < client.output.size()) return true;
+        client.output.clear();
+        client.sent = 0;
+        if (client.closing) {
+            close_client(index);
+            return false;
+        }
+        return true;
+    }
+
+    // Agrega bytes al buffer de salida de un cliente
+    void append_output(ServeClient& client, const void* data, size_t bytes) {
+        const char* cursor = static_cast<const char*>(data);
+        client.output.insert(client.output.end(), cursor, cursor + bytes);
+    }
+
+    // Cierra la conexión de un cliente; sus solicitudes del lote actual se asignan pero no se responden
+    void close_client(size_t index) {
+        for (PendingRequest& request : pending_) {
+            if (request.fd == clients_[index].fd) request.fd = -1;
+        }
+        close(clients_[index].fd);
+        clients_.erase(clients_.begin() + index);
+    }
+
+    // Clientes que pueden enviar otra solicitud al lote actual (los que no tienen respuestas por enviar)
+    size_t sending_clients() const {
+        size_t count = 0;
+        for (const ServeClient& client : clients_) count += client.output.empty();
+        return count;
+    }
+
+    // Copia los puntos de una solicitud (punto por punto) a las columnas del lote; si no caben, primero se asigna el lote actual
+    void add_request(int fd, const float* rows, long long int count) {
+        if (batch_points_ > 0 && batch_points_ + count > batch_.size()) flush_batch();
+        if (count > batch_.size()) batch_ = Dataset(count, centroids_.dimension());
+        const int dimension = centroids_.dimension();
+        for (long long int i = 0; i < count; i++) {
+            for (int d = 0; d < dimension; d++) {
+                batch_.at(batch_points_ + i, d) = rows[i * dimension + d];
+            }
+        }
+        pending_.push_back({fd, batch_points_, count, omp_get_wtime()});
+        batch_points_ += count;
+    }
+
+    // Asigna todos los puntos del lote en bloques de KERNEL_BLOCK_SIZE (en paralelo sólo si hay más de un bloque) y copia la respuesta de cada solicitud al buffer de salida de su cliente; no envía nada, así que nunca bloquea
+    void flush_batch() {
+        const long long int num_points = batch_points_;
+        int32_t* labels = batch_.labels();
+        #pragma omp parallel for num_threads(num_threads_) schedule(static) if (num_points > KERNEL_BLOCK_SIZE)
+        for (long long int begin = 0; begin < num_points; begin += KERNEL_BLOCK_SIZE) {
+            nearest_centroids_(batch_, begin, min(begin + KERNEL_BLOCK_SIZE, num_points), centroids_, labels + begin, nullptr);
+        }
+        for (const PendingRequest& request : pending_) {
+            if (request.fd < 0) continue;
+            auto client = find_if(clients_.begin(), clients_.end(), [&](const ServeClient& c) { return c.fd == request.fd; });
+            ServeResponseHeader response = {SERVE_MAGIC, (uint32_t) request.count, SERVE_OK, 0};
+            append_output(*client, &response, sizeof(response));
+            append_output(*client, labels + request.first, request.count * sizeof(int32_t));
+            client->replies.push_back({client->output.size(), request.count, request.received});
+        }
+        interval_.batches++;
+        total_.batches++;
+        pending_.clear();
+        batch_points_ = 0;
+    }
+
+    const Dataset& centroids_;
+    string socket_path_;
+    ServeOptions options_;
+    int num_threads_;
+    NearestCentroidsKernel nearest_centroids_;
+    int listen_fd_;
+    vector<ServeClient> clients_;     // Conexiones abiertas
+    Dataset batch_;                   // Puntos del lote actual por columnas
+    long long int batch_points_;      // Puntos en el lote actual
+    vector<PendingRequest> pending_;  // Solicitudes del lote actual en orden de llegada
+    ServeStats interval_;
+    ServeStats total_;
+};
+
+/**
+ * @name main
+ * @brief Función main del programa
+ * @param argc Cantidad de argumentos de entrada (STDIN)
+ * @param argv Argumentos de entrada (STDIN) [nombre del programa, archivo de centroides, ruta del socket, número de hilos, opciones nombre=valor (window=microsegundos, batch=puntos, report=segundos)]
+ * @return 0 si el programa termina correctamente
+ * */
+int main(int argc, char** argv) {
+    string centroids_file;
+    string socket_path;
+    int num_threads;
+    ServeOptions options;
+    try{
+        if (argc < 4)
+            throw std::invalid_argument("Invalid number of arguments");
+        centroids_file = argv[1];
+        socket_path = argv[2];
+        num_threads = stoi(argv[3]);
+        options = parse_serve_options(argc, argv, 4);
+        if (num_threads < 1)
+            throw std::invalid_argument("Invalid number of threads");
+    } catch (const std::exception& e) {
+        cout << e.what() << "\n";
+        cout << "Usage: ./kmeans_serve <centroids_file> <socket_path> <num_threads> " << SERVE_OPTIONS_USAGE << "\n";
+        return 1;
+    }
+    omp_set_num_threads(num_threads);
+    signal(SIGINT, request_stop);
+    signal(SIGTERM, request_stop);
+    signal(SIGPIPE, SIG_IGN);
+
+    try{
+        Dataset centroids = std::move(load_model(centroids_file).centroids);
+        Server server(centroids, socket_path, options, num_threads);
+        const char* kernel_name = nullptr;
+        select_nearest_centroids_kernel(centroids.dimension(), &kernel_name);
+        cout << "Serving " << centroids.size() << " centroids of dimension " << centroids.dimension() << " on " << socket_path << " (" << kernel_name << ", "
+             << num_threads << " threads, window " << options.window_us << " us, batch " << options.batch_size << " points)" << endl;
+        server.run();
+    } catch (const std::exception& e) {
+        cout << "Error: kmeans_serve" << "\n";
+        cout << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,24 @@
+# K Selection Experiment
+# Author: Diego Hernández Delgado
+# Author: Jesús Isaías García Moreno
+# Date: 2023-03-08
+
+# Parameters
+num_points=("100000" "200000" "300000")
+num_points_size=${#num_points[@]}
+num_threads=("1" "6" "12" "24")
+num_threads_size=${#num_threads[@]}
+k_range="2-13"
+max_iterations="500"
+seed="42"
+
+# Run the K selection sweep on every data set; each K starts from the solution of K - 1 and the elbow table is written to ./../Analysis/KSweep/
+# compare=on also runs every K from its own initial centroids to measure the time saved by the warm start
+for((i=0; i<num_points_size; i++))
+do
+    for((j=0; j<num_threads_size; j++))
+    do
+        echo "Experiment:  ${num_points[i]} points, ${num_threads[j]} threads, K=${k_range}"
+        ./parallel_kmeans ksweep ${num_points[i]} $max_iterations ${num_threads[j]} k=$k_range seed=$seed compare=on
+    done
+done
@@ -0,0 +1,121 @@
+/**
+ * @file label_file.hpp
+ * @date 2023-03-08
+ * @author Diego Hernández Delgado
+ * @author Jesús Isaías García Moreno
+ * @brief Archivo auxiliar con el cluster de cada punto para la ejecución fuera de memoria. Cada cluster se guarda con el menor ancho que alcanza para el número de clusters (1, 2 o 4 bytes), y los trozos se leen y escriben en su posición con pread y pwrite
+ * */
+
+#ifndef LABEL_FILE_HPP
+#define LABEL_FILE_HPP
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/**
+ * @name label_width
+ * @brief Función para obtener el ancho en bytes con el que se guarda cada cluster
+ * @param n_clusters Número de clusters o centroides
+ * @return 1, 2 o 4 bytes
+ * */
+inline int label_width(int n_clusters) {
+    return n_clusters <= 256 ? 1 : n_clusters <= 65536 ? 2 : 4;
+}
+
+/**
+ * @name LabelFile
+ * @brief Archivo de clusters de ancho fijo que se crea vacío y se borra al destruir el objeto
+ * */
+class LabelFile {
+public:
+    /**
+     * @name LabelFile
+     * @brief Constructor que crea (o trunca) el archivo
+     * @param file_name Nombre del archivo
+     * @param n_clusters Número de clusters o centroides (determina el ancho de cada cluster)
+     * */
+    LabelFile(const std::string& file_name, int n_clusters)
+        : file_name_(file_name), width_(label_width(n_clusters)) {
+        fd_ = open(file_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd_ < 0) throw std::runtime_error("Could not open " + file_name + ": " + strerror(errno));
+    }
+
+    ~LabelFile() {
+        close(fd_);
+        unlink(file_name_.c_str());
+    }
+
+    LabelFile(const LabelFile&) = delete;
+    LabelFile& operator=(const LabelFile&) = delete;
+
+    // Bytes por cluster
+    int width() const { return width_; }
+
+    /**
+     * @name read
+     * @brief Función para leer los clusters de un rango de puntos
+     * @param first_row Índice del primer punto
+     * @param rows Cantidad de puntos
+     * @param labels Arreglo de al menos rows clusters donde se guardan
+     * */
+    void read(long long int first_row, long long int rows, int32_t* labels) {
+        buffer_.resize(rows * width_);
+        char* data = buffer_.data();
+        long long int remaining = rows * width_;
+        long long int offset = first_row * width_;
+        while (remaining > 0) {
+            ssize_t done = pread(fd_, data, remaining, offset);
+            if (done < 0 && errno == EINTR) continue;
+            if (done <= 0) throw std::runtime_error("Could not read " + file_name_ + ": " + (done < 0 ? strerror(errno) : "unexpected end of file"));
+            data += done;
+            offset += done;
+            remaining -= done;
+        }
+        for (long long int i = 0; i < rows; i++) {
+            if (width_ == 1) labels[i] = reinterpret_cast<const uint8_t*>(buffer_.data())[i];
+            else if (width_ == 2) labels[i] = reinterpret_cast<const uint16_t*>(buffer_.data())[i];
+            else labels[i] = reinterpret_cast<const int32_t*>(buffer_.data())[i];
+        }
+    }
+
+    /**
+     * @name write
+     * @brief Función para escribir los clusters de un rango de puntos en su posición
+     * @param first_row Índice del primer punto
+     * @param rows Cantidad de puntos
+     * @param labels Cluster de cada punto del rango
+     * */
+    void write(long long int first_row, long long int rows, const int32_t* labels) {
+        buffer_.resize(rows * width_);
+        for (long long int i = 0; i < rows; i++) {
+            if (width_ == 1) reinterpret_cast<uint8_t*>(buffer_.data())[i] = labels[i];
+            else if (width_ == 2) reinterpret_cast<uint16_t*>(buffer_.data())[i] = labels[i];
+            else reinterpret_cast<int32_t*>(buffer_.data())[i] = labels[i];
+        }
+        const char* data = buffer_.data();
+        long long int remaining = rows * width_;
+        long long int offset = first_row * width_;
+        while (remaining > 0) {
+            ssize_t done = pwrite(fd_, data, remaining, offset);
+            if (done < 0 && errno == EINTR) continue;
+            if (done < 0) throw std::runtime_error("Could not write " + file_name_ + ": " + strerror(errno));
+            data += done;
+            offset += done;
+            remaining -= done;
+        }
+    }
+
+private:
+    std::string file_name_;
+    int width_;
+    int fd_;
+    std::vector<char> buffer_; // Trozo de clusters con el ancho del archivo
+};
+
+#endif
@@ -0,0 +1,92 @@
+/**
+ * @file mapped_file.hpp
+ * @date 2023-03-08
+ * @author Diego Hernández Delgado
+ * @author Jesús Isaías García Moreno
+ * @brief Archivo de sólo lectura proyectado en memoria (mmap) para leer los datos sin copiarlos a un buffer intermedio
+ * */
+
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+/**
+ * @name MappedFile
+ * @brief Proyección en memoria de un archivo completo; se libera al destruir el objeto
+ * */
+class MappedFile {
+public:
+    /**
+     * @name MappedFile
+     * @brief Constructor que abre el archivo y lo proyecta en memoria para lectura secuencial
+     * @param file_name Nombre del archivo
+     * */
+    explicit MappedFile(const std::string& file_name) : data_(nullptr), size_(0) {
+        int fd = open(file_name.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("Could not open " + file_name + ": " + strerror(errno));
+        struct stat sb;
+        if (fstat(fd, &sb) != 0) {
+            close(fd);
+            throw std::runtime_error("Could not stat " + file_name + ": " + strerror(errno));
+        }
+        size_ = sb.st_size;
+        if (size_ > 0) {
+            void* mapped = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED) {
+                close(fd);
+                throw std::runtime_error("Could not mmap " + file_name + ": " + strerror(errno));
+            }
+            madvise(mapped, size_, MADV_SEQUENTIAL);
+            data_ = static_cast<const char*>(mapped);
+        }
+        close(fd);
+    }
+
+    ~MappedFile() {
+        if (data_ != nullptr) munmap(const_cast<char*>(data_), size_);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Primer byte del archivo
+    const char* data() const { return data_; }
+    // Tamaño del archivo en bytes
+    long long int size() const { return size_; }
+
+    /**
+     * @name advise
+     * @brief Función para indicar al sistema operativo cómo se va a leer el archivo (MADV_SEQUENTIAL o MADV_RANDOM)
+     * @param advice Patrón de acceso de madvise
+     * */
+    void advise(int advice) const {
+        if (data_ != nullptr) madvise(const_cast<char*>(data_), size_, advice);
+    }
+
+    /**
+     * @name release
+     * @brief Función para descartar de la memoria del proceso las páginas completas de un rango ya leído; si se vuelven a leer se cargan otra vez del archivo
+     * @param offset Byte donde empieza el rango
+     * @param length Tamaño del rango en bytes
+     * */
+    void release(long long int offset, long long int length) const {
+        const long long int page = sysconf(_SC_PAGESIZE);
+        long long int begin = (offset + page - 1) / page * page;
+        long long int end = (offset + length) / page * page;
+        if (data_ != nullptr && begin < end) madvise(const_cast<char*>(data_) + begin, end - begin, MADV_DONTNEED);
+    }
+
+private:
+    const char* data_;
+    long long int size_;
+};
+
+#endif
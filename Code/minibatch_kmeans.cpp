@@ -0,0 +1,270 @@
+/**
+ * @file minibatch_kmeans.cpp
+ * @date 2023-03-08
+ * @author Diego Hernández Delgado
+ * @author Jesús Isaías García Moreno
+ * @brief Código paralelo del algoritmo k-means por lotes pequeños (mini-batch) para archivos de puntos más grandes que la memoria. Los lotes se leen del archivo (al azar o en orden) en un hilo de lectura mientras los hilos de OpenMP asignan y acumulan el lote anterior, y cada centroide se mueve hacia el promedio de sus puntos del lote con una tasa de aprendizaje propia (sus puntos del lote entre todos los puntos que ha recibido). La memoria depende del tamaño del lote y no del número de puntos
+ * @param n_clusters Número de clusters o centroides
+ * @param input_file_path Ruta del archivo de entrada (CSV o binario)
+ * @param max_batches Número de lotes a procesar
+ * @param num_threads Número de hilos a utilizar
+ * */
+
+#include <omp.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <bits/stdc++.h>
+#include "dataset.hpp"
+#include "binary_format.hpp"
+#include "centroid_accumulator.hpp"
+#include "csv_io.hpp"
+#include "distance_kernels.hpp"
+#include "point_stream.hpp"
+#include "result_writer.hpp"
+
+using namespace std;
+
+// Texto de ayuda con las opciones aceptadas
+const char MINIBATCH_OPTIONS_USAGE[] = "[batch=points] [sampling=random|sequential] [seed=n] [output=csv|labels|none]";
+
+/**
+ * @name MiniBatchOptions
+ * @brief Opciones de la ejecución por lotes con sus valores por defecto
+ * */
+struct MiniBatchOptions {
+    long long int batch_size = 16384;          // Puntos por lote
+    SamplingMode sampling = SAMPLING_RANDOM;   // Forma de elegir los puntos de cada lote
+    uint64_t seed = 42;                        // Semilla de los lotes al azar y de los centroides iniciales
+    OutputMode output_mode = OUTPUT_LABELS;    // Formato de los clusters de la pasada final
+};
+
+/**
+ * @name parse_minibatch_options
+ * @brief Función para leer las opciones nombre=valor de los argumentos de entrada
+ * @param argc Cantidad de argumentos de entrada
+ * @param argv Argumentos de entrada
+ * @param first Índice del primer argumento opcional
+ * @return Opciones de la ejecución
+ * */
+MiniBatchOptions parse_minibatch_options(int argc, char** argv, int first) {
+    MiniBatchOptions options;
+    for (int i = first; i < argc; i++) {
+        string argument = argv[i];
+        size_t separator = argument.find('=');
+        if (separator == string::npos)
+            throw std::invalid_argument("Invalid option (expected name=value): " + argument);
+        string name = argument.substr(0, separator);
+        string value = argument.substr(separator + 1);
+        if (name == "batch") {
+            size_t parsed = 0;
+            options.batch_size = stoll(value, &parsed);
+            if (parsed != value.size() || options.batch_size < 1)
+                throw std::invalid_argument("Invalid batch size: " + value);
+        } else if (name == "sampling") {
+            options.sampling = parse_sampling_mode(value);
+        } else if (name == "seed") {
+            size_t parsed = 0;
+            options.seed = stoull(value, &parsed);
+            if (parsed != value.size())
+                throw std::invalid_argument("Invalid seed: " + value);
+        } else if (name == "output") {
+            options.output_mode = parse_output_mode(value);
+        } else {
+            throw std::invalid_argument("Unknown option: " + name);
+        }
+    }
+    return options;
+}
+
+/**
+ * @name assign_batch
+ * @brief Función para asignar cada punto del lote a su centroide más cercano repartiendo los bloques del lote entre los hilos
+ * @param centroids Conjunto de centroides por columnas
+ * @param points Puntos del lote; su arreglo de clusters recibe el centroide más cercano
+ * @param rows Cantidad de puntos válidos del lote
+ * */
+void assign_batch(const Dataset& centroids, Dataset& points, long long int rows) {
+    const NearestCentroidsKernel nearest_centroids = select_nearest_centroids_kernel(points.dimension());
+    int32_t* labels = points.labels();
+    #pragma omp parallel for shared(centroids, points, labels) schedule(static)
+    for (long long int begin = 0; begin < rows; begin += KERNEL_BLOCK_SIZE) {
+        nearest_centroids(points, begin, min(begin + KERNEL_BLOCK_SIZE, rows), centroids, labels + begin, nullptr);
+    }
+}
+
+/**
+ * @name update_centroids
+ * @brief Función para mover cada centroide hacia el promedio de sus puntos del lote. Con tasa de aprendizaje 1 / (puntos recibidos) por punto, aplicar los puntos del lote uno por uno equivale a mover el centroide una fracción (puntos del lote) / (puntos recibidos, incluidos los del lote) hacia su promedio en el lote, lo que permite acumular el lote en paralelo
+ * @param centroids Conjunto de centroides por columnas
+ * @param received Cantidad de puntos que ha recibido cada centroide en todos los lotes
+ * @param points Puntos del lote con su cluster
+ * @param rows Cantidad de puntos válidos del lote
+ * @param accumulator Buffers de acumulación por hilo reservados previamente
+ * */
+void update_centroids(Dataset& centroids, vector<double>& received, const Dataset& points, long long int rows, CentroidAccumulator* accumulator) {
+    const int n_clusters = centroids.size();
+    const int dimension = points.dimension();
+    const int fields = accumulator->fields;
+    accumulate_clusters(points, rows, points.labels(), accumulator);
+    for (int k = 0; k < n_clusters; k++) {
+        const double* slot = accumulator->buffer + (long long int) k * fields;
+        if (slot[dimension] == 0) continue;
+        received[k] += slot[dimension];
+        double rate = slot[dimension] / received[k]; // Tasa de aprendizaje del centroide en este lote
+        for (int d = 0; d < dimension; d++) {
+            double mean = slot[d] / slot[dimension];
+            centroids.at(k, d) += rate * (mean - centroids.at(k, d));
+        }
+    }
+}
+
+/**
+ * @name minibatch_kmeans
+ * @brief Función para llevar a cabo el agrupamiento por lotes. Los centroides iniciales son puntos distintos del primer lote elegidos al azar
+ * @param centroids Conjunto de centroides por columnas; al terminar contiene los centroides finales
+ * @param stream Archivo de puntos
+ * @param max_batches Número de lotes a procesar
+ * @param options Opciones de la ejecución (tamaño del lote, forma de elegir los lotes, semilla)
+ * @param accumulator Buffers de acumulación por hilo reservados previamente
+ * @param wait_time Segundos que los hilos de cálculo esperaron al hilo de lectura
+ * */
+void minibatch_kmeans(Dataset& centroids, PointStream& stream, long long int max_batches, const MiniBatchOptions& options, CentroidAccumulator* accumulator, double& wait_time) {
+    const int n_clusters = centroids.size();
+    const int dimension = stream.dimension();
+    vector<double> received(n_clusters, 0.0);
+    BatchPrefetcher prefetcher(stream, options.batch_size, options.sampling, true, options.seed);
+
+    // Paso 1. Los centroides iniciales son puntos distintos del primer lote (que también se usa como primer lote de entrenamiento)
+    PointBatch* batch = prefetcher.next();
+    if (batch->rows < n_clusters)
+        throw std::invalid_argument("The batch size must be at least the number of clusters");
+    mt19937_64 generator(options.seed ^ 0x9e3779b97f4a7c15ULL);
+    vector<long long int> order(batch->rows);
+    for (long long int i = 0; i < batch->rows; i++) order[i] = i;
+    for (int k = 0; k < n_clusters; k++) {
+        uniform_int_distribution<long long int> pick(k, batch->rows - 1);
+        swap(order[k], order[pick(generator)]);
+        for (int d = 0; d < dimension; d++) {
+            centroids.at(k, d) = batch->points.at(order[k], d);
+        }
+    }
+
+    // Paso 2. Cada lote se asigna y acumula en paralelo mientras el hilo de lectura llena el siguiente
+    for (long long int b = 0; b < max_batches; b++) {
+        if (b > 0) batch = prefetcher.next();
+        assign_batch(centroids, batch->points, batch->rows);
+        update_centroids(centroids, received, batch->points, batch->rows, accumulator);
+    }
+    wait_time = prefetcher.wait_time();
+}
+
+/**
+ * @name label_points
+ * @brief Función para asignar todos los puntos del archivo a los centroides finales en una pasada en orden, escribiendo los clusters en el archivo de salida lote por lote
+ * @param centroids Conjunto de centroides por columnas
+ * @param stream Archivo de puntos
+ * @param options Opciones de la ejecución (tamaño del lote, formato de salida)
+ * @param output_file_name Nombre del archivo de salida
+ * @return Cantidad de puntos del archivo
+ * */
+long long int label_points(const Dataset& centroids, PointStream& stream, const MiniBatchOptions& options, const string& output_file_name) {
+    stream.rewind();
+    BatchPrefetcher prefetcher(stream, options.batch_size, SAMPLING_SEQUENTIAL, false, options.seed);
+    vector<char> buffer;
+    long long int num_points = 0;
+    int fd = open_output(output_file_name);
+    try {
+        for (PointBatch* batch = prefetcher.next(); batch != nullptr; batch = prefetcher.next()) {
+            assign_batch(centroids, batch->points, batch->rows);
+            if (options.output_mode == OUTPUT_CSV) {
+                append_CSV(fd, batch->points, batch->rows, batch->points.labels(), buffer);
+            } else {
+                append_labels(fd, batch->points.labels(), batch->rows);
+            }
+            num_points += batch->rows;
+        }
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+    return num_points;
+}
+
+/**
+ * @name main
+ * @brief Función main del programa
+ * @param argc Cantidad de argumentos de entrada (STDIN)
+ * @param argv Argumentos de entrada (STDIN) [nombre del programa, número de clusters, número de puntos o ruta del archivo de entrada (CSV o binario), número de lotes, número de hilos, opciones nombre=valor (batch=puntos, sampling=random|sequential, seed=n, output=csv|labels|none)]
+ * @return 0 si el programa termina correctamente
+ * */
+int main(int argc, char** argv) {
+    int n_clusters;
+    int num_threads;
+    long long int max_batches;
+    string input_file_name;
+    MiniBatchOptions options;
+    try{
+        if (argc < 5)
+            throw std::invalid_argument("Invalid number of arguments");
+        n_clusters = stoi(argv[1]);
+        input_file_name = resolve_input_file(argv[2]); // Ruta del archivo o número de puntos de ./../Data/<num_points>_data.csv
+        max_batches = stoll(argv[3]);
+        num_threads = stoi(argv[4]);
+        options = parse_minibatch_options(argc, argv, 5);
+        if (n_clusters < 1)
+            throw std::invalid_argument("Invalid number of clusters");
+        if (max_batches < 1)
+            throw std::invalid_argument("Invalid number of batches");
+        if (num_threads < 1)
+            throw std::invalid_argument("Invalid number of threads");
+    } catch (const std::exception& e) {
+        cout << e.what() << "\n";
+        cout << "Usage: ./minibatch_kmeans <n_clusters> <num_points | input_file> <max_batches> <num_threads> " << MINIBATCH_OPTIONS_USAGE << "\n";
+        return 1;
+    }
+    omp_set_num_threads(num_threads);
+
+    // Crea el directorio de resultados de la ejecución por lotes
+    string dir_str = "./../Results/MiniBatch/";
+    struct stat sb;
+    if (stat(dir_str.c_str(), &sb) != 0) {
+        mkdir(dir_str.c_str(), 0777);
+    }
+    string output_prefix = dir_str + file_stem(input_file_name) + "_" + to_string(n_clusters) + "_" + to_string(options.batch_size);
+
+    try{
+        PointStream stream(input_file_name);
+        Dataset centroids(n_clusters, stream.dimension(), false);
+        CentroidAccumulator* accumulator = create_accumulator(num_threads, n_clusters, stream.dimension());
+        double wait_time = 0.0;
+        double start = omp_get_wtime();
+        try{
+            minibatch_kmeans(centroids, stream, max_batches, options, accumulator, wait_time);
+        } catch (...) {
+            free_accumulator(accumulator);
+            throw;
+        }
+        double elapsed = omp_get_wtime() - start;
+        free_accumulator(accumulator);
+        save_centroids(output_prefix + "_centroids.csv", centroids);
+        cout << max_batches << " batches of " << options.batch_size << " points: " << elapsed << " s ("
+             << max_batches * options.batch_size / elapsed << " points/s, " << wait_time << " s waiting for input)" << "\n";
+
+        // Pasada final en orden para escribir el cluster de cada punto del archivo
+        if (options.output_mode != OUTPUT_NONE) {
+            start = omp_get_wtime();
+            long long int num_points = label_points(centroids, stream, options, output_prefix + output_file_suffix(options.output_mode));
+            cout << "Labeled " << num_points << " points: " << omp_get_wtime() - start << " s" << "\n";
+        }
+    } catch (const std::exception& e) {
+        cout << "Error: minibatch_kmeans()" << "\n";
+        cout << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,620 @@
+/**
+ * @file mpi_kmeans.cpp
+ * @date 2023-03-08
+ * @author Diego Hernández Delgado
+ * @author Jesús Isaías García Moreno
+ * @brief Código distribuido del algoritmo k-means con MPI y OpenMP. Cada proceso lee sólo su parte del archivo de entrada y asigna y acumula sus puntos con los hilos de OpenMP igual que parallel_kmeans; en cada iteración los procesos combinan las sumas y las cantidades de puntos de cada cluster con MPI_Allreduce y el proceso 0 transmite los nuevos centroides con MPI_Bcast, de modo que todos los procesos usan exactamente los mismos centroides y deciden lo mismo sobre la convergencia
+ * @param n_clusters Número de clusters o centroides
+ * @param input_file_path Ruta del archivo de entrada (CSV o binario)
+ * @param max_iterations Número máximo de iteraciones
+ * @param num_threads Número de hilos a utilizar en cada proceso
+ * */
+
+// Inclusión de las librerías necesarias para el programa
+#include <mpi.h>
+#include <omp.h>
+#include <iostream>
+#include <string>
+#include <fstream>
+#include <vector>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <bits/stdc++.h>
+#include "dataset.hpp"
+#include "binary_format.hpp"
+#include "centroid_accumulator.hpp"
+#include "distance_kernels.hpp"
+#include "kd_tree.hpp"
+#include "result_writer.hpp"
+#include "run_options.hpp"
+#include "seeding.hpp"
+#include "triangle_bounds.hpp"
+
+using namespace std;
+
+/**
+ * @name Shard
+ * @brief Parte del conjunto de puntos de un proceso y posición de las partes de todos los procesos en el conjunto completo
+ * */
+struct Shard {
+    int rank = 0;                       // Número del proceso
+    int n_ranks = 1;                    // Número de procesos
+    long long int first_row = 0;        // Índice global del primer punto del proceso
+    long long int num_points = 0;       // Número de puntos de todo el conjunto
+    vector<long long int> first_rows;   // Índice global del primer punto de cada proceso, más el total al final
+};
+
+/**
+ * @name describe_shard
+ * @brief Función para conocer la posición de la parte de cada proceso a partir de sus tamaños (las partes se leen en orden de proceso)
+ * @param local_points Número de puntos de este proceso
+ * @return Descripción de las partes
+ * */
+Shard describe_shard(long long int local_points) {
+    Shard shard;
+    MPI_Comm_rank(MPI_COMM_WORLD, &shard.rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &shard.n_ranks);
+    vector<long long int> sizes(shard.n_ranks);
+    MPI_Allgather(&local_points, 1, MPI_LONG_LONG, sizes.data(), 1, MPI_LONG_LONG, MPI_COMM_WORLD);
+    shard.first_rows.assign(shard.n_ranks + 1, 0);
+    for (int r = 0; r < shard.n_ranks; r++) {
+        shard.first_rows[r + 1] = shard.first_rows[r] + sizes[r];
+    }
+    shard.first_row = shard.first_rows[shard.rank];
+    shard.num_points = shard.first_rows[shard.n_ranks];
+    return shard;
+}
+
+/**
+ * @name global_sum
+ * @brief Función para sumar un valor de todos los procesos en orden de proceso, de modo que todos obtienen exactamente la misma suma
+ * @param local Valor de este proceso
+ * @param shard Descripción de las partes
+ * @param rank_values Arreglo donde se guarda el valor de cada proceso
+ * @return Suma de los valores de todos los procesos
+ * */
+double global_sum(double local, const Shard& shard, vector<double>& rank_values) {
+    rank_values.resize(shard.n_ranks);
+    MPI_Allgather(&local, 1, MPI_DOUBLE, rank_values.data(), 1, MPI_DOUBLE, MPI_COMM_WORLD);
+    double total = 0.0;
+    for (int r = 0; r < shard.n_ranks; r++) {
+        total += rank_values[r];
+    }
+    return total;
+}
+
+/**
+ * @name fetch_point
+ * @brief Función para copiar en todos los procesos un punto identificado por su índice global; el proceso que lo tiene lo transmite
+ * @param points Parte del conjunto de puntos de este proceso
+ * @param shard Descripción de las partes
+ * @param global_index Índice global del punto
+ * @param to Conjunto de destino
+ * @param k Índice de la fila de destino
+ * */
+void fetch_point(const Dataset& points, const Shard& shard, long long int global_index, Dataset& to, long long int k) {
+    const int dimension = to.dimension();
+    int owner = upper_bound(shard.first_rows.begin(), shard.first_rows.end(), global_index) - shard.first_rows.begin() - 1;
+    vector<float> coordinates(dimension);
+    if (owner == shard.rank) {
+        for (int d = 0; d < dimension; d++) coordinates[d] = points.at(global_index - shard.first_row, d);
+    }
+    MPI_Bcast(coordinates.data(), dimension, MPI_FLOAT, owner, MPI_COMM_WORLD);
+    for (int d = 0; d < dimension; d++) to.at(k, d) = coordinates[d];
+}
+
+/**
+ * @name mpi_random_centroids
+ * @brief Función para elegir como centroides puntos distintos uniformemente al azar entre todos los procesos. Todos los procesos sortean los mismos índices globales (algoritmo de Floyd) y cada uno aporta las coordenadas de los suyos en una sola suma
+ * @param points Parte del conjunto de puntos de este proceso
+ * @param centroids Conjunto de centroides por columnas donde se guardan
+ * @param seed Semilla
+ * @param shard Descripción de las partes
+ * */
+void mpi_random_centroids(const Dataset& points, Dataset& centroids, uint64_t seed, const Shard& shard) {
+    const long long int n_clusters = centroids.size();
+    const int dimension = centroids.dimension();
+    RandomStream random(seed, SEED_STREAM_FIRST);
+    unordered_set<long long int> chosen;
+    vector<double> coordinates(n_clusters * dimension, 0.0);
+    for (long long int j = shard.num_points - n_clusters; j < shard.num_points; j++) {
+        long long int i = random.below(j + 1);
+        if (!chosen.insert(i).second) {
+            i = j;
+            chosen.insert(j);
+        }
+        long long int k = chosen.size() - 1;
+        if (i >= shard.first_row && i < shard.first_rows[shard.rank + 1]) {
+            for (int d = 0; d < dimension; d++) coordinates[k * dimension + d] = points.at(i - shard.first_row, d);
+        }
+    }
+    // Cada coordenada la aporta un solo proceso; los demás suman 0
+    MPI_Allreduce(MPI_IN_PLACE, coordinates.data(), coordinates.size(), MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    for (long long int k = 0; k < n_clusters; k++) {
+        for (int d = 0; d < dimension; d++) centroids.at(k, d) = coordinates[k * dimension + d];
+    }
+}
+
+/**
+ * @name mpi_kmeans_plus_plus
+ * @brief Función para elegir los centroides con k-means++ entre todos los procesos: cada proceso actualiza las distancias de sus puntos, todos reciben la suma de cada proceso, y el proceso donde cae el valor elegido busca el punto en sus bloques y lo transmite
+ * @param points Parte del conjunto de puntos de este proceso
+ * @param centroids Conjunto de centroides por columnas donde se guardan
+ * @param seed Semilla
+ * @param num_threads Número de hilos a utilizar
+ * @param shard Descripción de las partes
+ * */
+void mpi_kmeans_plus_plus(const Dataset& points, Dataset& centroids, uint64_t seed, int num_threads, const Shard& shard) {
+    const long long int num_points = points.size();
+    const int n_clusters = centroids.size();
+    const long long int n_blocks = (num_points + KERNEL_BLOCK_SIZE - 1) / KERNEL_BLOCK_SIZE;
+    vector<float> min_distances(num_points, numeric_limits<float>::infinity());
+    vector<double> block_sums(n_blocks);
+    vector<double> rank_totals;
+    Dataset newest(1, points.dimension(), false);
+    RandomStream first(seed, SEED_STREAM_FIRST);
+    RandomStream random(seed, SEED_STREAM_PLUS_PLUS);
+    fetch_point(points, shard, first.below(shard.num_points), centroids, 0);
+    for (int k = 1; k < n_clusters; k++) {
+        copy_point(centroids, k - 1, newest, 0);
+        double local = update_min_distances(points, newest, min_distances, block_sums, num_threads);
+        double total = global_sum(local, shard, rank_totals);
+        long long int chosen = -1;
+        if (total > 0.0) {
+            // Todos los procesos sortean el mismo valor y recorren las sumas por proceso hasta encontrar el proceso que lo tiene
+            double target = random.uniform() * total;
+            int owner = 0;
+            while (owner + 1 < shard.n_ranks && target >= rank_totals[owner]) target -= rank_totals[owner++];
+            if (owner == shard.rank) {
+                long long int local_chosen = pick_weighted_point(min_distances, block_sums, target);
+                chosen = local_chosen < 0 ? -1 : shard.first_row + local_chosen;
+            }
+            MPI_Bcast(&chosen, 1, MPI_LONG_LONG, owner, MPI_COMM_WORLD);
+        }
+        // Todos los puntos coinciden con algún centroide: se repite un punto al azar
+        if (chosen < 0) chosen = random.below(shard.num_points);
+        fetch_point(points, shard, chosen, centroids, k);
+    }
+}
+
+/**
+ * @name mpi_kmeans_parallel
+ * @brief Función para elegir los centroides con k-means|| entre todos los procesos: cada proceso sortea sus puntos en cada ronda con los flujos de sus bloques (identificados por el índice global del bloque), los candidatos de todos los procesos se juntan con MPI_Allgatherv en orden de proceso y sus pesos se suman con MPI_Allreduce; todos los procesos agrupan los mismos candidatos de la misma forma
+ * @param points Parte del conjunto de puntos de este proceso
+ * @param centroids Conjunto de centroides por columnas donde se guardan
+ * @param seed Semilla
+ * @param num_threads Número de hilos a utilizar
+ * @param shard Descripción de las partes
+ * */
+void mpi_kmeans_parallel(const Dataset& points, Dataset& centroids, uint64_t seed, int num_threads, const Shard& shard) {
+    const long long int num_points = points.size();
+    const int n_clusters = centroids.size();
+    const int dimension = points.dimension();
+    const long long int n_blocks = (num_points + KERNEL_BLOCK_SIZE - 1) / KERNEL_BLOCK_SIZE;
+    const double oversampling = KMEANS_PARALLEL_OVERSAMPLING * n_clusters;
+    vector<float> min_distances(num_points, numeric_limits<float>::infinity());
+    vector<double> block_sums(n_blocks);
+    vector<double> rank_totals;
+    vector<float> candidates; // Coordenadas de los candidatos, un renglón de dimension valores por candidato
+
+    RandomStream first(seed, SEED_STREAM_FIRST);
+    Dataset selected(1, dimension, false);
+    fetch_point(points, shard, first.below(shard.num_points), selected, 0);
+    for (int d = 0; d < dimension; d++) candidates.push_back(selected.at(0, d));
+    double total = global_sum(update_min_distances(points, selected, min_distances, block_sums, num_threads), shard, rank_totals);
+
+    vector<int> counts(shard.n_ranks);
+    vector<int> offsets(shard.n_ranks);
+    for (int round = 0; round < KMEANS_PARALLEL_ROUNDS && total > 0.0; round++) {
+        vector<long long int> round_selected = oversample_round(min_distances, total, oversampling, seed, round, shard.first_row, num_threads);
+        vector<float> local(round_selected.size() * dimension);
+        for (size_t s = 0; s < round_selected.size(); s++) {
+            for (int d = 0; d < dimension; d++) local[s * dimension + d] = points.at(round_selected[s], d);
+        }
+        int local_count = local.size();
+        MPI_Allgather(&local_count, 1, MPI_INT, counts.data(), 1, MPI_INT, MPI_COMM_WORLD);
+        long long int n_values = 0;
+        for (int r = 0; r < shard.n_ranks; r++) {
+            offsets[r] = n_values;
+            n_values += counts[r];
+        }
+        if (n_values == 0) continue;
+        vector<float> gathered(n_values);
+        MPI_Allgatherv(local.data(), local_count, MPI_FLOAT, gathered.data(), counts.data(), offsets.data(), MPI_FLOAT, MPI_COMM_WORLD);
+        const long long int n_selected = n_values / dimension;
+        selected = Dataset(n_selected, dimension, false);
+        for (long long int s = 0; s < n_selected; s++) {
+            for (int d = 0; d < dimension; d++) selected.at(s, d) = gathered[s * dimension + d];
+        }
+        candidates.insert(candidates.end(), gathered.begin(), gathered.end());
+        total = global_sum(update_min_distances(points, selected, min_distances, block_sums, num_threads), shard, rank_totals);
+    }
+
+    // Con pocos candidatos (por ejemplo puntos repetidos) se completan con puntos distintos al azar
+    const long long int n_candidates = candidates.size() / dimension;
+    if (n_candidates < n_clusters) {
+        mpi_random_centroids(points, centroids, seed, shard);
+        return;
+    }
+
+    // Peso de cada candidato: cantidad de puntos de todos los procesos que lo tienen como candidato más cercano
+    Dataset candidate_points(n_candidates, dimension, false);
+    for (long long int c = 0; c < n_candidates; c++) {
+        for (int d = 0; d < dimension; d++) candidate_points.at(c, d) = candidates[c * dimension + d];
+    }
+    vector<double> weights = candidate_weights(points, candidate_points, num_threads);
+    MPI_Allreduce(MPI_IN_PLACE, weights.data(), n_candidates, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    weighted_recluster(candidate_points, weights, centroids, seed);
+}
+
+/**
+ * @name mpi_initialize_centroids
+ * @brief Función para elegir los centroides iniciales con la forma indicada entre todos los procesos; todos obtienen los mismos centroides
+ * @param points Parte del conjunto de puntos de este proceso
+ * @param centroids Conjunto de centroides por columnas donde se guardan
+ * @param method Forma de elegir los centroides iniciales
+ * @param seed Semilla
+ * @param num_threads Número de hilos a utilizar
+ * @param shard Descripción de las partes
+ * */
+void mpi_initialize_centroids(const Dataset& points, Dataset& centroids, InitMethod method, uint64_t seed, int num_threads, const Shard& shard) {
+    if (shard.num_points < centroids.size())
+        throw std::invalid_argument("There are fewer points than clusters");
+    switch (method) {
+        case INIT_RANDOM: mpi_random_centroids(points, centroids, seed, shard); break;
+        case INIT_KMEANS_PLUS_PLUS: mpi_kmeans_plus_plus(points, centroids, seed, num_threads, shard); break;
+        case INIT_KMEANS_PARALLEL: mpi_kmeans_parallel(points, centroids, seed, num_threads, shard); break;
+    }
+}
+
+/**
+ * @name assign_points
+ * @brief Función para asignar cada punto de este proceso a su centroide más cercano repartiendo el rango de puntos entre los hilos, como en parallel_kmeans
+ * @param centroids Conjunto de centroides por columnas
+ * @param points Parte del conjunto de puntos de este proceso con el cluster de cada punto
+ * @param bounds Cotas de Hamerly, Elkan o Yinyang para evitar distancias innecesarias, o nullptr para calcularlas todas (Lloyd)
+ * @param tree Árbol kd de los puntos de este proceso (algorithm=kdtree), o nullptr
+ * @param accumulator Buffers de acumulación por hilo; con el árbol kd quedan con las sumas de cada cluster para update_centroids
+ * @return Cantidad de puntos de este proceso que cambiaron de cluster
+ * */
+long long int assign_points(const Dataset& centroids, Dataset& points, TriangleBounds* bounds, KdTree* tree, CentroidAccumulator* accumulator) {
+    // El árbol kd asigna y acumula en la misma pasada
+    if (tree != nullptr) {
+        return tree->assign(centroids, points, accumulator);
+    }
+    const long long int num_points = points.size();
+    const NearestCentroidsKernel nearest_centroids = select_nearest_centroids_kernel(points.dimension());
+    int32_t* labels = points.labels();
+    long long int changed = 0;
+    if (bounds != nullptr) {
+        bounds->begin_pass(centroids);
+    }
+
+    #pragma omp parallel shared(centroids, points, labels, bounds) reduction(+:changed)
+    {
+        vector<int32_t> block_labels(KERNEL_BLOCK_SIZE);
+        #pragma omp for schedule(static)
+        for (long long int begin = 0; begin < num_points; begin += KERNEL_BLOCK_SIZE) {
+            long long int end = min(begin + KERNEL_BLOCK_SIZE, num_points);
+            if (bounds != nullptr) {
+                bounds->nearest_centroids(points, begin, end, centroids, block_labels.data());
+            } else {
+                nearest_centroids(points, begin, end, centroids, block_labels.data(), nullptr);
+            }
+            for (long long int i = begin; i < end; i++) {
+                changed += labels[i] != block_labels[i - begin];
+                labels[i] = block_labels[i - begin];
+            }
+        }
+    }
+    return changed;
+}
+
+/**
+ * @name update_centroids
+ * @brief Función para actualizar los centroides con las sumas de todos los procesos. Cada proceso acumula sus puntos con los bloques por hilo; las sumas, las cantidades de puntos y la cantidad de puntos que cambiaron de cluster se combinan con un solo MPI_Allreduce, y el proceso 0 calcula los promedios y los transmite para que todos los procesos tengan exactamente los mismos centroides
+ * @param centroids Conjunto de centroides por columnas
+ * @param points Parte del conjunto de puntos de este proceso con el cluster de cada punto
+ * @param accumulator Buffers de acumulación por hilo reservados previamente
+ * @param tree Árbol kd que ya dejó las sumas en el acumulador durante la asignación, o nullptr para sumar los puntos aquí
+ * @param changed Cantidad de puntos de este proceso que cambiaron de cluster
+ * @param shard Descripción de las partes
+ * @param comm_time Segundos de comunicación entre procesos (se acumulan)
+ * @return Cantidad de puntos de todos los procesos que cambiaron de cluster
+ * */
+long long int update_centroids(Dataset& centroids, const Dataset& points, CentroidAccumulator* accumulator, const KdTree* tree, long long int changed, const Shard& shard, double& comm_time) {
+    const int n_clusters = centroids.size();
+    const int dimension = points.dimension();
+    const int fields = accumulator->fields;
+    const long long int n_sums = (long long int) n_clusters * fields;
+    if (tree == nullptr) {
+        accumulate_clusters(points, points.size(), points.labels(), accumulator);
+    }
+
+    // [suma de cada coordenada, cantidad] de cada cluster seguidas de la cantidad de puntos que cambiaron de cluster
+    vector<double> sums(n_sums + 1);
+    copy(accumulator->buffer, accumulator->buffer + n_sums, sums.begin());
+    sums[n_sums] = changed;
+    vector<float> coordinates((long long int) n_clusters * dimension);
+    double start = MPI_Wtime();
+    MPI_Allreduce(MPI_IN_PLACE, sums.data(), n_sums + 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    if (shard.rank == 0) {
+        for (int i = 0; i < n_clusters; i++) {
+            const double* slot = sums.data() + (long long int) i * fields;
+            for (int d = 0; d < dimension; d++) {
+                coordinates[(long long int) i * dimension + d] = slot[dimension] != 0 ? slot[d] / slot[dimension] : centroids.at(i, d);
+            }
+        }
+    }
+    MPI_Bcast(coordinates.data(), coordinates.size(), MPI_FLOAT, 0, MPI_COMM_WORLD);
+    comm_time += MPI_Wtime() - start;
+    for (int i = 0; i < n_clusters; i++) {
+        for (int d = 0; d < dimension; d++) {
+            centroids.at(i, d) = coordinates[(long long int) i * dimension + d];
+        }
+    }
+    return (long long int) sums[n_sums];
+}
+
+/**
+ * @name kmeans
+ * @brief Función para llevar a cabo el agrupamiento con el algoritmo de k-means entre todos los procesos
+ * @param points Parte del conjunto de puntos de este proceso; al terminar contiene el cluster de cada punto
+ * @param n_clusters Número de clusters o centroides
+ * @param max_iterations Número máximo de iteraciones
+ * @param accumulator Buffers de acumulación por hilo reutilizados por update_centroids
+ * @param bounds Cotas de los puntos de este proceso reutilizadas por assign_points, o nullptr para la asignación completa (Lloyd)
+ * @param tree Árbol kd de los puntos de este proceso reutilizado por assign_points (algorithm=kdtree), o nullptr
+ * @param init Forma de elegir los centroides iniciales
+ * @param seed Semilla de la elección de los centroides iniciales
+ * @param shard Descripción de las partes
+ * @param init_time Segundos que tomó elegir los centroides iniciales
+ * @param comm_time Segundos de comunicación entre procesos en las iteraciones
+ * @return Número de iteraciones después de la primera asignación
+ * */
+long long int kmeans(Dataset& points, int n_clusters, long long int max_iterations, CentroidAccumulator* accumulator, TriangleBounds* bounds, KdTree* tree, InitMethod init, uint64_t seed, const Shard& shard, double& init_time, double& comm_time) {
+    // Paso 1. Elegir k centroides iniciales entre los puntos de todos los procesos
+    Dataset centroids(n_clusters, points.dimension(), false);
+    double init_start = MPI_Wtime();
+    mpi_initialize_centroids(points, centroids, init, seed, omp_get_max_threads(), shard);
+    init_time = MPI_Wtime() - init_start;
+    comm_time = 0.0;
+
+    // Paso 2 y 3. Asignar los puntos de cada proceso y actualizar los centroides con las sumas de todos
+    if (bounds != nullptr) {
+        bounds->reset();
+    }
+    if (tree != nullptr) {
+        tree->reset(points);
+    }
+    long long int changed = assign_points(centroids, points, bounds, tree, accumulator);
+    update_centroids(centroids, points, accumulator, tree, changed, shard, comm_time);
+
+    // Paso 4. Repetir hasta que ningún punto de ningún proceso cambie de cluster o hasta el número máximo de iteraciones
+    long long int iteration = 0;
+    long long int global_changed = 1;
+    while (global_changed > 0 && iteration < max_iterations) {
+        changed = assign_points(centroids, points, bounds, tree, accumulator);
+        global_changed = update_centroids(centroids, points, accumulator, tree, changed, shard, comm_time);
+        iteration++;
+    }
+    return iteration;
+}
+
+/**
+ * @name save_shard_results
+ * @brief Función para escribir los resultados de todos los procesos en un solo archivo: los procesos escriben su parte en orden, cada uno después de recibir el turno del anterior
+ * @param file_name Nombre del archivo de resultados
+ * @param points Parte del conjunto de puntos de este proceso con el cluster de cada punto
+ * @param mode Formato de los resultados (csv o labels)
+ * @param shard Descripción de las partes
+ * */
+void save_shard_results(const string& file_name, const Dataset& points, OutputMode mode, const Shard& shard) {
+    int turn = 0;
+    if (shard.rank > 0) {
+        MPI_Recv(&turn, 1, MPI_INT, shard.rank - 1, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    }
+    int fd = shard.rank == 0 ? open_output(file_name) : open(file_name.c_str(), O_WRONLY | O_APPEND);
+    if (fd < 0) throw std::runtime_error("Could not open " + file_name + ": " + strerror(errno));
+    try {
+        if (mode == OUTPUT_CSV) {
+            vector<char> buffer;
+            append_CSV(fd, points, points.size(), points.labels(), buffer);
+        } else {
+            append_labels(fd, points.labels(), points.size());
+        }
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+    if (shard.rank + 1 < shard.n_ranks) {
+        MPI_Send(&turn, 1, MPI_INT, shard.rank + 1, 0, MPI_COMM_WORLD);
+    }
+}
+
+void save_array_to_CSV(string file_name, double* times,  int size) {
+    fstream fout;
+    fout.open(file_name, ios::out);
+    for (int i = 0; i < size; i++) {
+        fout << times[i] << "\n";
+    }
+}
+
+/**
+ * @name main
+ * @brief Función main del programa; se ejecuta con mpirun -np <procesos> y todos los procesos reciben los mismos argumentos
+ * @param argc Cantidad de argumentos de entrada (STDIN)
+ * @param argv Argumentos de entrada (STDIN) [nombre del programa, número de clusters, número de puntos o ruta del archivo de entrada (CSV o binario), número máximo de iteraciones, número de hilos por proceso, opciones nombre=valor (output=csv|labels|none, algorithm=lloyd|hamerly|elkan|yinyang|kdtree, memory=MiB, init=random|kmeans++|kmeans||, seed=n)]
+ * @return 0 si el programa termina correctamente
+ * */
+int main(int argc, char** argv) {
+    // Sólo el hilo principal de cada proceso llama a MPI; los hilos de OpenMP calculan entre llamadas
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+    int rank;
+    int n_ranks;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &n_ranks);
+
+    int n_clusters;
+    int num_threads;
+    long long int max_iterations;
+    string input_file_name;
+    RunOptions options;
+    try{
+        if (argc < 5)
+            throw std::invalid_argument("Invalid number of arguments");
+        n_clusters = stoi(argv[1]);
+        input_file_name = resolve_input_file(argv[2]); // Ruta del archivo o número de puntos de ./../Data/<num_points>_data.csv
+        max_iterations = stoll(argv[3]);
+        num_threads = stoi(argv[4]);
+        options = parse_run_options(argc, argv, 5);
+        if (n_clusters < 1)
+            throw std::invalid_argument("Invalid number of clusters");
+        if (max_iterations < 1)
+            throw std::invalid_argument("Invalid number of iterations");
+        if (!options.trace_prefix.empty())
+            throw std::invalid_argument("trace= is only supported by parallel_kmeans");
+        if (options.storage != STORAGE_FLOAT)
+            throw std::invalid_argument("storage=q16|q8 is only supported by parallel_kmeans");
+        if (options.numa || options.affinity != AFFINITY_NONE)
+            throw std::invalid_argument("numa= and affinity= are only supported by parallel_kmeans");
+        if (options.n_init > 1)
+            throw std::invalid_argument("n_init= is only supported by parallel_kmeans");
+        if (!options.model_file.empty() || !options.warm_file.empty())
+            throw std::invalid_argument("model=, checkpoint= and warm= are only supported by parallel_kmeans");
+        if (options.update_mode == UPDATE_INCREMENTAL)
+            throw std::invalid_argument("update=incremental is only supported by serial_kmeans and parallel_kmeans");
+        if (num_threads < 1)
+            throw std::invalid_argument("Invalid number of threads");
+    } catch (const std::exception& e) {
+        // Todos los procesos leen los mismos argumentos, así que todos terminan; sólo el proceso 0 imprime el error
+        if (rank == 0) {
+            cout << e.what() << "\n";
+            cout << "Usage: mpirun -np <num_processes> ./mpi_kmeans <n_clusters> <num_points | input_file> <max_iterations> <num_threads> " << RUN_OPTIONS_USAGE << "\n";
+        }
+        MPI_Finalize();
+        return 1;
+    }
+    omp_set_num_threads(num_threads);
+
+    // Cada proceso lee sólo su parte del archivo de entrada
+    Dataset points;
+    try{
+        points = load_points_shard(input_file_name, rank, n_ranks, num_threads);
+    } catch (const std::exception& e) {
+        cout << "Error: load_points_shard() in process " << rank << "\n";
+        cout << e.what() << "\n";
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    Shard shard = describe_shard(points.size());
+    const long long int num_points = shard.num_points;
+
+    // El proceso 0 crea los directorios de resultados y de tiempos con el mismo esquema que parallel_kmeans
+    string dir_str = "./../Results/MPI/" + to_string(num_points) + "_Points/" + to_string(n_ranks) + "_Processes_" + to_string(num_threads) + "_Threads/";
+    string dir_str_b = "./../Analysis/MPI/Execution_Times/" + to_string(num_points) + "_Points/";
+    if (rank == 0) {
+        make_directory("./../Results/MPI/");
+        make_directory("./../Results/MPI/" + to_string(num_points) + "_Points/");
+        make_directory(dir_str);
+        make_directory("./../Analysis/MPI/");
+        make_directory("./../Analysis/MPI/Execution_Times/");
+        make_directory(dir_str_b);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    // Buffers de acumulación y cotas (o árbol kd) de los puntos de este proceso, reservados una sola vez para las 10 repeticiones
+    CentroidAccumulator* accumulator = create_accumulator(num_threads, n_clusters, points.dimension());
+    TriangleBounds* bounds = nullptr;
+    if (uses_triangle_bounds(options.algorithm)) {
+        bounds = new TriangleBounds(options.algorithm, points.size(), n_clusters, points.dimension(), options.bounds_memory);
+    }
+    KdTree* tree = nullptr;
+    double tree_build_time = 0.0;
+    if (options.algorithm == ASSIGN_KDTREE) {
+        double tree_start = MPI_Wtime();
+        tree = new KdTree(points, num_threads);
+        double local_build_time = MPI_Wtime() - tree_start;
+        MPI_Reduce(&local_build_time, &tree_build_time, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    }
+
+    double times[11] = {0.0};       // Tiempo de cada repetición (el del proceso más lento)
+    double comm_times[11] = {0.0};  // Tiempo de comunicación de cada repetición (el del proceso con más espera)
+    double init_times[11] = {0.0};  // Tiempo de la elección de los centroides iniciales de cada repetición
+    long long int iterations[11] = {0};
+    double sum_times = 0.0;
+    double sum_comm_times = 0.0;
+    for (int i = 1; i < 11; i++) {
+        double elapsed = 0.0;
+        double init_time = 0.0;
+        double comm_time = 0.0;
+        try{
+            MPI_Barrier(MPI_COMM_WORLD);
+            double start = MPI_Wtime();
+            iterations[i] = kmeans(points, n_clusters, max_iterations, accumulator, bounds, tree, options.init, options.seed + i - 1, shard, init_time, comm_time);
+            elapsed = MPI_Wtime() - start;
+        } catch (const std::exception& e) {
+            cout << "Error: kmeans() in process " << rank << "\n";
+            cout << e.what() << "\n";
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        MPI_Reduce(&elapsed, &times[i], 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+        MPI_Reduce(&comm_time, &comm_times[i], 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+        MPI_Reduce(&init_time, &init_times[i], 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+        sum_times += times[i];
+        sum_comm_times += comm_times[i];
+
+        // Los procesos escriben su parte de los resultados en orden en un solo archivo
+        if (options.output_mode != OUTPUT_NONE) {
+            string output_file_name = dir_str + to_string(i) + "_" + to_string(num_points) + "_" + to_string(n_ranks) + "_" + to_string(num_threads) + output_file_suffix(options.output_mode);
+            try{
+                save_shard_results(output_file_name, points, options.output_mode, shard);
+            } catch (const std::exception& e) {
+                cout << "Error: save_shard_results() in process " << rank << "\n";
+                cout << e.what() << "\n";
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+        }
+    }
+
+    // Distancias que evitaron calcular las cotas (o el árbol kd) en todos los procesos
+    long long int distances[2] = {0, 0};
+    long long int total_distances[2] = {0, 0};
+    if (bounds != nullptr) {
+        distances[0] = bounds->total_distances();
+        distances[1] = bounds->skipped_distances();
+    } else if (tree != nullptr) {
+        distances[0] = tree->total_distances();
+        distances[1] = tree->total_distances() - tree->computed_distances();
+    }
+    MPI_Reduce(distances, total_distances, 2, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+
+    // El proceso 0 guarda los tiempos con el mismo formato que parallel_kmeans (promedio en el primer renglón) y reporta la comunicación
+    if (rank == 0) {
+        times[0] = sum_times / 10.0;
+        string output_file_name = dir_str_b + to_string(n_ranks) + "_processes_" + to_string(num_threads) + "_threads.csv";
+        try{
+            save_array_to_CSV(output_file_name, times, 11);
+        } catch (const std::exception& e) {
+            cout << "Error: save_to_CSV()" << "\n";
+            cout << e.what() << "\n";
+        }
+        cout << n_ranks << " processes x " << num_threads << " threads, " << num_points << " points: avg " << times[0] << " s, communication avg "
+             << sum_comm_times / 10.0 << " s (" << (sum_times > 0.0 ? 100.0 * sum_comm_times / sum_times : 0.0) << "%)" << "\n";
+        report_iterations(options.init, options.seed, iterations, init_times, 10);
+        if (tree != nullptr) {
+            cout << "kdtree built in " << tree_build_time << " s (slowest process)" << "\n";
+        }
+        if (bounds != nullptr || tree != nullptr) {
+            cout << assignment_algorithm_name(options.algorithm) << ": skipped " << total_distances[1] << " of " << total_distances[0]
+                 << " distance evaluations (" << (total_distances[0] > 0 ? 100.0 * total_distances[1] / total_distances[0] : 0.0) << "%)" << "\n";
+        }
+    }
+
+    free_accumulator(accumulator);
+    delete bounds;
+    delete tree;
+    MPI_Finalize();
+    return 0;
+}
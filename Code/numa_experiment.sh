@@ -0,0 +1,25 @@
+# Parallel K-Means NUMA Placement
+# Author: Diego Hernández Delgado
+# Author: Jesús Isaías García Moreno
+# Date: 2023-03-08
+
+# Parameters
+num_points="4000000"
+num_threads=("12" "24")
+num_threads_size=${#num_threads[@]}
+n_clusters="13"
+max_iterations="20"
+placements=("numa=off affinity=none" "numa=off affinity=compact" "numa=on affinity=compact" "numa=on affinity=spread")
+placements_size=${#placements[@]}
+
+# Time every phase with each placement of the memory and the threads; the benchmark prints the NUMA nodes, the threads per node and the
+# percentage of the points and labels on the node of the thread that assigns them, and saves it in the CSV report of ./../Analysis/Benchmark/
+for((i=0; i<num_threads_size; i++))
+do
+    for((j=0; j<placements_size; j++))
+    do
+        echo "NUMA:  ${num_points} points, ${num_threads[i]} threads, ${placements[j]}"
+        ./parallel_kmeans bench $n_clusters $num_points $max_iterations ${num_threads[i]} output=none ${placements[j]} format=csv \
+            file=./../Analysis/Benchmark/${num_points}_Points_${num_threads[i]}_threads_${placements[j]// /_}.csv
+    done
+done
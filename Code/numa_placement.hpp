@@ -0,0 +1,406 @@
+/**
+ * @file numa_placement.hpp
+ * @date 2023-03-08
+ * @author Diego Hernández Delgado
+ * @author Jesús Isaías García Moreno
+ * @brief Colocación de la memoria en máquinas con varios nodos NUMA (numa=on y affinity=). Linux asigna cada página al nodo del hilo que la escribe primero, así que los puntos y sus clusters se copian con el mismo reparto estático por bloques de KERNEL_BLOCK_SIZE que usan la asignación y la acumulación: cada hilo escribe primero las páginas que después recorre en cada iteración. Los hilos se fijan a CPUs según una política de afinidad, los centroides se replican en cada nodo y el bloque de cada hilo del acumulador ocupa páginas propias. La topología se lee de /sys/devices/system/node y el nodo de cada página se consulta con la llamada al sistema move_pages, sin depender de libnuma
+ * */
+
+#ifndef NUMA_PLACEMENT_HPP
+#define NUMA_PLACEMENT_HPP
+
+#include <omp.h>
+#include <dirent.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "centroid_accumulator.hpp"
+#include "dataset.hpp"
+#include "distance_kernels.hpp"
+
+// Tamaño de página en bytes; con columnas alineadas a página cada bloque de KERNEL_BLOCK_SIZE coordenadas en float ocupa exactamente una página
+const long long int NUMA_PAGE_SIZE = 4096;
+// Páginas que se consultan en cada llamada a move_pages
+const long long int NUMA_QUERY_PAGES = 4096;
+
+/**
+ * @name page_padded_bytes
+ * @brief Función para redondear un tamaño a páginas completas, como las reservas de Dataset::untouched con alineación NUMA_PAGE_SIZE
+ * @param bytes Cantidad de bytes útiles
+ * @return Bytes hasta el final de la última página (al menos una página)
+ * */
+inline long long int page_padded_bytes(long long int bytes) {
+    return std::max((bytes + NUMA_PAGE_SIZE - 1) / NUMA_PAGE_SIZE * NUMA_PAGE_SIZE, NUMA_PAGE_SIZE);
+}
+
+/**
+ * @name AffinityPolicy
+ * @brief Forma de fijar los hilos de OpenMP a las CPUs
+ * */
+enum AffinityPolicy { AFFINITY_NONE, AFFINITY_COMPACT, AFFINITY_SPREAD };
+
+/**
+ * @name parse_affinity_policy
+ * @brief Función para convertir el argumento de entrada en una política de afinidad
+ * @param argument "none" (el sistema mueve los hilos), "compact" (se llenan las CPUs de un nodo antes de pasar al siguiente) o "spread" (los hilos se reparten por turnos entre los nodos)
+ * @return Política de afinidad
+ * */
+inline AffinityPolicy parse_affinity_policy(const std::string& argument) {
+    if (argument == "none") return AFFINITY_NONE;
+    if (argument == "compact") return AFFINITY_COMPACT;
+    if (argument == "spread") return AFFINITY_SPREAD;
+    throw std::invalid_argument("Invalid affinity (none, compact or spread): " + argument);
+}
+
+/**
+ * @name affinity_policy_name
+ * @brief Función para obtener el nombre de una política de afinidad
+ * @param policy Política de afinidad
+ * @return Nombre de la política
+ * */
+inline const char* affinity_policy_name(AffinityPolicy policy) {
+    switch (policy) {
+        case AFFINITY_COMPACT: return "compact";
+        case AFFINITY_SPREAD: return "spread";
+        default: return "none";
+    }
+}
+
+/**
+ * @name parse_cpu_list
+ * @brief Función para leer una lista de CPUs con el formato de /sys (por ejemplo "0-3,8,10-11")
+ * @param text Lista de CPUs
+ * @return Números de las CPUs
+ * */
+inline std::vector<int> parse_cpu_list(const std::string& text) {
+    std::vector<int> cpus;
+    size_t position = 0;
+    while (position < text.size()) {
+        size_t comma = text.find(',', position);
+        if (comma == std::string::npos) comma = text.size();
+        std::string range = text.substr(position, comma - position);
+        size_t dash = range.find('-');
+        if (!range.empty() && range.find_first_not_of("0123456789-\n") == std::string::npos) {
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+        }
+        position = comma + 1;
+    }
+    return cpus;
+}
+
+/**
+ * @name NumaTopology
+ * @brief Nodos NUMA y CPUs que el proceso puede usar
+ * */
+struct NumaTopology {
+    int n_nodes;                // Cantidad de nodos con alguna CPU permitida
+    std::vector<int> cpus;      // CPUs permitidas por la afinidad del proceso
+    std::vector<int> cpu_node;  // Nodo de cada CPU permitida, en el mismo orden que cpus
+};
+
+/**
+ * @name numa_topology
+ * @brief Función para leer los nodos de /sys/devices/system/node y quedarse con las CPUs de la afinidad del proceso. Sin ese directorio (kernel sin NUMA) todas las CPUs son del nodo 0
+ * @return Topología de la máquina
+ * */
+inline NumaTopology numa_topology() {
+    NumaTopology topology;
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        CPU_SET(0, &allowed);
+    }
+    std::vector<int> node_of(CPU_SETSIZE, 0);
+    DIR* directory = opendir("/sys/devices/system/node");
+    if (directory != nullptr) {
+        while (dirent* entry = readdir(directory)) {
+            const char* name = entry->d_name;
+            if (strncmp(name, "node", 4) != 0 || name[4] < '0' || name[4] > '9') continue;
+            std::ifstream list(std::string("/sys/devices/system/node/") + name + "/cpulist");
+            std::string text;
+            std::getline(list, text);
+            for (int cpu : parse_cpu_list(text)) {
+                if (cpu < CPU_SETSIZE) node_of[cpu] = atoi(name + 4);
+            }
+        }
+        closedir(directory);
+    }
+    std::vector<int> nodes;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed)) continue;
+        topology.cpus.push_back(cpu);
+        topology.cpu_node.push_back(node_of[cpu]);
+        nodes.push_back(node_of[cpu]);
+    }
+    std::sort(nodes.begin(), nodes.end());
+    topology.n_nodes = std::unique(nodes.begin(), nodes.end()) - nodes.begin();
+    return topology;
+}
+
+/**
+ * @name node_of_cpu
+ * @brief Función para obtener el nodo de una CPU
+ * @param topology Topología de la máquina
+ * @param cpu Número de la CPU
+ * @return Nodo de la CPU (0 si no es una CPU permitida)
+ * */
+inline int node_of_cpu(const NumaTopology& topology, int cpu) {
+    for (size_t c = 0; c < topology.cpus.size(); c++) {
+        if (topology.cpus[c] == cpu) return topology.cpu_node[c];
+    }
+    return 0;
+}
+
+/**
+ * @name affinity_cpu_order
+ * @brief Función para ordenar las CPUs permitidas según la política: el hilo t se fija a la CPU t (módulo la cantidad de CPUs). Con compact se recorren los nodos uno tras otro; con spread se toma una CPU de cada nodo por turnos, de modo que hilos consecutivos quedan en nodos distintos
+ * @param policy Política de afinidad
+ * @param topology Topología de la máquina
+ * @return CPUs en el orden en que se asignan a los hilos
+ * */
+inline std::vector<int> affinity_cpu_order(AffinityPolicy policy, const NumaTopology& topology) {
+    std::vector<std::pair<int, int>> by_node; // (nodo, CPU)
+    for (size_t c = 0; c < topology.cpus.size(); c++) {
+        by_node.push_back({topology.cpu_node[c], topology.cpus[c]});
+    }
+    std::sort(by_node.begin(), by_node.end());
+    std::vector<int> order;
+    if (policy == AFFINITY_SPREAD) {
+        // Posición de cada CPU dentro de su nodo; se ordena por esa posición y luego por nodo
+        std::vector<std::pair<std::pair<int, int>, int>> turns;
+        for (size_t c = 0; c < by_node.size(); c++) {
+            int rank = c > 0 && by_node[c - 1].first == by_node[c].first ? turns.back().first.first + 1 : 0;
+            turns.push_back({{rank, by_node[c].first}, by_node[c].second});
+        }
+        std::sort(turns.begin(), turns.end());
+        for (const auto& turn : turns) order.push_back(turn.second);
+    } else {
+        for (const auto& cpu : by_node) order.push_back(cpu.second);
+    }
+    return order;
+}
+
+/**
+ * @name place_threads
+ * @brief Función para fijar cada hilo de OpenMP a una CPU según la política y obtener el nodo en el que queda. libgomp reutiliza los mismos hilos en las regiones paralelas siguientes con la misma cantidad de hilos, así que la afinidad se conserva en toda la ejecución. Con affinity=none los hilos no se fijan y el nodo es el de la CPU en la que estaban al llamarla
+ * @param policy Política de afinidad
+ * @param num_threads Número de hilos de OpenMP
+ * @param topology Topología de la máquina
+ * @return Nodo de cada hilo
+ * */
+inline std::vector<int> place_threads(AffinityPolicy policy, int num_threads, const NumaTopology& topology) {
+    const std::vector<int> order = affinity_cpu_order(policy, topology);
+    std::vector<int> thread_nodes(num_threads, 0);
+    bool failed = false;
+    #pragma omp parallel num_threads(num_threads) reduction(||:failed)
+    {
+        int thread_id = omp_get_thread_num();
+        if (policy != AFFINITY_NONE && !order.empty()) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(order[thread_id % order.size()], &set);
+            failed = sched_setaffinity(0, sizeof(set), &set) != 0;
+        }
+        thread_nodes[thread_id] = node_of_cpu(topology, sched_getcpu());
+    }
+    if (failed) throw std::runtime_error("sched_setaffinity() could not pin the OpenMP threads");
+    return thread_nodes;
+}
+
+/**
+ * @name first_touch_copy
+ * @brief Función para copiar los puntos y sus clusters en columnas alineadas a página que escribe primero el hilo que las recorre: el ciclo tiene las mismas iteraciones y el mismo reparto estático que los de assign_points y accumulate_clusters, así que con la misma cantidad de hilos cada bloque queda en el nodo de su hilo. Sirve tanto para un CSV leído (cuyas columnas llenó el hilo principal al reservarlas) como para un binario proyectado (cuyas páginas son de la caché de archivos)
+ * @param points Conjunto de puntos por columnas con el cluster de cada punto
+ * @param num_threads Número de hilos de OpenMP
+ * @return Copia de los puntos colocada en los nodos de los hilos
+ * */
+inline Dataset first_touch_copy(const Dataset& points, int num_threads) {
+    const long long int num_points = points.size();
+    const int dimension = points.dimension();
+    // Elementos de cada columna hasta el final de su última página (el relleno también lo escribe el hilo del último bloque)
+    const long long int padded = page_padded_bytes(num_points * sizeof(float)) / sizeof(float);
+    Dataset local = Dataset::untouched(num_points, dimension, NUMA_PAGE_SIZE);
+    int32_t* labels = local.labels();
+    const int32_t* source_labels = points.labels();
+    #pragma omp parallel num_threads(num_threads)
+    {
+        #pragma omp for schedule(static)
+        for (long long int begin = 0; begin < num_points; begin += KERNEL_BLOCK_SIZE) {
+            long long int end = std::min(begin + KERNEL_BLOCK_SIZE, num_points);
+            long long int fill_end = end == num_points ? padded : end;
+            for (int d = 0; d < dimension; d++) {
+                const float* source = points.column(d);
+                float* column = local.column(d);
+                for (long long int i = begin; i < end; i++) column[i] = source[i];
+                for (long long int i = end; i < fill_end; i++) column[i] = 0.0f;
+            }
+            for (long long int i = begin; i < end; i++) labels[i] = source_labels[i];
+            for (long long int i = end; i < fill_end; i++) labels[i] = 0;
+        }
+    }
+    return local;
+}
+
+/**
+ * @name create_local_accumulator
+ * @brief Función para reservar los buffers de acumulación por hilo con cada bloque en páginas propias y escrito primero por su hilo, de modo que las sumas de cada hilo quedan en su nodo
+ * @param n_threads Número de hilos que usarán el acumulador
+ * @param n_clusters Número de clusters o centroides
+ * @param dimension Número de coordenadas de cada punto
+ * @return Apuntador al acumulador reservado
+ * */
+inline CentroidAccumulator* create_local_accumulator(int n_threads, int n_clusters, int dimension) {
+    CentroidAccumulator* accumulator = create_accumulator(n_threads, n_clusters, dimension, NUMA_PAGE_SIZE);
+    #pragma omp parallel num_threads(n_threads)
+    {
+        double* local = accumulator->buffer + omp_get_thread_num() * accumulator->stride;
+        for (long long int f = 0; f < accumulator->stride; f++) {
+            local[f] = 0.0;
+        }
+    }
+    return accumulator;
+}
+
+/**
+ * @name CentroidReplicas
+ * @brief Copias de los centroides, una por nodo, en páginas escritas primero por un hilo de ese nodo. La asignación lee las coordenadas de los centroides para cada bloque de puntos, así que cada hilo lee la copia de su nodo; refresh las actualiza antes de cada pasada
+ * */
+class CentroidReplicas {
+public:
+    /**
+     * @name CentroidReplicas
+     * @brief Constructor que reserva una copia por cada nodo en el que hay hilos; el primer hilo de cada nodo la escribe
+     * @param thread_nodes Nodo de cada hilo (place_threads)
+     * @param n_clusters Número de clusters o centroides
+     * @param dimension Número de coordenadas de cada centroide
+     * */
+    CentroidReplicas(const std::vector<int>& thread_nodes, int n_clusters, int dimension) : thread_replica_(thread_nodes.size()) {
+        std::vector<int> nodes;
+        std::vector<int> first_thread;
+        for (size_t t = 0; t < thread_nodes.size(); t++) {
+            size_t r = std::find(nodes.begin(), nodes.end(), thread_nodes[t]) - nodes.begin();
+            if (r == nodes.size()) {
+                nodes.push_back(thread_nodes[t]);
+                first_thread.push_back(t);
+            }
+            thread_replica_[t] = r;
+        }
+        replicas_.resize(nodes.size());
+        #pragma omp parallel num_threads(thread_nodes.size())
+        {
+            int thread_id = omp_get_thread_num();
+            int r = thread_replica_[thread_id];
+            if (first_thread[r] == thread_id) {
+                Dataset replica = Dataset::untouched(n_clusters, dimension, NUMA_PAGE_SIZE);
+                for (int d = 0; d < dimension; d++) {
+                    memset(replica.column(d), 0, page_padded_bytes(n_clusters * sizeof(float)));
+                }
+                memset(replica.labels(), 0, page_padded_bytes(n_clusters * sizeof(int32_t)));
+                replicas_[r] = std::move(replica);
+            }
+        }
+    }
+
+    /**
+     * @name refresh
+     * @brief Función para copiar los centroides actuales en la copia de cada nodo (las páginas ya están colocadas, así que escribirlas desde otro hilo no las mueve)
+     * @param centroids Conjunto de centroides por columnas
+     * */
+    void refresh(const Dataset& centroids) {
+        for (Dataset& replica : replicas_) {
+            for (int d = 0; d < centroids.dimension(); d++) {
+                memcpy(replica.column(d), centroids.column(d), centroids.size() * sizeof(float));
+            }
+        }
+    }
+
+    // Copia de los centroides del nodo del hilo thread_id
+    const Dataset& for_thread(int thread_id) const { return replicas_[thread_replica_[thread_id]]; }
+    // Cantidad de copias (nodos con hilos)
+    int size() const { return replicas_.size(); }
+
+private:
+    std::vector<Dataset> replicas_;   // Copia de cada nodo con hilos
+    std::vector<int> thread_replica_; // Copia que lee cada hilo
+};
+
+/**
+ * @name PageLocality
+ * @brief Bytes de las columnas de los puntos y de los clusters según el nodo de sus páginas respecto al nodo del hilo que las recorre en la asignación
+ * */
+struct PageLocality {
+    bool available = false;          // Si move_pages pudo consultar las páginas
+    long long int local_bytes = 0;   // En el nodo del hilo que las recorre
+    long long int remote_bytes = 0;  // En otro nodo
+    long long int unplaced_bytes = 0; // Páginas que todavía no existen (nunca se escribieron)
+
+    // Porcentaje de los bytes colocados que son locales
+    double local_percent() const {
+        long long int placed = local_bytes + remote_bytes;
+        return placed > 0 ? 100.0 * local_bytes / placed : 0.0;
+    }
+};
+
+/**
+ * @name measure_page_locality
+ * @brief Función para estimar cuántos de los bytes que lee cada pasada de asignación son locales: se obtiene el hilo de cada bloque con el mismo reparto estático que assign_points y se consulta con move_pages (sin mover nada) el nodo de cada página de las columnas y de los clusters
+ * @param points Conjunto de puntos por columnas con el cluster de cada punto
+ * @param thread_nodes Nodo de cada hilo (place_threads)
+ * @return Bytes locales, remotos y sin colocar
+ * */
+inline PageLocality measure_page_locality(const Dataset& points, const std::vector<int>& thread_nodes) {
+    PageLocality locality;
+    const long long int num_points = points.size();
+    const long long int n_blocks = (num_points + KERNEL_BLOCK_SIZE - 1) / KERNEL_BLOCK_SIZE;
+    std::vector<int> owner(n_blocks, 0);
+    #pragma omp parallel num_threads(thread_nodes.size())
+    {
+        #pragma omp for schedule(static)
+        for (long long int begin = 0; begin < num_points; begin += KERNEL_BLOCK_SIZE) {
+            owner[begin / KERNEL_BLOCK_SIZE] = omp_get_thread_num();
+        }
+    }
+    std::vector<const char*> regions;
+    for (int d = 0; d < points.dimension(); d++) regions.push_back(reinterpret_cast<const char*>(points.column(d)));
+    regions.push_back(reinterpret_cast<const char*>(points.labels()));
+    const long long int bytes = num_points * 4; // float y int32_t
+    std::vector<void*> pages;
+    std::vector<int> status;
+    for (const char* region : regions) {
+        const char* first_page = reinterpret_cast<const char*>(reinterpret_cast<uintptr_t>(region) / NUMA_PAGE_SIZE * NUMA_PAGE_SIZE);
+        for (const char* page = first_page; page < region + bytes; page += NUMA_PAGE_SIZE * NUMA_QUERY_PAGES) {
+            pages.clear();
+            for (const char* p = page; p < region + bytes && (long long int) pages.size() < NUMA_QUERY_PAGES; p += NUMA_PAGE_SIZE) {
+                pages.push_back(const_cast<char*>(p));
+            }
+            status.assign(pages.size(), 0);
+            if (syscall(SYS_move_pages, 0, pages.size(), pages.data(), nullptr, status.data(), 0) != 0) return locality;
+            for (size_t p = 0; p < pages.size(); p++) {
+                // Parte de la página que pertenece a la región y bloque del primer elemento de esa parte
+                const char* start = std::max(static_cast<const char*>(pages[p]), region);
+                const char* end = std::min(static_cast<const char*>(pages[p]) + NUMA_PAGE_SIZE, region + bytes);
+                int thread_id = owner[(start - region) / 4 / KERNEL_BLOCK_SIZE];
+                if (status[p] < 0) {
+                    locality.unplaced_bytes += end - start;
+                } else if (status[p] == thread_nodes[thread_id]) {
+                    locality.local_bytes += end - start;
+                } else {
+                    locality.remote_bytes += end - start;
+                }
+            }
+        }
+    }
+    locality.available = true;
+    return locality;
+}
+
+#endif
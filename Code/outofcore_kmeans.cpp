@@ -0,0 +1,339 @@
+/**
+ * @file outofcore_kmeans.cpp
+ * @date 2023-03-08
+ * @author Diego Hernández Delgado
+ * @author Jesús Isaías García Moreno
+ * @brief Código paralelo del algoritmo k-means (Lloyd exacto) para archivos de puntos más grandes que la memoria. Cada iteración es una pasada en orden por el archivo en trozos de tamaño fijo: un hilo de lectura llena el siguiente trozo mientras los hilos de OpenMP asignan y acumulan el actual, y el cluster de cada punto se guarda en un archivo auxiliar compacto para saber si cambió. La memoria es del orden de un trozo más los centroides y sus sumas
+ * @param n_clusters Número de clusters o centroides
+ * @param input_file_path Ruta del archivo de entrada (CSV o binario)
+ * @param max_iterations Número máximo de iteraciones
+ * @param num_threads Número de hilos a utilizar
+ * */
+
+#include <omp.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <bits/stdc++.h>
+#include "dataset.hpp"
+#include "binary_format.hpp"
+#include "centroid_accumulator.hpp"
+#include "csv_io.hpp"
+#include "distance_kernels.hpp"
+#include "label_file.hpp"
+#include "point_stream.hpp"
+#include "result_writer.hpp"
+
+using namespace std;
+
+// Texto de ayuda con las opciones aceptadas
+const char OUTOFCORE_OPTIONS_USAGE[] = "[chunk=points] [seed=n] [output=csv|labels|none]";
+
+/**
+ * @name OutOfCoreOptions
+ * @brief Opciones de la ejecución fuera de memoria con sus valores por defecto
+ * */
+struct OutOfCoreOptions {
+    long long int chunk_size = 1 << 20;     // Puntos por trozo
+    uint64_t seed = 42;                     // Semilla de la elección de los centroides iniciales
+    OutputMode output_mode = OUTPUT_LABELS; // Formato de los resultados
+};
+
+/**
+ * @name parse_outofcore_options
+ * @brief Función para leer las opciones nombre=valor de los argumentos de entrada
+ * @param argc Cantidad de argumentos de entrada
+ * @param argv Argumentos de entrada
+ * @param first Índice del primer argumento opcional
+ * @return Opciones de la ejecución
+ * */
+OutOfCoreOptions parse_outofcore_options(int argc, char** argv, int first) {
+    OutOfCoreOptions options;
+    for (int i = first; i < argc; i++) {
+        string argument = argv[i];
+        size_t separator = argument.find('=');
+        if (separator == string::npos)
+            throw std::invalid_argument("Invalid option (expected name=value): " + argument);
+        string name = argument.substr(0, separator);
+        string value = argument.substr(separator + 1);
+        if (name == "chunk") {
+            size_t parsed = 0;
+            options.chunk_size = stoll(value, &parsed);
+            if (parsed != value.size() || options.chunk_size < 1)
+                throw std::invalid_argument("Invalid chunk size: " + value);
+        } else if (name == "seed") {
+            size_t parsed = 0;
+            options.seed = stoull(value, &parsed);
+            if (parsed != value.size())
+                throw std::invalid_argument("Invalid seed: " + value);
+        } else if (name == "output") {
+            options.output_mode = parse_output_mode(value);
+        } else {
+            throw std::invalid_argument("Unknown option: " + name);
+        }
+    }
+    return options;
+}
+
+/**
+ * @name PassStats
+ * @brief Tiempos acumulados de las pasadas por el archivo
+ * */
+struct PassStats {
+    long long int passes = 0; // Pasadas completas por el archivo
+    double time = 0.0;        // Segundos de todas las pasadas
+    double wait_time = 0.0;   // Segundos que los hilos de cálculo esperaron al hilo de lectura
+};
+
+/**
+ * @name assign_chunk
+ * @brief Función para asignar cada punto del trozo a su centroide más cercano repartiendo los bloques del trozo entre los hilos
+ * @param centroids Conjunto de centroides por columnas
+ * @param points Puntos del trozo; su arreglo de clusters recibe el centroide más cercano
+ * @param rows Cantidad de puntos válidos del trozo
+ * */
+void assign_chunk(const Dataset& centroids, Dataset& points, long long int rows) {
+    const NearestCentroidsKernel nearest_centroids = select_nearest_centroids_kernel(points.dimension());
+    int32_t* labels = points.labels();
+    #pragma omp parallel for shared(centroids, points, labels) schedule(static)
+    for (long long int begin = 0; begin < rows; begin += KERNEL_BLOCK_SIZE) {
+        nearest_centroids(points, begin, min(begin + KERNEL_BLOCK_SIZE, rows), centroids, labels + begin, nullptr);
+    }
+}
+
+/**
+ * @name sample_centroids
+ * @brief Función para elegir como centroides iniciales n_clusters puntos distintos del archivo, uniformemente al azar, en una sola pasada en orden (muestreo de reservorio con saltos, algoritmo L de Li)
+ * @param centroids Conjunto de centroides por columnas donde se guardan los puntos elegidos
+ * @param stream Archivo de puntos
+ * @param options Opciones de la ejecución (tamaño del trozo, semilla)
+ * @param stats Tiempos de las pasadas
+ * @return Cantidad de puntos del archivo
+ * */
+long long int sample_centroids(Dataset& centroids, PointStream& stream, const OutOfCoreOptions& options, PassStats& stats) {
+    const int n_clusters = centroids.size();
+    const int dimension = centroids.dimension();
+    mt19937_64 generator(options.seed);
+    uniform_real_distribution<double> uniform(0.0, 1.0);
+    uniform_int_distribution<int> slot(0, n_clusters - 1);
+    // Siguiente punto que entra al reservorio después de llenarlo y peso del algoritmo L
+    double weight = exp(log(uniform(generator)) / n_clusters);
+    long long int next = n_clusters + (long long int) floor(log(uniform(generator)) / log(1.0 - weight));
+    long long int num_points = 0;
+
+    double start = omp_get_wtime();
+    stream.rewind();
+    BatchPrefetcher prefetcher(stream, options.chunk_size, SAMPLING_SEQUENTIAL, false, options.seed);
+    for (PointBatch* chunk = prefetcher.next(); chunk != nullptr; chunk = prefetcher.next()) {
+        for (long long int i = 0; i < chunk->rows; i++) {
+            long long int row = chunk->first_row + i;
+            int k = -1;
+            if (row < n_clusters) {
+                k = row;
+            } else if (row == next) {
+                k = slot(generator);
+                weight *= exp(log(uniform(generator)) / n_clusters);
+                next += 1 + (long long int) floor(log(uniform(generator)) / log(1.0 - weight));
+            }
+            if (k < 0) continue;
+            for (int d = 0; d < dimension; d++) {
+                centroids.at(k, d) = chunk->points.at(i, d);
+            }
+        }
+        num_points += chunk->rows;
+    }
+    stats.passes++;
+    stats.time += omp_get_wtime() - start;
+    stats.wait_time += prefetcher.wait_time();
+    if (num_points < n_clusters)
+        throw std::invalid_argument("The input file has fewer points than clusters");
+    return num_points;
+}
+
+/**
+ * @name lloyd_pass
+ * @brief Función para hacer una iteración de Lloyd como una pasada en orden por el archivo: cada trozo se asigna, se compara y guarda en el archivo de clusters y se acumula; al terminar la pasada los centroides se mueven al promedio de sus puntos
+ * @param centroids Conjunto de centroides por columnas
+ * @param stream Archivo de puntos
+ * @param labels Archivo auxiliar con el cluster de cada punto
+ * @param compare Si el archivo de clusters ya tiene los de la pasada anterior (false en la primera pasada)
+ * @param options Opciones de la ejecución (tamaño del trozo)
+ * @param accumulator Buffers de acumulación por hilo reservados previamente
+ * @param stats Tiempos de las pasadas
+ * @return true si al menos un punto cambió de cluster
+ * */
+bool lloyd_pass(Dataset& centroids, PointStream& stream, LabelFile& labels, bool compare, const OutOfCoreOptions& options, CentroidAccumulator* accumulator, PassStats& stats) {
+    const int n_clusters = centroids.size();
+    const int dimension = centroids.dimension();
+    const int fields = accumulator->fields;
+    vector<double> sums((long long int) n_clusters * fields, 0.0); // [suma de cada coordenada, cantidad] de cada cluster en todo el archivo
+    vector<int32_t> previous(compare ? options.chunk_size : 0);
+    bool changed = !compare;
+
+    double start = omp_get_wtime();
+    stream.rewind();
+    BatchPrefetcher prefetcher(stream, options.chunk_size, SAMPLING_SEQUENTIAL, false, options.seed);
+    for (PointBatch* chunk = prefetcher.next(); chunk != nullptr; chunk = prefetcher.next()) {
+        const int32_t* chunk_labels = chunk->points.labels();
+        assign_chunk(centroids, chunk->points, chunk->rows);
+        if (compare && !changed) {
+            labels.read(chunk->first_row, chunk->rows, previous.data());
+            changed = !equal(chunk_labels, chunk_labels + chunk->rows, previous.begin());
+        }
+        labels.write(chunk->first_row, chunk->rows, chunk_labels);
+        accumulate_clusters(chunk->points, chunk->rows, chunk_labels, accumulator);
+        for (long long int f = 0; f < (long long int) n_clusters * fields; f++) {
+            sums[f] += accumulator->buffer[f];
+        }
+    }
+    stats.passes++;
+    stats.time += omp_get_wtime() - start;
+    stats.wait_time += prefetcher.wait_time();
+
+    // La nueva posición de cada centroide es el promedio de los puntos del cluster
+    for (int k = 0; k < n_clusters; k++) {
+        const double* slot = sums.data() + (long long int) k * fields;
+        if (slot[dimension] != 0) {
+            for (int d = 0; d < dimension; d++) {
+                centroids.at(k, d) = slot[d] / slot[dimension];
+            }
+        }
+    }
+    return changed;
+}
+
+/**
+ * @name outofcore_kmeans
+ * @brief Función para llevar a cabo el agrupamiento con el algoritmo de k-means (Lloyd) en pasadas por el archivo
+ * @param centroids Conjunto de centroides por columnas; al terminar contiene los centroides finales
+ * @param stream Archivo de puntos
+ * @param labels Archivo auxiliar con el cluster de cada punto; al terminar contiene el de la última asignación
+ * @param max_iterations Número máximo de iteraciones después de la primera asignación
+ * @param options Opciones de la ejecución
+ * @param accumulator Buffers de acumulación por hilo reservados previamente
+ * @param stats Tiempos de las pasadas
+ * @return Número de iteraciones después de la primera asignación
+ * */
+long long int outofcore_kmeans(Dataset& centroids, PointStream& stream, LabelFile& labels, long long int max_iterations, const OutOfCoreOptions& options, CentroidAccumulator* accumulator, PassStats& stats) {
+    // Paso 1. Los centroides iniciales son puntos distintos del archivo elegidos al azar
+    sample_centroids(centroids, stream, options, stats);
+
+    // Paso 2 y 3. Primera asignación y actualización de los centroides
+    lloyd_pass(centroids, stream, labels, false, options, accumulator, stats);
+
+    // Paso 4. Repetir hasta que ningún punto cambie de cluster o hasta el número máximo de iteraciones
+    long long int iteration = 0;
+    bool changed = true;
+    while (changed && iteration < max_iterations) {
+        changed = lloyd_pass(centroids, stream, labels, true, options, accumulator, stats);
+        iteration++;
+    }
+    return iteration;
+}
+
+/**
+ * @name save_results
+ * @brief Función para escribir los resultados a partir del archivo de clusters: en binario (un int32 por punto) o en CSV junto con las coordenadas, que se vuelven a leer en una pasada en orden
+ * @param stream Archivo de puntos
+ * @param labels Archivo auxiliar con el cluster de cada punto
+ * @param options Opciones de la ejecución (tamaño del trozo, formato)
+ * @param output_file_name Nombre del archivo de salida
+ * */
+void save_results(PointStream& stream, LabelFile& labels, const OutOfCoreOptions& options, const string& output_file_name) {
+    stream.rewind();
+    BatchPrefetcher prefetcher(stream, options.chunk_size, SAMPLING_SEQUENTIAL, false, options.seed);
+    vector<int32_t> chunk_labels(options.chunk_size);
+    vector<char> buffer;
+    int fd = open_output(output_file_name);
+    try {
+        for (PointBatch* chunk = prefetcher.next(); chunk != nullptr; chunk = prefetcher.next()) {
+            labels.read(chunk->first_row, chunk->rows, chunk_labels.data());
+            if (options.output_mode == OUTPUT_CSV) {
+                append_CSV(fd, chunk->points, chunk->rows, chunk_labels.data(), buffer);
+            } else {
+                append_labels(fd, chunk_labels.data(), chunk->rows);
+            }
+        }
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+}
+
+/**
+ * @name main
+ * @brief Función main del programa
+ * @param argc Cantidad de argumentos de entrada (STDIN)
+ * @param argv Argumentos de entrada (STDIN) [nombre del programa, número de clusters, número de puntos o ruta del archivo de entrada (CSV o binario), número máximo de iteraciones, número de hilos, opciones nombre=valor (chunk=puntos, seed=n, output=csv|labels|none)]
+ * @return 0 si el programa termina correctamente
+ * */
+int main(int argc, char** argv) {
+    int n_clusters;
+    int num_threads;
+    long long int max_iterations;
+    string input_file_name;
+    OutOfCoreOptions options;
+    try{
+        if (argc < 5)
+            throw std::invalid_argument("Invalid number of arguments");
+        n_clusters = stoi(argv[1]);
+        input_file_name = resolve_input_file(argv[2]); // Ruta del archivo o número de puntos de ./../Data/<num_points>_data.csv
+        max_iterations = stoll(argv[3]);
+        num_threads = stoi(argv[4]);
+        options = parse_outofcore_options(argc, argv, 5);
+        if (n_clusters < 1)
+            throw std::invalid_argument("Invalid number of clusters");
+        if (max_iterations < 1)
+            throw std::invalid_argument("Invalid number of iterations");
+        if (num_threads < 1)
+            throw std::invalid_argument("Invalid number of threads");
+    } catch (const std::exception& e) {
+        cout << e.what() << "\n";
+        cout << "Usage: ./outofcore_kmeans <n_clusters> <num_points | input_file> <max_iterations> <num_threads> " << OUTOFCORE_OPTIONS_USAGE << "\n";
+        return 1;
+    }
+    omp_set_num_threads(num_threads);
+
+    // Crea el directorio de resultados de la ejecución fuera de memoria
+    string dir_str = "./../Results/OutOfCore/";
+    struct stat sb;
+    if (stat(dir_str.c_str(), &sb) != 0) {
+        mkdir(dir_str.c_str(), 0777);
+    }
+    string output_prefix = dir_str + file_stem(input_file_name) + "_" + to_string(n_clusters);
+
+    try{
+        PointStream stream(input_file_name);
+        Dataset centroids(n_clusters, stream.dimension(), false);
+        LabelFile labels(output_prefix + "_labels.tmp", n_clusters);
+        CentroidAccumulator* accumulator = create_accumulator(num_threads, n_clusters, stream.dimension());
+        PassStats stats;
+        long long int iterations = 0;
+        double start = omp_get_wtime();
+        try{
+            iterations = outofcore_kmeans(centroids, stream, labels, max_iterations, options, accumulator, stats);
+        } catch (...) {
+            free_accumulator(accumulator);
+            throw;
+        }
+        double elapsed = omp_get_wtime() - start;
+        free_accumulator(accumulator);
+        save_centroids(output_prefix + "_centroids.csv", centroids);
+        cout << iterations << " iterations, " << stats.passes << " passes of " << stream.file_size() / 1048576.0 << " MiB in chunks of "
+             << options.chunk_size << " points: " << elapsed << " s (" << stats.passes * (stream.file_size() / 1048576.0) / stats.time
+             << " MiB/s, " << stats.wait_time << " s waiting for input)" << "\n";
+
+        if (options.output_mode != OUTPUT_NONE) {
+            save_results(stream, labels, options, output_prefix + output_file_suffix(options.output_mode));
+        }
+    } catch (const std::exception& e) {
+        cout << "Error: outofcore_kmeans()" << "\n";
+        cout << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -20,306 +20,1024 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <bits/stdc++.h>
+#include "dataset.hpp"
+#include "accumulate_kernels.hpp"
+#include "benchmark.hpp"
+#include "binary_format.hpp"
+#include "centroid_accumulator.hpp"
+#include "csv_io.hpp"
+#include "distance_kernels.hpp"
+#include "iteration_trace.hpp"
+#include "k_selection.hpp"
+#include "kd_tree.hpp"
+#include "kmeans_model.hpp"
+#include "numa_placement.hpp"
+#include "quantized_points.hpp"
+#include "restarts.hpp"
+#include "result_writer.hpp"
+#include "run_options.hpp"
+#include "running_sums.hpp"
+#include "seeding.hpp"
+#include "sweep.hpp"
+#include "triangle_bounds.hpp"
 
 using namespace std;
 
 
 /**
- * @name euclidean_distance 
- * @brief Función para calcular la distancia euclidiana entre dos puntos
- * @param point1 Punto 1 - Arreglo de floats [X, Y] 
- * @param point2 Punto 2 - Arreglo de floats [X, Y]
- * @param point_dimension_size Dimensiones de los puntos, es decir, el número de coordenadas de cada punto
- * @return Distancia euclidiana entre los dos puntos dados
+ * @name assign_points
+ * @brief Función para asignar cada punto a su centroide más cercano repartiendo el rango de puntos entre los hilos. Cada hilo recorre su rango en bloques con el kernel vectorizado de distancias al cuadrado y lleva su propio conteo de puntos por cluster y su propia bandera de cambio, que se combinan una sola vez al final
+ * @param centroids Conjunto de centroides por columnas
+ * @param cluster_sizes Cantidad de puntos de cada cluster (se recalcula completa)
+ * @param points Conjunto de puntos por columnas con el cluster de cada punto
+ * @param bounds Cotas de Hamerly o Elkan para evitar distancias innecesarias, o nullptr para calcularlas todas (Lloyd)
+ * @param tree Árbol kd para asignar subárboles completos (algorithm=kdtree), o nullptr
+ * @param accumulator Buffers de acumulación por hilo; con el árbol kd quedan con las sumas de cada cluster para update_centroids, y en una pasada incremental con las diferencias de los puntos que cambiaron de cluster
+ * @param running Sumas de cada cluster que se conservan entre iteraciones (update=incremental), o nullptr
+ * @param quantized Coordenadas cuantizadas que lee el kernel en lugar de las columnas en float (storage=q16|q8), o nullptr
+ * @param replicas Copias de los centroides en cada nodo NUMA que lee cada hilo en lugar de centroids (numa=on), o nullptr
+ * @param inertia Salida con la suma de las distancias al cuadrado de cada punto a su centroide más cercano, que el kernel ya calcula; sólo con la asignación completa (Lloyd sin storage=q16|q8), nullptr en otro caso
+ * @return true si al menos un punto cambió de cluster
  * */
-float euclidean_distance(float* point1, float* point2, int point_dimension_size) {    
-    float distance = 0;
-    int i;
-    // Se calcula la distancia euclidiana entre los dos puntos dados 
-    //#pragma omp parallel for reduction(+:distance) 
-    for (i = 0; i < point_dimension_size; i++) {
-        //#pragma omp atomic
-        distance += pow((point1[i] - point2[i]), 2);
-    }
-    // Se regresa la raíz cuadrada de la distancia euclidiana obtenida de forma serial
-    return sqrt(distance);
-}
+bool assign_points(const Dataset& centroids, long long int* cluster_sizes, Dataset& points, TriangleBounds* bounds, KdTree* tree, CentroidAccumulator* accumulator, RunningSums* running, const QuantizedPoints* quantized, CentroidReplicas* replicas, double* inertia) {
+    const int n_clusters = centroids.size();
+    // El árbol kd asigna y acumula en la misma pasada; la cantidad de puntos de cada cluster es el último campo de cada cluster
+    if (tree != nullptr) {
+        KMEANS_TRACE_ONLY(long long int computed_before = tree->computed_distances();)
+        long long int changed_points = tree->assign(centroids, points, accumulator);
+        KMEANS_TRACE_ONLY(iteration_trace().add_changed(changed_points);
+                          iteration_trace().add_distances(tree->computed_distances() - computed_before);)
+        for (int i = 0; i < n_clusters; i++) {
+            cluster_sizes[i] = (long long int) accumulator->buffer[(long long int) i * accumulator->fields + points.dimension()];
+        }
+        return changed_points > 0;
+    }
+    const long long int num_points = points.size();
+    const NearestCentroidsKernel nearest_centroids = select_nearest_centroids_kernel(points.dimension());
+    const QuantizedNearestKernel quantized_nearest = quantized != nullptr ? select_quantized_nearest_kernel(*quantized) : nullptr;
+    int32_t* labels = points.labels();
+    bool changed = false;
+    double assigned_inertia = 0.0;
+    // En una pasada incremental cada hilo suma en su bloque del acumulador las diferencias de los puntos que cambiaron de cluster
+    const bool incremental = incremental_pass(running);
+    const int fields = accumulator->fields;
+    const long long int block = (long long int) n_clusters * fields;
+    // Se reinicia la cantidad de puntos de cada cluster, ya que se vuelve a contar completa en esta pasada
+    for (int i = 0; i < n_clusters; i++) {
+        cluster_sizes[i] = 0;
+    }
+    // Las cotas se corrigen con el desplazamiento de los centroides antes de repartir los puntos
+    if (bounds != nullptr) {
+        bounds->begin_pass(centroids);
+    }
+    // Con numa=on cada nodo lee su propia copia de los centroides de esta pasada
+    if (replicas != nullptr) {
+        replicas->refresh(centroids);
+    }
+    KMEANS_TRACE_ONLY(long long int computed_before = bounds != nullptr ? bounds->computed_distances() : 0;
+                      double region_start = omp_get_wtime();)
 
-/**
- * @name find_nearest_centroid
- * @brief Función para encontrar el índice del centroide más cercano para un punto dado
- * @param centroids Arreglo de centroides - Arreglo de arreglos de floats [[X, Y, cant_puntos_cluster], [X, Y, cant_puntos_cluster], ...]
- * @param point Punto - Arreglo de floats [X, Y]
- * @param n_clusters Número de clusters o centroides
- * @param point_dimension_size Dimensiones de los puntos, es decir, el número de coordenadas de cada punto
- * @return Índice del centroide más cercano al punto dado
- * */
-int find_nearest_centroid(float** centroids, float* point, int n_clusters, int point_dimension_size) {
-    // Se calcula la distancia euclidiana entre el punto y el primer centroide y se guarda como la distancia mínima
-    float min_distance = euclidean_distance(centroids[0], point, point_dimension_size);
-    // Se guarda el índice del primer centroide como el índice del centroide más cercano
-    int nearest_centroid_index = 0;
-
-    // Se calcula paralelamente la distancia euclidiana entre el punto y cada uno de los centroides restantes y se guarda el índice del centroide más cercano
-    float distance;
-    #pragma omp parallel for shared(centroids, point, min_distance, nearest_centroid_index) private(distance)
-    for (int i = 1; i < n_clusters; i++) {
-        distance = euclidean_distance(centroids[i], point, point_dimension_size);
+    #pragma omp parallel shared(centroids, cluster_sizes, points, labels, bounds, accumulator) num_threads(accumulator->n_threads) reduction(||:changed) reduction(+:assigned_inertia)
+    {
+        // Conteo local de puntos por cluster del hilo (la bandera changed es privada por la reducción)
+        long long int* local_counts = new long long int[n_clusters]();
+        int32_t* block_labels = new int32_t[KERNEL_BLOCK_SIZE];
+        float* block_distances = inertia != nullptr ? new float[KERNEL_BLOCK_SIZE] : nullptr;
+        double* local_deltas = accumulator->buffer + omp_get_thread_num() * accumulator->stride;
+        const Dataset& local_centroids = replicas != nullptr ? replicas->for_thread(omp_get_thread_num()) : centroids;
+        if (incremental) {
+            for (long long int f = 0; f < block; f++) {
+                local_deltas[f] = 0.0;
+            }
+        }
+        // Con la traza, cada hilo cuenta sus cambios y toma el fin de su último bloque (lo que sigue es espera en la barrera)
+        KMEANS_TRACE_ONLY(long long int local_changed = 0;
+                          double busy_start = omp_get_wtime();
+                          double busy_end = busy_start;)
+
+        #pragma omp for schedule(static)
+        for (long long int begin = 0; begin < num_points; begin += KERNEL_BLOCK_SIZE) {
+            long long int end = min(begin + KERNEL_BLOCK_SIZE, num_points);
+            // El kernel (o las cotas, que sólo calculan las distancias necesarias) obtiene el centroide más cercano de todo el bloque
+            if (bounds != nullptr) {
+                bounds->nearest_centroids(points, begin, end, local_centroids, block_labels);
+            } else if (quantized != nullptr) {
+                quantized_nearest(*quantized, begin, end, local_centroids, block_labels);
+            } else {
+                nearest_centroids(points, begin, end, local_centroids, block_labels, block_distances);
+            }
+            if (block_distances != nullptr) {
+                for (long long int i = begin; i < end; i++) {
+                    assigned_inertia += block_distances[i - begin];
+                }
+            }
+            for (long long int i = begin; i < end; i++) {
+                int32_t nearest_centroid_index = block_labels[i - begin];
+                changed = changed || labels[i] != nearest_centroid_index;
+                KMEANS_TRACE_ONLY(local_changed += labels[i] != nearest_centroid_index;)
+                if (incremental && labels[i] != nearest_centroid_index) {
+                    move_point(points, i, labels[i], nearest_centroid_index, local_deltas, fields);
+                }
+                labels[i] = nearest_centroid_index; // Asigna el cluster al punto
+                local_counts[nearest_centroid_index]++; // Incrementa la cantidad de puntos en el cluster
+            }
+            KMEANS_TRACE_ONLY(busy_end = omp_get_wtime();)
+        }
+
+        // Se combinan los conteos locales una sola vez por hilo
         #pragma omp critical
         {
-            if (distance < min_distance) {
-                min_distance = distance;
-                nearest_centroid_index = i;
+            for (int i = 0; i < n_clusters; i++) {
+                cluster_sizes[i] += local_counts[i];
             }
-        }    
+            KMEANS_TRACE_ONLY(iteration_trace().add_changed(local_changed);)
+        }
+        KMEANS_TRACE_ONLY(iteration_trace().thread_busy(TRACE_ASSIGN, omp_get_thread_num(), busy_start, busy_end);)
+        // Las diferencias de los hilos se combinan en árbol en el bloque del hilo 0
+        if (incremental) {
+            merge_thread_blocks(accumulator, omp_get_thread_num(), omp_get_num_threads());
+        }
+        delete[] block_distances;
+        delete[] block_labels;
+        delete[] local_counts;
     }
-    // Se regresa el índice del centroide más cercano
-    return nearest_centroid_index;
+    KMEANS_TRACE_ONLY(iteration_trace().region(TRACE_ASSIGN, region_start, omp_get_wtime());
+                      iteration_trace().add_distances(bounds != nullptr ? bounds->computed_distances() - computed_before : num_points * n_clusters);)
+    if (inertia != nullptr) {
+        *inertia = assigned_inertia;
+    }
+    return changed;
 }
 
 /**
  * @name update_centroids
- * @brief Función para actualizar los centroides basados en los clusters actuales
- * @param centroids Arreglo de centroides - Arreglo de arreglos de floats [[X, Y, cant_puntos_cluster], [X, Y, cant_puntos_cluster], ...]
- * @param points Arreglo de puntos - Arreglo de arreglos de floats [[X, Y, cluster], [X, Y, cluster], ...]
- * @param n_clusters Número de clusters o centroides
- * @param num_points Número de puntos
+ * @brief Función para actualizar los centroides basados en los clusters actuales. Las sumas de cada cluster se obtienen con los bloques por hilo del acumulador, sin secciones críticas
+ * @param centroids Conjunto de centroides por columnas
+ * @param points Conjunto de puntos por columnas con el cluster de cada punto
+ * @param accumulator Buffers de acumulación por hilo reservados previamente
+ * @param tree Árbol kd que ya dejó las sumas en el acumulador durante la asignación, o nullptr para sumar los puntos aquí
+ * @param running Sumas de cada cluster que se conservan entre iteraciones (update=incremental): en una pasada incremental sólo se les suman las diferencias que dejó assign_points, y en las demás se recalculan con todos los puntos. nullptr para recalcular siempre
+ * @param quantized Coordenadas cuantizadas cuyos códigos se suman en lugar de las columnas en float (storage=q16|q8), o nullptr
  * */
-void update_centroids(float** centroids, float** points, int n_clusters, long long int num_points) {
-    float** new_centroids = new float*[n_clusters];
-    int i;
-    // Se inicializa paralelamente el arreglo de nuevos centroides con 0s en todas sus coordenadas y se inicializa la cantidad de puntos en cada cluster en 0
-    #pragma omp parallel for //shared (new_centroids, n_clusters) 
-    for (i=0; i < n_clusters; i++)
-    {
-        #pragma omp critical
-        {
-            new_centroids[i] = new float[3];
-            new_centroids[i][0] = 0;
-            new_centroids[i][1] = 0;
-            new_centroids[i][2] = 0;
+void update_centroids(Dataset& centroids, const Dataset& points, CentroidAccumulator* accumulator, const KdTree* tree, RunningSums* running, const QuantizedPoints* quantized) {
+    const int n_clusters = centroids.size();
+    const int dimension = points.dimension();
+    const int fields = accumulator->fields;
+    KMEANS_TRACE_ONLY(double region_start = omp_get_wtime();)
+    const double* sums = accumulator->buffer;
+    if (incremental_pass(running)) {
+        apply_deltas(running, accumulator->buffer);
+        sums = running->sums;
+    } else {
+        if (quantized != nullptr) {
+            accumulate_quantized_clusters(*quantized, points.labels(), accumulator);
+        } else if (tree == nullptr) {
+            accumulate_clusters(points, points.size(), points.labels(), accumulator);
+        }
+        if (running != nullptr) {
+            store_full_sums(running, accumulator->buffer);
         }
     }
 
-    // Se iteran todos los puntos y se suman las X y Y de cada cluster
-    int cluster;
-    long long int j;
-    #pragma omp parallel for private(cluster)
-    for(j=0; j < num_points; j++){
-        #pragma omp critical
-        {
-            cluster = (int) points[j][2];  // Cluster/Centroide al que pertenece el punto
-            new_centroids[cluster][0] += points[j][0]; // Se suman las X de ese cluster en particular
-            new_centroids[cluster][1] += points[j][1]; // Se suman las Y de ese cluster en particular
+    // El bloque del hilo 0 (o las sumas incrementales) tiene las sumas totales; la nueva posición es el promedio de los puntos del cluster
+    #pragma omp parallel for shared(centroids, sums) num_threads(accumulator->n_threads) schedule(static)
+    for (int i = 0; i < n_clusters; i++) {
+        const double* slot = sums + i * fields;
+        if (slot[dimension] != 0) {
+            for (int d = 0; d < dimension; d++) {
+                centroids.at(i, d) = slot[d] / slot[dimension];
+            }
         }
     }
-    // Para obtener la nueva X del centroide, se divide la suma de las X de los puntos del cluster entre la cantidad de puntos en el cluster
-    // Para obtener la nueva Y del centroide, se divide la suma de las Y de los puntos del cluster entre la cantidad de puntos en el cluster
-    #pragma omp parallel for shared (new_centroids, centroids, n_clusters) 
-    for(int i =0; i < n_clusters; i++){
-        #pragma omp critical
-        {
-            if(centroids[i][2] != 0){
-            centroids[i][0] = new_centroids[i][0] / centroids[i][2]; 
-            centroids[i][1] = new_centroids[i][1] / centroids[i][2]; 
-            }
+    KMEANS_TRACE_ONLY(iteration_trace().region(TRACE_UPDATE, region_start, omp_get_wtime());)
+}
+
+#ifdef KMEANS_TRACE
+/**
+ * @name trace_save_centroids
+ * @brief Función para copiar los centroides antes de actualizarlos y empezar el registro de una iteración en la traza (sólo con -DKMEANS_TRACE y trace=)
+ * @param centroids Conjunto de centroides por columnas
+ * @param previous Copia de los centroides (centroide por centroide)
+ * */
+void trace_save_centroids(const Dataset& centroids, vector<double>& previous) {
+    if (!iteration_trace().enabled()) return;
+    previous.resize((size_t) centroids.size() * centroids.dimension());
+    for (int i = 0; i < centroids.size(); i++) {
+        for (int d = 0; d < centroids.dimension(); d++) {
+            previous[(size_t) i * centroids.dimension() + d] = centroids.at(i, d);
         }
     }
-    // Liberar memoria al borrar matriz temporal new_centroids utilizada para calcular los nuevos centroides
-    for (int i = 0; i < n_clusters; i++) {
-        delete[] new_centroids[i];
+}
+
+/**
+ * @name trace_end_iteration
+ * @brief Función para terminar el registro de una iteración con el desplazamiento máximo de los centroides y la inercia de la asignación (con los centroides con los que se asignó). Se calculan después de tomar el tiempo de la iteración y no cuentan en él
+ * @param previous Centroides antes de la actualización (los de la asignación)
+ * @param centroids Conjunto de centroides actualizados
+ * @param points Conjunto de puntos por columnas con el cluster de cada punto
+ * */
+void trace_end_iteration(const vector<double>& previous, const Dataset& centroids, const Dataset& points) {
+    IterationTrace& trace = iteration_trace();
+    if (!trace.enabled()) return;
+    trace.end_pass();
+    const int dimension = points.dimension();
+    double max_shift = 0.0;
+    for (int i = 0; i < centroids.size(); i++) {
+        double shift = 0.0;
+        for (int d = 0; d < dimension; d++) {
+            double diff = centroids.at(i, d) - previous[(size_t) i * dimension + d];
+            shift += diff * diff;
+        }
+        max_shift = max(max_shift, sqrt(shift));
+    }
+    const int32_t* labels = points.labels();
+    double inertia = 0.0;
+    #pragma omp parallel for schedule(static) reduction(+:inertia)
+    for (long long int i = 0; i < points.size(); i++) {
+        const double* centroid = previous.data() + (size_t) labels[i] * dimension;
+        for (int d = 0; d < dimension; d++) {
+            double diff = points.at(i, d) - centroid[d];
+            inertia += diff * diff;
+        }
     }
-    delete[] new_centroids;
+    trace.end_iteration(max_shift, inertia);
 }
+#endif
 
 /**
  * @name kmeans
  * @brief Función para llevar a cabo la el agrupamiento o clustering con el algoritmo de k-means
- * @param points Arreglo de puntos - Arreglo de arreglos de floats [[X, Y, cluster], [X, Y, cluster], ...]
+ * @param points Conjunto de puntos por columnas; al terminar contiene el cluster de cada punto
  * @param n_clusters Número de clusters o centroides
- * @param num_points Número de puntos
  * @param max_iterations Número máximo de iteraciones
+ * @param accumulator Buffers de acumulación por hilo reutilizados por update_centroids
+ * @param bounds Cotas de Hamerly o Elkan reutilizadas por assign_points, o nullptr para la asignación completa (Lloyd)
+ * @param tree Árbol kd reutilizado por assign_points (algorithm=kdtree), o nullptr
+ * @param running Sumas de cada cluster reutilizadas por la actualización incremental (update=incremental), o nullptr
+ * @param quantized Coordenadas cuantizadas de los puntos para la asignación y la acumulación (storage=q16|q8), o nullptr
+ * @param replicas Copias de los centroides en cada nodo NUMA para la asignación (numa=on), o nullptr
+ * @param monitor Seguimiento de la inercia que detiene el reinicio cuando ya no puede ganar (n_init=n), o nullptr
+ * @param warm Modelo de donde se toman los centroides iniciales en lugar de elegirlos (warm=); si es un punto de control, la ejecución continúa desde su iteración. O nullptr
+ * @param recorder Registro que escribe los puntos de control y conserva los centroides finales (model=, checkpoint=n), o nullptr
+ * @param init Forma de elegir los centroides iniciales
+ * @param seed Semilla de la elección de los centroides iniciales
+ * @param init_time Segundos que tomó elegir los centroides iniciales
+ * @param phases Tiempos por fase donde se suman las pasadas de asignación y de actualización (parallel_kmeans bench), o nullptr
+ * @return Número de iteraciones después de la primera asignación (contando las del punto de control con el que se reanudó)
  * */
-void kmeans(float** points, int n_clusters, long long int num_points, long long int max_iterations) {
+long long int kmeans(Dataset& points, int n_clusters, long long int max_iterations, CentroidAccumulator* accumulator, TriangleBounds* bounds, KdTree* tree, RunningSums* running, const QuantizedPoints* quantized, CentroidReplicas* replicas, RestartMonitor* monitor, const KmeansModel* warm, ModelRecorder* recorder, InitMethod init, uint64_t seed, double& init_time, PhaseTimes* phases) {
+    const int dimension = points.dimension();
 
-    // Paso 1. Crear k centroides y distribuirlos aleatoriamente sobre los datos
+    // Paso 1. Elegir k centroides iniciales entre los puntos (al azar, k-means++ o k-means||) con los hilos de OpenMP y flujos aleatorios por semilla
+    // Con warm= se copian los centroides del modelo; un punto de control continúa con la iteración siguiente a la que se guardó
     //cout << "Paso 1. Crear k centroides y distribuirlos aleatoriamente sobre los datos" << "\n";
-    float** centroids = new float*[n_clusters];
-    #pragma omp parallel for shared(centroids, points, n_clusters, num_points) 
-    for (int i = 0; i < n_clusters; i++) {
-        #pragma omp critical
-        {
-            srand(time(NULL));
-            centroids[i] = new float[3];  //{cantidad de puntos en el cluster, x position, y position}
-            centroids[i][0] = points[rand() % num_points][0]; // position x
-            centroids[i][1] = points[rand() % num_points][1]; // position y
-            centroids[i][2] = 0; // cantidad de puntos en el cluster
+    Dataset centroids(n_clusters, dimension, false);
+    long long int* cluster_sizes = new long long int[n_clusters](); // cantidad de puntos en cada cluster
+    double init_start = omp_get_wtime();
+    if (warm != nullptr) {
+        for (int d = 0; d < dimension; d++) {
+            memcpy(centroids.column(d), warm->centroids.column(d), n_clusters * sizeof(float));
         }
+    } else {
+        initialize_centroids(points, centroids, init, seed, omp_get_max_threads());
     }
+    init_time = omp_get_wtime() - init_start;
+    const long long int first_iteration = warm != nullptr && warm->checkpoint ? warm->iterations + 1 : 0;
 
     // Paso 2. Asignar los puntos al centroide / cluster más cercano
     //cout << "Paso 2. Asignar los puntos al centroide / cluster más cercano" << "\n";
-    // #pragma omp parallel for shared(points, centroids, n_clusters)  
-    for (long long int i = 0; i < num_points; i++) {
-        int nearest_centroid_index = find_nearest_centroid(centroids, points[i], n_clusters, 2); //Find nearest es paralelo
-        points[i][2] = nearest_centroid_index;
-        centroids[nearest_centroid_index][2]++; //Incrementar la cantidad de puntos en ese cluster
+    // Los puntos se reparten entre los hilos y cada hilo cuenta los puntos de cada cluster por separado
+    if (bounds != nullptr) {
+        bounds->reset(); // Las cotas de la repetición anterior no sirven con los nuevos centroides
     }
+    if (tree != nullptr) {
+        tree->reset(points); // Los dueños de los nodos de la repetición anterior no sirven con los nuevos centroides
+    }
+    if (running != nullptr) {
+        reset_running_sums(running); // Las sumas de la repetición anterior no corresponden a los nuevos clusters
+    }
+    // Con -DKMEANS_TRACE y trace= cada pasada se registra en la traza (la primera asignación es la iteración 0)
+    KMEANS_TRACE_ONLY(vector<double> previous_centroids;
+                      iteration_trace().begin_iteration(0);)
+    double phase_start = omp_get_wtime();
+    assign_points(centroids, cluster_sizes, points, bounds, tree, accumulator, running, quantized, replicas, nullptr);
+    if (phases != nullptr) phases->seconds[PHASE_ASSIGN] += omp_get_wtime() - phase_start;
+    KMEANS_TRACE_ONLY(trace_save_centroids(centroids, previous_centroids);)
 
 
     // Paso 3. Actualizar la posición de los centroides
         // Centroide X = Promedio de todas las posiciones X de los puntos del cluster correspondiente a ese centroide
         // Centroide Y = Promedio de todas las posiciones Y de sus puntos del cluster correspondiente a ese centroide
     //cout << "Paso 3. Actualizar la posición de los centroides" << "\n";
-    update_centroids(centroids, points, n_clusters, num_points);
+    phase_start = omp_get_wtime();
+    update_centroids(centroids, points, accumulator, tree, running, quantized);
+    if (phases != nullptr) phases->seconds[PHASE_UPDATE] += omp_get_wtime() - phase_start;
+    KMEANS_TRACE_ONLY(trace_end_iteration(previous_centroids, centroids, points);)
+    // Con n_init=n la inercia de cada iteración se publica en el tablero de los reinicios. Con Lloyd es la suma de las distancias mínimas de la pasada de
+    // asignación siguiente, que usa estos centroides; los demás modos la calculan después de la actualización sólo cuando puede detener el reinicio
+    const bool assigned_inertia = monitor != nullptr && bounds == nullptr && tree == nullptr && quantized == nullptr;
+    bool inertia_current = false; // Si la última inercia registrada es la de los centroides actuales
+    bool losing = false;
+    if (recorder != nullptr) recorder->record_iteration(centroids, first_iteration);
   
 
     // Paso 4. Repetir pasos 1 y 2 hasta que ningún punto cambie de cluster o hasta un número dado.
     //cout << "Paso 4. Repetir pasos 1 y 2 hasta que ningún punto cambie de cluster o hasta un número dado." << "\n";
-    long long int iteration = 0;
-    int index;
+    long long int iteration = first_iteration;
     bool changed = true;
-    int nearest_centroid_index;
-    // Itera hasta que no haya cambios en los clusters o hasta que se alcance el número máximo de iteraciones
-    while (changed && iteration < max_iterations) {
+    // Al reanudar un punto de control no se guardaron los clusters de su iteración, así que la primera pasada no sabe si algún punto cambió;
+    // los mismos clusters dan los mismos centroides, de modo que si los centroides no se movieron la ejecución sin interrumpir ya había convergido
+    if (first_iteration > 0) {
         changed = false;
-        // Asignar los puntos a los clusters más cercanos si es que ha cambiado el centroide más cercano
-        for (long long int i = 0; i < num_points; i++) {
-            nearest_centroid_index = find_nearest_centroid(centroids, points[i], n_clusters, 2);
-            if (points[i][2] != nearest_centroid_index) {
-                index = (int) points[i][2];
-                centroids[index][2]--;// Decrementa la cantidad de puntos en el cluster en el que estaba anteriormente 
-                centroids[nearest_centroid_index][2]++; // Incrementa la cantidad de puntos en el cluster al que ahora pertenece
-                points[i][2] = nearest_centroid_index; // Asigna el nuevo cluster al punto
-                changed = true;
-            }
+        for (int d = 0; d < dimension && !changed; d++) {
+            changed = memcmp(centroids.column(d), warm->centroids.column(d), n_clusters * sizeof(float)) != 0;
         }
+    }
+    // Itera hasta que no haya cambios en los clusters o hasta que se alcance el número máximo de iteraciones
+    while (changed && !losing && iteration < max_iterations) {
+        // Asignar paralelamente los puntos a los clusters más cercanos y recontar los puntos de cada cluster
+        KMEANS_TRACE_ONLY(iteration_trace().begin_iteration(iteration + 1);)
+        phase_start = omp_get_wtime();
+        double inertia = 0.0;
+        changed = assign_points(centroids, cluster_sizes, points, bounds, tree, accumulator, running, quantized, replicas, assigned_inertia ? &inertia : nullptr);
+        if (phases != nullptr) phases->seconds[PHASE_ASSIGN] += omp_get_wtime() - phase_start;
+        if (assigned_inertia) {
+            // Si ningún punto cambió de cluster la actualización deja los mismos centroides, así que ésta ya es la inercia final
+            losing = monitor->record_iteration(inertia, iteration);
+            inertia_current = !changed;
+        }
+        KMEANS_TRACE_ONLY(trace_save_centroids(centroids, previous_centroids);)
         /*
         cout << "Iteration " << iteration <<  " centroids: " << "\n";
-        cout << "0:  " << centroids[0][0] <<  ", " << centroids[0][1] <<  ", "  << centroids[0][2]  << "\n";
-        cout << "1:  " << centroids[1][0] <<  ", " << centroids[1][1] <<  ", "  << centroids[1][2]  << "\n";
-        cout << "2:  " << centroids[2][0] <<  ", " << centroids[2][1] <<  ", "  << centroids[2][2]  << "\n";
-        cout << "3:  " << centroids[3][0] <<  ", " << centroids[3][1] <<  ", "  << centroids[3][2]  << "\n";
-        cout << "4:  " << centroids[4][0] <<  ", " << centroids[4][1] <<  ", "  << centroids[4][2]  << "\n";
+        for (int i = 0; i < n_clusters; i++) {
+            cout << i << ":  " << centroids.at(i, 0) <<  ", " << centroids.at(i, 1) <<  ", "  << cluster_sizes[i]  << "\n";
+        }
         cout << changed << "\n";
         cout << max_iterations << "\n";
         */
         // Actualizar la posición de los centroides
-        update_centroids(centroids, points, n_clusters, num_points);
+        phase_start = omp_get_wtime();
+        update_centroids(centroids, points, accumulator, tree, running, quantized);
+        if (phases != nullptr) phases->seconds[PHASE_UPDATE] += omp_get_wtime() - phase_start;
+        KMEANS_TRACE_ONLY(trace_end_iteration(previous_centroids, centroids, points);)
         iteration++;
+        if (monitor != nullptr && !assigned_inertia) {
+            inertia_current = monitor->needs_inertia(iteration);
+            if (inertia_current) losing = monitor->record_iteration(monitor->measure(points, centroids), iteration);
+        }
+        if (recorder != nullptr) recorder->record_iteration(centroids, iteration);
     }
+    if (monitor != nullptr) monitor->finish(points, centroids, inertia_current);
+    if (recorder != nullptr) recorder->finish(centroids, iteration);
 
 
     // Imprimie los centroides y los puntos asignados a cada uno para debugear
     /*
     cout << "Step 5" << "\n";
     for (int i = 0; i < n_clusters; i++) {
-        cout << "Centroid " << i << ": (" << centroids[i][0] << ", " << centroids[i][1] << ", " << centroids[i][2] << ")\n";
+        cout << "Centroid " << i << ": (" << centroids.at(i, 0) << ", " << centroids.at(i, 1) << ", " << cluster_sizes[i] << ")\n";
     }
     for (long long int i = 0; i < num_points; i++) {
-        cout << "Point " << i << ": (" << points[i][0] << ", " << points[i][1] << ") -> Cluster " << points[i][2] << "\n";
+        cout << "Point " << i << ": (" << points.at(i, 0) << ", " << points.at(i, 1) << ") -> Cluster " << points.labels()[i] << "\n";
     }
     */
 
-    // Liberar memoria de la matriz de centroides
-    for (int i = 0; i < n_clusters; i++) {
-        delete[] centroids[i];
+    // Liberar memoria del conteo de puntos por cluster (las columnas de los centroides se liberan al salir de la función)
+    delete[] cluster_sizes;
+    return iteration;
+}
+
+
+void save_array_to_CSV(string file_name, double* times,  int size) {
+    fstream fout;
+    fout.open(file_name, ios::out);
+    for (int i = 0; i < size; i++) {
+        fout << times[i] << "\n";
     }
-    delete[] centroids;
 }
 
 
 /**
- * @name load_CSV
- * @brief Función para leer un archivo CSV y guardar los puntos en una matriz llamada puntos
- * @param file_name Nombre del archivo CSV
- * @param points Matriz donde se guardarán los puntos
- * @param num_points Cantidad de puntos que se leerán del archivo
+ * @name run_sweep
+ * @brief Función para el barrido de parámetros en un solo proceso (./parallel_kmeans sweep ...). El archivo se lee una sola vez; cada cantidad de puntos es una vista sin copia de los primeros puntos, y todas las configuraciones (clusters, algoritmo, hilos) se ejecutan sobre esas vistas con los mismos hilos de OpenMP, que se crean una sola vez. No se escriben los clusters de los puntos, sólo los tiempos y las tablas de escalamiento en ./../Analysis/Sweep/
+ * @param argc Cantidad de argumentos de entrada (STDIN)
+ * @param argv Argumentos de entrada (STDIN) [nombre del programa, "sweep", número de puntos o ruta del archivo de entrada, número máximo de iteraciones, opciones nombre=valor]
+ * @return 0 si el barrido termina correctamente
  * */
-void load_CSV(string file_name, float** points, long long int num_points, int num_threads) {
-    fstream myfile;
-    myfile.open(file_name, ios::in);
-    long long int i;
-    string * str_points = new string[num_points];
-
-    // Lee los puntos del archivo CSV de forma serial y los almacena en un arreglo de strings
-    for(i=0; i<num_points; i++){
-        getline(myfile, str_points[i]);
-    }
-    myfile.close();
-
-    // Convierte los strings a floats y los almacena en la matriz de puntos de forma paralela   
-    #pragma omp parallel for shared(points, num_points, str_points) 
-    for(i=0; i<num_points; i++){
-        points[i][0] = stof(str_points[i].substr(0, 5));
-        points[i][1] = stof(str_points[i].substr(6, 5));
-    }
-    
-    // Libera la memoria del arreglo de strings que se utilizó para leer los puntos del archivo CSV al borra el arreglo
-    delete[] str_points;
+int run_sweep(int argc, char** argv) {
+    string input_file_name;
+    long long int max_iterations;
+    SweepOptions options;
+    try{
+        if (argc < 4)
+            throw std::invalid_argument("Invalid number of arguments");
+        input_file_name = resolve_input_file(argv[2]);
+        max_iterations = (long long int) stoi(argv[3]);
+        options = parse_sweep_options(argc, argv, 4);
+        if (max_iterations < 1)
+            throw std::invalid_argument("Invalid number of iterations");
+    } catch (const std::exception& e) {
+        cout << e.what() << "\n";
+        cout << SWEEP_USAGE << "\n";
+        return 1;
+    }
+    vector<int> threads = options.threads;
+    sort(threads.begin(), threads.end());
+    threads.erase(unique(threads.begin(), threads.end()), threads.end());
+    const int max_threads = threads.back();
+
+    // Los datos se leen una sola vez con todos los hilos
+    omp_set_num_threads(max_threads);
+    Dataset all_points;
+    try{
+        all_points = load_points(input_file_name, max_threads);
+    } catch (const std::exception& e) {
+        cout << "Error: load_points()" << "\n";
+        cout << e.what() << "\n";
+        return 1;
+    }
+
+    // Cantidades de puntos del escalamiento fuerte y, con weak=, las del débil (puntos por hilo x hilos)
+    vector<long long int> strong_points = options.points;
+    if (strong_points.empty()) strong_points.push_back(all_points.size());
+    vector<long long int> sizes = strong_points;
+    if (options.weak_points > 0) {
+        for (int t : threads) sizes.push_back(options.weak_points * t);
+    }
+    sort(sizes.begin(), sizes.end());
+    sizes.erase(unique(sizes.begin(), sizes.end()), sizes.end());
+
+    vector<SweepResult> results;
+    for (long long int num_points : sizes) {
+        if (num_points > all_points.size()) {
+            cout << "Skipping " << num_points << " points: the input file has " << all_points.size() << "\n";
+            continue;
+        }
+        Dataset points = prefix_view(all_points, num_points);
+        bool strong = find(strong_points.begin(), strong_points.end(), num_points) != strong_points.end();
+
+        // El árbol kd sólo depende de los puntos: se construye una vez por cantidad de puntos
+        KdTree* tree = nullptr;
+        if (find(options.algorithms.begin(), options.algorithms.end(), ASSIGN_KDTREE) != options.algorithms.end()) {
+            omp_set_num_threads(max_threads);
+            tree = new KdTree(points, max_threads);
+        }
+        for (int n_clusters : options.clusters) {
+            if (n_clusters > num_points) continue;
+            for (AssignmentAlgorithm algorithm : options.algorithms) {
+                TriangleBounds* bounds = nullptr;
+                if (uses_triangle_bounds(algorithm)) {
+                    bounds = new TriangleBounds(algorithm, num_points, n_clusters, points.dimension(), options.bounds_memory);
+                }
+                for (int num_threads : threads) {
+                    // Sin escalamiento fuerte en esta cantidad de puntos, sólo se mide la cantidad de hilos del escalamiento débil
+                    if (!strong && num_points != options.weak_points * num_threads) continue;
+                    omp_set_num_threads(num_threads);
+                    CentroidAccumulator* accumulator = create_accumulator(num_threads, n_clusters, points.dimension());
+                    SweepResult result = {n_clusters, algorithm, num_points, num_threads, 0.0, 0.0, 0.0, 0.0};
+                    for (int r = 0; r < options.repetitions; r++) {
+                        double init_time = 0.0;
+                        double start = omp_get_wtime();
+                        long long int iterations = kmeans(points, n_clusters, max_iterations, accumulator, bounds,
+                                                          algorithm == ASSIGN_KDTREE ? tree : nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, options.init, options.seed + r, init_time, nullptr);
+                        double elapsed = omp_get_wtime() - start;
+                        result.avg_time += elapsed / options.repetitions;
+                        result.min_time = r == 0 ? elapsed : min(result.min_time, elapsed);
+                        result.avg_init_time += init_time / options.repetitions;
+                        result.avg_iterations += (double) iterations / options.repetitions;
+                    }
+                    free_accumulator(accumulator);
+                    results.push_back(result);
+                    cout << "K=" << n_clusters << " " << assignment_algorithm_name(algorithm) << " " << num_points << " points, " << num_threads << " threads: avg "
+                         << result.avg_time << " s (min " << result.min_time << " s), iterations avg " << result.avg_iterations << "\n";
+                }
+                delete bounds;
+            }
+        }
+        delete tree;
+    }
+
+    // Tiempos y tablas de escalamiento
+    string dir_str = "./../Analysis/Sweep/";
+    make_directory("./../Analysis/");
+    make_directory(dir_str);
+    try{
+        write_sweep_tables(results, options, strong_points, dir_str);
+    } catch (const std::exception& e) {
+        cout << "Error: write_sweep_tables()" << "\n";
+        cout << e.what() << "\n";
+        return 1;
+    }
+    return 0;
 }
 
+/**
+ * @name run_ksweep
+ * @brief Función para elegir el número de clusters en un solo proceso (./parallel_kmeans ksweep ...). El archivo se lee una sola vez y K va de k_min a k_max: el primer K elige sus centroides iniciales y cada K siguiente empieza de los centroides finales del anterior con el cluster de mayor SSE dividido en dos (split_highest_sse), así que sólo necesita unas cuantas iteraciones. Después de kmeans, la pasada final de cada K (evaluate_clusters) calcula la inercia, la SSE de cada cluster y la silueta de una muestra cuyas distancias se calculan una sola vez. El árbol kd también se construye una sola vez. Con compare=on cada K se ejecuta además por separado desde centroides elegidos para medir el ahorro. La tabla del codo se imprime y se guarda en ./../Analysis/KSweep/
+ * @param argc Cantidad de argumentos de entrada (STDIN)
+ * @param argv Argumentos de entrada (STDIN) [nombre del programa, "ksweep", número de puntos o ruta del archivo de entrada, número máximo de iteraciones de cada K, número de hilos, opciones nombre=valor]
+ * @return 0 si la selección termina correctamente
+ * */
+int run_ksweep(int argc, char** argv) {
+    string input_file_name;
+    long long int max_iterations;
+    int num_threads;
+    KSweepOptions options;
+    try{
+        if (argc < 5)
+            throw std::invalid_argument("Invalid number of arguments");
+        input_file_name = resolve_input_file(argv[2]);
+        max_iterations = (long long int) stoi(argv[3]);
+        num_threads = stoi(argv[4]);
+        options = parse_ksweep_options(argc, argv, 5);
+        if (max_iterations < 1)
+            throw std::invalid_argument("Invalid number of iterations");
+        if (num_threads < 1)
+            throw std::invalid_argument("Invalid number of threads");
+    } catch (const std::exception& e) {
+        cout << e.what() << "\n";
+        cout << KSWEEP_USAGE << "\n";
+        return 1;
+    }
+    omp_set_num_threads(num_threads);
+    Dataset points;
+    try{
+        points = load_points(input_file_name, num_threads);
+        if (options.k_max > points.size())
+            throw std::invalid_argument("k=" + to_string(options.k_max) + " exceeds the " + to_string(points.size()) + " points of the input file");
+    } catch (const std::exception& e) {
+        cout << "Error: load_points()" << "\n";
+        cout << e.what() << "\n";
+        return 1;
+    }
+    const long long int num_points = points.size();
+    const int dimension = points.dimension();
+
+    // Trabajo que no depende de K: la muestra de la silueta con sus distancias y el árbol kd
+    double start = omp_get_wtime();
+    SilhouetteSample sample = make_silhouette_sample(points, options.sample_size, options.seed, num_threads);
+    KdTree* tree = options.algorithm == ASSIGN_KDTREE ? new KdTree(points, num_threads) : nullptr;
+    const double shared_seconds = omp_get_wtime() - start;
+
+    vector<KSweepResult> results;
+    KmeansModel warm;                    // Centroides iniciales del siguiente K
+    ModelRecorder recorder("", 0, num_points, options.seed); // Centroides finales de cada K
+    double sweep_seconds = shared_seconds;
+    double independent_seconds = 0.0;
+    int next_split = -1;                 // Cluster que se dividió para el siguiente K
+    try{
+        for (int k = options.k_min; k <= options.k_max; k++) {
+            CentroidAccumulator* accumulator = create_accumulator(num_threads, k, dimension);
+            TriangleBounds* bounds = uses_triangle_bounds(options.algorithm) ? new TriangleBounds(options.algorithm, num_points, k, dimension, options.bounds_memory) : nullptr;
+            KSweepResult result = {k, next_split, 0, 0.0, 0.0, 0.0, -1, 0.0, 0.0};
+            double init_time = 0.0;
+            start = omp_get_wtime();
+            result.iterations = kmeans(points, k, max_iterations, accumulator, bounds, tree, nullptr, nullptr, nullptr, nullptr, k == options.k_min ? nullptr : &warm, &recorder,
+                                       options.init, options.seed, init_time, nullptr);
+            ClusterEvaluation evaluation = evaluate_clusters(points, recorder.centroids(), sample, num_threads);
+            if (k < options.k_max) {
+                warm.centroids = Dataset(k + 1, dimension, false);
+                next_split = split_highest_sse(points, recorder.centroids(), evaluation, warm.centroids, num_threads);
+            }
+            result.seconds = omp_get_wtime() - start;
+            result.inertia = evaluation.inertia;
+            result.silhouette = evaluation.silhouette;
+
+            // Con compare=on el mismo K desde centroides elegidos, con su propia pasada final
+            if (options.compare) {
+                start = omp_get_wtime();
+                result.independent_iterations = kmeans(points, k, max_iterations, accumulator, bounds, tree, nullptr, nullptr, nullptr, nullptr, nullptr, &recorder,
+                                                       options.init, options.seed, init_time, nullptr);
+                result.independent_inertia = evaluate_clusters(points, recorder.centroids(), sample, num_threads).inertia;
+                result.independent_seconds = omp_get_wtime() - start;
+                independent_seconds += result.independent_seconds;
+            }
+            sweep_seconds += result.seconds;
+            results.push_back(result);
+            free_accumulator(accumulator);
+            delete bounds;
+        }
+    } catch (const std::exception& e) {
+        cout << "Error: kmeans()" << "\n";
+        cout << e.what() << "\n";
+        delete tree;
+        return 1;
+    }
+    delete tree;
+
+    cout << "ksweep: K=" << options.k_min << "-" << options.k_max << ", " << num_points << " points, " << num_threads << " threads, "
+         << assignment_algorithm_name(options.algorithm) << ", silhouette sample " << sample.points.size() << ": " << sweep_seconds << " s (" << shared_seconds << " s shared)";
+    if (options.compare) cout << "; each K separately " << independent_seconds << " s (" << 100.0 * sweep_seconds / independent_seconds << "%)";
+    cout << "\n";
+    string dir_str = "./../Analysis/KSweep/";
+    make_directory("./../Analysis/");
+    make_directory(dir_str);
+    try{
+        write_ksweep_table(dir_str + to_string(num_points) + "_Points_" + to_string(num_threads) + "_threads.csv", results, options.compare);
+    } catch (const std::exception& e) {
+        cout << "Error: write_ksweep_table()" << "\n";
+        cout << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
 
 /**
- * @name save_to_CSV
- * @brief Función para guardar los puntos con su respectivo centroide resultante en un archivo CSV 
- * @param file_name Nombre del archivo CSV
- * @param points Matriz donde se guardarán los puntos
- * @param size Cantidad de puntos que se leerán del archivo
+ * @name report_numa_placement
+ * @brief Función para imprimir los nodos NUMA, la afinidad, cuántos hilos quedaron en cada nodo y qué parte de los bytes de los puntos y de los clusters está en el nodo del hilo que los asigna
+ * @param topology Topología de la máquina
+ * @param thread_nodes Nodo de cada hilo
+ * @param options Opciones de la ejecución (numa= y affinity=)
+ * @param locality Bytes locales, remotos y sin colocar (measure_page_locality)
  * */
-void save_to_CSV(string file_name, float** points, long long int size) {
-    fstream fout;
-    fout.open(file_name, ios::out);
-    for (long long int i = 0; i < size; i++) {
-        fout << points[i][0] << ","
-             << points[i][1] << ","
-             << points[i][2] << "\n";
+void report_numa_placement(const NumaTopology& topology, const vector<int>& thread_nodes, const RunOptions& options, const PageLocality& locality) {
+    map<int, int> threads_per_node;
+    for (int node : thread_nodes) threads_per_node[node]++;
+    cout << "NUMA: " << topology.n_nodes << " node(s), numa=" << (options.numa ? "on" : "off") << ", affinity=" << affinity_policy_name(options.affinity) << ", threads per node";
+    for (const auto& node : threads_per_node) cout << " " << node.first << ":" << node.second;
+    if (!locality.available) {
+        cout << "; page locality unavailable (move_pages failed)" << "\n";
+        return;
     }
+    const double mib = 1024.0 * 1024.0;
+    cout << "; points and labels local to the assigning thread: " << locality.local_percent() << "% (" << locality.local_bytes / mib << " MiB local, "
+         << locality.remote_bytes / mib << " MiB remote, " << locality.unplaced_bytes / mib << " MiB not placed)" << "\n";
 }
 
-void save_array_to_CSV(string file_name, double* times,  int size) {
-    fstream fout;
-    fout.open(file_name, ios::out);
-    for (int i = 0; i < size; i++) {
-        fout << times[i] << "\n";
+/**
+ * @name run_benchmark
+ * @brief Función para medir por fases una configuración (./parallel_kmeans bench ...). Cada ronda lee el archivo, reserva los acumuladores (y las cotas o el árbol kd), ejecuta k-means con la misma semilla para que todas las rondas hagan el mismo trabajo y escribe los resultados; las primeras warmup rondas se descartan. La estadística de cada fase se guarda en JSON o CSV en ./../Analysis/Benchmark/ y, con baseline=, se compara con un CSV anterior
+ * @param argc Cantidad de argumentos de entrada (STDIN)
+ * @param argv Argumentos de entrada (STDIN) [nombre del programa, "bench", número de clusters, número de puntos o ruta del archivo de entrada, número máximo de iteraciones, número de hilos, opciones nombre=valor]
+ * @return 0 si la medición termina correctamente, 2 si alguna fase es más lenta que en baseline= por más de la tolerancia
+ * */
+int run_benchmark(int argc, char** argv) {
+    int n_clusters;
+    int num_threads;
+    long long int max_iterations;
+    string input_file_name;
+    RunOptions options;
+    BenchmarkOptions bench;
+    try{
+        if (argc < 6)
+            throw std::invalid_argument("Invalid number of arguments");
+        n_clusters = stoi(argv[2]);
+        input_file_name = resolve_input_file(argv[3]);
+        max_iterations = (long long int) stoi(argv[4]);
+        num_threads = stoi(argv[5]);
+        vector<char*> run_arguments = {argv[0]};
+        bench = parse_benchmark_options(argc, argv, 6, run_arguments);
+        options = parse_run_options(run_arguments.size(), run_arguments.data(), 1);
+        if (n_clusters < 1)
+            throw std::invalid_argument("Invalid number of clusters");
+        if (max_iterations < 1)
+            throw std::invalid_argument("Invalid number of iterations");
+        if (num_threads < 1)
+            throw std::invalid_argument("Invalid number of threads");
+        if (!options.trace_prefix.empty())
+            throw std::invalid_argument("trace= is not supported by bench (the trace would be timed with the phases)");
+        if (options.n_init > 1)
+            throw std::invalid_argument("n_init= is not supported by bench");
+        if (!options.model_file.empty() || !options.warm_file.empty())
+            throw std::invalid_argument("model=, checkpoint= and warm= are not supported by bench");
+    } catch (const std::exception& e) {
+        cout << e.what() << "\n";
+        cout << "Usage: ./parallel_kmeans bench <n_clusters> <num_points | input_file> <max_iterations> <num_threads> " << RUN_OPTIONS_USAGE << " " << BENCHMARK_USAGE << "\n";
+        return 1;
+    }
+    omp_set_num_threads(num_threads);
+
+    // Los hilos se fijan una sola vez según affinity= (sin afinidad sólo se toma el nodo en el que están) para estimar la localidad de la memoria
+    NumaTopology topology = numa_topology();
+    vector<int> thread_nodes;
+    try{
+        thread_nodes = place_threads(options.affinity, num_threads, topology);
+    } catch (const std::exception& e) {
+        cout << "Error: place_threads()" << "\n";
+        cout << e.what() << "\n";
+        return 1;
+    }
+    PageLocality locality;
+
+    MachineInfo machine = machine_info();
+    BenchmarkConfig config = {0, 0, n_clusters, max_iterations, num_threads, assignment_algorithm_name(options.algorithm),
+                              init_method_name(options.init), options.seed, output_mode_name(options.output_mode), input_file_name,
+                              options.numa, affinity_policy_name(options.affinity), topology.n_nodes, -1.0};
+    vector<PhaseTimes> samples;
+    vector<long long int> iterations;
+    vector<char> buffer; // Buffer de escritura del CSV de resultados
+    for (int round = 0; round < bench.warmup + bench.repetitions; round++) {
+        PhaseTimes phases;
+        long long int round_iterations = 0;
+        double round_start = omp_get_wtime();
+        try{
+            // Lectura
+            double start = omp_get_wtime();
+            Dataset points = load_points(input_file_name, num_threads);
+            if (options.numa) {
+                points = first_touch_copy(points, num_threads);
+            }
+            phases.seconds[PHASE_LOAD] = omp_get_wtime() - start;
+            if (points.size() < n_clusters)
+                throw std::invalid_argument("The input file has fewer points than clusters");
+            config.num_points = points.size();
+            config.dimension = points.dimension();
+
+            // Acumuladores y, según el algoritmo, cotas o árbol kd
+            start = omp_get_wtime();
+            CentroidAccumulator* accumulator = options.numa ? create_local_accumulator(num_threads, n_clusters, points.dimension())
+                                                            : create_accumulator(num_threads, n_clusters, points.dimension());
+            CentroidReplicas* replicas = options.numa ? new CentroidReplicas(thread_nodes, n_clusters, points.dimension()) : nullptr;
+            TriangleBounds* bounds = nullptr;
+            if (uses_triangle_bounds(options.algorithm)) {
+                bounds = new TriangleBounds(options.algorithm, points.size(), n_clusters, points.dimension(), options.bounds_memory);
+            }
+            KdTree* tree = nullptr;
+            if (options.algorithm == ASSIGN_KDTREE) {
+                tree = new KdTree(points, num_threads);
+            }
+            RunningSums* running = nullptr;
+            if (options.update_mode == UPDATE_INCREMENTAL) {
+                running = create_running_sums(n_clusters, points.dimension(), options.recompute_interval);
+            }
+            QuantizedPoints* quantized = nullptr;
+            if (options.storage != STORAGE_FLOAT) {
+                quantized = new QuantizedPoints(points, options.storage, num_threads);
+            }
+            phases.seconds[PHASE_SETUP] = omp_get_wtime() - start;
+
+            // Elección de centroides, asignación y actualización (kmeans suma las dos últimas)
+            round_iterations = kmeans(points, n_clusters, max_iterations, accumulator, bounds, tree, running, quantized, replicas, nullptr, nullptr, nullptr, options.init, options.seed, phases.seconds[PHASE_INIT], &phases);
+
+            // Escritura de los resultados en el hilo principal, sin ResultWriter, para medirla aparte
+            start = omp_get_wtime();
+            if (options.output_mode != OUTPUT_NONE) {
+                make_directory("./../Results/");
+                make_directory("./../Results/Benchmark/");
+                string output_file_name = "./../Results/Benchmark/" + to_string(points.size()) + "_" + to_string(num_threads) + output_file_suffix(options.output_mode);
+                if (options.output_mode == OUTPUT_CSV) {
+                    save_to_CSV(output_file_name, points, points.labels(), buffer);
+                } else {
+                    save_labels(output_file_name, points.labels(), points.size());
+                }
+            }
+            phases.seconds[PHASE_SAVE] = omp_get_wtime() - start;
+
+            // La colocación de las páginas se consulta en la última ronda, fuera del tiempo total
+            if (round + 1 == bench.warmup + bench.repetitions) {
+                start = omp_get_wtime();
+                locality = measure_page_locality(points, thread_nodes);
+                round_start += omp_get_wtime() - start;
+            }
+
+            free_accumulator(accumulator);
+            delete replicas;
+            delete bounds;
+            delete tree;
+            if (running != nullptr) free_running_sums(running);
+            delete quantized;
+        } catch (const std::exception& e) {
+            cout << "Error: bench round " << round << "\n";
+            cout << e.what() << "\n";
+            return 1;
+        }
+        phases.seconds[PHASE_TOTAL] = omp_get_wtime() - round_start;
+        if (round >= bench.warmup) {
+            samples.push_back(phases);
+            iterations.push_back(round_iterations);
+        }
+    }
+
+    // Reporte
+    string dir_str = "./../Analysis/Benchmark/";
+    string report_file_name = bench.file;
+    if (report_file_name.empty()) {
+        make_directory("./../Analysis/");
+        make_directory(dir_str);
+        report_file_name = dir_str + to_string(config.num_points) + "_Points_" + to_string(num_threads) + "_threads_" + config.algorithm + (bench.json ? ".json" : ".csv");
+    }
+    cout << machine.cpu << " (" << machine.logical_cores << " logical cores, " << machine.simd << "), " << num_threads << " threads, "
+         << config.num_points << " points x " << config.dimension << ", K=" << n_clusters << ", " << config.algorithm << ", "
+         << bench.repetitions << " repetitions after " << bench.warmup << " warmup, " << iterations[0] << " iterations" << "\n";
+    report_numa_placement(topology, thread_nodes, options, locality);
+    config.local_percent = locality.available ? locality.local_percent() : -1.0;
+    print_benchmark_summary(samples);
+    try{
+        write_benchmark_report(report_file_name, bench.json, machine, config, bench, samples, iterations);
+    } catch (const std::exception& e) {
+        cout << "Error: write_benchmark_report()" << "\n";
+        cout << e.what() << "\n";
+        return 1;
+    }
+    cout << "Report: " << report_file_name << "\n";
+    if (!bench.baseline.empty()) {
+        try{
+            if (compare_with_baseline(bench.baseline, samples, bench.tolerance) > 0) return 2;
+        } catch (const std::exception& e) {
+            cout << "Error: compare_with_baseline()" << "\n";
+            cout << e.what() << "\n";
+            return 1;
+        }
     }
+    return 0;
 }
 
+/**
+ * @name report_quantized_labels
+ * @brief Función para imprimir el error de la cuantización y cuántos puntos asigna a otro cluster el kernel sobre códigos que el kernel en float, con los centroides de los clusters actuales de los puntos
+ * @param points Conjunto de puntos por columnas con el cluster de cada punto
+ * @param quantized Los mismos puntos cuantizados
+ * @param accumulator Buffers de acumulación por hilo
+ * @param storage Forma de guardar las coordenadas
+ * @param num_threads Número de hilos de OpenMP
+ * */
+void report_quantized_labels(const Dataset& points, const QuantizedPoints& quantized, CentroidAccumulator* accumulator, StorageMode storage, int num_threads) {
+    const int dimension = points.dimension();
+    Dataset centroids(accumulator->n_clusters, dimension, false);
+    accumulate_clusters(points, points.size(), points.labels(), accumulator);
+    for (int k = 0; k < accumulator->n_clusters; k++) {
+        const double* slot = accumulator->buffer + (long long int) k * accumulator->fields;
+        for (int d = 0; d < dimension; d++) {
+            centroids.at(k, d) = slot[dimension] != 0 ? slot[d] / slot[dimension] : 0.0f;
+        }
+    }
+    long long int mismatches = count_quantized_mismatches(points, quantized, centroids, num_threads);
+    cout << storage_mode_name(storage) << ": " << quantized.bytes_per_coordinate() << " bytes per coordinate (4 with float), max quantization error "
+         << quantized.max_error() << "; " << mismatches << " of " << points.size() << " labels differ from the float kernel with the same centroids ("
+         << 100.0 * mismatches / points.size() << "%)" << "\n";
+}
+
+/**
+ * @name model_file_name
+ * @brief Función para obtener el archivo del modelo final (model=): con model=on es ./../Results/Models/[num puntos]_Points_[num clusters]_clusters.kmodel, y se crea la carpeta
+ * @param options Opciones de la ejecución
+ * @param num_points Número de puntos
+ * @param n_clusters Número de clusters o centroides
+ * @return Ruta del archivo de modelo
+ * */
+string model_file_name(const RunOptions& options, long long int num_points, int n_clusters) {
+    if (options.model_file != "on") return options.model_file;
+    make_directory("./../Results/");
+    make_directory("./../Results/Models/");
+    return "./../Results/Models/" + to_string(num_points) + "_Points_" + to_string(n_clusters) + "_clusters.kmodel";
+}
+
+/**
+ * @name run_restarts
+ * @brief Función para ejecutar n_init reinicios de k-means al mismo tiempo en lugar de las 10 repeticiones (n_init=n). Los hilos se reparten en grupos (restart_groups) con OpenMP anidado: cada hilo de la región externa fija la cantidad de hilos de su grupo y toma el siguiente reinicio libre. Cada reinicio usa la semilla seed + r, una vista sin copia de las columnas de los puntos con su propio arreglo de clusters y sus propios acumuladores, cotas y sumas; las coordenadas cuantizadas son de sólo lectura y se comparten. Al terminar un reinicio, si su inercia es la menor hasta el momento sus clusters reemplazan a los conservados y, si no, se liberan. Se escriben los clusters del mejor reinicio y una tabla con todos los reinicios, y con model= el modelo del mejor reinicio
+ * @param points Conjunto de puntos por columnas (sólo lectura)
+ * @param n_clusters Número de clusters o centroides
+ * @param max_iterations Número máximo de iteraciones de cada reinicio
+ * @param num_threads Hilos disponibles en total
+ * @param options Opciones de la ejecución
+ * @param output_dir Carpeta de los resultados de los puntos
+ * @return 0 si los reinicios terminan correctamente
+ * */
+int run_restarts(const Dataset& points, int n_clusters, long long int max_iterations, int num_threads, const RunOptions& options, const string& output_dir) {
+    const int n_init = options.n_init;
+    const int dimension = points.dimension();
+    const RestartGroups groups = restart_groups(n_init, num_threads);
+    RestartBoard board;
+    board.margin = options.prune_margin;
+    board.max_iterations = max_iterations;
+    vector<const float*> columns(dimension);
+    for (int d = 0; d < dimension; d++) columns[d] = points.column(d);
+    QuantizedPoints* quantized = nullptr;
+    if (options.storage != STORAGE_FLOAT) {
+        quantized = new QuantizedPoints(points, options.storage, num_threads);
+    }
+
+    vector<RestartResult> results(n_init);
+    Dataset best;          // Vista con los clusters del reinicio de menor inercia
+    int best_restart = -1;
+    const bool keep_model = !options.model_file.empty();
+    ModelRecorder best_model("", 0, points.size(), options.seed); // Centroides del reinicio de menor inercia (model=)
+    string error;
+    omp_set_max_active_levels(2);
+    double start = omp_get_wtime();
+    #pragma omp parallel num_threads(groups.n_groups)
+    {
+        const int group_threads = groups.group_threads[omp_get_thread_num()];
+        omp_set_num_threads(group_threads); // Hilos de las regiones anidadas de este grupo (también la elección de los centroides iniciales)
+        #pragma omp for schedule(dynamic, 1)
+        for (int r = 0; r < n_init; r++) {
+            try{
+                double restart_start = omp_get_wtime();
+                Dataset restart_points = Dataset::view(points.size(), dimension, columns.data(), nullptr);
+                CentroidAccumulator* accumulator = create_accumulator(group_threads, n_clusters, dimension);
+                TriangleBounds* bounds = nullptr;
+                if (uses_triangle_bounds(options.algorithm)) {
+                    bounds = new TriangleBounds(options.algorithm, points.size(), n_clusters, dimension, options.bounds_memory);
+                }
+                RunningSums* running = nullptr;
+                if (options.update_mode == UPDATE_INCREMENTAL) {
+                    running = create_running_sums(n_clusters, dimension, options.recompute_interval);
+                }
+                RestartMonitor monitor(&board, group_threads);
+                ModelRecorder recorder("", 0, points.size(), options.seed + r);
+                double init_time = 0.0;
+                long long int iterations = kmeans(restart_points, n_clusters, max_iterations, accumulator, bounds, nullptr, running, quantized, nullptr, &monitor,
+                                                  nullptr, keep_model ? &recorder : nullptr, options.init, options.seed + r, init_time, nullptr);
+                results[r] = {r, options.seed + r, group_threads, iterations, monitor.inertia(), omp_get_wtime() - restart_start, monitor.stopped()};
+                free_accumulator(accumulator);
+                delete bounds;
+                if (running != nullptr) free_running_sums(running);
+                // Un reinicio detenido nunca es el mejor: su inercia ya era mayor que la del tablero
+                #pragma omp critical(restart_best)
+                {
+                    if (!monitor.stopped() && (best_restart < 0 || monitor.inertia() < results[best_restart].inertia)) {
+                        best = std::move(restart_points);
+                        best_restart = r;
+                        if (keep_model) best_model = std::move(recorder);
+                    }
+                }
+            } catch (const std::exception& e) {
+                #pragma omp critical(restart_best)
+                error = e.what();
+            }
+        }
+    }
+    double elapsed = omp_get_wtime() - start;
+    delete quantized;
+    if (!error.empty() || best_restart < 0) {
+        cout << "Error: run_restarts()" << "\n";
+        cout << error << "\n";
+        return 1;
+    }
+
+    int stopped = 0;
+    for (const RestartResult& result : results) stopped += result.stopped;
+    cout << "n_init=" << n_init << ": " << groups.n_groups << " concurrent restarts with " << groups.group_threads.back()
+         << (groups.group_threads.front() != groups.group_threads.back() ? "-" + to_string(groups.group_threads.front()) : "") << " threads each, " << stopped << " stopped early, " << elapsed << " s; best restart " << best_restart << " (seed " << results[best_restart].seed
+         << ") with inertia " << results[best_restart].inertia << "\n";
+    try{
+        make_directory("./../Analysis/");
+        make_directory("./../Analysis/Restarts/");
+        write_restart_table("./../Analysis/Restarts/" + to_string(points.size()) + "_Points_" + to_string(num_threads) + "_threads.csv", results, best_restart);
+        ResultWriter writer(options.output_mode);
+        writer.submit(output_dir + "best_" + to_string(points.size()) + "_" + to_string(num_threads) + output_file_suffix(options.output_mode), best);
+        writer.finish();
+        if (keep_model) {
+            string model_file = model_file_name(options, points.size(), n_clusters);
+            best_model.save(model_file, results[best_restart].inertia);
+            cout << "Model: " << model_file << " (restart " << best_restart << ")" << "\n";
+        }
+    } catch (const std::exception& e) {
+        cout << "Error: write_restart_table()" << "\n";
+        cout << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
 
 /**
  * @name main
  * @brief Función main del programa 
  * @param argc Cantidad de argumentos de entrada (STDIN)
- * @param argv Argumentos de entrada (STDIN) [nombre del programa, número de clusters, número de puntos, número máximo de iteraciones]
+ * @param argv Argumentos de entrada (STDIN) [nombre del programa, número de clusters (o "sweep" para el barrido de run_sweep, o "bench" para la medición por fases de run_benchmark), número de puntos o ruta del archivo de entrada (CSV o binario), número máximo de iteraciones, número de hilos, opciones nombre=valor (output=csv|labels|none, algorithm=lloyd|hamerly|elkan|yinyang|kdtree, memory=MiB)]
  * @return 0 si el programa termina correctamente
  * */
 int main(int argc, char** argv) {
 
+    // Barrido de parámetros en un solo proceso
+    if (argc >= 2 && string(argv[1]) == "sweep") {
+        return run_sweep(argc, argv);
+    }
+    // Selección del número de clusters en un solo proceso
+    if (argc >= 2 && string(argv[1]) == "ksweep") {
+        return run_ksweep(argc, argv);
+    }
+    // Medición por fases de una configuración
+    if (argc >= 2 && string(argv[1]) == "bench") {
+        return run_benchmark(argc, argv);
+    }
+
     // Se definen las variables 
     int n_clusters;
     int num_threads;
     long long int num_points;
     long long int max_iterations;
+    string input_file_name; // Archivo de entrada (CSV o binario)
+    RunOptions options; // Opciones nombre=valor (formato de resultados, algoritmo de asignación)
 
     // Se obtienen los argumentos de entrada del programa (número de clusters, número de puntos, número máximo de iteraciones)
     try{
         // Si no se pasan argumentos, se usan los valores por defecto
         if(argc == 1){
             n_clusters = 5;
-            num_points = 100;
+            input_file_name = resolve_input_file("100");
             max_iterations = 5; //90000000;
             num_threads = 6;
         }else
             // Si se pasan argumentos, se usan esos valores
-            if(argc == 5){
+            if(argc >= 5){
                 n_clusters = stoi(argv[1]);
-                num_points = (long long int) stoi(argv[2]);
+                input_file_name = resolve_input_file(argv[2]); // Ruta del archivo o número de puntos de ./../Data/<num_points>_data.csv
                 max_iterations = (long long int) stoi(argv[3]);
                 num_threads = stoi(argv[4]);
+                options = parse_run_options(argc, argv, 5); // output=csv|labels|none, algorithm=lloyd|hamerly|elkan|yinyang|kdtree, memory=MiB
                 if (n_clusters < 1) 
                     throw std::invalid_argument("Invalid number of clusters");
-                if (num_points < 1) 
-                    throw std::invalid_argument("Invalid number of points");
                 if (max_iterations < 1) 
                     throw std::invalid_argument("Invalid number of iterations");
                 if (num_threads < 1)
@@ -330,21 +1048,37 @@ int main(int argc, char** argv) {
     } catch (const std::exception& e) {
         // Se imprime el mensaje de error y se muestra la forma correcta de ejecutar el programa
         cout << e.what() << "\n";
-        cout << "Usage: ./kmeans <n_clusters> <num_points> <max_iterations>" << "\n";
+        cout << "Usage: ./kmeans <n_clusters> <num_points | input_file> <max_iterations> <num_threads> " << RUN_OPTIONS_USAGE << "\n";
         return 1;
     }
-    max_iterations = 2;
     // Se establece el número de hilos a usar en OpenMP pasando el argumento de entrada de num_threads
     omp_set_num_threads(num_threads);
 
     // Se establece que se pueden usar hidir_strlos anidados en OpenMP
     //omp_set_nested(true);
 
-    // Inicializa de forma paralela el arreglo de puntos con ceros y sin cluster con -1
-    float** points = new float*[num_points];
-    //#pragma omp parallel for shared(points, num_points) 
-    for(long long int i = 0; i < num_points; i++) {
-        points[i] = new float[3]{0.0, 0.0, -1}; // {x, y, cluster}
+    // Lee de forma paralela los puntos del archivo de entrada y se guardan en el conjunto de puntos por columnas (coordenadas y cluster -1).
+    // El formato se detecta del encabezado: un archivo binario se proyecta en memoria y se usa sin copiarlo; cualquier otro se lee como CSV.
+    // La cantidad de puntos y la dimensión se obtienen del archivo
+    // Con affinity= (spread por defecto con numa=on) los hilos se fijan antes a sus CPUs, y con numa=on los puntos se copian para que cada página
+    // quede en el nodo del hilo que la recorre
+    NumaTopology topology;
+    vector<int> thread_nodes;
+    Dataset points;
+    try{
+        if (options.numa || options.affinity != AFFINITY_NONE) {
+            topology = numa_topology();
+            thread_nodes = place_threads(options.affinity, num_threads, topology);
+        }
+        points = load_points(input_file_name, num_threads);
+        if (options.numa) {
+            points = first_touch_copy(points, num_threads);
+        }
+        num_points = points.size();
+    } catch (const std::exception& e) {
+        cout << "Error: load_points()" << "\n";
+        cout << e.what() << "\n";
+        return 1;
     }
 
     // Crea el directorio de resultados correspondiente al número de puntos del experimento  
@@ -375,45 +1109,130 @@ int main(int argc, char** argv) {
     }
     delete[] dir_a;
 
-    // Lee de forma paralela los puntos del archivo csv  y se guardan en la matriz de puntos
-    string input_file_name = "./../Data/" + to_string(num_points)+"_data.csv";
-    try{
-        load_CSV(input_file_name, points, num_points, num_threads);
-    } catch (const std::exception& e) {
-        cout << "Error: load_CSV()" << "\n";
-        cout << e.what() << "\n";
+    // Con warm= los centroides iniciales se toman de un modelo anterior, de un punto de control (para reanudar la ejecución) o de un CSV de centroides
+    KmeansModel* warm = nullptr;
+    if (!options.warm_file.empty()) {
+        try{
+            warm = new KmeansModel(load_model(options.warm_file));
+            if (warm->centroids.size() != n_clusters || warm->centroids.dimension() != points.dimension())
+                throw std::invalid_argument("The model has " + to_string(warm->centroids.size()) + " centroids of dimension " + to_string(warm->centroids.dimension()) +
+                                            ", expected " + to_string(n_clusters) + " of dimension " + to_string(points.dimension()));
+        } catch (const std::exception& e) {
+            cout << "Error: load_model()" << "\n";
+            cout << e.what() << "\n";
+            delete warm;
+            return 1;
+        }
+        cout << "warm=" << options.warm_file << ": " << (warm->checkpoint ? "resuming after iteration " + to_string(warm->iterations) : "starting from its centroids") << "\n";
     }
-    
+
+    // Con n_init=n se ejecutan n reinicios concurrentes en lugar de las 10 repeticiones y sólo se conserva el de menor inercia
+    if (options.n_init > 1) {
+        return run_restarts(points, n_clusters, max_iterations, num_threads, options, dir_str_a);
+    }
+
+    // Reserva una sola vez los buffers de acumulación por hilo que se reutilizan en las 10 repeticiones
+    // Con numa=on el bloque de cada hilo ocupa páginas propias en su nodo y los centroides se replican en cada nodo
+    CentroidAccumulator* accumulator = options.numa ? create_local_accumulator(num_threads, n_clusters, points.dimension())
+                                                    : create_accumulator(num_threads, n_clusters, points.dimension());
+    CentroidReplicas* replicas = options.numa ? new CentroidReplicas(thread_nodes, n_clusters, points.dimension()) : nullptr;
+    // Con algorithm=hamerly, elkan o yinyang también se reservan una sola vez las cotas de los puntos
+    TriangleBounds* bounds = nullptr;
+    if (uses_triangle_bounds(options.algorithm)) {
+        bounds = new TriangleBounds(options.algorithm, num_points, n_clusters, points.dimension(), options.bounds_memory);
+    }
+    // Con algorithm=kdtree el árbol se construye una sola vez en paralelo y se reutiliza en las 10 repeticiones
+    KdTree* tree = nullptr;
+    double tree_build_time = 0.0;
+    if (options.algorithm == ASSIGN_KDTREE) {
+        double tree_start = omp_get_wtime();
+        tree = new KdTree(points, num_threads);
+        tree_build_time = omp_get_wtime() - tree_start;
+    }
+    // Con update=incremental las sumas de cada cluster se conservan entre iteraciones
+    RunningSums* running = nullptr;
+    if (options.update_mode == UPDATE_INCREMENTAL) {
+        running = create_running_sums(n_clusters, points.dimension(), options.recompute_interval);
+    }
+    // Con storage=q16|q8 las coordenadas se cuantizan una sola vez y la asignación y la acumulación leen los códigos
+    QuantizedPoints* quantized = nullptr;
+    if (options.storage != STORAGE_FLOAT) {
+        quantized = new QuantizedPoints(points, options.storage, num_threads);
+    }
+
+    // Con model= se guarda el modelo de la repetición de menor inercia, y con checkpoint=n un punto de control cada n iteraciones en [modelo].ckpt
+    ModelRecorder* recorder = nullptr;
+    string model_file;
+    if (!options.model_file.empty()) {
+        model_file = model_file_name(options, num_points, n_clusters);
+        recorder = new ModelRecorder(model_file + ".ckpt", options.checkpoint_interval, num_points, options.seed);
+    }
+    double best_inertia = numeric_limits<double>::infinity(); // Inercia del modelo guardado
+    int best_repetition = 0;
+
+    // Con -DKMEANS_TRACE y trace= se registra cada iteración de las 10 repeticiones
+    KMEANS_TRACE_ONLY(iteration_trace().configure(!options.trace_prefix.empty(), options.hardware_counters);)
+
+    // Los resultados de cada repetición se escriben en segundo plano mientras empieza la siguiente
+    ResultWriter writer(options.output_mode);
     string output_file_name;
     double* times = new double[11]{0.0}; // Arreglo para guardar los tiempos de ejecución de cada experimento
     float sum_times = 0.0; // Variable para guardar la suma de los tiempos de ejecución de los 10 experimentos
     float avg_time = 0.0; // Variable para guardar el promedio de los tiempos de ejecución de los 10 experimentos
     double start; // Variable para guardar el tiempo de inicio de la ejecución del algoritmo
+    long long int iterations[11] = {0}; // Iteraciones de cada experimento hasta converger (o hasta el máximo)
+    double init_times[11] = {0.0}; // Segundos de la elección de los centroides iniciales de cada experimento
     // Se itera serialmente 10 veces para repetir el experimento con esta configuración de parámetros
     for(int i = 1; i < 11; i++){
         //cout << "Experiment " << i << "\n";
         // Invoca el método de kmeans con la matriz de puntos, el número de clusters deseados y el número total de puntos
         try{
+            KMEANS_TRACE_ONLY(iteration_trace().begin_run(i, num_threads);)
+            // Un punto de control reanudado conserva la semilla de la ejecución que lo escribió
+            if (recorder != nullptr) recorder->set_seed(warm != nullptr && warm->checkpoint ? warm->seed : options.seed + i - 1);
             start = omp_get_wtime(); 
-            kmeans(points, n_clusters, num_points, max_iterations); 
+            iterations[i] = kmeans(points, n_clusters, max_iterations, accumulator, bounds, tree, running, quantized, replicas, nullptr, warm, recorder, options.init, options.seed + i - 1, init_times[i], nullptr);
             times[i] = omp_get_wtime() - start;
             sum_times += times[i];
         } catch (const std::exception& e) {
             cout << "Error: kmeans()" << "\n";
             cout << e.what() << "\n";
         }
+
+        // Con model= la inercia de los centroides finales se calcula fuera del tiempo medido y el modelo se reemplaza si es menor
+        if (recorder != nullptr) {
+            try{
+                double inertia = cluster_inertia(points, recorder->centroids(), num_threads);
+                if (inertia < best_inertia) {
+                    recorder->save(model_file, inertia);
+                    best_inertia = inertia;
+                    best_repetition = i;
+                }
+            } catch (const std::exception& e) {
+                cout << "Error: save_model()" << "\n";
+                cout << e.what() << "\n";
+            }
+        }
             
-        // Guarda el resultado de los puntos con su respectivo centroide/cluster en el archivo de salida
-        output_file_name = dir_str_a + to_string(i) +"_"+ to_string(num_points)+"_"+to_string(num_threads)+"_results.csv"; 
+        // Encola el resultado de los puntos con su respectivo centroide/cluster para escribirlo en el archivo de salida
+        output_file_name = dir_str_a + to_string(i) +"_"+ to_string(num_points)+"_"+to_string(num_threads)+output_file_suffix(options.output_mode); 
         //output_file_name = dir_str + "P_"+ to_string(num_points)+"_results.csv"; 
         try{
-            save_to_CSV(output_file_name, points, num_points);
+            writer.submit(output_file_name, points);
         } catch (const std::exception& e) {
             cout << "Error: save_to_CSV()" << "\n";
             cout << e.what() << "\n";
         }
     }
 
+    // Espera a que termine la escritura de los resultados
+    try{
+        writer.finish();
+    } catch (const std::exception& e) {
+        cout << "Error: save_to_CSV()" << "\n";
+        cout << e.what() << "\n";
+    }
+
     // Crea el directorio de resultados correspondiente al número de puntos del experimento  
     string dir_str_b = "./../Analysis/Parallel/Execution_Times/"+ to_string(num_points) +"_Points/";
     char* dir_b = new char[dir_str_b.length() + 1];
@@ -440,12 +1259,68 @@ int main(int argc, char** argv) {
     }
 
 
-    // Libera la memoria al borrar la matriz de puntos
-    for(long long int i = 0; i < num_points; i++) {
-        delete[] points[i];
+    // Reporta las iteraciones que necesitó cada repetición con la forma de elegir los centroides iniciales
+    // (con warm= las 10 repeticiones empiezan de los mismos centroides y necesitan las mismas iteraciones)
+    if (warm != nullptr) {
+        cout << "warm=" << options.warm_file << ": " << iterations[1] << " iterations" << (warm->checkpoint ? " in total" : "") << ", " << init_times[1] << " s copying the centroids" << "\n";
+    } else {
+        report_iterations(options.init, options.seed, iterations, init_times, 10);
+    }
+    // El punto de control ya no hace falta cuando la ejecución terminó
+    if (recorder != nullptr && best_repetition > 0) {
+        cout << "Model: " << model_file << " (repetition " << best_repetition << ", " << iterations[best_repetition] << " iterations, inertia " << best_inertia;
+        if (options.checkpoint_interval > 0) {
+            cout << ", " << recorder->checkpoints() << " checkpoints every " << options.checkpoint_interval << " iterations";
+            remove((model_file + ".ckpt").c_str());
+        }
+        cout << ")" << "\n";
+    }
+
+    // Reporta cuántas distancias evitaron calcular las cotas en las 10 repeticiones
+    if (bounds != nullptr) {
+        report_skipped_distances(*bounds);
+    }
+    if (tree != nullptr) {
+        report_kd_tree(*tree, tree_build_time);
+    }
+    // Reporta qué parte de los puntos y de los clusters quedó en el nodo del hilo que los asigna
+    if (options.numa || options.affinity != AFFINITY_NONE) {
+        report_numa_placement(topology, thread_nodes, options, measure_page_locality(points, thread_nodes));
+    }
+    // Verifica la asignación cuantizada contra la de float con los centroides de los clusters de la última repetición
+    if (quantized != nullptr) {
+        report_quantized_labels(points, *quantized, accumulator, options.storage, num_threads);
+    }
+
+    // Escribe la traza por iteración (formato de eventos de Chrome y CSV)
+#ifdef KMEANS_TRACE
+    if (iteration_trace().enabled()) {
+        string trace_prefix = options.trace_prefix;
+        if (trace_prefix == "on") {
+            make_directory("./../Analysis/");
+            make_directory("./../Analysis/Trace/");
+            trace_prefix = "./../Analysis/Trace/" + to_string(num_points) + "_Points_" + to_string(num_threads) + "_threads";
+        }
+        try{
+            iteration_trace().write(trace_prefix);
+            cout << "Trace: " << trace_prefix << ".json, " << trace_prefix << ".csv (hardware counters "
+                 << (iteration_trace().counters_available() ? "on" : options.hardware_counters ? "unavailable" : "off") << ")" << "\n";
+        } catch (const std::exception& e) {
+            cout << "Error: iteration_trace().write()" << "\n";
+            cout << e.what() << "\n";
+        }
     }
-    delete[] points;
+#endif
 
+    // Libera los buffers de acumulación por hilo, las cotas y el árbol (las columnas de los puntos se liberan al salir de main)
+    free_accumulator(accumulator);
+    delete bounds;
+    delete tree;
+    if (running != nullptr) free_running_sums(running);
+    delete quantized;
+    delete replicas;
+    delete warm;
+    delete recorder;
 
     // Termina el programa con éxito
     return 0;
@@ -13,13 +13,16 @@ python3 ./generate_data.py
 # 3. Run the parallel experiment.
 ./parallel_experiment.sh
 
+# 4. Run the in-process sweep that writes the strong and weak scaling tables.
+./sweep_experiment.sh
+
 
 # Otras posibles automatizaciones futuras:
 
-# 4. Run the plot script to generate the plots.
+# 5. Run the plot script to generate the plots.
 
-# 5. Run the report script to generate the report.
+# 6. Run the report script to generate the report.
 
-# 6. Run the clean script to remove the generated files.
+# 7. Run the clean script to remove the generated files.
 
-# 7. Run the zip script to zip the project.
+# 8. Run the zip script to zip the project.
@@ -0,0 +1,374 @@
+/**
+ * @file point_stream.hpp
+ * @date 2023-03-08
+ * @author Diego Hernández Delgado
+ * @author Jesús Isaías García Moreno
+ * @brief Lectura por lotes de archivos de puntos más grandes que la memoria. El archivo (CSV o binario) se proyecta en memoria y cada lote se copia a un conjunto de tamaño fijo, ya sea en orden o con renglones elegidos al azar; las páginas ya leídas en orden se descartan, de modo que la memoria depende del tamaño del lote y no del número de puntos. Un hilo de lectura llena el siguiente lote mientras los hilos de cálculo procesan el actual
+ * */
+
+#ifndef POINT_STREAM_HPP
+#define POINT_STREAM_HPP
+
+#include <omp.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "binary_format.hpp"
+#include "csv_io.hpp"
+#include "dataset.hpp"
+#include "mapped_file.hpp"
+
+/**
+ * @name SamplingMode
+ * @brief Forma de elegir los puntos de cada lote: renglones al azar (con reemplazo) o renglones consecutivos del archivo
+ * */
+enum SamplingMode { SAMPLING_RANDOM, SAMPLING_SEQUENTIAL };
+
+/**
+ * @name parse_sampling_mode
+ * @brief Función para convertir el argumento de entrada en una forma de elegir los lotes
+ * @param argument "random" o "sequential"
+ * @return Forma de elegir los lotes
+ * */
+inline SamplingMode parse_sampling_mode(const std::string& argument) {
+    if (argument == "random") return SAMPLING_RANDOM;
+    if (argument == "sequential") return SAMPLING_SEQUENTIAL;
+    throw std::invalid_argument("Invalid sampling mode (random or sequential): " + argument);
+}
+
+// Bytes que se leen en orden antes de descartar las páginas ya copiadas
+const long long int POINT_STREAM_RELEASE_SIZE = 64 << 20;
+
+/**
+ * @name PointStream
+ * @brief Archivo de puntos leído por lotes. En orden, un cursor avanza por el archivo y las páginas que quedan atrás se descartan; al azar, cada renglón se elige con un índice uniforme (binario) o con un byte uniforme del archivo, tomando el renglón que lo contiene y aceptándolo con probabilidad longitud del renglón más corto / longitud del renglón (CSV). El byte elige cada renglón con probabilidad proporcional a su longitud, así que sin ese rechazo los renglones que se escriben con más caracteres saldrían más seguido; para conocer el renglón más corto, el primer lote al azar de un CSV recorre todo el archivo una vez, y cada punto cuesta en promedio longitud promedio / longitud mínima sorteos, así que para muestrear al azar conviene el formato binario
+ * */
+class PointStream {
+public:
+    /**
+     * @name PointStream
+     * @brief Constructor que proyecta el archivo en memoria y detecta su formato y su dimensión
+     * @param file_name Nombre del archivo de entrada (CSV o binario)
+     * */
+    explicit PointStream(const std::string& file_name)
+        : file_name_(file_name), file_(file_name), binary_(false), num_rows_(-1), dimension_(0), cursor_(0), text_(0), released_(0), shortest_row_(0) {
+        if (file_.size() == 0) throw std::runtime_error("Input file " + file_name + " is empty");
+        if (is_binary_dataset(file_.data(), file_.size())) {
+            BinaryDatasetHeader header = read_binary_header(file_, file_name);
+            binary_ = true;
+            num_rows_ = header.num_rows;
+            dimension_ = header.dimension;
+            for (uint64_t d = 0; d < header.dimension; d++) {
+                columns_.push_back(reinterpret_cast<const float*>(file_.data() + header.data_offset + d * header.column_stride));
+            }
+            if (num_rows_ == 0) throw std::runtime_error("Input file " + file_name + " has no points");
+        } else {
+            dimension_ = detect_dimension(file_.data(), file_.data() + file_.size());
+        }
+    }
+
+    PointStream(const PointStream&) = delete;
+    PointStream& operator=(const PointStream&) = delete;
+
+    // Número de coordenadas de cada punto
+    int dimension() const { return dimension_; }
+    // Número de puntos del archivo (-1 si es un CSV, que no se cuenta por adelantado)
+    long long int size() const { return num_rows_; }
+    // Índice del siguiente punto que se lee en orden
+    long long int position() const { return cursor_; }
+    // Tamaño del archivo en bytes
+    long long int file_size() const { return file_.size(); }
+
+    /**
+     * @name set_sampling
+     * @brief Función para avisar al sistema operativo si los siguientes lotes se leen en orden o al azar
+     * @param mode Forma de elegir los lotes
+     * */
+    void set_sampling(SamplingMode mode) {
+        file_.advise(mode == SAMPLING_RANDOM ? MADV_RANDOM : MADV_SEQUENTIAL);
+    }
+
+    /**
+     * @name rewind
+     * @brief Función para regresar el cursor al inicio del archivo
+     * */
+    void rewind() {
+        cursor_ = 0;
+        text_ = 0;
+        released_ = 0;
+    }
+
+    /**
+     * @name read
+     * @brief Función para copiar los siguientes puntos en orden al inicio de un lote
+     * @param batch Conjunto de puntos de destino (de la misma dimensión)
+     * @param max_rows Cantidad máxima de puntos a leer (a lo más batch.size())
+     * @return Cantidad de puntos leídos (0 al final del archivo)
+     * */
+    long long int read(Dataset& batch, long long int max_rows) {
+        long long int rows = 0;
+        if (binary_) {
+            rows = std::min(max_rows, num_rows_ - cursor_);
+            for (int d = 0; d < dimension_ && rows > 0; d++) {
+                memcpy(batch.column(d), columns_[d] + cursor_, rows * sizeof(float));
+            }
+            cursor_ += rows;
+            // Las columnas se leen en paralelo, así que se descarta lo ya leído de cada una
+            if ((cursor_ - released_) * (long long int) sizeof(float) * dimension_ >= POINT_STREAM_RELEASE_SIZE || cursor_ == num_rows_) {
+                for (int d = 0; d < dimension_; d++) {
+                    file_.release(reinterpret_cast<const char*>(columns_[d] + released_) - file_.data(), (cursor_ - released_) * sizeof(float));
+                }
+                released_ = cursor_;
+            }
+            return rows;
+        }
+        const char* text = file_.data();
+        const char* end = text + file_.size();
+        const char* c = text + text_;
+        while (rows < max_rows && c < end) {
+            if (!csv_row_starts(c)) {
+                c++;
+                continue;
+            }
+            c = parse_csv_row(c, end, batch, rows);
+            if (c == nullptr)
+                throw std::invalid_argument("Invalid row " + std::to_string(cursor_ + rows + 1) + " in " + file_name_);
+            rows++;
+        }
+        cursor_ += rows;
+        text_ = c - text;
+        if (text_ - released_ >= POINT_STREAM_RELEASE_SIZE || c == end) {
+            file_.release(released_, text_ - released_);
+            released_ = text_;
+        }
+        return rows;
+    }
+
+    /**
+     * @name sample
+     * @brief Función para copiar puntos elegidos al azar (con reemplazo) al inicio de un lote
+     * @param batch Conjunto de puntos de destino (de la misma dimensión)
+     * @param rows Cantidad de puntos a elegir (a lo más batch.size())
+     * @param generator Generador de números aleatorios
+     * */
+    void sample(Dataset& batch, long long int rows, std::mt19937_64& generator) {
+        if (binary_) {
+            std::uniform_int_distribution<long long int> index(0, num_rows_ - 1);
+            for (long long int i = 0; i < rows; i++) {
+                long long int row = index(generator);
+                for (int d = 0; d < dimension_; d++) {
+                    batch.at(i, d) = columns_[d][row];
+                }
+            }
+            return;
+        }
+        const char* text = file_.data();
+        const char* end = text + file_.size();
+        std::uniform_int_distribution<long long int> offset(0, file_.size() - 1);
+        const long long int shortest = shortest_row();
+        for (long long int i = 0; i < rows; ) {
+            // Inicio del renglón que contiene el byte elegido (los renglones vacíos se vuelven a sortear)
+            const char* c = text + offset(generator);
+            while (c > text && c[-1] != '\n') c--;
+            if (!csv_row_starts(c)) continue;
+            // Un renglón de L bytes contiene el byte elegido con probabilidad proporcional a L; aceptarlo con probabilidad shortest / L deja la misma probabilidad para todos los renglones
+            const long long int length = csv_next_row(c, end) - c;
+            if (std::uniform_int_distribution<long long int>(1, length)(generator) > shortest) continue;
+            if (parse_csv_row(c, end, batch, i) == nullptr)
+                throw std::invalid_argument("Invalid row at byte " + std::to_string(c - text) + " in " + file_name_);
+            i++;
+        }
+    }
+
+private:
+    // Longitud en bytes (con el fin de renglón) del renglón con datos más corto del CSV; se calcula en paralelo la primera vez que se necesita
+    long long int shortest_row() {
+        if (shortest_row_ > 0) return shortest_row_;
+        const char* text = file_.data();
+        const char* end = text + file_.size();
+        const int n_chunks = omp_get_max_threads();
+        std::vector<const char*> bounds = csv_chunk_bounds(text, end, n_chunks);
+        long long int shortest = file_.size();
+        #pragma omp parallel for schedule(static, 1) reduction(min:shortest)
+        for (int t = 0; t < n_chunks; t++) {
+            for (const char* c = bounds[t]; c < bounds[t + 1]; ) {
+                const char* next = csv_next_row(c, end);
+                if (csv_row_starts(c)) shortest = std::min(shortest, (long long int) (next - c));
+                c = next;
+            }
+        }
+        shortest_row_ = shortest;
+        return shortest_row_;
+    }
+
+    std::string file_name_;
+    MappedFile file_;
+    bool binary_;
+    long long int num_rows_;
+    int dimension_;
+    std::vector<const float*> columns_; // Columnas del archivo binario
+    long long int cursor_;   // Índice del siguiente punto en orden
+    long long int text_;     // Byte del siguiente renglón en orden (CSV)
+    long long int released_; // Hasta dónde se descartaron las páginas leídas (punto en binario, byte en CSV)
+    long long int shortest_row_; // Bytes del renglón con datos más corto del CSV (0 mientras no se calcula)
+};
+
+/**
+ * @name PointBatch
+ * @brief Lote de puntos leído del archivo. El conjunto tiene capacidad fija y sólo sus primeros rows puntos son válidos; su arreglo de clusters queda libre para el cálculo
+ * */
+struct PointBatch {
+    Dataset points;          // Puntos del lote (capacidad fija)
+    long long int rows;      // Cantidad de puntos válidos
+    long long int first_row; // Índice en el archivo del primer punto (sólo en orden)
+};
+
+/**
+ * @name BatchPrefetcher
+ * @brief Hilo de lectura que llena lotes por adelantado. Mientras los hilos de cálculo procesan un lote, el hilo de lectura llena el siguiente (doble buffer con dos lotes). En orden y con repeat, al llegar al final del archivo se vuelve al inicio; sin repeat, next regresa nullptr al final del archivo
+ * */
+class BatchPrefetcher {
+public:
+    /**
+     * @name BatchPrefetcher
+     * @brief Constructor que reserva los lotes y arranca el hilo de lectura
+     * @param stream Archivo de puntos; no se debe usar desde otro hilo mientras exista el lector
+     * @param batch_size Capacidad de cada lote en puntos
+     * @param mode Forma de elegir los puntos de cada lote
+     * @param repeat Si la lectura en orden vuelve al inicio del archivo al terminarlo
+     * @param seed Semilla de la elección al azar
+     * @param slots Número de lotes en circulación (2: doble buffer)
+     * */
+    BatchPrefetcher(PointStream& stream, long long int batch_size, SamplingMode mode, bool repeat, uint64_t seed, int slots = 2)
+        : stream_(stream), mode_(mode), repeat_(repeat), generator_(seed), ready_(slots, false),
+          produced_(0), consumed_(0), holding_(false), stopping_(false), wait_time_(0.0) {
+        for (int s = 0; s < slots; s++) {
+            batches_.emplace_back(new PointBatch{Dataset(batch_size, stream.dimension()), 0, 0});
+        }
+        stream_.set_sampling(mode_);
+        worker_ = std::thread(&BatchPrefetcher::run, this);
+    }
+
+    ~BatchPrefetcher() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        changed_.notify_all();
+        worker_.join();
+    }
+
+    BatchPrefetcher(const BatchPrefetcher&) = delete;
+    BatchPrefetcher& operator=(const BatchPrefetcher&) = delete;
+
+    /**
+     * @name next
+     * @brief Función para devolver el lote anterior al hilo de lectura y esperar el siguiente. Lanza el error de lectura, si lo hubo
+     * @return Siguiente lote, o nullptr si se terminó el archivo (sólo en orden y sin repeat)
+     * */
+    PointBatch* next() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (holding_) {
+            ready_[consumed_ % ready_.size()] = false;
+            consumed_++;
+            holding_ = false;
+            changed_.notify_all();
+        }
+        double start = omp_get_wtime();
+        changed_.wait(lock, [this]() { return ready_[consumed_ % ready_.size()] || error_; });
+        wait_time_ += omp_get_wtime() - start;
+        if (error_) std::rethrow_exception(error_);
+        PointBatch* batch = batches_[consumed_ % ready_.size()].get();
+        if (batch->rows == 0) return nullptr;
+        holding_ = true;
+        return batch;
+    }
+
+    // Segundos que los hilos de cálculo esperaron un lote (0 si la lectura se traslapa por completo con el cálculo)
+    double wait_time() const { return wait_time_; }
+
+private:
+    // Ciclo del hilo de lectura: llena los lotes en orden circular mientras haya uno libre
+    void run() {
+        try {
+            while (true) {
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    changed_.wait(lock, [this]() { return stopping_ || !ready_[produced_ % ready_.size()]; });
+                    if (stopping_) return;
+                }
+                PointBatch* batch = batches_[produced_ % ready_.size()].get();
+                fill(*batch);
+                std::lock_guard<std::mutex> lock(mutex_);
+                ready_[produced_ % ready_.size()] = true;
+                produced_++;
+                changed_.notify_all();
+                if (batch->rows == 0) return; // Fin del archivo
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            error_ = std::current_exception();
+            changed_.notify_all();
+        }
+    }
+
+    // Llena un lote completo según la forma de elegir los puntos
+    void fill(PointBatch& batch) {
+        const long long int capacity = batch.points.size();
+        if (mode_ == SAMPLING_RANDOM) {
+            stream_.sample(batch.points, capacity, generator_);
+            batch.rows = capacity;
+            batch.first_row = -1;
+            return;
+        }
+        batch.first_row = stream_.position();
+        batch.rows = stream_.read(batch.points, capacity);
+        // Al dar la vuelta al archivo el lote se completa desde el inicio (batch.first_row sólo describe la primera parte)
+        while (repeat_ && batch.rows < capacity) {
+            if (batch.rows == 0 && stream_.position() == 0)
+                throw std::runtime_error("Input file has no points");
+            stream_.rewind();
+            batch.rows += read_at(batch, batch.rows, capacity - batch.rows);
+        }
+    }
+
+    // Lee en orden a partir de la posición offset del lote, pasando por un lote auxiliar del tamaño que falta
+    long long int read_at(PointBatch& batch, long long int offset, long long int rows) {
+        if (offset == 0) return stream_.read(batch.points, rows);
+        if (tail_.size() < rows) tail_ = Dataset(rows, stream_.dimension(), false);
+        long long int read = stream_.read(tail_, rows);
+        for (int d = 0; d < stream_.dimension(); d++) {
+            memcpy(batch.points.column(d) + offset, tail_.column(d), read * sizeof(float));
+        }
+        return read;
+    }
+
+    PointStream& stream_;
+    SamplingMode mode_;
+    bool repeat_;
+    std::mt19937_64 generator_;
+    std::vector<std::unique_ptr<PointBatch>> batches_;
+    std::vector<bool> ready_;  // Si cada lote está lleno y listo para el cálculo
+    Dataset tail_;             // Lote auxiliar para completar un lote al dar la vuelta al archivo
+    long long int produced_;   // Lotes llenados por el hilo de lectura
+    long long int consumed_;   // Lotes devueltos por los hilos de cálculo
+    bool holding_;             // Si los hilos de cálculo tienen un lote
+    bool stopping_;
+    double wait_time_;
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::exception_ptr error_;
+    std::thread worker_;
+};
+
+#endif
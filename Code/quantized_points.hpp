@@ -0,0 +1,528 @@
+/**
+ * @file quantized_points.hpp
+ * @date 2023-03-08
+ * @author Diego Hernández Delgado
+ * @author Jesús Isaías García Moreno
+ * @brief Almacenamiento comprimido de las coordenadas (storage=q16|q8) para la asignación de Lloyd: cada columna se guarda como enteros sin signo de 16 u 8 bits con una escala y un desplazamiento propios (x ≈ offset + scale * código). Los kernels de distancia leen los códigos, los convierten a float dentro de los registros vectoriales y calculan las distancias igual que los kernels de distance_kernels.hpp, de modo que cada iteración lee 2 o 1 bytes por coordenada en lugar de 4. La acumulación suma los códigos en double (exacta) y los convierte a coordenadas una sola vez por cluster
+ * */
+
+#ifndef QUANTIZED_POINTS_HPP
+#define QUANTIZED_POINTS_HPP
+
+#include <omp.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "centroid_accumulator.hpp"
+#include "dataset.hpp"
+#include "distance_kernels.hpp"
+
+/**
+ * @name StorageMode
+ * @brief Forma de guardar las coordenadas que se leen en cada iteración
+ * */
+enum StorageMode { STORAGE_FLOAT, STORAGE_Q16, STORAGE_Q8 };
+
+/**
+ * @name parse_storage_mode
+ * @brief Función para convertir el argumento de entrada en una forma de guardar las coordenadas
+ * @param argument "float", "q16" o "q8"
+ * @return Forma de guardar las coordenadas
+ * */
+inline StorageMode parse_storage_mode(const std::string& argument) {
+    if (argument == "float") return STORAGE_FLOAT;
+    if (argument == "q16") return STORAGE_Q16;
+    if (argument == "q8") return STORAGE_Q8;
+    throw std::invalid_argument("Invalid storage mode (float, q16 or q8): " + argument);
+}
+
+/**
+ * @name storage_mode_name
+ * @brief Función para obtener el nombre de una forma de guardar las coordenadas
+ * @param mode Forma de guardar las coordenadas
+ * @return Nombre de la forma
+ * */
+inline const char* storage_mode_name(StorageMode mode) {
+    switch (mode) {
+        case STORAGE_Q16: return "q16";
+        case STORAGE_Q8: return "q8";
+        default: return "float";
+    }
+}
+
+/**
+ * @name QuantizedPoints
+ * @brief Columnas de códigos de 16 u 8 bits de un conjunto de puntos, con la escala y el desplazamiento de cada columna. Se construye a partir del conjunto en float, que se sigue usando para elegir los centroides iniciales y para escribir los resultados
+ * */
+class QuantizedPoints {
+public:
+    /**
+     * @name QuantizedPoints
+     * @brief Constructor que cuantiza en paralelo cada columna en el rango [mínimo, máximo] de la columna
+     * @param points Conjunto de puntos por columnas
+     * @param mode STORAGE_Q16 o STORAGE_Q8
+     * @param num_threads Número de hilos de OpenMP
+     * */
+    QuantizedPoints(const Dataset& points, StorageMode mode, int num_threads)
+        : num_rows_(points.size()), dimension_(points.dimension()), bytes_(mode == STORAGE_Q8 ? 1 : 2),
+          columns_(points.dimension(), nullptr), scale_(points.dimension()), offset_(points.dimension()), max_error_(0.0) {
+        if (mode == STORAGE_FLOAT)
+            throw std::invalid_argument("QuantizedPoints needs storage=q16 or storage=q8");
+        const double levels = bytes_ == 1 ? 255.0 : 65535.0;
+        try {
+            for (int d = 0; d < dimension_; d++) {
+                long long int padded = (num_rows_ * bytes_ + DATASET_ALIGNMENT - 1) / DATASET_ALIGNMENT * DATASET_ALIGNMENT;
+                columns_[d] = aligned_alloc(DATASET_ALIGNMENT, std::max(padded, DATASET_ALIGNMENT));
+                if (columns_[d] == nullptr) throw std::bad_alloc();
+                memset(columns_[d], 0, std::max(padded, DATASET_ALIGNMENT));
+
+                // Rango de la columna
+                const float* column = points.column(d);
+                float low = num_rows_ > 0 ? column[0] : 0.0f;
+                float high = low;
+                #pragma omp parallel for num_threads(num_threads) schedule(static) reduction(min:low) reduction(max:high)
+                for (long long int i = 0; i < num_rows_; i++) {
+                    low = std::min(low, column[i]);
+                    high = std::max(high, column[i]);
+                }
+                offset_[d] = low;
+                scale_[d] = high > low ? (float) ((high - low) / levels) : 1.0f;
+
+                // Código más cercano de cada coordenada
+                const double scale = scale_[d];
+                double max_error = 0.0;
+                #pragma omp parallel for num_threads(num_threads) schedule(static) reduction(max:max_error)
+                for (long long int i = 0; i < num_rows_; i++) {
+                    double code = std::min(levels, std::max(0.0, std::nearbyint((column[i] - (double) low) / scale)));
+                    if (bytes_ == 1) {
+                        static_cast<uint8_t*>(columns_[d])[i] = (uint8_t) code;
+                    } else {
+                        static_cast<uint16_t*>(columns_[d])[i] = (uint16_t) code;
+                    }
+                    max_error = std::max(max_error, std::fabs((double) dequantize(d, (uint32_t) code) - column[i]));
+                }
+                max_error_ = std::max(max_error_, max_error);
+            }
+        } catch (...) {
+            release();
+            throw;
+        }
+    }
+
+    ~QuantizedPoints() {
+        release();
+    }
+
+    QuantizedPoints(const QuantizedPoints&) = delete;
+    QuantizedPoints& operator=(const QuantizedPoints&) = delete;
+
+    // Número de puntos
+    long long int size() const { return num_rows_; }
+    // Número de coordenadas de cada punto
+    int dimension() const { return dimension_; }
+    // Bytes por coordenada (2 con q16, 1 con q8)
+    int bytes_per_coordinate() const { return bytes_; }
+    // Columna de códigos de la coordenada d
+    const uint16_t* column16(int d) const { return static_cast<const uint16_t*>(columns_[d]); }
+    const uint8_t* column8(int d) const { return static_cast<const uint8_t*>(columns_[d]); }
+    // Escala y desplazamiento de la columna d
+    float scale(int d) const { return scale_[d]; }
+    float offset(int d) const { return offset_[d]; }
+    // Máxima diferencia entre una coordenada y su valor cuantizado
+    double max_error() const { return max_error_; }
+
+    /**
+     * @name dequantize
+     * @brief Función para convertir un código en coordenada, con las mismas operaciones (producto y suma sin FMA) que los kernels vectoriales
+     * @param d Coordenada
+     * @param code Código
+     * @return Coordenada cuantizada
+     * */
+    KMEANS_KERNEL_ATTRIBUTES
+    float dequantize(int d, uint32_t code) const {
+        return (float) code * scale_[d] + offset_[d];
+    }
+
+private:
+    void release() {
+        for (void* column : columns_) free(column);
+        columns_.clear();
+    }
+
+    long long int num_rows_;
+    int dimension_;
+    int bytes_;
+    std::vector<void*> columns_;
+    std::vector<float> scale_;
+    std::vector<float> offset_;
+    double max_error_;
+};
+
+/**
+ * @name QuantizedNearestKernel
+ * @brief Firma común de los kernels de distancia sobre códigos: asigna a cada punto del rango [begin, end) el índice de su centroide más cercano con las coordenadas cuantizadas
+ * */
+typedef void (*QuantizedNearestKernel)(const QuantizedPoints& points, long long int begin, long long int end, const Dataset& centroids, int32_t* labels);
+
+/**
+ * @name quantized_codes
+ * @brief Función para obtener la columna de códigos de una coordenada con el tipo del kernel
+ * */
+template <typename T>
+inline const T* quantized_codes(const QuantizedPoints& points, int d);
+
+template <>
+inline const uint16_t* quantized_codes<uint16_t>(const QuantizedPoints& points, int d) { return points.column16(d); }
+
+template <>
+inline const uint8_t* quantized_codes<uint8_t>(const QuantizedPoints& points, int d) { return points.column8(d); }
+
+/**
+ * @name quantized_nearest_scalar
+ * @brief Kernel escalar de referencia sobre códigos; también se usa para los puntos sobrantes de los kernels vectoriales
+ * @tparam T uint16_t o uint8_t
+ * @tparam DIM Dimensión fija de los puntos, o 0 para usar la dimensión del conjunto en tiempo de ejecución
+ * */
+template <typename T, int DIM>
+KMEANS_KERNEL_ATTRIBUTES
+inline void quantized_nearest_scalar(const QuantizedPoints& points, long long int begin, long long int end, const Dataset& centroids, int32_t* labels) {
+    const int n_clusters = centroids.size();
+    const int dimension = DIM > 0 ? DIM : points.dimension();
+    for (long long int i = begin; i < end; i++) {
+        float best = __builtin_inff();
+        int32_t best_index = 0;
+        for (int k = 0; k < n_clusters; k++) {
+            float distance = 0.0f;
+            for (int d = 0; d < dimension; d++) {
+                float diff = points.dequantize(d, quantized_codes<T>(points, d)[i]) - centroids.at(k, d);
+                distance += diff * diff;
+            }
+            bool closer = distance < best;
+            best = closer ? distance : best;
+            best_index = closer ? k : best_index;
+        }
+        labels[i - begin] = best_index;
+    }
+}
+
+#ifdef KMEANS_X86
+
+// Con dimensión fija las coordenadas del bloque de puntos se convierten una sola vez; con dimensión en tiempo de ejecución se convierten en cada centroide
+#define KMEANS_POINT_REGISTERS (DIM > 0 ? DIM : 1)
+
+/**
+ * @name load_codes_sse2
+ * @brief Funciones para cargar 4 códigos consecutivos y convertirlos a float (SSE2, extendiendo con ceros)
+ * */
+__attribute__((target("sse2")))
+inline __m128 load_codes_sse2(const uint16_t* codes) {
+    __m128i words = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(codes));
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, _mm_setzero_si128()));
+}
+
+__attribute__((target("sse2")))
+inline __m128 load_codes_sse2(const uint8_t* codes) {
+    int32_t packed;
+    memcpy(&packed, codes, sizeof(packed));
+    __m128i bytes = _mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), _mm_setzero_si128());
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(bytes, _mm_setzero_si128()));
+}
+
+/**
+ * @name load_codes_avx2
+ * @brief Funciones para cargar 8 códigos consecutivos y convertirlos a float (AVX2)
+ * */
+__attribute__((target("avx2")))
+inline __m256 load_codes_avx2(const uint16_t* codes) {
+    return _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(codes))));
+}
+
+__attribute__((target("avx2")))
+inline __m256 load_codes_avx2(const uint8_t* codes) {
+    return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(codes))));
+}
+
+/**
+ * @name load_codes_avx512
+ * @brief Funciones para cargar 16 códigos consecutivos y convertirlos a float (AVX-512). Se usan las versiones con máscara completa porque las versiones sin máscara de GCC 12 avisan de un registro sin inicializar
+ * */
+__attribute__((target("avx512f")))
+inline __m512 load_codes_avx512(const uint16_t* codes) {
+    return _mm512_maskz_cvtepi32_ps(0xFFFF, _mm512_maskz_cvtepu16_epi32(0xFFFF, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(codes))));
+}
+
+__attribute__((target("avx512f")))
+inline __m512 load_codes_avx512(const uint8_t* codes) {
+    return _mm512_maskz_cvtepi32_ps(0xFFFF, _mm512_maskz_cvtepu8_epi32(0xFFFF, _mm_loadu_si128(reinterpret_cast<const __m128i*>(codes))));
+}
+
+/**
+ * @name quantized_nearest_sse2
+ * @brief Kernel SSE2 sobre códigos: 4 puntos a la vez
+ * @tparam T uint16_t o uint8_t
+ * @tparam DIM Dimensión fija de los puntos, o 0 para usar la dimensión del conjunto en tiempo de ejecución
+ * */
+template <typename T, int DIM>
+__attribute__((target("sse2"))) KMEANS_KERNEL_ATTRIBUTES
+inline void quantized_nearest_sse2(const QuantizedPoints& points, long long int begin, long long int end, const Dataset& centroids, int32_t* labels) {
+    const int n_clusters = centroids.size();
+    const int dimension = DIM > 0 ? DIM : points.dimension();
+    long long int i = begin;
+    for (; i + 4 <= end; i += 4) {
+        __m128 coordinates[KMEANS_POINT_REGISTERS];
+        if (DIM > 0) {
+            for (int d = 0; d < DIM; d++) {
+                coordinates[d] = _mm_add_ps(_mm_mul_ps(load_codes_sse2(quantized_codes<T>(points, d) + i), _mm_set1_ps(points.scale(d))), _mm_set1_ps(points.offset(d)));
+            }
+        }
+        __m128 best = _mm_set1_ps(__builtin_inff());
+        __m128i best_index = _mm_setzero_si128();
+        for (int k = 0; k < n_clusters; k++) {
+            __m128 distance = _mm_setzero_ps();
+            for (int d = 0; d < dimension; d++) {
+                __m128 coordinate = DIM > 0 ? coordinates[d]
+                    : _mm_add_ps(_mm_mul_ps(load_codes_sse2(quantized_codes<T>(points, d) + i), _mm_set1_ps(points.scale(d))), _mm_set1_ps(points.offset(d)));
+                __m128 diff = _mm_sub_ps(coordinate, _mm_set1_ps(centroids.at(k, d)));
+                distance = _mm_add_ps(distance, _mm_mul_ps(diff, diff));
+            }
+            __m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, best));
+            best = _mm_min_ps(distance, best);
+            best_index = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(k)), _mm_andnot_si128(closer, best_index));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(labels + (i - begin)), best_index);
+    }
+    quantized_nearest_scalar<T, DIM>(points, i, end, centroids, labels + (i - begin));
+}
+
+/**
+ * @name quantized_nearest_avx2
+ * @brief Kernel AVX2 sobre códigos: 8 puntos a la vez
+ * @tparam T uint16_t o uint8_t
+ * @tparam DIM Dimensión fija de los puntos, o 0 para usar la dimensión del conjunto en tiempo de ejecución
+ * */
+template <typename T, int DIM>
+__attribute__((target("avx2"))) KMEANS_KERNEL_ATTRIBUTES
+inline void quantized_nearest_avx2(const QuantizedPoints& points, long long int begin, long long int end, const Dataset& centroids, int32_t* labels) {
+    const int n_clusters = centroids.size();
+    const int dimension = DIM > 0 ? DIM : points.dimension();
+    long long int i = begin;
+    for (; i + 8 <= end; i += 8) {
+        __m256 coordinates[KMEANS_POINT_REGISTERS];
+        if (DIM > 0) {
+            for (int d = 0; d < DIM; d++) {
+                coordinates[d] = _mm256_add_ps(_mm256_mul_ps(load_codes_avx2(quantized_codes<T>(points, d) + i), _mm256_set1_ps(points.scale(d))), _mm256_set1_ps(points.offset(d)));
+            }
+        }
+        __m256 best = _mm256_set1_ps(__builtin_inff());
+        __m256i best_index = _mm256_setzero_si256();
+        for (int k = 0; k < n_clusters; k++) {
+            __m256 distance = _mm256_setzero_ps();
+            for (int d = 0; d < dimension; d++) {
+                __m256 coordinate = DIM > 0 ? coordinates[d]
+                    : _mm256_add_ps(_mm256_mul_ps(load_codes_avx2(quantized_codes<T>(points, d) + i), _mm256_set1_ps(points.scale(d))), _mm256_set1_ps(points.offset(d)));
+                __m256 diff = _mm256_sub_ps(coordinate, _mm256_set1_ps(centroids.at(k, d)));
+                distance = _mm256_add_ps(distance, _mm256_mul_ps(diff, diff));
+            }
+            __m256 closer = _mm256_cmp_ps(distance, best, _CMP_LT_OQ);
+            best = _mm256_blendv_ps(best, distance, closer);
+            best_index = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(best_index), _mm256_castsi256_ps(_mm256_set1_epi32(k)), closer));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(labels + (i - begin)), best_index);
+    }
+    quantized_nearest_sse2<T, DIM>(points, i, end, centroids, labels + (i - begin));
+}
+
+/**
+ * @name quantized_nearest_avx512
+ * @brief Kernel AVX-512 sobre códigos: 16 puntos a la vez
+ * @tparam T uint16_t o uint8_t
+ * @tparam DIM Dimensión fija de los puntos, o 0 para usar la dimensión del conjunto en tiempo de ejecución
+ * */
+template <typename T, int DIM>
+__attribute__((target("avx512f"))) KMEANS_KERNEL_ATTRIBUTES
+inline void quantized_nearest_avx512(const QuantizedPoints& points, long long int begin, long long int end, const Dataset& centroids, int32_t* labels) {
+    const int n_clusters = centroids.size();
+    const int dimension = DIM > 0 ? DIM : points.dimension();
+    long long int i = begin;
+    for (; i + 16 <= end; i += 16) {
+        __m512 coordinates[KMEANS_POINT_REGISTERS];
+        if (DIM > 0) {
+            for (int d = 0; d < DIM; d++) {
+                coordinates[d] = _mm512_add_ps(_mm512_mul_ps(load_codes_avx512(quantized_codes<T>(points, d) + i), _mm512_set1_ps(points.scale(d))), _mm512_set1_ps(points.offset(d)));
+            }
+        }
+        __m512 best = _mm512_set1_ps(__builtin_inff());
+        __m512i best_index = _mm512_setzero_si512();
+        for (int k = 0; k < n_clusters; k++) {
+            __m512 distance = _mm512_setzero_ps();
+            for (int d = 0; d < dimension; d++) {
+                __m512 coordinate = DIM > 0 ? coordinates[d]
+                    : _mm512_add_ps(_mm512_mul_ps(load_codes_avx512(quantized_codes<T>(points, d) + i), _mm512_set1_ps(points.scale(d))), _mm512_set1_ps(points.offset(d)));
+                __m512 diff = _mm512_sub_ps(coordinate, _mm512_set1_ps(centroids.at(k, d)));
+                distance = _mm512_add_ps(distance, _mm512_mul_ps(diff, diff));
+            }
+            __mmask16 closer = _mm512_cmp_ps_mask(distance, best, _CMP_LT_OQ);
+            best = _mm512_mask_mov_ps(best, closer, distance);
+            best_index = _mm512_mask_mov_epi32(best_index, closer, _mm512_set1_epi32(k));
+        }
+        _mm512_storeu_si512(labels + (i - begin), best_index);
+    }
+    quantized_nearest_avx2<T, DIM>(points, i, end, centroids, labels + (i - begin));
+}
+
+#undef KMEANS_POINT_REGISTERS
+
+#endif
+
+// Elige la instancia de un kernel sobre códigos con el tipo de código y la dimensión fija, igual que KMEANS_SPECIALIZE_DIMENSION
+#define KMEANS_SPECIALIZE_QUANTIZED(kernel, T, dimension) \
+    ((dimension) == 2 ? kernel<T, 2> : \
+     (dimension) == 3 ? kernel<T, 3> : \
+     (dimension) == 4 ? kernel<T, 4> : \
+     (dimension) == 8 ? kernel<T, 8> : \
+     (dimension) == 16 ? kernel<T, 16> : \
+     (dimension) == 32 ? kernel<T, 32> : kernel<T, 0>)
+
+/**
+ * @name quantized_nearest_kernel_for
+ * @brief Función para obtener el kernel sobre códigos de tipo T de un conjunto de instrucciones y una dimensión
+ * @tparam T uint16_t o uint8_t
+ * @param isa Conjunto de instrucciones
+ * @param dimension Número de coordenadas de cada punto
+ * @return Apuntador al kernel
+ * */
+template <typename T>
+inline QuantizedNearestKernel quantized_nearest_kernel_for(KernelIsa isa, int dimension) {
+#ifdef KMEANS_X86
+    if (isa == ISA_AVX512) return KMEANS_SPECIALIZE_QUANTIZED(quantized_nearest_avx512, T, dimension);
+    if (isa == ISA_AVX2) return KMEANS_SPECIALIZE_QUANTIZED(quantized_nearest_avx2, T, dimension);
+    if (isa == ISA_SSE2) return KMEANS_SPECIALIZE_QUANTIZED(quantized_nearest_sse2, T, dimension);
+#endif
+    return KMEANS_SPECIALIZE_QUANTIZED(quantized_nearest_scalar, T, dimension);
+}
+
+/**
+ * @name quantized_nearest_kernel
+ * @brief Función para obtener el kernel sobre códigos de un conjunto de instrucciones, tamaño de código y dimensión
+ * @param isa Conjunto de instrucciones
+ * @param bytes Bytes por coordenada (2 o 1)
+ * @param dimension Número de coordenadas de cada punto
+ * @return Apuntador al kernel
+ * */
+inline QuantizedNearestKernel quantized_nearest_kernel(KernelIsa isa, int bytes, int dimension) {
+    return bytes == 1 ? quantized_nearest_kernel_for<uint8_t>(isa, dimension) : quantized_nearest_kernel_for<uint16_t>(isa, dimension);
+}
+
+/**
+ * @name select_quantized_nearest_kernel
+ * @brief Función para obtener el kernel sobre códigos más ancho que soporta el procesador
+ * @param points Puntos cuantizados
+ * @return Apuntador al kernel elegido
+ * */
+inline QuantizedNearestKernel select_quantized_nearest_kernel(const QuantizedPoints& points) {
+    return quantized_nearest_kernel(detect_kernel_isa(), points.bytes_per_coordinate(), points.dimension());
+}
+
+/**
+ * @name accumulate_codes
+ * @brief Kernel que suma los códigos y la cantidad de puntos [begin, end) en el bloque de su cluster
+ * @tparam T uint16_t o uint8_t
+ * @tparam DIM Dimensión fija de los puntos, o 0 para usar la dimensión del conjunto en tiempo de ejecución
+ * */
+template <typename T, int DIM>
+inline void accumulate_codes(const QuantizedPoints& points, long long int begin, long long int end, const int32_t* labels, uint64_t* sums, int fields) {
+    const int dimension = DIM > 0 ? DIM : points.dimension();
+    for (long long int i = begin; i < end; i++) {
+        uint64_t* slot = sums + (long long int) labels[i] * fields;
+        for (int d = 0; d < dimension; d++) {
+            slot[d] += quantized_codes<T>(points, d)[i];
+        }
+        slot[dimension]++;
+    }
+}
+
+// Firma común de los kernels de acumulación de códigos
+typedef void (*AccumulateCodesKernel)(const QuantizedPoints& points, long long int begin, long long int end, const int32_t* labels, uint64_t* sums, int fields);
+
+/**
+ * @name accumulate_quantized_clusters
+ * @brief Función para sumar las coordenadas cuantizadas y la cantidad de puntos de cada cluster con los bloques por hilo del acumulador. Cada hilo suma los códigos en enteros de 64 bits (exacto) y los copia a su bloque en double (exacto mientras la suma de una columna no pase de 2^53) y, después de combinar los bloques en árbol, cada suma de códigos se convierte en suma de coordenadas (escala x suma + desplazamiento x cantidad), de modo que el bloque del hilo 0 queda igual que con accumulate_clusters
+ * @param points Puntos cuantizados
+ * @param labels Cluster de cada punto
+ * @param accumulator Buffers de acumulación por hilo reservados previamente
+ * */
+inline void accumulate_quantized_clusters(const QuantizedPoints& points, const int32_t* labels, CentroidAccumulator* accumulator) {
+    const int dimension = points.dimension();
+    const int fields = accumulator->fields;
+    const long long int stride = accumulator->stride;
+    const long long int block = (long long int) accumulator->n_clusters * fields;
+    const long long int count = points.size();
+    const AccumulateCodesKernel accumulate = points.bytes_per_coordinate() == 1 ? KMEANS_SPECIALIZE_QUANTIZED(accumulate_codes, uint8_t, dimension)
+                                                                               : KMEANS_SPECIALIZE_QUANTIZED(accumulate_codes, uint16_t, dimension);
+
+    #pragma omp parallel shared(points, accumulator, labels) num_threads(accumulator->n_threads)
+    {
+        int thread_id = omp_get_thread_num();
+        int n_threads = omp_get_num_threads();
+        double* local = accumulator->buffer + thread_id * stride;
+        std::vector<uint64_t> code_sums(block, 0);
+
+        #pragma omp for schedule(static) nowait
+        for (long long int begin = 0; begin < count; begin += KERNEL_BLOCK_SIZE) {
+            accumulate(points, begin, std::min(begin + KERNEL_BLOCK_SIZE, count), labels, code_sums.data(), fields);
+        }
+        for (long long int f = 0; f < block; f++) {
+            local[f] = (double) code_sums[f];
+        }
+
+        merge_thread_blocks(accumulator, thread_id, n_threads);
+
+        // Conversión de las sumas de códigos a sumas de coordenadas
+        #pragma omp for schedule(static)
+        for (int k = 0; k < accumulator->n_clusters; k++) {
+            double* slot = accumulator->buffer + (long long int) k * fields;
+            for (int d = 0; d < dimension; d++) {
+                slot[d] = (double) points.scale(d) * slot[d] + (double) points.offset(d) * slot[dimension];
+            }
+        }
+    }
+}
+
+/**
+ * @name count_quantized_mismatches
+ * @brief Función para verificar la asignación cuantizada contra la de float: con los mismos centroides, cuenta los puntos a los que el kernel sobre códigos y el kernel en float asignan clusters distintos
+ * @param points Conjunto de puntos por columnas en float
+ * @param quantized Los mismos puntos cuantizados
+ * @param centroids Conjunto de centroides por columnas
+ * @param num_threads Número de hilos de OpenMP
+ * @return Cantidad de puntos con distinto cluster
+ * */
+inline long long int count_quantized_mismatches(const Dataset& points, const QuantizedPoints& quantized, const Dataset& centroids, int num_threads) {
+    const NearestCentroidsKernel float_kernel = select_nearest_centroids_kernel(points.dimension());
+    const QuantizedNearestKernel quantized_kernel = select_quantized_nearest_kernel(quantized);
+    const long long int num_points = points.size();
+    long long int mismatches = 0;
+    #pragma omp parallel num_threads(num_threads) reduction(+:mismatches)
+    {
+        std::vector<int32_t> float_labels(KERNEL_BLOCK_SIZE);
+        std::vector<int32_t> quantized_labels(KERNEL_BLOCK_SIZE);
+        #pragma omp for schedule(static)
+        for (long long int begin = 0; begin < num_points; begin += KERNEL_BLOCK_SIZE) {
+            long long int end = std::min(begin + KERNEL_BLOCK_SIZE, num_points);
+            float_kernel(points, begin, end, centroids, float_labels.data(), nullptr);
+            quantized_kernel(quantized, begin, end, centroids, quantized_labels.data());
+            for (long long int i = 0; i < end - begin; i++) {
+                mismatches += float_labels[i] != quantized_labels[i];
+            }
+        }
+    }
+    return mismatches;
+}
+
+#endif
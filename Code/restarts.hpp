@@ -0,0 +1,200 @@
+/**
+ * @file restarts.hpp
+ * @date 2023-03-08
+ * @author Diego Hernández Delgado
+ * @author Jesús Isaías García Moreno
+ * @brief Reinicios concurrentes de k-means (n_init=n): cada reinicio usa otra semilla, su propio arreglo de clusters sobre las mismas columnas de sólo lectura y su propio grupo de hilos. En cada iteración se registra la inercia (suma de distancias al cuadrado de cada punto a su centroide), que nunca crece de una iteración a la siguiente, y se publica en un tablero compartido: con Lloyd sale de las distancias mínimas que ya calcula la asignación, y con los demás modos se calcula con una pasada más sólo cuando puede detener el reinicio; un reinicio se detiene cuando ni siquiera conservando su última mejora en todas las iteraciones que le quedan quedaría a menos de un margen (10% por defecto) de la menor inercia de los demás. Al final sólo se conserva el reinicio de menor inercia
+ * */
+
+#ifndef RESTARTS_HPP
+#define RESTARTS_HPP
+
+#include <omp.h>
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "dataset.hpp"
+
+// Margen por defecto de la detención temprana, en por ciento sobre la mejor inercia
+const double DEFAULT_PRUNE_MARGIN = 10.0;
+
+/**
+ * @name parse_prune_margin
+ * @brief Función para convertir el argumento de entrada en el margen de la detención temprana
+ * @param argument "off" para no detener reinicios, o el porcentaje sobre la mejor inercia que debe superar la estimación optimista de un reinicio para detenerlo
+ * @return Margen en por ciento, o un valor negativo con "off"
+ * */
+inline double parse_prune_margin(const std::string& argument) {
+    if (argument == "off") return -1.0;
+    size_t parsed = 0;
+    double margin = std::stod(argument, &parsed);
+    if (parsed != argument.size() || margin < 0.0)
+        throw std::invalid_argument("Invalid prune margin (off or a percentage): " + argument);
+    return margin;
+}
+
+/**
+ * @name RestartGroups
+ * @brief Reparto de los hilos entre los reinicios que se ejecutan al mismo tiempo
+ * */
+struct RestartGroups {
+    int n_groups;                   // Reinicios concurrentes (hilos de la región externa)
+    std::vector<int> group_threads; // Hilos de cada grupo
+};
+
+/**
+ * @name restart_groups
+ * @brief Función para repartir los hilos: hay tantos grupos como reinicios, hasta la cantidad de hilos, y los hilos sobrantes se dan a los primeros grupos. Con más reinicios que grupos, cada grupo toma el siguiente reinicio al terminar el anterior
+ * @param n_init Cantidad de reinicios
+ * @param num_threads Hilos disponibles en total (normalmente los cores de la máquina)
+ * @return Grupos y sus hilos
+ * */
+inline RestartGroups restart_groups(int n_init, int num_threads) {
+    RestartGroups groups;
+    groups.n_groups = std::max(1, std::min(n_init, num_threads));
+    for (int g = 0; g < groups.n_groups; g++) {
+        groups.group_threads.push_back(num_threads / groups.n_groups + (g < num_threads % groups.n_groups ? 1 : 0));
+    }
+    return groups;
+}
+
+/**
+ * @name cluster_inertia
+ * @brief Función para calcular la inercia de los clusters actuales: la suma de las distancias al cuadrado de cada punto al centroide de su cluster
+ * @param points Conjunto de puntos por columnas con el cluster de cada punto
+ * @param centroids Conjunto de centroides por columnas
+ * @param num_threads Número de hilos de OpenMP
+ * @return Inercia
+ * */
+inline double cluster_inertia(const Dataset& points, const Dataset& centroids, int num_threads) {
+    const int dimension = points.dimension();
+    const int32_t* labels = points.labels();
+    double inertia = 0.0;
+    #pragma omp parallel for num_threads(num_threads) schedule(static) reduction(+:inertia)
+    for (long long int i = 0; i < points.size(); i++) {
+        for (int d = 0; d < dimension; d++) {
+            double diff = points.at(i, d) - centroids.at(labels[i], d);
+            inertia += diff * diff;
+        }
+    }
+    return inertia;
+}
+
+/**
+ * @name RestartBoard
+ * @brief Tablero compartido por todos los reinicios con la menor inercia alcanzada hasta el momento
+ * */
+struct RestartBoard {
+    double best_inertia = std::numeric_limits<double>::infinity(); // Menor inercia actual entre todos los reinicios
+    double margin = DEFAULT_PRUNE_MARGIN; // Porcentaje de la detención temprana (negativo para no detener reinicios)
+    long long int max_iterations = 0; // Número máximo de iteraciones de cada reinicio
+};
+
+/**
+ * @name RestartMonitor
+ * @brief Seguimiento de la inercia de un reinicio que kmeans consulta después de cada actualización de los centroides
+ * */
+class RestartMonitor {
+public:
+    /**
+     * @name RestartMonitor
+     * @brief Constructor del seguimiento de un reinicio
+     * @param board Tablero compartido por todos los reinicios
+     * @param num_threads Hilos del grupo del reinicio
+     * */
+    RestartMonitor(RestartBoard* board, int num_threads)
+        : board_(board), num_threads_(num_threads), inertia_(std::numeric_limits<double>::infinity()), stopped_(false) {}
+
+    /**
+     * @name record_iteration
+     * @brief Función para registrar la inercia de una iteración y decidir si el reinicio ya no puede ganar. Con la última mejora (inercia anterior menos la actual) repetida en todas las iteraciones restantes se obtiene una estimación de la inercia final; si supera la mejor inercia del tablero por más del margen, el reinicio se detiene. No es una cota inferior: k-means puede estancarse varias iteraciones y después volver a bajar, así que un margen de 0 detiene reinicios que todavía podían ganar, y cuáles se detienen depende de en qué momento publican los demás. El margen por defecto sólo detiene los que van claramente perdiendo
+     * @param inertia Inercia de los centroides de la iteración: la de la pasada de asignación que les sigue (Lloyd), que sólo puede ser menor, o la de cluster_inertia
+     * @param iteration Iteraciones terminadas después de la primera asignación
+     * @return true si el reinicio se debe detener
+     * */
+    bool record_iteration(double inertia, long long int iteration) {
+        const double previous = inertia_;
+        inertia_ = inertia;
+        double best;
+        #pragma omp critical(restart_board)
+        {
+            board_->best_inertia = std::min(board_->best_inertia, inertia_);
+            best = board_->best_inertia;
+        }
+        const long long int remaining = board_->max_iterations - iteration;
+        if (board_->margin < 0.0 || iteration < 1 || remaining <= 0) return false;
+        // Estimación, no cota inferior: una meseta seguida de otra bajada la supera
+        double optimistic = inertia_ - remaining * std::max(previous - inertia_, 0.0);
+        stopped_ = optimistic > best * (1.0 + board_->margin / 100.0);
+        return stopped_;
+    }
+
+    // Si en esta iteración hace falta una pasada de cluster_inertia (los modos que no obtienen la inercia de la asignación): sin detención temprana sólo importa la inercia final, y la iteración 0 no tiene una mejora anterior con la cual estimar
+    bool needs_inertia(long long int iteration) const { return board_->margin >= 0.0 && iteration >= 1; }
+    // Inercia de los centroides actuales con una pasada de cluster_inertia con los hilos del grupo del reinicio
+    double measure(const Dataset& points, const Dataset& centroids) const { return cluster_inertia(points, centroids, num_threads_); }
+
+    /**
+     * @name finish
+     * @brief Función para dejar la inercia de los centroides finales con los que se elige el mejor reinicio; sólo se calcula si la última inercia registrada no es la de esos centroides y el reinicio no se detuvo
+     * @param points Conjunto de puntos por columnas con el cluster de cada punto
+     * @param centroids Conjunto de centroides finales
+     * @param current Si la última inercia registrada ya es la de los centroides finales
+     * */
+    void finish(const Dataset& points, const Dataset& centroids, bool current) {
+        if (!current && !stopped_) inertia_ = measure(points, centroids);
+    }
+
+    // Inercia de la última iteración registrada (o de los centroides finales después de finish)
+    double inertia() const { return inertia_; }
+    // Si el reinicio se detuvo antes de converger
+    bool stopped() const { return stopped_; }
+
+private:
+    RestartBoard* board_;
+    int num_threads_;
+    double inertia_;
+    bool stopped_;
+};
+
+/**
+ * @name RestartResult
+ * @brief Resultado de un reinicio
+ * */
+struct RestartResult {
+    int restart;                // Número del reinicio
+    uint64_t seed;              // Semilla de la elección de los centroides iniciales
+    int threads;                // Hilos de su grupo
+    long long int iterations;   // Iteraciones después de la primera asignación
+    double inertia;             // Inercia al terminar (o al detenerse)
+    double seconds;             // Segundos del reinicio, incluida la elección de los centroides iniciales
+    bool stopped;               // Si se detuvo antes de converger
+};
+
+/**
+ * @name write_restart_table
+ * @brief Función para guardar un renglón por reinicio en CSV e imprimir la tabla, marcando el reinicio que se conservó
+ * @param file_name Nombre del archivo CSV
+ * @param results Resultado de cada reinicio
+ * @param best Índice del reinicio de menor inercia
+ * */
+inline void write_restart_table(const std::string& file_name, const std::vector<RestartResult>& results, int best) {
+    std::ofstream out(file_name);
+    if (!out) throw std::runtime_error("Could not open " + file_name);
+    out.precision(12);
+    out << "restart,seed,threads,iterations,inertia,seconds,stopped,best\n";
+    std::cout << "restart   seed   threads   iterations   inertia   seconds" << "\n";
+    for (const RestartResult& result : results) {
+        out << result.restart << "," << result.seed << "," << result.threads << "," << result.iterations << "," << result.inertia << ","
+            << result.seconds << "," << (result.stopped ? 1 : 0) << "," << (result.restart == best ? 1 : 0) << "\n";
+        std::cout << result.restart << "   " << result.seed << "   " << result.threads << "   " << result.iterations << "   " << result.inertia << "   "
+                  << result.seconds << (result.stopped ? "   stopped early" : "") << (result.restart == best ? "   best" : "") << "\n";
+    }
+}
+
+#endif
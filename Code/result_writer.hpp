@@ -0,0 +1,331 @@
+/**
+ * @file result_writer.hpp
+ * @date 2023-03-08
+ * @author Diego Hernández Delgado
+ * @author Jesús Isaías García Moreno
+ * @brief Escritura asíncrona de los resultados de k-means. Los números se convierten con to_chars a buffers grandes que se escriben con una sola llamada a write por trozo, en un hilo en segundo plano para que la siguiente repetición pueda empezar mientras se escribe la anterior
+ * */
+
+#ifndef RESULT_WRITER_HPP
+#define RESULT_WRITER_HPP
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <charconv>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "dataset.hpp"
+
+// Tamaño de cada trozo que se escribe con una sola llamada a write
+const size_t RESULT_WRITER_CHUNK_SIZE = 4 << 20;
+
+/**
+ * @name OutputMode
+ * @brief Formato de los resultados: CSV completo (coordenadas y cluster), sólo los clusters en binario (int32 por punto) o sin salida (sólo se miden tiempos)
+ * */
+enum OutputMode { OUTPUT_CSV, OUTPUT_LABELS, OUTPUT_NONE };
+
+/**
+ * @name parse_output_mode
+ * @brief Función para convertir el argumento de entrada en un formato de resultados
+ * @param argument "csv", "labels" o "none"
+ * @return Formato de resultados
+ * */
+inline OutputMode parse_output_mode(const std::string& argument) {
+    if (argument == "csv") return OUTPUT_CSV;
+    if (argument == "labels") return OUTPUT_LABELS;
+    if (argument == "none") return OUTPUT_NONE;
+    throw std::invalid_argument("Invalid output mode (csv, labels or none): " + argument);
+}
+
+/**
+ * @name output_mode_name
+ * @brief Función para obtener el nombre de un formato de resultados
+ * @param mode Formato de resultados
+ * @return Nombre del formato
+ * */
+inline const char* output_mode_name(OutputMode mode) {
+    switch (mode) {
+        case OUTPUT_LABELS: return "labels";
+        case OUTPUT_NONE: return "none";
+        default: return "csv";
+    }
+}
+
+/**
+ * @name output_file_suffix
+ * @brief Función para obtener la terminación del archivo de resultados según el formato
+ * @param mode Formato de resultados
+ * @return Terminación del nombre del archivo
+ * */
+inline std::string output_file_suffix(OutputMode mode) {
+    return mode == OUTPUT_LABELS ? "_labels.bin" : "_results.csv";
+}
+
+/**
+ * @name write_all
+ * @brief Función para escribir un bloque completo en un descriptor de archivo, repitiendo write si la escritura es parcial
+ * @param fd Descriptor de archivo
+ * @param data Inicio del bloque
+ * @param size Tamaño del bloque en bytes
+ * */
+inline void write_all(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error(std::string("write() failed: ") + strerror(errno));
+        }
+        data += written;
+        size -= written;
+    }
+}
+
+/**
+ * @name make_directory
+ * @brief Función para crear un directorio si no existe
+ * @param dir_str Ruta del directorio
+ * */
+inline void make_directory(const std::string& dir_str) {
+    struct stat sb;
+    if (stat(dir_str.c_str(), &sb) != 0) {
+        mkdir(dir_str.c_str(), 0777);
+    }
+}
+
+/**
+ * @name open_output
+ * @brief Función para crear (o truncar) un archivo de resultados
+ * @param file_name Nombre del archivo
+ * @return Descriptor de archivo
+ * */
+inline int open_output(const std::string& file_name) {
+    int fd = open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) throw std::runtime_error("Could not open " + file_name + ": " + strerror(errno));
+    return fd;
+}
+
+/**
+ * @name append_CSV
+ * @brief Función para escribir los primeros puntos de un conjunto con su respectivo cluster al final de un archivo CSV abierto. Cada número se convierte con to_chars (mismo formato que fout << float) en el buffer, que se escribe completo cada vez que se llena
+ * @param fd Descriptor del archivo CSV
+ * @param points Conjunto de puntos por columnas
+ * @param count Cantidad de puntos a escribir
+ * @param labels Cluster de cada punto
+ * @param buffer Buffer de formato reutilizable
+ * */
+inline void append_CSV(int fd, const Dataset& points, long long int count, const int32_t* labels, std::vector<char>& buffer) {
+    const int dimension = points.dimension();
+    // Longitud máxima de un renglón: por coordenada hasta 15 caracteres de %g más la coma, y hasta 12 del cluster y el salto de línea
+    const size_t max_row = dimension * 16 + 12;
+    buffer.resize(RESULT_WRITER_CHUNK_SIZE > max_row ? RESULT_WRITER_CHUNK_SIZE : max_row);
+    char* begin = buffer.data();
+    char* end = begin + buffer.size();
+    char* c = begin;
+    for (long long int i = 0; i < count; i++) {
+        if ((size_t) (end - c) < max_row) {
+            write_all(fd, begin, c - begin);
+            c = begin;
+        }
+        for (int d = 0; d < dimension; d++) {
+            c = std::to_chars(c, end, points.at(i, d), std::chars_format::general, 6).ptr;
+            *c++ = ',';
+        }
+        c = std::to_chars(c, end, labels[i]).ptr;
+        *c++ = '\n';
+    }
+    write_all(fd, begin, c - begin);
+}
+
+/**
+ * @name save_to_CSV
+ * @brief Función para guardar los puntos con su respectivo cluster en un archivo CSV
+ * @param file_name Nombre del archivo CSV
+ * @param points Conjunto de puntos por columnas
+ * @param labels Cluster de cada punto
+ * @param buffer Buffer de formato reutilizable
+ * */
+inline void save_to_CSV(const std::string& file_name, const Dataset& points, const int32_t* labels, std::vector<char>& buffer) {
+    int fd = open_output(file_name);
+    try {
+        append_CSV(fd, points, points.size(), labels, buffer);
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+}
+
+/**
+ * @name append_labels
+ * @brief Función para escribir clusters en binario (un int32 little endian por punto) al final de un archivo abierto, en trozos de RESULT_WRITER_CHUNK_SIZE
+ * @param fd Descriptor del archivo binario
+ * @param labels Cluster de cada punto
+ * @param num_points Número de puntos
+ * */
+inline void append_labels(int fd, const int32_t* labels, long long int num_points) {
+    const char* data = reinterpret_cast<const char*>(labels);
+    size_t remaining = num_points * sizeof(int32_t);
+    while (remaining > 0) {
+        size_t chunk = remaining < RESULT_WRITER_CHUNK_SIZE ? remaining : RESULT_WRITER_CHUNK_SIZE;
+        write_all(fd, data, chunk);
+        data += chunk;
+        remaining -= chunk;
+    }
+}
+
+/**
+ * @name save_labels
+ * @brief Función para guardar sólo los clusters de los puntos en binario (un int32 little endian por punto)
+ * @param file_name Nombre del archivo binario
+ * @param labels Cluster de cada punto
+ * @param num_points Número de puntos
+ * */
+inline void save_labels(const std::string& file_name, const int32_t* labels, long long int num_points) {
+    int fd = open_output(file_name);
+    try {
+        append_labels(fd, labels, num_points);
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+}
+
+/**
+ * @name ResultWriter
+ * @brief Etapa de escritura en segundo plano. submit copia los clusters actuales (las coordenadas no cambian y se leen del conjunto) y regresa de inmediato; un hilo escribe los trabajos en orden. Como máximo hay max_pending trabajos en espera para acotar la memoria. Un error de escritura no detiene el hilo ni descarta los trabajos siguientes: cada archivo que falla se reporta una vez, en el siguiente submit o en finish
+ * */
+class ResultWriter {
+public:
+    /**
+     * @name ResultWriter
+     * @brief Constructor que arranca el hilo de escritura (si el formato no es OUTPUT_NONE)
+     * @param mode Formato de los resultados
+     * @param max_pending Número máximo de trabajos en espera antes de bloquear submit
+     * */
+    explicit ResultWriter(OutputMode mode, size_t max_pending = 2)
+        : mode_(mode), max_pending_(max_pending), stopping_(false) {
+        if (mode_ != OUTPUT_NONE) worker_ = std::thread(&ResultWriter::run, this);
+    }
+
+    ~ResultWriter() {
+        try {
+            finish();
+        } catch (...) {
+        }
+    }
+
+    ResultWriter(const ResultWriter&) = delete;
+    ResultWriter& operator=(const ResultWriter&) = delete;
+
+    /**
+     * @name submit
+     * @brief Función para encolar la escritura del resultado actual de los puntos. El trabajo siempre se encola; después se lanzan los errores de los trabajos anteriores que fallaron desde la última llamada
+     * @param file_name Nombre del archivo de resultados
+     * @param points Conjunto de puntos con el cluster de cada punto; debe seguir vivo hasta finish
+     * */
+    void submit(const std::string& file_name, const Dataset& points) {
+        if (mode_ == OUTPUT_NONE) return;
+        std::unique_lock<std::mutex> lock(mutex_);
+        space_.wait(lock, [this]() { return pending_.size() < max_pending_; });
+        Job job;
+        job.file_name = file_name;
+        job.points = &points;
+        if (!free_labels_.empty()) {
+            job.labels.swap(free_labels_.back());
+            free_labels_.pop_back();
+        }
+        lock.unlock();
+        job.labels.assign(points.labels(), points.labels() + points.size());
+        lock.lock();
+        pending_.push_back(std::move(job));
+        ready_.notify_one();
+        throw_errors();
+    }
+
+    /**
+     * @name finish
+     * @brief Función para esperar a que se escriban todos los trabajos y detener el hilo. Lanza los errores de escritura que todavía no se habían reportado
+     * */
+    void finish() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        ready_.notify_one();
+        if (worker_.joinable()) worker_.join();
+        std::lock_guard<std::mutex> lock(mutex_);
+        throw_errors();
+    }
+
+private:
+    struct Job {
+        std::string file_name;
+        const Dataset* points;
+        std::vector<int32_t> labels;
+    };
+
+    // Lanza juntos, un renglón por archivo, los errores del hilo de escritura que no se han reportado (se debe llamar con el candado tomado)
+    void throw_errors() {
+        if (errors_.empty()) return;
+        std::string message;
+        for (const std::string& error : errors_) message += (message.empty() ? "" : "\n") + error;
+        errors_.clear();
+        throw std::runtime_error(message);
+    }
+
+    // Ciclo del hilo de escritura: toma los trabajos en orden hasta que se detiene y la cola queda vacía
+    void run() {
+        std::vector<char> buffer;
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            ready_.wait(lock, [this]() { return !pending_.empty() || stopping_; });
+            if (pending_.empty()) break;
+            Job job = std::move(pending_.front());
+            pending_.pop_front();
+            space_.notify_one();
+            lock.unlock();
+            try {
+                if (mode_ == OUTPUT_CSV) {
+                    save_to_CSV(job.file_name, *job.points, job.labels.data(), buffer);
+                } else {
+                    save_labels(job.file_name, job.labels.data(), job.labels.size());
+                }
+            } catch (const std::exception& e) {
+                std::lock_guard<std::mutex> error_lock(mutex_);
+                // Cada error nombra su archivo (write() no lo conoce)
+                std::string error = e.what();
+                errors_.push_back(error.find(job.file_name) == std::string::npos ? job.file_name + ": " + error : error);
+            } catch (...) {
+                std::lock_guard<std::mutex> error_lock(mutex_);
+                errors_.push_back("Could not write " + job.file_name);
+            }
+            lock.lock();
+            free_labels_.push_back(std::move(job.labels));
+        }
+    }
+
+    OutputMode mode_;
+    size_t max_pending_;
+    bool stopping_;
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::condition_variable space_;
+    std::deque<Job> pending_;
+    std::vector<std::vector<int32_t>> free_labels_;
+    std::vector<std::string> errors_; // Errores de escritura que todavía no se reportan
+    std::thread worker_;
+};
+
+#endif
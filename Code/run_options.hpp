@@ -0,0 +1,161 @@
+/**
+ * @file run_options.hpp
+ * @date 2023-03-08
+ * @author Diego Hernández Delgado
+ * @author Jesús Isaías García Moreno
+ * @brief Opciones opcionales de la ejecución de k-means compartidas por la implementación serial y la paralela. Se pasan después de los argumentos obligatorios con la forma nombre=valor, en cualquier orden
+ * */
+
+#ifndef RUN_OPTIONS_HPP
+#define RUN_OPTIONS_HPP
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include "numa_placement.hpp"
+#include "quantized_points.hpp"
+#include "restarts.hpp"
+#include "result_writer.hpp"
+#include "running_sums.hpp"
+#include "seeding.hpp"
+#include "triangle_bounds.hpp"
+
+// Texto de ayuda con las opciones aceptadas
+const char RUN_OPTIONS_USAGE[] = "[output=csv|labels|none] [algorithm=lloyd|hamerly|elkan|yinyang|kdtree] [memory=MiB] [init=random|kmeans++|kmeans||] [seed=n] [update=full|incremental] [recompute=n] [storage=float|q16|q8] [trace=on|prefix] [counters=on|off] [numa=on|off] [affinity=none|compact|spread] [n_init=n] [prune=percent|off] [model=on|file] [checkpoint=n] [warm=file]";
+
+/**
+ * @name RunOptions
+ * @brief Opciones de la ejecución con sus valores por defecto
+ * */
+struct RunOptions {
+    OutputMode output_mode = OUTPUT_CSV;           // Formato de los resultados
+    AssignmentAlgorithm algorithm = ASSIGN_LLOYD;  // Algoritmo de asignación de los puntos
+    long long int bounds_memory = DEFAULT_BOUNDS_MEMORY; // Bytes disponibles para las cotas inferiores de Yinyang
+    InitMethod init = INIT_KMEANS_PLUS_PLUS;       // Forma de elegir los centroides iniciales
+    uint64_t seed = 42;                            // Semilla de la primera repetición (la repetición i usa seed + i - 1)
+    UpdateMode update_mode = UPDATE_FULL;          // Si las sumas de cada cluster se recalculan en cada iteración o sólo con los puntos que cambiaron de cluster
+    int recompute_interval = DEFAULT_RECOMPUTE_INTERVAL; // Pasadas incrementales entre dos recálculos completos de las sumas
+    StorageMode storage = STORAGE_FLOAT;           // Si la asignación de Lloyd lee las coordenadas en float o cuantizadas a 16 u 8 bits
+    std::string trace_prefix;                      // Ruta sin extensión de la traza por iteración (iteration_trace.hpp), "on" para la ruta por defecto, o vacía sin traza
+    bool hardware_counters = false;                // Si la traza lee los contadores de hardware con perf_event_open
+    bool numa = false;                             // Si los puntos, los centroides y el acumulador se colocan en el nodo NUMA de los hilos que los usan (numa_placement.hpp)
+    AffinityPolicy affinity = AFFINITY_NONE;       // Forma de fijar los hilos a las CPUs (spread por defecto con numa=on)
+    int n_init = 1;                                // Reinicios concurrentes con distintas semillas de los que se conserva el de menor inercia (restarts.hpp)
+    double prune_margin = DEFAULT_PRUNE_MARGIN;    // Porcentaje de la detención temprana de los reinicios que van claramente perdiendo (negativo sin detención)
+    std::string model_file;                        // Archivo donde se guarda el modelo final (kmeans_model.hpp), "on" para la ruta por defecto, o vacío sin modelo
+    long long int checkpoint_interval = 0;         // Iteraciones entre dos puntos de control del modelo (0 sin puntos de control)
+    std::string warm_file;                         // Modelo, punto de control o centroides de donde se empieza en lugar de elegir los centroides iniciales (vacío para elegirlos)
+};
+
+/**
+ * @name parse_run_options
+ * @brief Función para leer las opciones nombre=valor de los argumentos de entrada
+ * @param argc Cantidad de argumentos de entrada
+ * @param argv Argumentos de entrada
+ * @param first Índice del primer argumento opcional
+ * @return Opciones de la ejecución
+ * */
+inline RunOptions parse_run_options(int argc, char** argv, int first) {
+    RunOptions options;
+    bool affinity_given = false;
+    for (int i = first; i < argc; i++) {
+        std::string argument = argv[i];
+        size_t separator = argument.find('=');
+        if (separator == std::string::npos)
+            throw std::invalid_argument("Invalid option (expected name=value): " + argument);
+        std::string name = argument.substr(0, separator);
+        std::string value = argument.substr(separator + 1);
+        if (name == "output") {
+            options.output_mode = parse_output_mode(value);
+        } else if (name == "algorithm") {
+            options.algorithm = parse_assignment_algorithm(value);
+        } else if (name == "memory") {
+            size_t parsed = 0;
+            long long int megabytes = std::stoll(value, &parsed);
+            if (parsed != value.size() || megabytes < 1)
+                throw std::invalid_argument("Invalid memory budget in MiB: " + value);
+            options.bounds_memory = megabytes << 20;
+        } else if (name == "init") {
+            options.init = parse_init_method(value);
+        } else if (name == "seed") {
+            size_t parsed = 0;
+            options.seed = std::stoull(value, &parsed);
+            if (parsed != value.size())
+                throw std::invalid_argument("Invalid seed: " + value);
+        } else if (name == "update") {
+            options.update_mode = parse_update_mode(value);
+        } else if (name == "recompute") {
+            size_t parsed = 0;
+            long long int interval = std::stoll(value, &parsed);
+            if (parsed != value.size() || interval < 1 || interval > 1000000)
+                throw std::invalid_argument("Invalid recompute interval: " + value);
+            options.recompute_interval = (int) interval;
+        } else if (name == "storage") {
+            options.storage = parse_storage_mode(value);
+        } else if (name == "numa") {
+            if (value != "on" && value != "off")
+                throw std::invalid_argument("Invalid numa (expected on or off): " + value);
+            options.numa = value == "on";
+        } else if (name == "affinity") {
+            options.affinity = parse_affinity_policy(value);
+            affinity_given = true;
+        } else if (name == "n_init") {
+            size_t parsed = 0;
+            long long int restarts = std::stoll(value, &parsed);
+            if (parsed != value.size() || restarts < 1 || restarts > 100000)
+                throw std::invalid_argument("Invalid number of restarts: " + value);
+            options.n_init = (int) restarts;
+        } else if (name == "prune") {
+            options.prune_margin = parse_prune_margin(value);
+        } else if (name == "model" || name == "warm") {
+            if (value.empty())
+                throw std::invalid_argument("Invalid " + name + " file: " + value);
+            (name == "model" ? options.model_file : options.warm_file) = value;
+        } else if (name == "checkpoint") {
+            size_t parsed = 0;
+            options.checkpoint_interval = std::stoll(value, &parsed);
+            if (parsed != value.size() || options.checkpoint_interval < 1)
+                throw std::invalid_argument("Invalid checkpoint interval: " + value);
+        } else if (name == "trace" || name == "counters") {
+#ifndef KMEANS_TRACE
+            throw std::invalid_argument("Option " + name + "= requires compiling with -DKMEANS_TRACE");
+#else
+            if (value.empty())
+                throw std::invalid_argument("Invalid " + name + ": " + value);
+            if (name == "trace") {
+                options.trace_prefix = value;
+            } else if (value == "on" || value == "off") {
+                options.hardware_counters = value == "on";
+            } else {
+                throw std::invalid_argument("Invalid counters (expected on or off): " + value);
+            }
+#endif
+        } else {
+            throw std::invalid_argument("Unknown option: " + name);
+        }
+    }
+    // El árbol kd ya suma subárboles completos durante la asignación
+    if (options.update_mode == UPDATE_INCREMENTAL && options.algorithm == ASSIGN_KDTREE)
+        throw std::invalid_argument("update=incremental cannot be combined with algorithm=kdtree");
+    // Las coordenadas cuantizadas sólo se leen en la asignación completa (Lloyd) y en la acumulación completa
+    if (options.storage != STORAGE_FLOAT && (options.algorithm != ASSIGN_LLOYD || options.update_mode != UPDATE_FULL))
+        throw std::invalid_argument("storage=q16|q8 requires algorithm=lloyd and update=full");
+    // El árbol kd recorre su propia copia ordenada de los puntos, que no se coloca por nodos
+    if (options.numa && options.algorithm == ASSIGN_KDTREE)
+        throw std::invalid_argument("numa=on cannot be combined with algorithm=kdtree");
+    // Cada reinicio necesita su propio árbol y sus propias copias por nodo, y la traza registra una sola ejecución a la vez
+    if (options.n_init > 1 && (options.algorithm == ASSIGN_KDTREE || options.numa || !options.trace_prefix.empty()))
+        throw std::invalid_argument("n_init= cannot be combined with algorithm=kdtree, numa=on or trace=");
+    // Todos los reinicios empezarían de los mismos centroides, y los puntos de control son de una sola ejecución
+    if (options.n_init > 1 && (!options.warm_file.empty() || options.checkpoint_interval > 0))
+        throw std::invalid_argument("n_init= cannot be combined with warm= or checkpoint=");
+    // Los puntos de control se escriben junto al modelo
+    if (options.checkpoint_interval > 0 && options.model_file.empty())
+        options.model_file = "on";
+    // Sin una afinidad explícita, numa=on reparte los hilos entre los nodos
+    if (options.numa && !affinity_given)
+        options.affinity = AFFINITY_SPREAD;
+    return options;
+}
+
+#endif
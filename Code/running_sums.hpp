@@ -0,0 +1,157 @@
+/**
+ * @file running_sums.hpp
+ * @date 2023-03-08
+ * @author Diego Hernández Delgado
+ * @author Jesús Isaías García Moreno
+ * @brief Actualización incremental de los centroides (update=incremental): las sumas de las coordenadas y la cantidad de puntos de cada cluster se conservan entre iteraciones y en cada pasada sólo se restan del cluster anterior y se suman al nuevo los puntos que cambiaron de cluster. Cada recompute pasadas incrementales las sumas se recalculan con todos los puntos para acotar el error de redondeo acumulado
+ * */
+
+#ifndef RUNNING_SUMS_HPP
+#define RUNNING_SUMS_HPP
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include "dataset.hpp"
+
+// Pasadas incrementales entre dos recálculos completos de las sumas
+const int DEFAULT_RECOMPUTE_INTERVAL = 10;
+
+/**
+ * @name UpdateMode
+ * @brief Forma de obtener las sumas de cada cluster en la actualización de los centroides
+ * */
+enum UpdateMode { UPDATE_FULL, UPDATE_INCREMENTAL };
+
+/**
+ * @name parse_update_mode
+ * @brief Función para convertir el argumento de entrada en una forma de actualización
+ * @param argument "full" o "incremental"
+ * @return Forma de actualización
+ * */
+inline UpdateMode parse_update_mode(const std::string& argument) {
+    if (argument == "full") return UPDATE_FULL;
+    if (argument == "incremental") return UPDATE_INCREMENTAL;
+    throw std::invalid_argument("Invalid update mode (full or incremental): " + argument);
+}
+
+/**
+ * @name RunningSums
+ * @brief Sumas de las coordenadas y cantidad de puntos de cada cluster que se conservan entre iteraciones, con el mismo orden de campos que CentroidAccumulator (dimensión + 1 por cluster)
+ * */
+struct RunningSums {
+    int n_clusters;               // Número de clusters o centroides
+    int fields;                   // Campos por cluster: una suma por coordenada más la cantidad de puntos
+    double* sums;                 // Sumas de cada cluster
+    int recompute_interval;       // Pasadas incrementales entre dos recálculos completos
+    int passes_since_full;        // Pasadas incrementales desde el último recálculo completo
+    bool valid;                   // Si las sumas corresponden a los clusters actuales de los puntos
+};
+
+/**
+ * @name create_running_sums
+ * @brief Función para reservar las sumas de cada cluster
+ * @param n_clusters Número de clusters o centroides
+ * @param dimension Número de coordenadas de cada punto
+ * @param recompute_interval Pasadas incrementales entre dos recálculos completos
+ * @return Apuntador a las sumas reservadas (todavía no válidas)
+ * */
+inline RunningSums* create_running_sums(int n_clusters, int dimension, int recompute_interval) {
+    RunningSums* running = new RunningSums;
+    running->n_clusters = n_clusters;
+    running->fields = dimension + 1;
+    running->sums = new double[(long long int) n_clusters * running->fields]();
+    running->recompute_interval = recompute_interval;
+    running->passes_since_full = 0;
+    running->valid = false;
+    return running;
+}
+
+/**
+ * @name free_running_sums
+ * @brief Función para liberar las sumas de cada cluster
+ * @param running Sumas a liberar
+ * */
+inline void free_running_sums(RunningSums* running) {
+    delete[] running->sums;
+    delete running;
+}
+
+/**
+ * @name reset_running_sums
+ * @brief Función para invalidar las sumas al empezar una repetición (los clusters de los puntos son los de la repetición anterior); la siguiente pasada las recalcula completas
+ * @param running Sumas de cada cluster
+ * */
+inline void reset_running_sums(RunningSums* running) {
+    running->valid = false;
+    running->passes_since_full = 0;
+}
+
+/**
+ * @name incremental_pass
+ * @brief Función para saber si la pasada actual aplica sólo los puntos que cambiaron de cluster o recalcula las sumas completas. La asignación y la actualización de una misma pasada deben llamarla antes de modificar las sumas
+ * @param running Sumas de cada cluster, o nullptr con update=full
+ * @return true si la pasada es incremental
+ * */
+inline bool incremental_pass(const RunningSums* running) {
+    return running != nullptr && running->valid && running->passes_since_full < running->recompute_interval;
+}
+
+/**
+ * @name move_point
+ * @brief Función para restar un punto de las sumas de su cluster anterior y sumarlo a las de su nuevo cluster
+ * @param points Conjunto de puntos por columnas
+ * @param i Índice del punto
+ * @param from Cluster anterior del punto, o -1 si no tenía
+ * @param to Nuevo cluster del punto
+ * @param sums Sumas (o diferencias) de cada cluster con fields campos por cluster
+ * @param fields Campos por cluster
+ * */
+inline void move_point(const Dataset& points, long long int i, int32_t from, int32_t to, double* sums, int fields) {
+    const int dimension = points.dimension();
+    double* to_slot = sums + (long long int) to * fields;
+    if (from >= 0) {
+        double* from_slot = sums + (long long int) from * fields;
+        for (int d = 0; d < dimension; d++) {
+            from_slot[d] -= points.at(i, d);
+        }
+        from_slot[dimension] -= 1.0;
+    }
+    for (int d = 0; d < dimension; d++) {
+        to_slot[d] += points.at(i, d);
+    }
+    to_slot[dimension] += 1.0;
+}
+
+/**
+ * @name store_full_sums
+ * @brief Función para guardar las sumas recalculadas con todos los puntos
+ * @param running Sumas de cada cluster
+ * @param full Sumas de todos los puntos de cada cluster con el mismo orden de campos
+ * */
+inline void store_full_sums(RunningSums* running, const double* full) {
+    const long long int size = (long long int) running->n_clusters * running->fields;
+    for (long long int f = 0; f < size; f++) {
+        running->sums[f] = full[f];
+    }
+    running->valid = true;
+    running->passes_since_full = 0;
+}
+
+/**
+ * @name apply_deltas
+ * @brief Función para sumar las diferencias de los puntos que cambiaron de cluster en una pasada incremental
+ * @param running Sumas de cada cluster
+ * @param deltas Diferencias de cada cluster con el mismo orden de campos, o nullptr si ya se aplicaron directamente sobre las sumas
+ * */
+inline void apply_deltas(RunningSums* running, const double* deltas) {
+    if (deltas != nullptr) {
+        const long long int size = (long long int) running->n_clusters * running->fields;
+        for (long long int f = 0; f < size; f++) {
+            running->sums[f] += deltas[f];
+        }
+    }
+    running->passes_since_full++;
+}
+
+#endif
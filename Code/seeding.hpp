@@ -0,0 +1,468 @@
+/**
+ * @file seeding.hpp
+ * @date 2023-03-08
+ * @author Diego Hernández Delgado
+ * @author Jesús Isaías García Moreno
+ * @brief Elección de los centroides iniciales compartida por la implementación serial y la paralela: puntos distintos al azar, k-means++ y k-means|| (k-means++ paralelo por rondas de sobremuestreo). Los números aleatorios salen de flujos deterministas por semilla y por bloque de KERNEL_BLOCK_SIZE puntos, de modo que el resultado depende sólo de la semilla y no del número de hilos
+ * */
+
+#ifndef SEEDING_HPP
+#define SEEDING_HPP
+
+#include <omp.h>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "dataset.hpp"
+#include "distance_kernels.hpp"
+
+/**
+ * @name InitMethod
+ * @brief Forma de elegir los centroides iniciales
+ * */
+enum InitMethod { INIT_RANDOM, INIT_KMEANS_PLUS_PLUS, INIT_KMEANS_PARALLEL };
+
+// Rondas de sobremuestreo de k-means|| y puntos esperados por ronda (en múltiplos del número de clusters)
+const int KMEANS_PARALLEL_ROUNDS = 5;
+const double KMEANS_PARALLEL_OVERSAMPLING = 2.0;
+// Iteraciones máximas de Lloyd ponderado con las que k-means|| agrupa sus candidatos
+const int KMEANS_PARALLEL_RECLUSTER_ITERATIONS = 20;
+
+/**
+ * @name parse_init_method
+ * @brief Función para convertir el argumento de entrada en una forma de elegir los centroides iniciales
+ * @param argument "random", "kmeans++" o "kmeans||"
+ * @return Forma de elegir los centroides iniciales
+ * */
+inline InitMethod parse_init_method(const std::string& argument) {
+    if (argument == "random") return INIT_RANDOM;
+    if (argument == "kmeans++") return INIT_KMEANS_PLUS_PLUS;
+    if (argument == "kmeans||") return INIT_KMEANS_PARALLEL;
+    throw std::invalid_argument("Invalid init method (random, kmeans++ or kmeans||): " + argument);
+}
+
+/**
+ * @name init_method_name
+ * @brief Función para obtener el nombre de una forma de elegir los centroides iniciales
+ * @param method Forma de elegir los centroides iniciales
+ * @return Nombre como se escribe en los argumentos de entrada
+ * */
+inline const char* init_method_name(InitMethod method) {
+    switch (method) {
+        case INIT_RANDOM: return "random";
+        case INIT_KMEANS_PLUS_PLUS: return "kmeans++";
+        case INIT_KMEANS_PARALLEL: return "kmeans||";
+    }
+    return "unknown";
+}
+
+/**
+ * @name RandomStream
+ * @brief Generador splitmix64 de un flujo identificado por la semilla y dos números de flujo. Es barato de crear, así que cada hilo crea el suyo por bloque de puntos en lugar de compartir uno
+ * */
+class RandomStream {
+public:
+    /**
+     * @name RandomStream
+     * @brief Constructor del flujo
+     * @param seed Semilla de la ejecución
+     * @param stream Primer número de flujo (por ejemplo la ronda)
+     * @param substream Segundo número de flujo (por ejemplo el bloque de puntos)
+     * */
+    RandomStream(uint64_t seed, uint64_t stream, uint64_t substream = 0)
+        : state_(mix(seed ^ mix(stream + 0x9e3779b97f4a7c15ULL * (substream + 1)))) {}
+
+    // Siguiente número de 64 bits
+    uint64_t next() {
+        state_ += 0x9e3779b97f4a7c15ULL;
+        return mix(state_);
+    }
+    // Número uniforme en [0, 1)
+    double uniform() { return (next() >> 11) * 0x1.0p-53; }
+    // Entero uniforme en [0, n)
+    long long int below(long long int n) { return (long long int) (uniform() * n); }
+
+private:
+    static uint64_t mix(uint64_t z) {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    uint64_t state_;
+};
+
+// Números de flujo de cada uso de los números aleatorios
+const uint64_t SEED_STREAM_FIRST = 1;     // Primer centroide y puntos distintos al azar
+const uint64_t SEED_STREAM_PLUS_PLUS = 2; // Elección proporcional a D^2 de k-means++
+const uint64_t SEED_STREAM_ROUNDS = 3;    // Rondas de k-means|| (el bloque es el segundo número de flujo)
+const uint64_t SEED_STREAM_RECLUSTER = 4; // k-means++ ponderado sobre los candidatos de k-means||
+
+/**
+ * @name copy_point
+ * @brief Función para copiar un punto de un conjunto a una fila de otro
+ * @param from Conjunto de origen
+ * @param i Índice del punto de origen
+ * @param to Conjunto de destino
+ * @param k Índice de la fila de destino
+ * */
+inline void copy_point(const Dataset& from, long long int i, Dataset& to, long long int k) {
+    for (int d = 0; d < from.dimension(); d++) {
+        to.at(k, d) = from.at(i, d);
+    }
+}
+
+/**
+ * @name update_min_distances
+ * @brief Función para bajar la distancia al cuadrado de cada punto al centroide más cercano con un nuevo conjunto de centroides, y sumar las distancias de cada bloque de KERNEL_BLOCK_SIZE puntos (la suma total se hace en orden de bloque para no depender del número de hilos)
+ * @param points Conjunto de puntos por columnas
+ * @param centers Nuevos centroides
+ * @param min_distances Menor distancia al cuadrado de cada punto a los centroides anteriores (se actualiza)
+ * @param block_sums Suma de las distancias de cada bloque
+ * @param num_threads Número de hilos a utilizar
+ * @return Suma de las distancias de todos los puntos
+ * */
+inline double update_min_distances(const Dataset& points, const Dataset& centers, std::vector<float>& min_distances, std::vector<double>& block_sums, int num_threads) {
+    const long long int num_points = points.size();
+    const long long int n_blocks = (num_points + KERNEL_BLOCK_SIZE - 1) / KERNEL_BLOCK_SIZE;
+    const NearestCentroidsKernel nearest_centroids = select_nearest_centroids_kernel(points.dimension());
+    #pragma omp parallel num_threads(num_threads)
+    {
+        std::vector<int32_t> block_labels(KERNEL_BLOCK_SIZE);
+        std::vector<float> block_distances(KERNEL_BLOCK_SIZE);
+        #pragma omp for schedule(static)
+        for (long long int b = 0; b < n_blocks; b++) {
+            long long int begin = b * KERNEL_BLOCK_SIZE;
+            long long int end = std::min(begin + KERNEL_BLOCK_SIZE, num_points);
+            nearest_centroids(points, begin, end, centers, block_labels.data(), block_distances.data());
+            double sum = 0.0;
+            for (long long int i = begin; i < end; i++) {
+                min_distances[i] = std::min(min_distances[i], block_distances[i - begin]);
+                sum += min_distances[i];
+            }
+            block_sums[b] = sum;
+        }
+    }
+    double total = 0.0;
+    for (long long int b = 0; b < n_blocks; b++) {
+        total += block_sums[b];
+    }
+    return total;
+}
+
+/**
+ * @name random_centroids
+ * @brief Función para elegir como centroides puntos distintos uniformemente al azar (algoritmo de Floyd)
+ * @param points Conjunto de puntos por columnas
+ * @param centroids Conjunto de centroides por columnas donde se guardan
+ * @param seed Semilla
+ * */
+inline void random_centroids(const Dataset& points, Dataset& centroids, uint64_t seed) {
+    const long long int num_points = points.size();
+    const long long int n_clusters = centroids.size();
+    RandomStream random(seed, SEED_STREAM_FIRST);
+    std::unordered_set<long long int> chosen;
+    for (long long int j = num_points - n_clusters; j < num_points; j++) {
+        long long int i = random.below(j + 1);
+        if (!chosen.insert(i).second) {
+            i = j;
+            chosen.insert(j);
+        }
+        copy_point(points, i, centroids, chosen.size() - 1);
+    }
+}
+
+/**
+ * @name pick_weighted_point
+ * @brief Función para encontrar el punto donde la suma acumulada de las distancias alcanza el valor elegido: primero se recorre la suma de cada bloque y después los puntos del bloque
+ * @param min_distances Menor distancia al cuadrado de cada punto a los centroides elegidos
+ * @param block_sums Suma de las distancias de cada bloque de KERNEL_BLOCK_SIZE puntos
+ * @param target Valor elegido entre 0 y la suma de todas las distancias
+ * @return Índice del punto elegido, o -1 si el bloque alcanzado no tiene puntos con distancia positiva
+ * */
+inline long long int pick_weighted_point(const std::vector<float>& min_distances, const std::vector<double>& block_sums, double target) {
+    const long long int num_points = min_distances.size();
+    const long long int n_blocks = block_sums.size();
+    long long int chosen = -1;
+    long long int b = 0;
+    while (b + 1 < n_blocks && target >= block_sums[b]) target -= block_sums[b++];
+    long long int end = std::min((b + 1) * KERNEL_BLOCK_SIZE, num_points);
+    for (long long int i = b * KERNEL_BLOCK_SIZE; i < end; i++) {
+        if (min_distances[i] > 0.0f) chosen = i;
+        target -= min_distances[i];
+        if (target < 0.0 && chosen >= 0) break;
+    }
+    return chosen;
+}
+
+/**
+ * @name kmeans_plus_plus
+ * @brief Función para elegir los centroides con k-means++: el primero uniformemente al azar y cada siguiente con probabilidad proporcional a la distancia al cuadrado de cada punto al centroide más cercano ya elegido. Las distancias se actualizan en paralelo y la elección recorre las sumas por bloque
+ * @param points Conjunto de puntos por columnas
+ * @param centroids Conjunto de centroides por columnas donde se guardan
+ * @param seed Semilla
+ * @param num_threads Número de hilos a utilizar
+ * */
+inline void kmeans_plus_plus(const Dataset& points, Dataset& centroids, uint64_t seed, int num_threads) {
+    const long long int num_points = points.size();
+    const int n_clusters = centroids.size();
+    const long long int n_blocks = (num_points + KERNEL_BLOCK_SIZE - 1) / KERNEL_BLOCK_SIZE;
+    std::vector<float> min_distances(num_points, std::numeric_limits<float>::infinity());
+    std::vector<double> block_sums(n_blocks);
+    Dataset newest(1, points.dimension(), false);
+    RandomStream first(seed, SEED_STREAM_FIRST);
+    RandomStream random(seed, SEED_STREAM_PLUS_PLUS);
+    copy_point(points, first.below(num_points), centroids, 0);
+    for (int k = 1; k < n_clusters; k++) {
+        copy_point(centroids, k - 1, newest, 0);
+        double total = update_min_distances(points, newest, min_distances, block_sums, num_threads);
+        long long int chosen = -1;
+        if (total > 0.0) {
+            chosen = pick_weighted_point(min_distances, block_sums, random.uniform() * total);
+        }
+        // Todos los puntos coinciden con algún centroide: se repite un punto al azar
+        if (chosen < 0) chosen = random.below(num_points);
+        copy_point(points, chosen, centroids, k);
+    }
+}
+
+/**
+ * @name weighted_recluster
+ * @brief Función para agrupar los candidatos de k-means|| en n_clusters centroides: k-means++ ponderado por el peso de cada candidato y después Lloyd ponderado hasta que ningún candidato cambie de cluster
+ * @param candidates Candidatos por columnas
+ * @param weights Cantidad de puntos más cercanos a cada candidato
+ * @param centroids Conjunto de centroides por columnas donde se guardan
+ * @param seed Semilla
+ * */
+inline void weighted_recluster(const Dataset& candidates, const std::vector<double>& weights, Dataset& centroids, uint64_t seed) {
+    const long long int n_candidates = candidates.size();
+    const int n_clusters = centroids.size();
+    const int dimension = candidates.dimension();
+    const NearestCentroidsKernel nearest_centroids = select_nearest_centroids_kernel(dimension);
+    RandomStream random(seed, SEED_STREAM_RECLUSTER);
+    std::vector<float> min_distances(n_candidates, std::numeric_limits<float>::infinity());
+    std::vector<float> distances(n_candidates);
+    std::vector<int32_t> labels(n_candidates, -1);
+    std::vector<int32_t> nearest(n_candidates);
+
+    // k-means++ ponderado: probabilidad proporcional al peso por la distancia al cuadrado
+    double total_weight = 0.0;
+    for (long long int c = 0; c < n_candidates; c++) total_weight += weights[c];
+    double target = random.uniform() * total_weight;
+    long long int chosen = n_candidates - 1;
+    for (long long int c = 0; c < n_candidates; c++) {
+        target -= weights[c];
+        if (target < 0.0) {
+            chosen = c;
+            break;
+        }
+    }
+    Dataset newest(1, dimension, false);
+    for (int k = 0; k < n_clusters; k++) {
+        copy_point(candidates, chosen, centroids, k);
+        copy_point(candidates, chosen, newest, 0);
+        nearest_centroids(candidates, 0, n_candidates, newest, nearest.data(), distances.data());
+        double total = 0.0;
+        for (long long int c = 0; c < n_candidates; c++) {
+            min_distances[c] = std::min(min_distances[c], distances[c]);
+            total += weights[c] * min_distances[c];
+        }
+        chosen = -1;
+        if (total > 0.0) {
+            target = random.uniform() * total;
+            for (long long int c = 0; c < n_candidates; c++) {
+                if (weights[c] * min_distances[c] > 0.0) chosen = c;
+                target -= weights[c] * min_distances[c];
+                if (target < 0.0 && chosen >= 0) break;
+            }
+        }
+        if (chosen < 0) chosen = random.below(n_candidates);
+    }
+
+    // Lloyd ponderado sobre los candidatos
+    std::vector<double> sums((long long int) n_clusters * (dimension + 1));
+    for (int iteration = 0; iteration < KMEANS_PARALLEL_RECLUSTER_ITERATIONS; iteration++) {
+        nearest_centroids(candidates, 0, n_candidates, centroids, nearest.data(), nullptr);
+        bool changed = false;
+        std::fill(sums.begin(), sums.end(), 0.0);
+        for (long long int c = 0; c < n_candidates; c++) {
+            changed = changed || nearest[c] != labels[c];
+            labels[c] = nearest[c];
+            double* slot = sums.data() + (long long int) labels[c] * (dimension + 1);
+            for (int d = 0; d < dimension; d++) slot[d] += weights[c] * candidates.at(c, d);
+            slot[dimension] += weights[c];
+        }
+        if (!changed) break;
+        for (int k = 0; k < n_clusters; k++) {
+            const double* slot = sums.data() + (long long int) k * (dimension + 1);
+            if (slot[dimension] > 0.0) {
+                for (int d = 0; d < dimension; d++) centroids.at(k, d) = slot[d] / slot[dimension];
+            }
+        }
+    }
+}
+
+/**
+ * @name oversample_round
+ * @brief Función para hacer una ronda de sobremuestreo de k-means||: cada punto se vuelve candidato con probabilidad oversampling * d^2 / total. Cada bloque sortea sus puntos con su propio flujo, identificado por el índice global de su primer punto, así que los candidatos no dependen del número de hilos ni de cómo se reparta el conjunto entre procesos
+ * @param min_distances Menor distancia al cuadrado de cada punto a los candidatos elegidos
+ * @param total Suma de las distancias de todos los puntos (de todo el conjunto si está repartido)
+ * @param oversampling Candidatos esperados por ronda
+ * @param seed Semilla
+ * @param round Número de ronda
+ * @param first_row Índice global del primer punto (0 si el conjunto no está repartido)
+ * @param num_threads Número de hilos a utilizar
+ * @return Índices locales de los puntos elegidos, en orden
+ * */
+inline std::vector<long long int> oversample_round(const std::vector<float>& min_distances, double total, double oversampling, uint64_t seed, int round, long long int first_row, int num_threads) {
+    const long long int num_points = min_distances.size();
+    const long long int n_blocks = (num_points + KERNEL_BLOCK_SIZE - 1) / KERNEL_BLOCK_SIZE;
+    std::vector<std::vector<long long int>> block_selected(n_blocks);
+    #pragma omp parallel for num_threads(num_threads) schedule(static)
+    for (long long int b = 0; b < n_blocks; b++) {
+        RandomStream random(seed, SEED_STREAM_ROUNDS + ((uint64_t) round << 8), first_row + b * KERNEL_BLOCK_SIZE);
+        long long int end = std::min((b + 1) * KERNEL_BLOCK_SIZE, num_points);
+        for (long long int i = b * KERNEL_BLOCK_SIZE; i < end; i++) {
+            if (random.uniform() * total < oversampling * min_distances[i]) block_selected[b].push_back(i);
+        }
+    }
+    std::vector<long long int> selected;
+    for (long long int b = 0; b < n_blocks; b++) {
+        selected.insert(selected.end(), block_selected[b].begin(), block_selected[b].end());
+    }
+    return selected;
+}
+
+/**
+ * @name candidate_weights
+ * @brief Función para contar cuántos puntos tienen a cada candidato de k-means|| como el más cercano
+ * @param points Conjunto de puntos por columnas
+ * @param candidates Candidatos por columnas
+ * @param num_threads Número de hilos a utilizar
+ * @return Cantidad de puntos más cercanos a cada candidato
+ * */
+inline std::vector<double> candidate_weights(const Dataset& points, const Dataset& candidates, int num_threads) {
+    const long long int num_points = points.size();
+    const long long int n_candidates = candidates.size();
+    const long long int n_blocks = (num_points + KERNEL_BLOCK_SIZE - 1) / KERNEL_BLOCK_SIZE;
+    const NearestCentroidsKernel nearest_centroids = select_nearest_centroids_kernel(points.dimension());
+    std::vector<double> weights(n_candidates, 0.0);
+    #pragma omp parallel num_threads(num_threads)
+    {
+        std::vector<int32_t> block_labels(KERNEL_BLOCK_SIZE);
+        std::vector<double> local_weights(n_candidates, 0.0);
+        #pragma omp for schedule(static)
+        for (long long int b = 0; b < n_blocks; b++) {
+            long long int begin = b * KERNEL_BLOCK_SIZE;
+            long long int end = std::min(begin + KERNEL_BLOCK_SIZE, num_points);
+            nearest_centroids(points, begin, end, candidates, block_labels.data(), nullptr);
+            for (long long int i = 0; i < end - begin; i++) local_weights[block_labels[i]] += 1.0;
+        }
+        #pragma omp critical
+        {
+            for (long long int c = 0; c < n_candidates; c++) weights[c] += local_weights[c];
+        }
+    }
+    return weights;
+}
+
+/**
+ * @name kmeans_parallel
+ * @brief Función para elegir los centroides con k-means|| (Bahmani et al.): a partir de un punto al azar, en cada ronda cada punto se vuelve candidato de forma independiente con probabilidad l * d^2 / (suma de d^2), con l = KMEANS_PARALLEL_OVERSAMPLING * n_clusters. Al final cada candidato pesa la cantidad de puntos que tiene más cerca y los candidatos se agrupan en n_clusters centroides con k-means++ y Lloyd ponderados
+ * @param points Conjunto de puntos por columnas
+ * @param centroids Conjunto de centroides por columnas donde se guardan
+ * @param seed Semilla
+ * @param num_threads Número de hilos a utilizar
+ * */
+inline void kmeans_parallel(const Dataset& points, Dataset& centroids, uint64_t seed, int num_threads) {
+    const long long int num_points = points.size();
+    const int n_clusters = centroids.size();
+    const int dimension = points.dimension();
+    const long long int n_blocks = (num_points + KERNEL_BLOCK_SIZE - 1) / KERNEL_BLOCK_SIZE;
+    const double oversampling = KMEANS_PARALLEL_OVERSAMPLING * n_clusters;
+    std::vector<float> min_distances(num_points, std::numeric_limits<float>::infinity());
+    std::vector<double> block_sums(n_blocks);
+    std::vector<long long int> candidates;
+
+    RandomStream first(seed, SEED_STREAM_FIRST);
+    candidates.push_back(first.below(num_points));
+    Dataset selected(1, dimension, false);
+    copy_point(points, candidates[0], selected, 0);
+    double total = update_min_distances(points, selected, min_distances, block_sums, num_threads);
+
+    for (int round = 0; round < KMEANS_PARALLEL_ROUNDS && total > 0.0; round++) {
+        std::vector<long long int> round_selected = oversample_round(min_distances, total, oversampling, seed, round, 0, num_threads);
+        if (round_selected.empty()) continue;
+        selected = Dataset(round_selected.size(), dimension, false);
+        for (size_t s = 0; s < round_selected.size(); s++) {
+            copy_point(points, round_selected[s], selected, s);
+            candidates.push_back(round_selected[s]);
+        }
+        total = update_min_distances(points, selected, min_distances, block_sums, num_threads);
+    }
+
+    // Con pocos candidatos (por ejemplo puntos repetidos) se completan con puntos distintos al azar
+    if ((long long int) candidates.size() < n_clusters) {
+        random_centroids(points, centroids, seed);
+        return;
+    }
+
+    // Peso de cada candidato: cantidad de puntos que lo tienen como candidato más cercano
+    const long long int n_candidates = candidates.size();
+    Dataset candidate_points(n_candidates, dimension, false);
+    for (long long int c = 0; c < n_candidates; c++) {
+        copy_point(points, candidates[c], candidate_points, c);
+    }
+    std::vector<double> weights = candidate_weights(points, candidate_points, num_threads);
+    weighted_recluster(candidate_points, weights, centroids, seed);
+}
+
+/**
+ * @name initialize_centroids
+ * @brief Función para elegir los centroides iniciales con la forma indicada
+ * @param points Conjunto de puntos por columnas
+ * @param centroids Conjunto de centroides por columnas donde se guardan
+ * @param method Forma de elegir los centroides iniciales
+ * @param seed Semilla
+ * @param num_threads Número de hilos a utilizar
+ * */
+inline void initialize_centroids(const Dataset& points, Dataset& centroids, InitMethod method, uint64_t seed, int num_threads) {
+    if (points.size() < centroids.size())
+        throw std::invalid_argument("There are fewer points than clusters");
+    switch (method) {
+        case INIT_RANDOM: random_centroids(points, centroids, seed); break;
+        case INIT_KMEANS_PLUS_PLUS: kmeans_plus_plus(points, centroids, seed, num_threads); break;
+        case INIT_KMEANS_PARALLEL: kmeans_parallel(points, centroids, seed, num_threads); break;
+    }
+}
+
+/**
+ * @name report_iterations
+ * @brief Función para imprimir cuántas iteraciones necesitaron las repeticiones con una forma de elegir los centroides iniciales y cuánto tomó elegirlos
+ * @param method Forma de elegir los centroides iniciales
+ * @param seed Semilla de la primera repetición
+ * @param iterations Iteraciones de cada repetición, a partir del índice 1
+ * @param init_times Segundos de la elección de los centroides de cada repetición, a partir del índice 1
+ * @param runs Número de repeticiones
+ * */
+inline void report_iterations(InitMethod method, uint64_t seed, const long long int* iterations, const double* init_times, int runs) {
+    long long int min_iterations = iterations[1];
+    long long int max_iterations = iterations[1];
+    double sum_iterations = 0.0;
+    double sum_times = 0.0;
+    for (int i = 1; i <= runs; i++) {
+        min_iterations = std::min(min_iterations, iterations[i]);
+        max_iterations = std::max(max_iterations, iterations[i]);
+        sum_iterations += iterations[i];
+        sum_times += init_times[i];
+    }
+    std::cout << "init=" << init_method_name(method) << " seed=" << seed << ": iterations avg " << sum_iterations / runs
+              << " (min " << min_iterations << ", max " << max_iterations << "), seeding avg " << sum_times / runs << " s" << "\n";
+}
+
+#endif
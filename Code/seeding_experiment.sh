@@ -0,0 +1,24 @@
+# Seeding Experiment
+# Author: Diego Hernández Delgado
+# Author: Jesús Isaías García Moreno
+# Date: 2023-03-08
+
+# Parameters
+num_points=("100" "100000" "200000" "300000")
+num_points_size=${#num_points[@]}
+init_methods=("random" "kmeans++" "kmeans||")
+init_methods_size=${#init_methods[@]}
+num_threads="12"
+n_clusters="5"
+max_iterations="500"
+seed="42"
+
+# Run every initialization method on every data set; each run prints the iterations of its 10 repetitions (seeds seed..seed+9)
+for((i=0; i<num_points_size; i++))
+do
+    for((j=0; j<init_methods_size; j++))
+    do
+        echo "Experiment:  ${num_points[i]} points, init=${init_methods[j]}"
+        ./parallel_kmeans  $n_clusters ${num_points[i]} $max_iterations $num_threads output=none "init=${init_methods[j]}" seed=$seed
+    done
+done
@@ -18,116 +18,164 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <bits/stdc++.h>
+#include "dataset.hpp"
+#include "accumulate_kernels.hpp"
+#include "binary_format.hpp"
+#include "csv_io.hpp"
+#include "centroid_accumulator.hpp"
+#include "distance_kernels.hpp"
+#include "kd_tree.hpp"
+#include "result_writer.hpp"
+#include "run_options.hpp"
+#include "running_sums.hpp"
+#include "seeding.hpp"
+#include "triangle_bounds.hpp"
 
 using namespace std;
 
 
 /**
- * @name euclidean_distance 
- * @brief Función para calcular la distancia euclidiana entre dos puntos
- * @param point1 Punto 1 - Arreglo de floats [X, Y] 
- * @param point2 Punto 2 - Arreglo de floats [X, Y]
- * @param point_dimension_size Dimensiones de los puntos, es decir, el número de coordenadas de cada punto
- * @return Distancia euclidiana entre los dos puntos dados
+ * @name assign_block
+ * @brief Función para asignar los puntos del rango [begin, end) a su centroide más cercano con el kernel vectorizado de distancias al cuadrado, actualizando incrementalmente la cantidad de puntos de cada cluster
+ * @param centroids Conjunto de centroides por columnas
+ * @param cluster_sizes Cantidad de puntos de cada cluster
+ * @param points Conjunto de puntos por columnas con el cluster de cada punto
+ * @param begin Índice del primer punto del bloque
+ * @param end Índice siguiente al último punto del bloque
+ * @param block_labels Arreglo temporal de al menos end - begin etiquetas
+ * @param bounds Cotas de Hamerly o Elkan para evitar distancias innecesarias, o nullptr para calcularlas todas (Lloyd)
+ * @param running Sumas de cada cluster que se conservan entre iteraciones (update=incremental); en una pasada incremental los puntos que cambian de cluster se mueven directamente en ellas. nullptr con update=full
+ * @return true si al menos un punto del bloque cambió de cluster
  * */
-float euclidean_distance(float* point1, float* point2, int point_dimension_size) {
-    float distance = 0;
-    for (int i = 0; i < point_dimension_size; i++) {
-        distance += pow((point1[i] - point2[i]), 2);
+bool assign_block(const Dataset& centroids, long long int* cluster_sizes, Dataset& points, long long int begin, long long int end, int32_t* block_labels, TriangleBounds* bounds, RunningSums* running) {
+    int32_t* labels = points.labels();
+    bool changed = false;
+    const bool incremental = incremental_pass(running);
+    if (bounds != nullptr) {
+        bounds->nearest_centroids(points, begin, end, centroids, block_labels);
+    } else {
+        select_nearest_centroids_kernel(points.dimension())(points, begin, end, centroids, block_labels, nullptr);
     }
-    return sqrt(distance);
+    for (long long int i = begin; i < end; i++) {
+        int nearest_centroid_index = block_labels[i - begin];
+        if (labels[i] != nearest_centroid_index) {
+            if (incremental)
+                move_point(points, i, labels[i], nearest_centroid_index, running->sums, running->fields);
+            if (labels[i] >= 0)
+                cluster_sizes[labels[i]]--; // Decrementa la cantidad de puntos en el cluster en el que estaba anteriormente 
+            cluster_sizes[nearest_centroid_index]++; // Incrementa la cantidad de puntos en el cluster al que ahora pertenece
+            labels[i] = nearest_centroid_index; // Asigna el nuevo cluster al punto
+            changed = true;
+        }
+    }
+    return changed;
 }
 
 /**
- * @name find_nearest_centroid
- * @brief Función para encontrar el índice del centroide más cercano para un punto dado
- * @param centroids Arreglo de centroides - Arreglo de arreglos de floats [[X, Y, cant_puntos_cluster], [X, Y, cant_puntos_cluster], ...]
- * @param point Punto - Arreglo de floats [X, Y]
- * @param n_clusters Número de clusters o centroides
- * @param point_dimension_size Dimensiones de los puntos, es decir, el número de coordenadas de cada punto
- * @return Índice del centroide más cercano al punto dado
+ * @name assign_tree
+ * @brief Función para asignar todos los puntos a su centroide más cercano con el árbol kd, que asigna subárboles completos y deja las sumas de cada cluster en el acumulador
+ * @param centroids Conjunto de centroides por columnas
+ * @param cluster_sizes Cantidad de puntos de cada cluster (se recalcula completa)
+ * @param points Conjunto de puntos por columnas con el cluster de cada punto
+ * @param tree Árbol kd construido sobre los puntos
+ * @param accumulator Acumulador de un hilo donde quedan la suma de las coordenadas y la cantidad de puntos de cada cluster
+ * @return true si al menos un punto cambió de cluster
  * */
-int find_nearest_centroid(float** centroids, float* point, int n_clusters, int point_dimension_size) {
-    float min_distance = euclidean_distance(centroids[0], point, point_dimension_size);
-    int nearest_centroid_index = 0;
-    for (int i = 1; i < n_clusters; i++) {
-        float distance = euclidean_distance(centroids[i], point, point_dimension_size);
-        if (distance < min_distance) {
-            min_distance = distance;
-            nearest_centroid_index = i;
-        }
+bool assign_tree(const Dataset& centroids, long long int* cluster_sizes, Dataset& points, KdTree* tree, CentroidAccumulator* accumulator) {
+    long long int changed_points = tree->assign(centroids, points, accumulator);
+    for (int i = 0; i < centroids.size(); i++) {
+        cluster_sizes[i] = (long long int) accumulator->buffer[(long long int) i * accumulator->fields + points.dimension()];
     }
-    return nearest_centroid_index;
+    return changed_points > 0;
 }
 
 /**
  * @name update_centroids
  * @brief Función para actualizar los centroides basados en los clusters actuales
- * @param centroids Arreglo de centroides - Arreglo de arreglos de floats [[X, Y, cant_puntos_cluster], [X, Y, cant_puntos_cluster], ...]
- * @param points Arreglo de puntos - Arreglo de arreglos de floats [[X, Y, cluster], [X, Y, cluster], ...]
- * @param n_clusters Número de clusters o centroides
- * @param num_points Número de puntos
+ * @param centroids Conjunto de centroides por columnas
+ * @param cluster_sizes Cantidad de puntos de cada cluster
+ * @param points Conjunto de puntos por columnas con el cluster de cada punto
+ * @param tree_sums Sumas de cada cluster que ya calculó el árbol kd (dimensión + 1 campos por cluster), o nullptr para sumar los puntos aquí
+ * @param running Sumas de cada cluster que se conservan entre iteraciones (update=incremental): después de una pasada incremental ya están al día, y en las demás se recalculan con todos los puntos. nullptr para recalcular siempre
  * */
-void update_centroids(float** centroids, float** points, int n_clusters, long long int num_points) {
-    float** new_centroids = new float*[n_clusters];
-    for (size_t i = 0; i < n_clusters; i++)
-    {
-        new_centroids[i] = new float[3];
-        new_centroids[i][0] = 0;
-        new_centroids[i][1] = 0;
-        new_centroids[i][2] = 0;
-    }
-    // Se iteran todos los puntos y se suman las X y Y de cada cluster
-    int cluster;
-    for(long long int i =0; i < num_points; i++){
-        cluster = (int) points[i][2];  // Cluster/Centroide al que pertenece el punto
-        new_centroids[cluster][0] += points[i][0]; // Se suman las X de ese cluster en particular
-        new_centroids[cluster][1] += points[i][1]; // Se suman las Y de ese cluster en particular
+void update_centroids(Dataset& centroids, const long long int* cluster_sizes, const Dataset& points, const double* tree_sums, RunningSums* running) {
+    const int n_clusters = centroids.size();
+    const int dimension = points.dimension();
+    const int32_t* labels = points.labels();
+    const int fields = dimension + 1; // suma de cada coordenada y cantidad de puntos
+    double* sums = nullptr;
+    if (incremental_pass(running)) {
+        apply_deltas(running, nullptr); // assign_block ya movió los puntos que cambiaron de cluster
+    } else if (tree_sums == nullptr) {
+        sums = new double[(long long int) n_clusters * fields]();
+        // Se iteran todos los puntos y se suman las coordenadas de cada cluster
+        select_accumulate_kernel(dimension)(points, 0, points.size(), labels, sums, fields);
+        if (running != nullptr) {
+            store_full_sums(running, sums);
+        }
     }
-    // Para obtener la nueva X del centroide, se divide la suma de las X de los puntos del cluster entre la cantidad de puntos en el cluster
-    // Para obtener la nueva Y del centroide, se divide la suma de las Y de los puntos del cluster entre la cantidad de puntos en el cluster
+    const double* cluster_sums = running != nullptr ? running->sums : tree_sums != nullptr ? tree_sums : sums;
+    // Para obtener cada coordenada del centroide, se divide la suma de esa coordenada de los puntos del cluster entre la cantidad de puntos en el cluster
     for(int i =0; i < n_clusters; i++){
-        if(centroids[i][2] != 0){
-            centroids[i][0] = new_centroids[i][0] / centroids[i][2]; 
-            centroids[i][1] = new_centroids[i][1] / centroids[i][2]; 
+        if(cluster_sizes[i] != 0){
+            for (int d = 0; d < dimension; d++) {
+                centroids.at(i, d) = cluster_sums[i * fields + d] / cluster_sizes[i];
+            }
         }
     }
-    // Liberar memoria al borrar matriz temporal new_centroids utilizada para calcular los nuevos centroides
-    for (int i = 0; i < n_clusters; i++) {
-        delete[] new_centroids[i];
-    }
-    delete[] new_centroids;
+    // Liberar memoria del arreglo temporal de sumas utilizado para calcular los nuevos centroides
+    delete[] sums;
 }
 
 /**
  * @name kmeans
  * @brief Función para llevar a cabo la el agrupamiento o clustering con el algoritmo de k-means
- * @param points Arreglo de puntos - Arreglo de arreglos de floats [[X, Y, cluster], [X, Y, cluster], ...]
+ * @param points Conjunto de puntos por columnas; al terminar contiene el cluster de cada punto
  * @param n_clusters Número de clusters o centroides
- * @param num_points Número de puntos
  * @param max_iterations Número máximo de iteraciones
+ * @param bounds Cotas de Hamerly o Elkan reutilizadas por assign_block, o nullptr para la asignación completa (Lloyd)
+ * @param tree Árbol kd reutilizado por assign_tree (algorithm=kdtree), o nullptr
+ * @param accumulator Acumulador de un hilo para las sumas del árbol kd, o nullptr si no se usa el árbol
+ * @param running Sumas de cada cluster reutilizadas por la actualización incremental (update=incremental), o nullptr
+ * @param init Forma de elegir los centroides iniciales
+ * @param seed Semilla de la elección de los centroides iniciales
+ * @param init_time Segundos que tomó elegir los centroides iniciales
+ * @return Número de iteraciones después de la primera asignación
  * */
-void kmeans(float** points, int n_clusters, long long int num_points, long long int max_iterations) {
+long long int kmeans(Dataset& points, int n_clusters, long long int max_iterations, TriangleBounds* bounds, KdTree* tree, CentroidAccumulator* accumulator, RunningSums* running, InitMethod init, uint64_t seed, double& init_time) {
+    const long long int num_points = points.size();
+    const int dimension = points.dimension();
+    int32_t* labels = points.labels();
+    const double* tree_sums = tree != nullptr ? accumulator->buffer : nullptr;
 
-    // Paso 1. Crear k centroides y distribuirlos aleatoriamente sobre los datos
+    // Paso 1. Elegir k centroides iniciales entre los puntos (al azar, k-means++ o k-means||) con flujos aleatorios por semilla, en un solo hilo
     //cout << "Paso 1. Crear k centroides y distribuirlos aleatoriamente sobre los datos" << "\n";
-    float** centroids = new float*[n_clusters];
-    for (int i = 0; i < n_clusters; i++) {
-        srand(time(NULL));
-        centroids[i] = new float[3];  //{cantidad de puntos en el cluster, x position, y position}
-        centroids[i][0] = points[rand() % num_points][0]; // position x
-        centroids[i][1] = points[rand() % num_points][1]; // position y
-        //centroids[i][0] = RandomFloat(0.0, 1.5); // position x
-        //centroids[i][1] = RandomFloat(0.0, 1.5); // position y
-        centroids[i][2] = 0; // cantidad de puntos en el cluster
-    }
+    Dataset centroids(n_clusters, dimension, false);
+    long long int* cluster_sizes = new long long int[n_clusters](); // cantidad de puntos en cada cluster
+    double init_start = omp_get_wtime();
+    initialize_centroids(points, centroids, init, seed, 1);
+    init_time = omp_get_wtime() - init_start;
 
     // Paso 2. Asignar los puntos al centroide / cluster más cercano
     //cout << "Paso 2. Asignar los puntos al centroide / cluster más cercano" << "\n";
+    int32_t* block_labels = new int32_t[KERNEL_BLOCK_SIZE];
     for (long long int i = 0; i < num_points; i++) {
-        int nearest_centroid_index = find_nearest_centroid(centroids, points[i], n_clusters, 2);
-        points[i][2] = nearest_centroid_index;
-        centroids[nearest_centroid_index][2]++; //Incrementar la cantidad de puntos en ese cluster
+        labels[i] = -1; // Ningún punto tiene cluster todavía
+    }
+    if (running != nullptr) {
+        reset_running_sums(running); // Las sumas de la repetición anterior no corresponden a los nuevos clusters
+    }
+    if (bounds != nullptr) {
+        bounds->reset(); // Las cotas de la repetición anterior no sirven con los nuevos centroides
+        bounds->begin_pass(centroids);
+    }
+    if (tree != nullptr) {
+        tree->reset(points); // Los dueños de los nodos de la repetición anterior no sirven con los nuevos centroides
+        assign_tree(centroids, cluster_sizes, points, tree, accumulator);
+    } else {
+        for (long long int begin = 0; begin < num_points; begin += KERNEL_BLOCK_SIZE) {
+            assign_block(centroids, cluster_sizes, points, begin, min(begin + KERNEL_BLOCK_SIZE, num_points), block_labels, bounds, running);
+        }
     }
 
 
@@ -135,41 +183,38 @@ void kmeans(float** points, int n_clusters, long long int num_points, long long
         // Centroide X = Promedio de todas las posiciones X de los puntos del cluster correspondiente a ese centroide
         // Centroide Y = Promedio de todas las posiciones Y de sus puntos del cluster correspondiente a ese centroide
     //cout << "Paso 3. Actualizar la posición de los centroides" << "\n";
-    update_centroids(centroids, points, n_clusters, num_points);
+    update_centroids(centroids, cluster_sizes, points, tree_sums, running);
   
 
     // Paso 4. Repetir pasos 1 y 2 y 3hasta que ningún punto cambie de cluster o hasta un número dado.
     //cout << "Paso 4. Repetir pasos 1 y 2 hasta que ningún punto cambie de cluster o hasta un número dado." << "\n";
     long long int iteration = 0;
-    int index;
     bool changed = true;
-    int nearest_centroid_index;
     // Iterar hasta que no haya cambios en los clusters o hasta que se alcance el número máximo de iteraciones
     while (changed && iteration < max_iterations) {
         changed = false;
+        // Las cotas se corrigen con el desplazamiento de los centroides antes de recorrer los bloques
+        if (bounds != nullptr) {
+            bounds->begin_pass(centroids);
+        }
         // Asignar los puntos a los clusters más cercanos si es que ha cambiado el centroide más cercano
-        for (long long int i = 0; i < num_points; i++) {
-            nearest_centroid_index = find_nearest_centroid(centroids, points[i], n_clusters, 2);
-            if (points[i][2] != nearest_centroid_index) {
-                index = (int) points[i][2];
-                centroids[index][2]--;// Decrementa la cantidad de puntos en el cluster en el que estaba anteriormente 
-                centroids[nearest_centroid_index][2]++; // Incrementa la cantidad de puntos en el cluster al que ahora pertenece
-                points[i][2] = nearest_centroid_index; // Asigna el nuevo cluster al punto
-                changed = true;
+        if (tree != nullptr) {
+            changed = assign_tree(centroids, cluster_sizes, points, tree, accumulator);
+        } else {
+            for (long long int begin = 0; begin < num_points; begin += KERNEL_BLOCK_SIZE) {
+                changed |= assign_block(centroids, cluster_sizes, points, begin, min(begin + KERNEL_BLOCK_SIZE, num_points), block_labels, bounds, running);
             }
         }
         /*
         cout << "Iteration " << iteration <<  " centroids: " << "\n";
-        cout << "0:  " << centroids[0][0] <<  ", " << centroids[0][1] <<  ", "  << centroids[0][2]  << "\n";
-        cout << "1:  " << centroids[1][0] <<  ", " << centroids[1][1] <<  ", "  << centroids[1][2]  << "\n";
-        cout << "2:  " << centroids[2][0] <<  ", " << centroids[2][1] <<  ", "  << centroids[2][2]  << "\n";
-        cout << "3:  " << centroids[3][0] <<  ", " << centroids[3][1] <<  ", "  << centroids[3][2]  << "\n";
-        cout << "4:  " << centroids[4][0] <<  ", " << centroids[4][1] <<  ", "  << centroids[4][2]  << "\n";
+        for (int i = 0; i < n_clusters; i++) {
+            cout << i << ":  " << centroids.at(i, 0) <<  ", " << centroids.at(i, 1) <<  ", "  << cluster_sizes[i]  << "\n";
+        }
         cout << changed << "\n";
         cout << max_iterations << "\n";
         */
         // Actualizar la posición de los centroides
-        update_centroids(centroids, points, n_clusters, num_points);
+        update_centroids(centroids, cluster_sizes, points, tree_sums, running);
         iteration++;
     }
 
@@ -178,60 +223,20 @@ void kmeans(float** points, int n_clusters, long long int num_points, long long
     /*
     cout << "Step 5" << "\n";
     for (int i = 0; i < n_clusters; i++) {
-        cout << "Centroid " << i << ": (" << centroids[i][0] << ", " << centroids[i][1] << ", " << centroids[i][2] << ")\n";
+        cout << "Centroid " << i << ": (" << centroids.at(i, 0) << ", " << centroids.at(i, 1) << ", " << cluster_sizes[i] << ")\n";
     }
     for (long long int i = 0; i < num_points; i++) {
-        cout << "Point " << i << ": (" << points[i][0] << ", " << points[i][1] << ") -> Cluster " << points[i][2] << "\n";
+        cout << "Point " << i << ": (" << points.at(i, 0) << ", " << points.at(i, 1) << ") -> Cluster " << labels[i] << "\n";
     }
     */
 
-    // Liberar memoria de la matriz de centroides
-    for (int i = 0; i < n_clusters; i++) {
-        delete[] centroids[i];
-    }
-    delete[] centroids;
-}
-
-
-/**
- * @name load_CSV
- * @brief Función para leer un archivo CSV y guardar los puntos en una matriz llamada puntos
- * @param file_name Nombre del archivo CSV
- * @param points Matriz donde se guardarán los puntos
- * @param num_points Cantidad de puntos que se leerán del archivo
- * */
-void load_CSV(string file_name, float** points, long long int num_points) {
-    fstream myfile;
-    myfile.open(file_name, ios::in);
-    string row = "";
-
-    for(long long int i=0; i<num_points; i++){
-        getline(myfile,row);
-        //cout << stof(row.substr(0, 5)) << " - " << stof(row.substr(6, 5)) << "\n\n";
-        points[i][0] = stof(row.substr(0, 5));
-        points[i][1] = stof(row.substr(6, 5));
-    }
-    myfile.close();
+    // Liberar memoria del conteo de puntos por cluster y de las etiquetas temporales (las columnas de los centroides se liberan al salir de la función)
+    delete[] block_labels;
+    delete[] cluster_sizes;
+    return iteration;
 }
 
 
-/**
- * @name save_to_CSV
- * @brief Función para guardar los puntos con su respectivo centroide resultante en un archivo CSV 
- * @param file_name Nombre del archivo CSV
- * @param points Matriz donde se guardarán los puntos
- * @param size Cantidad de puntos que se leerán del archivo
- * */
-void save_to_CSV(string file_name, float** points, long long int size) {
-    fstream fout;
-    fout.open(file_name, ios::out);
-    for (long long int i = 0; i < size; i++) {
-        fout << points[i][0] << ","
-             << points[i][1] << ","
-             << points[i][2] << "\n";
-    }
-}
-
 void save_array_to_CSV(string file_name, float* times,  int size) {
     fstream fout;
     fout.open(file_name, ios::out);
@@ -245,7 +250,7 @@ void save_array_to_CSV(string file_name, float* times,  int size) {
  * @name main
  * @brief Función main del programa 
  * @param argc Cantidad de argumentos de entrada (STDIN)
- * @param argv Argumentos de entrada (STDIN) [nombre del programa, número de clusters, número de puntos, número máximo de iteraciones]
+ * @param argv Argumentos de entrada (STDIN) [nombre del programa, número de clusters, número de puntos o ruta del archivo de entrada (CSV o binario), número máximo de iteraciones, opciones nombre=valor (output=csv|labels|none, algorithm=lloyd|hamerly|elkan|yinyang|kdtree, memory=MiB)]
  * @return 0 si el programa termina correctamente
  * */
 int main(int argc, char** argv) {
@@ -254,71 +259,93 @@ int main(int argc, char** argv) {
     int n_clusters;
     long long int num_points;
     long long int max_iterations;
+    string input_file_name; // Archivo de entrada (CSV o binario)
+    RunOptions options; // Opciones nombre=valor (formato de resultados, algoritmo de asignación)
 
     // Se obtienen los argumentos de entrada del programa (número de clusters, número de puntos, número máximo de iteraciones)
     try{
         // Si no se pasan argumentos, se usan los valores por defecto
         if(argc == 1){
             n_clusters = 5;
-            num_points = 100;
+            input_file_name = resolve_input_file("100");
             max_iterations = 100;
         }else
             // Si se pasan argumentos, se usan esos valores
-            if(argc == 4){
+            if(argc >= 4){
                 n_clusters = stoi(argv[1]);
-                num_points = (long long int) stoi(argv[2]);
+                input_file_name = resolve_input_file(argv[2]); // Ruta del archivo o número de puntos de ./../Data/<num_points>_data.csv
                 max_iterations = (long long int) stoi(argv[3]);
+                options = parse_run_options(argc, argv, 4); // output=csv|labels|none, algorithm=lloyd|hamerly|elkan|yinyang|kdtree, memory=MiB
                 if (n_clusters < 1) 
                     throw std::invalid_argument("Invalid number of clusters");
-                if (num_points < 1) 
-                    throw std::invalid_argument("Invalid number of points");
                 if (max_iterations < 1) 
                     throw std::invalid_argument("Invalid number of iterations");
+                if (!options.trace_prefix.empty())
+                    throw std::invalid_argument("trace= is only supported by parallel_kmeans");
+                if (options.storage != STORAGE_FLOAT)
+                    throw std::invalid_argument("storage=q16|q8 is only supported by parallel_kmeans");
+                if (options.numa || options.affinity != AFFINITY_NONE)
+                    throw std::invalid_argument("numa= and affinity= are only supported by parallel_kmeans");
+                if (options.n_init > 1)
+                    throw std::invalid_argument("n_init= is only supported by parallel_kmeans");
+                if (!options.model_file.empty() || !options.warm_file.empty())
+                    throw std::invalid_argument("model=, checkpoint= and warm= are only supported by parallel_kmeans");
             }else
                 // Si se pasan más o menos argumentos, se lanza una excepción
                 throw std::invalid_argument("Invalid number of arguments");
     } catch (const std::exception& e) {
         // Se imprime el mensaje de error y se muestra la forma correcta de ejecutar el programa
         cout << e.what() << "\n";
-        cout << "Usage: ./kmeans <n_clusters> <num_points> <max_iterations>" << "\n";
+        cout << "Usage: ./kmeans <n_clusters> <num_points | input_file> <max_iterations> " << RUN_OPTIONS_USAGE << "\n";
         return 1;
     }
     
-    // Inicializa el arreglo de puntos con ceros y sin cluster con -1
-    float** points = new float*[num_points];
-    for(long long int i = 0; i < num_points; i++) {
-        points[i] = new float[3]{0.0, 0.0, -1}; 
-        // index 0: position x
-        // index 1: position y 
-        // index 2: cluster
+    // Lee los puntos del archivo de entrada y se guardan en el conjunto de puntos por columnas (coordenadas y cluster -1).
+    // El formato se detecta del encabezado: un archivo binario se proyecta en memoria y se usa sin copiarlo; cualquier otro se lee como CSV.
+    // La cantidad de puntos y la dimensión se obtienen del archivo
+    Dataset points;
+    try{
+        points = load_points(input_file_name, 1);
+        num_points = points.size();
+    } catch (const std::exception& e) {
+        cout << "Error: load_points()" << "\n";
+        cout << e.what() << "\n";
+        return 1;
     }
 
     // Crea el directorio de resultados correspondiente al número de puntos del experimento  
     string dir_str = "./../Results/Serial/"+ to_string(num_points) +"_Points/";
-    char* dir = new char[dir_str.length() + 1];
-    strcpy(dir, dir_str.c_str());
-    struct stat sb;
-    try{
-        if (stat(dir, &sb) == 0)
-        mkdir(dir, 0777);
-    }catch(const std::exception& e){
-        cout << "Error: mkdir()" << "\n";
-        cout << e.what() << "\n";
-    }
-    delete[] dir;
+    make_directory("./../Results/Serial/");
+    make_directory(dir_str);
 
 
-    // Lee los puntos del archivo csv  y se guardan en la matriz de puntos
-    string input_file_name = "./../Data/" + to_string(num_points)+"_data.csv";
-    try{
-        load_CSV(input_file_name, points, num_points);
-    } catch (const std::exception& e) {
-        cout << "Error: load_CSV()" << "\n";
-        cout << e.what() << "\n";
+    // Con algorithm=hamerly, elkan o yinyang se reservan una sola vez las cotas de los puntos que se reutilizan en las 10 repeticiones
+    TriangleBounds* bounds = nullptr;
+    if (uses_triangle_bounds(options.algorithm)) {
+        bounds = new TriangleBounds(options.algorithm, num_points, n_clusters, points.dimension(), options.bounds_memory);
     }
-    
+    // Con algorithm=kdtree el árbol se construye una sola vez, en un solo hilo, y sus sumas se dejan en un acumulador de un hilo
+    KdTree* tree = nullptr;
+    CentroidAccumulator* accumulator = nullptr;
+    double tree_build_time = 0.0;
+    if (options.algorithm == ASSIGN_KDTREE) {
+        const clock_t tree_begin = clock();
+        tree = new KdTree(points, 1);
+        tree_build_time = float( clock () - tree_begin ) /  CLOCKS_PER_SEC;
+        accumulator = create_accumulator(1, n_clusters, points.dimension());
+    }
+    // Con update=incremental las sumas de cada cluster se conservan entre iteraciones
+    RunningSums* running = nullptr;
+    if (options.update_mode == UPDATE_INCREMENTAL) {
+        running = create_running_sums(n_clusters, points.dimension(), options.recompute_interval);
+    }
+
+    // Los resultados de cada repetición se escriben en segundo plano mientras empieza la siguiente
+    ResultWriter writer(options.output_mode);
     string output_file_name;
     float* times = new float[11]{0.0}; // Arreglo para guardar los tiempos de ejecución de cada experimento
+    long long int iterations[11] = {0}; // Iteraciones de cada experimento hasta converger (o hasta el máximo)
+    double init_times[11] = {0.0}; // Segundos de la elección de los centroides iniciales de cada experimento
     float sum_times = 0.0; // Variable para guardar la suma de los tiempos de ejecución de los 10 experimentos
     float avg_time = 0.0; // Variable para guardar el promedio de los tiempos de ejecución de los 10 experimentos
     // Se itera 10 veces para repetir el experimento con esta configuración de parámetros
@@ -327,7 +354,7 @@ int main(int argc, char** argv) {
         // Invoca el método de kmeans con la matriz de puntos, el número de clusters deseados y el número total de puntos
         try{
             const clock_t begin_time = clock();
-            kmeans(points, n_clusters, num_points, max_iterations); 
+            iterations[i] = kmeans(points, n_clusters, max_iterations, bounds, tree, accumulator, running, options.init, options.seed + i - 1, init_times[i]);
             times[i] = float( clock () - begin_time ) /  CLOCKS_PER_SEC;
             sum_times += times[i];
         } catch (const std::exception& e) {
@@ -335,16 +362,24 @@ int main(int argc, char** argv) {
             cout << e.what() << "\n";
         }
             
-        // Guarda el resultado de los puntos con su respectivo centroide/cluster en el archivo de salida
-        output_file_name = dir_str + to_string(i) +"_"+ to_string(num_points)+"_results.csv"; 
+        // Encola el resultado de los puntos con su respectivo centroide/cluster para escribirlo en el archivo de salida
+        output_file_name = dir_str + to_string(i) +"_"+ to_string(num_points)+output_file_suffix(options.output_mode); 
         try{
-            save_to_CSV(output_file_name, points, num_points);
+            writer.submit(output_file_name, points);
         } catch (const std::exception& e) {
             cout << "Error: save_to_CSV()" << "\n";
             cout << e.what() << "\n";
         }
     }
 
+    // Espera a que termine la escritura de los resultados
+    try{
+        writer.finish();
+    } catch (const std::exception& e) {
+        cout << "Error: save_to_CSV()" << "\n";
+        cout << e.what() << "\n";
+    }
+
     // Guarda los tiempos de ejecución de los 10 experimentos y el promedio en la primera fila en un archivo csv 
     avg_time = sum_times / 10.0;
     times[0] = avg_time;
@@ -356,11 +391,25 @@ int main(int argc, char** argv) {
         cout << e.what() << "\n";
     }
 
+    // Reporta las iteraciones que necesitó cada repetición con la forma de elegir los centroides iniciales
+    report_iterations(options.init, options.seed, iterations, init_times, 10);
 
-    // Libera la memoria al borrar la matriz de puntos
-    for(long long int i = 0; i < num_points; i++) {
-        delete[] points[i];
+    // Reporta cuántas distancias evitaron calcular las cotas en las 10 repeticiones
+    if (bounds != nullptr) {
+        report_skipped_distances(*bounds);
+    }
+    if (tree != nullptr) {
+        report_kd_tree(*tree, tree_build_time);
+    }
+
+    // Libera las cotas, el árbol, su acumulador y las sumas incrementales (las columnas de los puntos se liberan al salir de main)
+    delete bounds;
+    delete tree;
+    if (running != nullptr) {
+        free_running_sums(running);
+    }
+    if (accumulator != nullptr) {
+        free_accumulator(accumulator);
     }
-    delete[] points;
     return 0;
 }
\ No newline at end of file
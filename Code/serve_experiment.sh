@@ -0,0 +1,32 @@
+# Parallel K-Means Assignment Server
+# Author: Diego Hernández Delgado
+# Author: Jesús Isaías García Moreno
+# Date: 2023-03-08
+
+# Parameters
+centroids_file="./../Results/OutOfCore/100000_data_5_centroids.csv"
+num_points="100000"
+socket_path="/tmp/kmeans_serve.sock"
+server_threads="1"
+windows=("0" "200" "1000")
+windows_size=${#windows[@]}
+clients=("1" "4" "16" "64")
+clients_size=${#clients[@]}
+requests="2000"
+points="64"
+
+# Start the server with each batching window and load it with an increasing number of closed-loop clients; each client prints the
+# throughput and the round-trip p50/p99 latency and checks every label against the centroids, and the server prints its totals on SIGTERM
+for((i=0; i<windows_size; i++))
+do
+    ./kmeans_serve $centroids_file $socket_path $server_threads window=${windows[i]} report=0 &
+    server_pid=$!
+    sleep 1
+    for((j=0; j<clients_size; j++))
+    do
+        echo "Serve:  window ${windows[i]} us, ${clients[j]} clients, ${points} points per request"
+        ./kmeans_load $socket_path $num_points clients=${clients[j]} requests=$requests points=$points centroids=$centroids_file
+    done
+    kill -TERM $server_pid
+    wait $server_pid
+done
@@ -0,0 +1,182 @@
+/**
+ * @file serve_protocol.hpp
+ * @date 2023-03-08
+ * @author Diego Hernández Delgado
+ * @author Jesús Isaías García Moreno
+ * @brief Protocolo del servidor de asignación (kmeans_serve) y de su generador de carga (kmeans_load) sobre un socket Unix de flujo. Cada solicitud es un encabezado con la cantidad de puntos y la dimensión seguido de las coordenadas en float punto por punto; la respuesta es un encabezado con la misma cantidad de puntos y un estado, seguido del cluster de cada punto en enteros de 32 bits. Un cliente puede enviar varias solicitudes por la misma conexión y las respuestas llegan en el mismo orden
+ * */
+
+#ifndef SERVE_PROTOCOL_HPP
+#define SERVE_PROTOCOL_HPP
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Identificador de los encabezados ("KMSV" en little endian)
+const uint32_t SERVE_MAGIC = 0x56534D4B;
+// Máximo de puntos por solicitud
+const uint32_t SERVE_MAX_POINTS = 1u << 20;
+// Estados de la respuesta
+const int32_t SERVE_OK = 0;
+const int32_t SERVE_BAD_DIMENSION = -1; // La dimensión de la solicitud no es la de los centroides
+const int32_t SERVE_TOO_LARGE = -2;     // La solicitud tiene más de SERVE_MAX_POINTS puntos
+
+/**
+ * @name ServeRequestHeader
+ * @brief Encabezado de una solicitud; le siguen num_points * dimension floats
+ * */
+struct ServeRequestHeader {
+    uint32_t magic;       // SERVE_MAGIC
+    uint32_t num_points;  // Puntos de la solicitud
+    uint32_t dimension;   // Coordenadas de cada punto
+    uint32_t reserved;    // 0
+};
+
+/**
+ * @name ServeResponseHeader
+ * @brief Encabezado de una respuesta; con estado SERVE_OK le siguen num_points enteros de 32 bits
+ * */
+struct ServeResponseHeader {
+    uint32_t magic;       // SERVE_MAGIC
+    uint32_t num_points;  // Puntos de la solicitud
+    int32_t status;       // SERVE_OK o el error
+    uint32_t reserved;    // 0
+};
+
+/**
+ * @name send_all
+ * @brief Función para enviar todos los bytes por un socket bloqueante (el servidor no la usa: sus sockets no bloquean y cada cliente tiene su propio buffer de salida)
+ * @param fd Socket
+ * @param data Bytes a enviar
+ * @param bytes Cantidad de bytes
+ * @return true si se enviaron todos, false si la conexión se cerró
+ * */
+inline bool send_all(int fd, const void* data, size_t bytes) {
+    const char* cursor = static_cast<const char*>(data);
+    while (bytes > 0) {
+        ssize_t sent = send(fd, cursor, bytes, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        cursor += sent;
+        bytes -= sent;
+    }
+    return true;
+}
+
+/**
+ * @name receive_all
+ * @brief Función para recibir exactamente la cantidad de bytes pedida de un socket bloqueante
+ * @param fd Socket
+ * @param data Destino de los bytes
+ * @param bytes Cantidad de bytes
+ * @return true si se recibieron todos, false si la conexión se cerró antes
+ * */
+inline bool receive_all(int fd, void* data, size_t bytes) {
+    char* cursor = static_cast<char*>(data);
+    while (bytes > 0) {
+        ssize_t received = recv(fd, cursor, bytes, 0);
+        if (received < 0 && errno == EINTR) continue;
+        if (received <= 0) return false;
+        cursor += received;
+        bytes -= received;
+    }
+    return true;
+}
+
+/**
+ * @name unix_address
+ * @brief Función para construir la dirección de un socket Unix
+ * @param path Ruta del socket
+ * @return Dirección del socket
+ * */
+inline sockaddr_un unix_address(const std::string& path) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+        throw std::invalid_argument("Socket path too long: " + path);
+    strcpy(address.sun_path, path.c_str());
+    return address;
+}
+
+/**
+ * @name connect_unix
+ * @brief Función para conectarse al socket Unix del servidor
+ * @param path Ruta del socket
+ * @return Socket conectado (bloqueante)
+ * */
+inline int connect_unix(const std::string& path) {
+    sockaddr_un address = unix_address(path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) throw std::runtime_error("socket() failed: " + std::string(strerror(errno)));
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        int error = errno;
+        close(fd);
+        throw std::runtime_error("Could not connect to " + path + ": " + strerror(error));
+    }
+    return fd;
+}
+
+/**
+ * @name latency_percentile
+ * @brief Función para obtener un percentil (por el método del rango más cercano) de latencias ya ordenadas
+ * @param sorted Latencias ordenadas de menor a mayor
+ * @param percent Percentil entre 0 y 100
+ * @return Latencia del percentil, o 0 sin latencias
+ * */
+inline double latency_percentile(const std::vector<double>& sorted, double percent) {
+    if (sorted.empty()) return 0.0;
+    size_t rank = (size_t) std::ceil(percent / 100.0 * sorted.size());
+    return sorted[std::min(std::max(rank, (size_t) 1), sorted.size()) - 1];
+}
+
+// Cubetas del histograma de latencias: LATENCY_BUCKETS_PER_DECADE por cada potencia de 10 desde LATENCY_MIN_SECONDS (de 100 ns a 100 s)
+const int LATENCY_BUCKETS_PER_DECADE = 100;
+const int LATENCY_DECADES = 9;
+const double LATENCY_MIN_SECONDS = 1e-7;
+
+/**
+ * @name LatencyHistogram
+ * @brief Histograma de latencias con cubetas de tamaño logarítmico, de modo que la memoria no crece con las solicitudes de un servidor que nunca se detiene; los percentiles tienen un error relativo menor a 1.2%
+ * */
+struct LatencyHistogram {
+    std::vector<long long int> counts = std::vector<long long int>(LATENCY_BUCKETS_PER_DECADE * LATENCY_DECADES + 2, 0); // Primera y última cubeta: fuera del intervalo
+    long long int total = 0;
+    double max = 0.0;
+
+    // Registra una latencia en segundos
+    void record(double seconds) {
+        int bucket = 0;
+        if (seconds >= LATENCY_MIN_SECONDS) {
+            bucket = 1 + (int) std::floor(std::log10(seconds / LATENCY_MIN_SECONDS) * LATENCY_BUCKETS_PER_DECADE);
+            bucket = std::min(bucket, (int) counts.size() - 1);
+        }
+        counts[bucket]++;
+        total++;
+        max = std::max(max, seconds);
+    }
+
+    // Percentil (rango más cercano) entre 0 y 100; regresa el centro geométrico de la cubeta, o 0 sin latencias
+    double percentile(double percent) const {
+        if (total == 0) return 0.0;
+        long long int rank = std::max((long long int) std::ceil(percent / 100.0 * total), 1LL);
+        size_t bucket = 0;
+        for (long long int seen = counts[0]; seen < rank; seen += counts[++bucket]) {}
+        if (bucket == 0) return std::min(LATENCY_MIN_SECONDS, max);
+        if (bucket == counts.size() - 1) return max;
+        return std::min(LATENCY_MIN_SECONDS * std::pow(10.0, (bucket - 0.5) / LATENCY_BUCKETS_PER_DECADE), max);
+    }
+};
+
+#endif
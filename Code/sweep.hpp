@@ -0,0 +1,233 @@
+/**
+ * @file sweep.hpp
+ * @date 2023-03-08
+ * @author Diego Hernández Delgado
+ * @author Jesús Isaías García Moreno
+ * @brief Barrido de parámetros dentro de un solo proceso (parallel_kmeans sweep): listas de clusters, hilos, cantidades de puntos y algoritmos que se ejecutan sobre los mismos datos leídos una sola vez, y las tablas de escalamiento fuerte y débil que se escriben al terminar
+ * */
+
+#ifndef SWEEP_HPP
+#define SWEEP_HPP
+
+#include <sys/types.h>
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+#include "dataset.hpp"
+#include "seeding.hpp"
+#include "triangle_bounds.hpp"
+
+// Texto de ayuda del barrido
+const char SWEEP_USAGE[] = "Usage: ./parallel_kmeans sweep <num_points | input_file> <max_iterations> [clusters=k1,k2,...] [threads=t1,t2,...] [points=n1,n2,...] [algorithm=a1,a2,...] [weak=points_per_thread] [repetitions=n] [memory=MiB] [init=random|kmeans++|kmeans||] [seed=n]";
+
+/**
+ * @name SweepOptions
+ * @brief Listas de parámetros del barrido con sus valores por defecto (los mismos de parallel_experiment.sh)
+ * */
+struct SweepOptions {
+    std::vector<int> clusters = {13};                          // Números de clusters
+    std::vector<int> threads = {1, 6, 12, 24};                 // Números de hilos
+    std::vector<long long int> points;                         // Cantidades de puntos (los primeros del archivo) del escalamiento fuerte; vacío para usar todos
+    std::vector<AssignmentAlgorithm> algorithms = {ASSIGN_LLOYD}; // Algoritmos de asignación
+    long long int weak_points = 0;                             // Puntos por hilo del escalamiento débil, o 0 para no medirlo
+    int repetitions = 10;                                      // Repeticiones de cada configuración
+    long long int bounds_memory = DEFAULT_BOUNDS_MEMORY;       // Bytes disponibles para las cotas inferiores de Yinyang
+    InitMethod init = INIT_KMEANS_PLUS_PLUS;                   // Forma de elegir los centroides iniciales
+    uint64_t seed = 42;                                        // Semilla de la primera repetición
+};
+
+/**
+ * @name parse_positive_list
+ * @brief Función para leer una lista de enteros positivos separados por comas
+ * @param value Lista, por ejemplo "1,6,12"
+ * @param name Nombre de la opción (para el mensaje de error)
+ * @return Enteros de la lista en el mismo orden
+ * */
+inline std::vector<long long int> parse_positive_list(const std::string& value, const std::string& name) {
+    std::vector<long long int> list;
+    size_t begin = 0;
+    while (begin <= value.size()) {
+        size_t end = value.find(',', begin);
+        if (end == std::string::npos) end = value.size();
+        std::string item = value.substr(begin, end - begin);
+        size_t parsed = 0;
+        long long int number = 0;
+        try {
+            number = std::stoll(item, &parsed);
+        } catch (const std::exception&) {
+            parsed = 0;
+        }
+        if (parsed == 0 || parsed != item.size() || number < 1)
+            throw std::invalid_argument("Invalid " + name + " list: " + value);
+        list.push_back(number);
+        begin = end + 1;
+    }
+    return list;
+}
+
+/**
+ * @name parse_sweep_options
+ * @brief Función para leer las opciones nombre=valor del barrido
+ * @param argc Cantidad de argumentos de entrada
+ * @param argv Argumentos de entrada
+ * @param first Índice del primer argumento opcional
+ * @return Opciones del barrido
+ * */
+inline SweepOptions parse_sweep_options(int argc, char** argv, int first) {
+    SweepOptions options;
+    for (int i = first; i < argc; i++) {
+        std::string argument = argv[i];
+        size_t separator = argument.find('=');
+        if (separator == std::string::npos)
+            throw std::invalid_argument("Invalid option (expected name=value): " + argument);
+        std::string name = argument.substr(0, separator);
+        std::string value = argument.substr(separator + 1);
+        if (name == "clusters" || name == "threads") {
+            std::vector<int>& list = name == "clusters" ? options.clusters : options.threads;
+            list.clear();
+            for (long long int number : parse_positive_list(value, name)) list.push_back((int) number);
+        } else if (name == "points") {
+            options.points = parse_positive_list(value, name);
+        } else if (name == "algorithm") {
+            options.algorithms.clear();
+            size_t begin = 0;
+            while (begin <= value.size()) {
+                size_t end = value.find(',', begin);
+                if (end == std::string::npos) end = value.size();
+                options.algorithms.push_back(parse_assignment_algorithm(value.substr(begin, end - begin)));
+                begin = end + 1;
+            }
+        } else if (name == "weak") {
+            options.weak_points = parse_positive_list(value, name)[0];
+        } else if (name == "repetitions") {
+            options.repetitions = (int) parse_positive_list(value, name)[0];
+        } else if (name == "memory") {
+            options.bounds_memory = parse_positive_list(value, name)[0] << 20;
+        } else if (name == "init") {
+            options.init = parse_init_method(value);
+        } else if (name == "seed") {
+            size_t parsed = 0;
+            options.seed = std::stoull(value, &parsed);
+            if (parsed != value.size())
+                throw std::invalid_argument("Invalid seed: " + value);
+        } else {
+            throw std::invalid_argument("Unknown option: " + name);
+        }
+    }
+    return options;
+}
+
+/**
+ * @name prefix_view
+ * @brief Función para ver los primeros puntos de un conjunto como otro conjunto, sin copiar sus columnas. El arreglo de clusters de la vista es propio; el conjunto original debe existir mientras exista la vista
+ * @param points Conjunto de puntos por columnas
+ * @param num_points Cantidad de puntos de la vista
+ * @return Conjunto con los primeros num_points puntos
+ * */
+inline Dataset prefix_view(const Dataset& points, long long int num_points) {
+    std::vector<const float*> columns(points.dimension());
+    for (int d = 0; d < points.dimension(); d++) {
+        columns[d] = points.column(d);
+    }
+    return Dataset::view(num_points, points.dimension(), columns.data(), std::shared_ptr<const void>());
+}
+
+/**
+ * @name SweepResult
+ * @brief Tiempos de una configuración del barrido
+ * */
+struct SweepResult {
+    int n_clusters;
+    AssignmentAlgorithm algorithm;
+    long long int num_points;
+    int threads;
+    double avg_time;        // Segundos promedio de una repetición
+    double min_time;        // Segundos de la repetición más rápida
+    double avg_init_time;   // Segundos promedio de la elección de los centroides iniciales
+    double avg_iterations;  // Iteraciones promedio después de la primera asignación
+};
+
+/**
+ * @name pass_time
+ * @brief Función para obtener los segundos promedio de una pasada (asignación y actualización) sin la elección de los centroides iniciales; el escalamiento débil compara conjuntos con distintas cantidades de iteraciones
+ * @param result Tiempos de una configuración
+ * @return Segundos por pasada
+ * */
+inline double pass_time(const SweepResult& result) {
+    return (result.avg_time - result.avg_init_time) / (result.avg_iterations + 1.0);
+}
+
+/**
+ * @name write_sweep_tables
+ * @brief Función para guardar los tiempos de todas las configuraciones y las tablas de escalamiento en dir_str e imprimirlas. El escalamiento fuerte compara cada cantidad de hilos contra la menor con los mismos puntos; el débil compara el tiempo por pasada con weak_points puntos por hilo contra el de la menor cantidad de hilos
+ * @param results Tiempos de cada configuración
+ * @param options Opciones del barrido
+ * @param strong_points Cantidades de puntos del escalamiento fuerte
+ * @param dir_str Directorio de salida (terminado en /)
+ * */
+inline void write_sweep_tables(const std::vector<SweepResult>& results, const SweepOptions& options, const std::vector<long long int>& strong_points, const std::string& dir_str) {
+    // Los resultados se buscan por (clusters, algoritmo, puntos, hilos)
+    std::map<std::tuple<int, int, long long int, int>, const SweepResult*> by_config;
+    for (const SweepResult& result : results) {
+        by_config[std::make_tuple(result.n_clusters, (int) result.algorithm, result.num_points, result.threads)] = &result;
+    }
+    std::vector<int> threads = options.threads;
+    std::sort(threads.begin(), threads.end());
+    threads.erase(std::unique(threads.begin(), threads.end()), threads.end());
+
+    std::ofstream all(dir_str + "sweep_times.csv");
+    all << "clusters,algorithm,points,threads,avg_time,min_time,init_time,iterations\n";
+    for (const SweepResult& result : results) {
+        all << result.n_clusters << "," << assignment_algorithm_name(result.algorithm) << "," << result.num_points << "," << result.threads << ","
+            << result.avg_time << "," << result.min_time << "," << result.avg_init_time << "," << result.avg_iterations << "\n";
+    }
+
+    std::ofstream strong(dir_str + "strong_scaling.csv");
+    strong << "clusters,algorithm,points,threads,avg_time,speedup,efficiency\n";
+    std::cout << "Strong scaling (speedup and efficiency against " << threads[0] << " threads)" << "\n";
+    for (int k : options.clusters) {
+        for (AssignmentAlgorithm algorithm : options.algorithms) {
+            for (long long int n : strong_points) {
+                auto base = by_config.find(std::make_tuple(k, (int) algorithm, n, threads[0]));
+                if (base == by_config.end()) continue;
+                for (int t : threads) {
+                    const SweepResult& result = *by_config.at(std::make_tuple(k, (int) algorithm, n, t));
+                    double speedup = base->second->avg_time / result.avg_time;
+                    double efficiency = speedup * threads[0] / t;
+                    strong << k << "," << assignment_algorithm_name(algorithm) << "," << n << "," << t << "," << result.avg_time << "," << speedup << "," << efficiency << "\n";
+                    std::cout << "  K=" << k << " " << assignment_algorithm_name(algorithm) << " " << n << " points, " << t << " threads: "
+                              << result.avg_time << " s, speedup " << speedup << ", efficiency " << efficiency << "\n";
+                }
+            }
+        }
+    }
+
+    if (options.weak_points == 0) return;
+    std::ofstream weak(dir_str + "weak_scaling.csv");
+    weak << "clusters,algorithm,points_per_thread,threads,points,pass_time,efficiency\n";
+    std::cout << "Weak scaling (" << options.weak_points << " points per thread, time per pass against " << threads[0] << " threads)" << "\n";
+    for (int k : options.clusters) {
+        for (AssignmentAlgorithm algorithm : options.algorithms) {
+            auto base = by_config.find(std::make_tuple(k, (int) algorithm, options.weak_points * threads[0], threads[0]));
+            if (base == by_config.end()) continue;
+            for (int t : threads) {
+                auto found = by_config.find(std::make_tuple(k, (int) algorithm, options.weak_points * t, t));
+                if (found == by_config.end()) continue;
+                double efficiency = pass_time(*base->second) / pass_time(*found->second);
+                weak << k << "," << assignment_algorithm_name(algorithm) << "," << options.weak_points << "," << t << "," << options.weak_points * t << ","
+                     << pass_time(*found->second) << "," << efficiency << "\n";
+                std::cout << "  K=" << k << " " << assignment_algorithm_name(algorithm) << " " << t << " threads, " << options.weak_points * t << " points: "
+                          << pass_time(*found->second) << " s per pass, efficiency " << efficiency << "\n";
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,18 @@
+# Parallel K-Means Sweep Experiment
+# Author: Diego Hernández Delgado
+# Author: Jesús Isaías García Moreno
+# Date: 2023-03-08
+
+# Parameters
+input_file="1000000"  # The sweep uses the first points of this data set
+num_points="100000,200000,300000,400000,600000,800000,1000000"
+num_threads="1,6,12,24"
+n_clusters="13"
+algorithms="lloyd,kdtree"
+weak_points="100000"  # Points per thread of the weak scaling table
+max_iterations="5" #"90000000"
+
+# Run every configuration in a single process: the data set is read once and every number of points is a view of its first points.
+# The times and the strong and weak scaling tables are written to ./../Analysis/Sweep/
+echo "Sweep:  points ${num_points}, threads ${num_threads}, clusters ${n_clusters}, algorithms ${algorithms}"
+./parallel_kmeans sweep $input_file $max_iterations clusters=$n_clusters threads=$num_threads points=$num_points algorithm=$algorithms weak=$weak_points
@@ -0,0 +1,549 @@
+/**
+ * @file triangle_bounds.hpp
+ * @date 2023-03-08
+ * @author Diego Hernández Delgado
+ * @author Jesús Isaías García Moreno
+ * @brief Asignación de los puntos con cotas por desigualdad del triángulo (Hamerly, Elkan y Yinyang). Cada punto guarda una cota superior de la distancia a su centroide y cotas inferiores de la distancia a los demás; al mover los centroides las cotas se corrigen con el desplazamiento de cada centroide y sólo se calculan las distancias que las cotas no descartan. Las etiquetas son exactamente las de la asignación completa (Lloyd)
+ * */
+
+#ifndef TRIANGLE_BOUNDS_HPP
+#define TRIANGLE_BOUNDS_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "dataset.hpp"
+#include "distance_kernels.hpp"
+
+/**
+ * @name AssignmentAlgorithm
+ * @brief Algoritmo de asignación de los puntos: completo (Lloyd, todas las distancias con el kernel vectorizado), Hamerly (una cota inferior por punto), Elkan (una cota inferior por punto y centroide), Yinyang (una cota inferior por punto y grupo de centroides) o filtrado sobre un árbol kd (kd_tree.hpp)
+ * */
+enum AssignmentAlgorithm { ASSIGN_LLOYD, ASSIGN_HAMERLY, ASSIGN_ELKAN, ASSIGN_YINYANG, ASSIGN_KDTREE };
+
+// Memoria por defecto para las cotas inferiores de Yinyang (1 GiB)
+const long long int DEFAULT_BOUNDS_MEMORY = 1LL << 30;
+// Centroides por grupo que busca Yinyang cuando la memoria alcanza
+const int YINYANG_CENTROIDS_PER_GROUP = 10;
+// Iteraciones de k-means sobre los centroides iniciales para formar los grupos de Yinyang
+const int YINYANG_GROUPING_ITERATIONS = 5;
+
+/**
+ * @name parse_assignment_algorithm
+ * @brief Función para convertir el argumento de entrada en un algoritmo de asignación
+ * @param argument "lloyd", "hamerly", "elkan", "yinyang" o "kdtree"
+ * @return Algoritmo de asignación
+ * */
+inline AssignmentAlgorithm parse_assignment_algorithm(const std::string& argument) {
+    if (argument == "lloyd") return ASSIGN_LLOYD;
+    if (argument == "hamerly") return ASSIGN_HAMERLY;
+    if (argument == "elkan") return ASSIGN_ELKAN;
+    if (argument == "yinyang") return ASSIGN_YINYANG;
+    if (argument == "kdtree") return ASSIGN_KDTREE;
+    throw std::invalid_argument("Invalid assignment algorithm (lloyd, hamerly, elkan, yinyang or kdtree): " + argument);
+}
+
+/**
+ * @name assignment_algorithm_name
+ * @brief Función para obtener el nombre de un algoritmo de asignación
+ * @param algorithm Algoritmo de asignación
+ * @return Nombre del algoritmo
+ * */
+inline const char* assignment_algorithm_name(AssignmentAlgorithm algorithm) {
+    switch (algorithm) {
+        case ASSIGN_HAMERLY: return "hamerly";
+        case ASSIGN_ELKAN: return "elkan";
+        case ASSIGN_YINYANG: return "yinyang";
+        case ASSIGN_KDTREE: return "kdtree";
+        default: return "lloyd";
+    }
+}
+
+/**
+ * @name uses_triangle_bounds
+ * @brief Función para saber si un algoritmo de asignación necesita las cotas de TriangleBounds
+ * @param algorithm Algoritmo de asignación
+ * @return true para Hamerly, Elkan y Yinyang
+ * */
+inline bool uses_triangle_bounds(AssignmentAlgorithm algorithm) {
+    return algorithm == ASSIGN_HAMERLY || algorithm == ASSIGN_ELKAN || algorithm == ASSIGN_YINYANG;
+}
+
+/**
+ * @name yinyang_groups
+ * @brief Función para elegir el número de grupos de Yinyang: un grupo por cada YINYANG_CENTROIDS_PER_GROUP centroides, limitado por la memoria de las cotas inferiores (num_points x grupos doubles)
+ * @param num_points Número de puntos
+ * @param n_clusters Número de clusters o centroides
+ * @param memory_budget Bytes disponibles para las cotas inferiores
+ * @return Número de grupos (al menos 1)
+ * */
+inline int yinyang_groups(long long int num_points, int n_clusters, long long int memory_budget) {
+    long long int groups = (n_clusters + YINYANG_CENTROIDS_PER_GROUP - 1) / YINYANG_CENTROIDS_PER_GROUP;
+    long long int affordable = memory_budget / ((long long int) sizeof(double) * std::max(num_points, 1LL));
+    return (int) std::max(1LL, std::min(groups, affordable));
+}
+
+/**
+ * @name TriangleBounds
+ * @brief Cotas por punto de los modos Hamerly, Elkan y Yinyang. Se reservan una sola vez y se reutilizan en todas las repeticiones. En cada pasada de asignación se llama primero a begin_pass (un solo hilo) y después a nearest_centroids por bloques, que puede llamarse desde varios hilos con bloques distintos.
+ *
+ * Las distancias se calculan en float con las mismas operaciones que el kernel escalar (squared_distance o el kernel vectorizado de un punto cuando se necesitan todas), por lo que una cota sólo descarta un centroide cuando garantiza que su distancia calculada es estrictamente mayor que la del centroide actual: las cotas se guardan ensanchadas por el error de redondeo de la distancia en float y cada comparación deja ese mismo margen
+ * */
+class TriangleBounds {
+public:
+    /**
+     * @name TriangleBounds
+     * @brief Constructor que reserva las cotas de todos los puntos
+     * @param algorithm ASSIGN_HAMERLY, ASSIGN_ELKAN o ASSIGN_YINYANG
+     * @param num_points Número de puntos
+     * @param n_clusters Número de clusters o centroides
+     * @param dimension Número de coordenadas de cada punto
+     * @param memory_budget Bytes disponibles para las cotas inferiores de Yinyang (determina el número de grupos)
+     * */
+    TriangleBounds(AssignmentAlgorithm algorithm, long long int num_points, int n_clusters, int dimension, long long int memory_budget = DEFAULT_BOUNDS_MEMORY)
+        : algorithm_(algorithm), n_clusters_(n_clusters), dimension_(dimension),
+          n_groups_(algorithm == ASSIGN_YINYANG ? yinyang_groups(num_points, n_clusters, memory_budget) : 1),
+          // Error relativo máximo de una distancia al cuadrado en float (resta, producto y suma de dimension términos positivos), con holgura
+          rounding_((dimension + 4) * (double) FLT_EPSILON),
+          first_pass_(true), previous_(n_clusters, dimension, false),
+          upper_(num_points), lower_(num_points * (algorithm == ASSIGN_ELKAN ? n_clusters : n_groups_)),
+          drift_(n_clusters), half_nearest_(n_clusters),
+          centroid_distances_(algorithm == ASSIGN_ELKAN ? (long long int) n_clusters * n_clusters : 0),
+          group_of_(n_clusters), group_start_(n_groups_ + 1), group_centroids_(n_clusters), group_drift_(n_groups_),
+          grouped_(algorithm == ASSIGN_YINYANG ? n_clusters + POINT_DISTANCES_LANES : 0, dimension, false),
+          computed_(0), total_(0) {
+        point_distances_ = select_point_distances_kernel(dimension);
+        switch (algorithm_) {
+            case ASSIGN_HAMERLY: block_ = KMEANS_SPECIALIZE_DIMENSION(hamerly_block, dimension); break;
+            case ASSIGN_ELKAN: block_ = KMEANS_SPECIALIZE_DIMENSION(elkan_block, dimension); break;
+            case ASSIGN_YINYANG: block_ = KMEANS_SPECIALIZE_DIMENSION(yinyang_block, dimension); break;
+            default: throw std::invalid_argument("TriangleBounds requires hamerly, elkan or yinyang");
+        }
+    }
+
+    TriangleBounds(const TriangleBounds&) = delete;
+    TriangleBounds& operator=(const TriangleBounds&) = delete;
+
+    /**
+     * @name reset
+     * @brief Función para descartar las cotas al empezar una nueva ejecución de k-means; la siguiente pasada calcula todas las distancias
+     * */
+    void reset() {
+        first_pass_ = true;
+    }
+
+    /**
+     * @name begin_pass
+     * @brief Función para preparar una pasada de asignación: calcula el desplazamiento de cada centroide desde la pasada anterior y, según el algoritmo, las distancias entre centroides y la mitad de la distancia de cada centroide al más cercano (Hamerly y Elkan) o el desplazamiento máximo de cada grupo (Yinyang). En la primera pasada de Yinyang también forma los grupos
+     * @param centroids Conjunto de centroides por columnas de esta pasada
+     * */
+    void begin_pass(const Dataset& centroids) {
+        full_pass_ = first_pass_;
+        first_pass_ = false;
+        max_drift_ = 0.0;
+        second_drift_ = 0.0;
+        max_drift_index_ = -1;
+        for (int k = 0; k < n_clusters_; k++) {
+            double drift = 0.0;
+            for (int d = 0; d < dimension_; d++) {
+                double diff = (double) centroids.at(k, d) - previous_.at(k, d);
+                drift += diff * diff;
+                previous_.at(k, d) = centroids.at(k, d);
+            }
+            drift_[k] = full_pass_ ? 0.0 : std::sqrt(drift) * (1.0 + rounding_);
+            // El desplazamiento más grande y el segundo más grande (Hamerly descuenta de la cota inferior el mayor entre los demás centroides)
+            if (drift_[k] > max_drift_) {
+                second_drift_ = max_drift_;
+                max_drift_ = drift_[k];
+                max_drift_index_ = k;
+            } else if (drift_[k] > second_drift_) {
+                second_drift_ = drift_[k];
+            }
+        }
+        for (int k = 0; k < n_clusters_; k++) {
+            half_nearest_[k] = std::numeric_limits<double>::infinity();
+        }
+        if (algorithm_ == ASSIGN_YINYANG) {
+            if (full_pass_) group_centroids(centroids);
+            for (int t = 0; t < n_groups_; t++) {
+                group_drift_[t] = 0.0;
+                for (int m = group_start_[t]; m < group_start_[t + 1]; m++) {
+                    int k = group_centroids_[m];
+                    group_drift_[t] = std::max(group_drift_[t], drift_[k]);
+                    for (int d = 0; d < dimension_; d++) grouped_.at(m, d) = centroids.at(k, d);
+                }
+            }
+            return;
+        }
+        for (int a = 0; a < n_clusters_; a++) {
+            if (algorithm_ == ASSIGN_ELKAN) centroid_distances_[(long long int) a * n_clusters_ + a] = 0.0;
+            for (int b = a + 1; b < n_clusters_; b++) {
+                double distance = 0.0;
+                for (int d = 0; d < dimension_; d++) {
+                    double diff = (double) centroids.at(a, d) - centroids.at(b, d);
+                    distance += diff * diff;
+                }
+                distance = std::sqrt(distance) * (1.0 - rounding_);
+                if (algorithm_ == ASSIGN_ELKAN) {
+                    centroid_distances_[(long long int) a * n_clusters_ + b] = distance;
+                    centroid_distances_[(long long int) b * n_clusters_ + a] = distance;
+                }
+                half_nearest_[a] = std::min(half_nearest_[a], 0.5 * distance);
+                half_nearest_[b] = std::min(half_nearest_[b], 0.5 * distance);
+            }
+        }
+    }
+
+    /**
+     * @name nearest_centroids
+     * @brief Función con la misma salida que los kernels de distance_kernels.hpp: el índice del centroide más cercano de cada punto del rango [begin, end), calculando sólo las distancias que las cotas no descartan
+     * @param points Conjunto de puntos por columnas con el cluster de cada punto de la pasada anterior
+     * @param begin Índice del primer punto del bloque
+     * @param end Índice siguiente al último punto del bloque
+     * @param centroids Conjunto de centroides por columnas (los mismos de begin_pass)
+     * @param labels Arreglo de salida con end - begin etiquetas; el llamador debe copiarlas al cluster de cada punto antes de la siguiente pasada
+     * */
+    void nearest_centroids(const Dataset& points, long long int begin, long long int end, const Dataset& centroids, int32_t* labels) {
+        long long int computed = block_(*this, points, begin, end, centroids, labels);
+        computed_.fetch_add(computed, std::memory_order_relaxed);
+        total_.fetch_add((end - begin) * n_clusters_, std::memory_order_relaxed);
+    }
+
+    // Algoritmo de asignación de las cotas
+    AssignmentAlgorithm algorithm() const { return algorithm_; }
+    // Número de grupos de centroides (Yinyang; 1 en los demás algoritmos)
+    int groups() const { return n_groups_; }
+    // Distancias punto-centroide calculadas desde la creación
+    long long int computed_distances() const { return computed_.load(); }
+    // Distancias punto-centroide que habría calculado la asignación completa desde la creación
+    long long int total_distances() const { return total_.load(); }
+    // Distancias punto-centroide que las cotas evitaron calcular
+    long long int skipped_distances() const { return total_distances() - computed_distances(); }
+
+private:
+    typedef long long int (*BlockFunction)(TriangleBounds& bounds, const Dataset& points, long long int begin, long long int end, const Dataset& centroids, int32_t* labels);
+
+    // Cota superior garantizada de la distancia real a partir de la distancia al cuadrado calculada en float
+    double upper_from(float squared) const { return std::sqrt((double) squared) * (1.0 + rounding_); }
+    // Cota inferior garantizada de la distancia real a partir de la distancia al cuadrado calculada en float
+    double lower_from(float squared) const { return std::sqrt((double) squared) * (1.0 - rounding_); }
+    // Si la cota superior del centroide actual deja fuera a un centroide con cota inferior bound, con margen para que su distancia en float sea estrictamente mayor
+    bool prunes(double upper, double bound) const { return upper < bound * (1.0 - 2.0 * rounding_); }
+
+    /**
+     * @name hamerly_block
+     * @brief Asignación de Hamerly: una cota superior y una sola cota inferior (al segundo centroide más cercano) por punto
+     * @tparam DIM Dimensión fija de los puntos, o 0 para usar la dimensión del conjunto en tiempo de ejecución
+     * @return Cantidad de distancias calculadas
+     * */
+    template <int DIM>
+    static long long int hamerly_block(TriangleBounds& bounds, const Dataset& points, long long int begin, long long int end, const Dataset& centroids, int32_t* labels) {
+        const int n_clusters = bounds.n_clusters_;
+        const int32_t* current = points.labels();
+        std::vector<float> distances(point_distances_size(n_clusters));
+        long long int computed = 0;
+        for (long long int i = begin; i < end; i++) {
+            if (!bounds.full_pass_) {
+                int32_t a = current[i];
+                double upper = bounds.upper_[i] + bounds.drift_[a];
+                double lower = bounds.lower_[i] - (a == bounds.max_drift_index_ ? bounds.second_drift_ : bounds.max_drift_);
+                double bound = std::max(lower, bounds.half_nearest_[a]);
+                if (!bounds.prunes(upper, bound)) {
+                    // Se ajusta la cota superior con la distancia real al centroide actual y se vuelve a probar
+                    upper = bounds.upper_from(squared_distance<DIM>(points, i, centroids, a));
+                    computed++;
+                }
+                if (bounds.prunes(upper, bound)) {
+                    bounds.upper_[i] = upper;
+                    bounds.lower_[i] = lower;
+                    labels[i - begin] = a;
+                    continue;
+                }
+            }
+            // Se calculan todas las distancias con el kernel vectorizado de un punto y se recorren en el mismo orden que el kernel escalar; se guardan la más cercana y la segunda
+            bounds.point_distances_(points, i, centroids, 0, n_clusters, distances.data());
+            float best = distances[0];
+            float second = std::numeric_limits<float>::infinity();
+            int32_t best_index = 0;
+            for (int k = 1; k < n_clusters; k++) {
+                float distance = distances[k];
+                if (distance < best) {
+                    second = best;
+                    best = distance;
+                    best_index = k;
+                } else if (distance < second) {
+                    second = distance;
+                }
+            }
+            computed += n_clusters;
+            bounds.upper_[i] = bounds.upper_from(best);
+            bounds.lower_[i] = bounds.lower_from(second);
+            labels[i - begin] = best_index;
+        }
+        return computed;
+    }
+
+    /**
+     * @name elkan_block
+     * @brief Asignación de Elkan: una cota superior y una cota inferior por cada centroide, además de las distancias entre centroides
+     * @tparam DIM Dimensión fija de los puntos, o 0 para usar la dimensión del conjunto en tiempo de ejecución
+     * @return Cantidad de distancias calculadas
+     * */
+    template <int DIM>
+    static long long int elkan_block(TriangleBounds& bounds, const Dataset& points, long long int begin, long long int end, const Dataset& centroids, int32_t* labels) {
+        const int n_clusters = bounds.n_clusters_;
+        const int32_t* current = points.labels();
+        std::vector<float> distances(point_distances_size(n_clusters));
+        long long int computed = 0;
+        for (long long int i = begin; i < end; i++) {
+            double* lower = bounds.lower_.data() + i * n_clusters;
+            if (bounds.full_pass_) {
+                bounds.point_distances_(points, i, centroids, 0, n_clusters, distances.data());
+                float best = std::numeric_limits<float>::infinity();
+                int32_t best_index = 0;
+                for (int k = 0; k < n_clusters; k++) {
+                    float distance = distances[k];
+                    lower[k] = bounds.lower_from(distance);
+                    if (distance < best) {
+                        best = distance;
+                        best_index = k;
+                    }
+                }
+                computed += n_clusters;
+                bounds.upper_[i] = bounds.upper_from(best);
+                labels[i - begin] = best_index;
+                continue;
+            }
+
+            int32_t a = current[i];
+            double upper = bounds.upper_[i] + bounds.drift_[a];
+            for (int k = 0; k < n_clusters; k++) {
+                lower[k] -= bounds.drift_[k];
+            }
+            int32_t best_index = a;
+            if (!bounds.prunes(upper, bounds.half_nearest_[a])) {
+                // Ningún otro centroide queda descartado por la distancia al más cercano del centroide actual; se recalcula la distancia al centroide actual
+                const double* between = bounds.centroid_distances_.data() + (long long int) a * n_clusters;
+                float best = squared_distance<DIM>(points, i, centroids, a);
+                computed++;
+                upper = bounds.upper_from(best);
+                lower[a] = bounds.lower_from(best);
+                for (int k = 0; k < n_clusters; k++) {
+                    if (k == a || bounds.prunes(upper, std::max(lower[k], 0.5 * between[k]))) continue;
+                    float distance = squared_distance<DIM>(points, i, centroids, k);
+                    computed++;
+                    lower[k] = bounds.lower_from(distance);
+                    // Mismo desempate que el kernel escalar: a igual distancia gana el índice menor
+                    if (distance < best || (distance == best && k < best_index)) {
+                        best = distance;
+                        best_index = k;
+                    }
+                }
+                upper = bounds.upper_from(best);
+            }
+            bounds.upper_[i] = upper;
+            labels[i - begin] = best_index;
+        }
+        return computed;
+    }
+
+    /**
+     * @name group_centroids
+     * @brief Función para formar los grupos de Yinyang con unas cuantas iteraciones de k-means sobre los centroides iniciales (en double, con desempate por el índice menor para que sea determinista). Los grupos se conservan durante toda la ejecución
+     * @param centroids Conjunto de centroides por columnas
+     * */
+    void group_centroids(const Dataset& centroids) {
+        std::vector<double> centers((long long int) n_groups_ * dimension_);
+        std::vector<double> sums((long long int) n_groups_ * dimension_);
+        std::vector<int> counts(n_groups_);
+        // Los centros iniciales son centroides repartidos uniformemente por índice
+        for (int t = 0; t < n_groups_; t++) {
+            int k = (int) ((long long int) t * n_clusters_ / n_groups_);
+            for (int d = 0; d < dimension_; d++) centers[(long long int) t * dimension_ + d] = centroids.at(k, d);
+        }
+        for (int iteration = 0; iteration <= YINYANG_GROUPING_ITERATIONS; iteration++) {
+            for (int k = 0; k < n_clusters_; k++) {
+                double best = std::numeric_limits<double>::infinity();
+                for (int t = 0; t < n_groups_; t++) {
+                    double distance = 0.0;
+                    for (int d = 0; d < dimension_; d++) {
+                        double diff = centroids.at(k, d) - centers[(long long int) t * dimension_ + d];
+                        distance += diff * diff;
+                    }
+                    if (distance < best) {
+                        best = distance;
+                        group_of_[k] = t;
+                    }
+                }
+            }
+            if (iteration == YINYANG_GROUPING_ITERATIONS) break;
+            std::fill(sums.begin(), sums.end(), 0.0);
+            std::fill(counts.begin(), counts.end(), 0);
+            for (int k = 0; k < n_clusters_; k++) {
+                counts[group_of_[k]]++;
+                for (int d = 0; d < dimension_; d++) sums[(long long int) group_of_[k] * dimension_ + d] += centroids.at(k, d);
+            }
+            for (int t = 0; t < n_groups_; t++) {
+                if (counts[t] == 0) continue;
+                for (int d = 0; d < dimension_; d++) centers[(long long int) t * dimension_ + d] = sums[(long long int) t * dimension_ + d] / counts[t];
+            }
+        }
+        // Lista de centroides de cada grupo (en orden de índice) a partir de los conteos
+        std::fill(group_start_.begin(), group_start_.end(), 0);
+        for (int k = 0; k < n_clusters_; k++) group_start_[group_of_[k] + 1]++;
+        for (int t = 0; t < n_groups_; t++) group_start_[t + 1] += group_start_[t];
+        std::vector<int> next(group_start_.begin(), group_start_.end() - 1);
+        for (int k = 0; k < n_clusters_; k++) group_centroids_[next[group_of_[k]]++] = k;
+    }
+
+    /**
+     * @name yinyang_block
+     * @brief Asignación de Yinyang: una cota superior y una cota inferior por grupo de centroides. Un filtro global (la menor cota de los grupos) descarta todos los centroides; si no alcanza, un filtro por grupo descarta grupos completos y la cota anterior del grupo menos el desplazamiento de cada centroide descarta los grupos en los que ningún centroide puede ganar. Las distancias de un grupo revisado se calculan juntas con el kernel vectorizado de un punto sobre la copia de los centroides ordenada por grupo
+     * @tparam DIM Dimensión fija de los puntos, o 0 para usar la dimensión del conjunto en tiempo de ejecución
+     * @return Cantidad de distancias calculadas
+     * */
+    template <int DIM>
+    static long long int yinyang_block(TriangleBounds& bounds, const Dataset& points, long long int begin, long long int end, const Dataset& centroids, int32_t* labels) {
+        const int n_clusters = bounds.n_clusters_;
+        const int n_groups = bounds.n_groups_;
+        const int* group_start = bounds.group_start_.data();
+        const int* group_centroids = bounds.group_centroids_.data();
+        const double infinity = std::numeric_limits<double>::infinity();
+        const int32_t* current = points.labels();
+        std::vector<float> distances(point_distances_size(n_clusters));
+        std::vector<double> previous(n_groups);   // Cotas de los grupos antes de descontar el desplazamiento
+        std::vector<double> group_min(n_groups);  // Menor y segunda menor cota de los centroides de cada grupo revisado (-1: grupo no revisado)
+        std::vector<double> group_second(n_groups);
+        std::vector<int> group_min_index(n_groups);
+        long long int computed = 0;
+        for (long long int i = begin; i < end; i++) {
+            double* lower = bounds.lower_.data() + i * n_groups;
+            int32_t a = -1;
+            float best = __builtin_inff();
+            int32_t best_index = 0;
+            double upper = 0.0;
+            float distance_a = 0.0f;
+            if (!bounds.full_pass_) {
+                // Filtro global
+                a = current[i];
+                upper = bounds.upper_[i] + bounds.drift_[a];
+                double global = infinity;
+                for (int t = 0; t < n_groups; t++) {
+                    previous[t] = lower[t];
+                    lower[t] -= bounds.group_drift_[t];
+                    global = std::min(global, lower[t]);
+                }
+                if (!bounds.prunes(upper, global)) {
+                    distance_a = squared_distance<DIM>(points, i, centroids, a);
+                    upper = bounds.upper_from(distance_a);
+                    computed++;
+                }
+                if (bounds.prunes(upper, global)) {
+                    bounds.upper_[i] = upper;
+                    labels[i - begin] = a;
+                    continue;
+                }
+                best = distance_a;
+                best_index = a;
+            }
+
+            // Filtro por grupo; upper ya es la distancia ajustada al centroide actual (la primera pasada revisa todos los grupos)
+            for (int t = 0; t < n_groups; t++) {
+                group_min_index[t] = -1;
+                if (!bounds.full_pass_) {
+                    if (bounds.prunes(upper, lower[t])) continue;
+                    bool needed = false;
+                    for (int m = group_start[t]; m < group_start[t + 1] && !needed; m++) {
+                        int k = group_centroids[m];
+                        needed = k != a && !bounds.prunes(upper, previous[t] - bounds.drift_[k]);
+                    }
+                    if (!needed) continue;
+                }
+                bounds.point_distances_(points, i, bounds.grouped_, group_start[t], group_start[t + 1], distances.data());
+                computed += group_start[t + 1] - group_start[t];
+                double first = infinity;
+                double second = infinity;
+                int first_index = -1;
+                for (int m = group_start[t]; m < group_start[t + 1]; m++) {
+                    int k = group_centroids[m];
+                    float distance = distances[m - group_start[t]];
+                    // Mismo desempate que el kernel escalar: a igual distancia gana el índice menor
+                    if (distance < best || (distance == best && k < best_index)) {
+                        best = distance;
+                        best_index = k;
+                    }
+                    double bound = bounds.lower_from(distance);
+                    if (bound < first || (bound == first && k < first_index)) {
+                        second = first;
+                        first = bound;
+                        first_index = k;
+                    } else if (bound < second) {
+                        second = bound;
+                    }
+                }
+                group_min[t] = first;
+                group_second[t] = second;
+                group_min_index[t] = first_index;
+            }
+
+            // Las cotas de los grupos revisados excluyen al nuevo centroide; si el punto cambió de centroide, el anterior entra en la cota de su grupo
+            for (int t = 0; t < n_groups; t++) {
+                if (group_min_index[t] >= 0) lower[t] = group_min_index[t] == best_index ? group_second[t] : group_min[t];
+            }
+            if (a >= 0 && best_index != a && group_min_index[bounds.group_of_[a]] < 0) {
+                lower[bounds.group_of_[a]] = std::min(lower[bounds.group_of_[a]], bounds.lower_from(distance_a));
+            }
+            bounds.upper_[i] = bounds.upper_from(best);
+            labels[i - begin] = best_index;
+        }
+        return computed;
+    }
+
+    AssignmentAlgorithm algorithm_;
+    int n_clusters_;
+    int dimension_;
+    int n_groups_;                // Número de grupos de centroides (Yinyang)
+    double rounding_;             // Error relativo con el que se ensanchan las cotas
+    bool first_pass_;             // Si la siguiente pasada es la primera de la ejecución
+    bool full_pass_;              // Si la pasada actual calcula todas las distancias
+    Dataset previous_;            // Centroides de la pasada anterior
+    std::vector<double> upper_;   // Cota superior de la distancia de cada punto a su centroide
+    std::vector<double> lower_;   // Cotas inferiores: una por punto (Hamerly), una por punto y centroide (Elkan) o una por punto y grupo (Yinyang)
+    std::vector<double> drift_;   // Desplazamiento de cada centroide desde la pasada anterior
+    std::vector<double> half_nearest_;       // Mitad de la distancia de cada centroide al centroide más cercano
+    std::vector<double> centroid_distances_; // Distancias entre cada par de centroides (K x K, sólo Elkan)
+    std::vector<int> group_of_;        // Grupo de cada centroide (Yinyang)
+    std::vector<int> group_start_;     // Inicio de los centroides de cada grupo en group_centroids_
+    std::vector<int> group_centroids_; // Centroides ordenados por grupo
+    std::vector<double> group_drift_;  // Desplazamiento máximo de los centroides de cada grupo
+    Dataset grouped_;                  // Copia de los centroides ordenada por grupo, con POINT_DISTANCES_LANES filas de relleno para los kernels de un punto
+    double max_drift_;
+    double second_drift_;
+    int max_drift_index_;
+    PointDistancesKernel point_distances_;
+    BlockFunction block_;
+    std::atomic<long long int> computed_;
+    std::atomic<long long int> total_;
+};
+
+/**
+ * @name report_skipped_distances
+ * @brief Función para imprimir cuántas distancias punto-centroide evitaron calcular las cotas respecto a la asignación completa
+ * @param bounds Cotas de Hamerly, Elkan o Yinyang
+ * */
+inline void report_skipped_distances(const TriangleBounds& bounds) {
+    long long int total = bounds.total_distances();
+    std::cout << assignment_algorithm_name(bounds.algorithm());
+    if (bounds.algorithm() == ASSIGN_YINYANG) std::cout << " (" << bounds.groups() << " groups)";
+    std::cout << ": skipped " << bounds.skipped_distances() << " of " << total
+              << " distance evaluations (" << (total > 0 ? 100.0 * bounds.skipped_distances() / total : 0.0) << "%)" << "\n";
+}
+
+#endif